@@ -0,0 +1,2177 @@
+#include "stringhashtable.h"
+
+/* Test function: 
+    • add 12 unique string (10 characters) to an hash table;
+    • delete 4 strings;
+    • change value of 3 strings;
+    At each single step, it pretty prints the entire hash table. */
+void test_12_strings() {
+    hashtable* htable = hashtable_newhashtable(16);
+
+    printf("Empty hashtable\n");
+    hashtable_prettyprint(htable);
+
+    printf("\nInsert strings (8ct4xaucod, 7i2pefipwc, mmnoy7c6yq, ouam4phm2c, e2xztziqtj, wrrw5arl6d, 7lc5pgl8kd, 93i5i8sx17, 6kkd8e0zq1, yeqmy6bjmk, hn1gybiuy6, 5wr2vyui8t), with value '0', in the hash table:\n");
+    hashtable_insert(htable, "8ct4xaucod", 0); /* hash = 7 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "7i2pefipwc", 0); /* hash = 0 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "mmnoy7c6yq", 0); /* hash = 10 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "ouam4phm2c", 0); /* hash = 0 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "e2xztziqtj", 0); /* hash = 15 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "wrrw5arl6d", 0); /* hash = 0 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "7lc5pgl8kd", 0); /* hash = 5 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "93i5i8sx17", 0); /* hash = 14 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "6kkd8e0zq1", 0); /* hash = 9 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "yeqmy6bjmk", 0); /* hash = 15 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "hn1gybiuy6", 0); /* hash = 6 */
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "5wr2vyui8t", 0); /* hash = 9 */
+    hashtable_prettyprint(htable);
+
+    printf("\nDelete strings (7lc5pgl8kd, 6kkd8e0zq1, e2xztziqtj, yeqmy6bjmk) from the hash table:\n");
+    hashtable_delete(htable, "7lc5pgl8kd");
+    hashtable_prettyprint(htable);
+    hashtable_delete(htable, "6kkd8e0zq1");
+    hashtable_prettyprint(htable);
+    hashtable_delete(htable, "e2xztziqtj");
+    hashtable_prettyprint(htable);
+    hashtable_delete(htable, "yeqmy6bjmk");
+    hashtable_prettyprint(htable);
+
+    printf("\nChange value of strings (ouam4phm2c -> 37, 93i5i8sx17 -> 55, 5wr2vyui8t -> 79) in the hash table:\n");
+    hashtable_insert(htable, "ouam4phm2c", 37);
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "93i5i8sx17", 55);
+    hashtable_prettyprint(htable);
+    hashtable_insert(htable, "5wr2vyui8t", 79);
+    hashtable_prettyprint(htable);
+
+    /* Keys are made of bytes: a NUL is part of the key and the length
+       has no limit. */
+    char long_key[100];
+    hashtable_entry* entry;
+    bool passed = true;
+    for(unsigned int i = 0; i < sizeof(long_key); i++)
+        long_key[i] = 'a' + i % 26;
+
+    printf("\nInsert keys with an embedded NUL byte (\"ab\\0cd\" -> 1, \"ab\" -> 2) and a 100-byte key (-> 3), through the _len functions:\n");
+    hashtable_insert_len(htable, "ab\0cd", 5, 1);
+    hashtable_insert_len(htable, "ab", 2, 2);
+    hashtable_insert_len(htable, long_key, sizeof(long_key), 3);
+    hashtable_prettyprint(htable);
+    passed &= (entry = hashtable_get_len(htable, "ab\0cd", 5)) != NULL && entry->val == 1;
+    passed &= (entry = hashtable_get_len(htable, "ab", 2)) != NULL && entry->val == 2;
+    passed &= hashtable_get_len(htable, "ab\0c", 4) == NULL;
+    passed &= (entry = hashtable_get_len(htable, long_key, sizeof(long_key))) != NULL && entry->val == 3 && entry->key_len == sizeof(long_key);
+    passed &= hashtable_get_len(htable, long_key, 64) == NULL;
+    passed &= hashtable_insert_len(htable, "\xe9t\xe9", 3, 4) != NULL && (entry = hashtable_get_len(htable, "\xe9t\xe9", 3)) != NULL && entry->val == 4;
+
+    printf("\nDelete \"ab\\0cd\" and the 100-byte key from the hash table:\n");
+    passed &= hashtable_delete_len(htable, "ab\0cd", 5) == 1;
+    passed &= hashtable_delete_len(htable, long_key, sizeof(long_key)) == 3;
+    passed &= hashtable_get_len(htable, "ab\0cd", 5) == NULL;
+    passed &= (entry = hashtable_get_len(htable, "ab", 2)) != NULL && entry->val == 2;
+    hashtable_prettyprint(htable);
+    printf("\nBinary keys: %s\n", passed ? "ok" : "FAILED");
+}
+
+/* Test function: reads from a file (rnd_str.txt) which contains 100.000
+   unique strings and adds them all into an hash table. */
+void test_100000_strings() {
+    hashtable* htable = hashtable_newhashtable(262144); /* 2^18 = 262144 */
+
+    FILE* file;
+    if((file = fopen("rnd_str.txt", "r")) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'fopen' on 'rnd_str_2.txt'. Closing...\n");
+		exit(EXIT_FAILURE);
+    }
+    
+    /* Read line by line, up to 64 characters (+1 for string terminator '\0'), 
+       and add this string to the hash table. */
+    char line[65];
+    while (fgets(line, sizeof(line), file)) {
+        line[64] = '\0';
+
+        hashtable_insert(htable, line, 0);
+    }
+    fclose(file);
+
+    hashtable_prettyprint(htable);
+}
+
+/* Return the current value of a monotonic clock, in seconds. */
+double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Return the resident set size (RSS) of the process, in KiB, read
+   from "/proc/self/statm". Return 0 if it is not available. */
+long get_rss_kb() {
+    long pages_total = 0, pages_resident = 0;
+
+    FILE* file;
+    if((file = fopen("/proc/self/statm", "r")) == NULL)
+        return 0;
+    if(fscanf(file, "%ld %ld", &pages_total, &pages_resident) != 2)
+        pages_resident = 0;
+    fclose(file);
+
+    return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Map a whole file in memory (read only) and return its address,
+   storing its size in 'file_size'. */
+char* map_file(char* path, size_t* file_size) {
+    int fd;
+    if((fd = open(path, O_RDONLY)) == -1) {
+        printf("[ERROR] There was an error while trying to call 'open' on '%s'. Closing...\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == -1 || file_stat.st_size == 0) {
+        printf("[ERROR] There was an error while trying to call 'fstat' on '%s'. Closing...\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    char* data;
+    if((data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        printf("[ERROR] There was an error while trying to call 'mmap' on '%s'. Closing...\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    *file_size = file_stat.st_size;
+    return data;
+}
+
+/* Benchmark function: maps the file "rnd_str.txt" in memory and, for
+   each key ownership policy, loads all its strings (sliced directly
+   from the mapped file, without copying or terminating them) into an
+   hash table, reporting the load time and the RSS growth.
+   Each policy runs in a child process, so that the memory released
+   by a run does not lower the RSS measured by the following one. */
+void bench_keymodes() {
+    char* modes_name[] = {"copy", "borrow", "arena"};
+    hashtable_keymode modes[] = {HASHTABLE_KEY_COPY, HASHTABLE_KEY_BORROW, HASHTABLE_KEY_ARENA};
+
+    size_t file_size;
+    char* data = map_file("rnd_str.txt", &file_size);
+
+    printf("\n%-8s %12s %14s\n", "Mode", "Load (ms)", "RSS (KiB)");
+    for(unsigned int m = 0; m < 3; m++) {
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if(pid == -1) {
+            printf("[ERROR] There was an error while trying to call 'fork'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        if(pid > 0) {
+            waitpid(pid, NULL, 0);
+            continue;
+        }
+
+        /* Child: touch the whole mapping, so that its pages are not
+           accounted to the hash table. */
+        volatile char sum = 0;
+        for(size_t i = 0; i < file_size; i += 4096)
+            sum += data[i];
+
+        long rss_before = get_rss_kb();
+        double start = get_time();
+
+        hashtable* htable = hashtable_newhashtable_keymode(262144, modes[m]);
+        char* line = data;
+        char* end = data + file_size;
+        while(line < end) {
+            char* newline = memchr(line, '\n', end - line);
+            if(newline == NULL)
+                newline = end;
+
+            if(newline > line)
+                hashtable_insert_len(htable, line, (unsigned int)(newline - line), 0);
+            line = newline + 1;
+        }
+
+        double elapsed = get_time() - start;
+        printf("%-8s %12.2f %14ld\n", modes_name[m], elapsed * 1000, get_rss_kb() - rss_before);
+
+        hashtable_free(htable);
+        exit(EXIT_SUCCESS);
+    }
+    printf("\n");
+
+    munmap(data, file_size);
+}
+
+/* Structure that holds a set of keys used by the benchmark functions. */
+typedef struct bench_keys_t {
+    char** keys;                    /* Keys (not NUL-terminated) */
+    unsigned int* lens;             /* Keys length */
+    unsigned int count;             /* Number of keys */
+} bench_keys;
+
+/* Load all the lines of a file as keys, sliced directly from a
+   mapping of the file (which is never unmapped). */
+bench_keys bench_loadkeys(char* path) {
+    size_t file_size;
+    char* data = map_file(path, &file_size);
+    bench_keys keys = {NULL, NULL, 0};
+    unsigned int capacity = 0;
+
+    char* line = data;
+    char* end = data + file_size;
+    while(line < end) {
+        char* newline = memchr(line, '\n', end - line);
+        if(newline == NULL)
+            newline = end;
+
+        if(newline > line) {
+            if(keys.count == capacity) {
+                capacity = capacity == 0 ? 1024 : capacity * 2;
+                if((keys.keys = (char**)realloc(keys.keys, sizeof(char*) * capacity)) == NULL ||
+                   (keys.lens = (unsigned int*)realloc(keys.lens, sizeof(unsigned int) * capacity)) == NULL) {
+                    printf("[ERROR] There was an error while trying to call 'realloc' on 'keys'. Closing...\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            keys.keys[keys.count] = line;
+            keys.lens[keys.count] = (unsigned int)(newline - line);
+            keys.count++;
+        }
+        line = newline + 1;
+    }
+
+    return keys;
+}
+
+/* Return a pseudo-random number (xorshift32), updating 'state'. */
+unsigned int bench_random(unsigned int* state) {
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+/* Pin the calling benchmark thread, the 'index'-th one, to a CPU:
+   the threads are spread round-robin among the NUMA nodes, and among
+   the CPUs of every node. */
+void bench_pin(unsigned int index) {
+    int nnodes = hashtable_numa_nodes();
+
+    if(nnodes > 1)
+        hashtable_pincpu(hashtable_numa_cpu(index % nnodes, index / nnodes));
+    else
+        hashtable_pincpu(index % sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+/* Structure that holds the parameters of a benchmark thread. */
+typedef struct bench_worker_t {
+    hashtable* htable;
+    bench_keys* keys;
+    unsigned int ops;               /* Number of operations to perform */
+    unsigned int read_pct;          /* Percentage of reads (the remaining are writes) */
+    unsigned int seed;              /* Seed of the pseudo-random numbers */
+    unsigned int index;             /* Index of the thread (see bench_pin) */
+
+    pthread_t thread;
+} bench_worker;
+
+/* Benchmark thread: performs a random mix of lookups and writes on
+   uniformly chosen keys. Half of the writes update the value of a
+   key, the other half delete it and insert it again. */
+void* bench_mixed_worker(void* arg) {
+    bench_worker* worker = (bench_worker*) arg;
+    unsigned int state = worker->seed;
+    unsigned int val;
+
+    bench_pin(worker->index);
+
+    for(unsigned int i = 0; i < worker->ops; i++) {
+        unsigned int r = bench_random(&state);
+        unsigned int k = (r >> 8) % worker->keys->count;
+        char* key = worker->keys->keys[k];
+        unsigned int key_len = worker->keys->lens[k];
+
+        if(r % 100 < worker->read_pct) {
+            hashtable_lookup_len(worker->htable, key, key_len, &val);
+        } else if(r & 0x80) {
+            hashtable_insert_len(worker->htable, key, key_len, i);
+        } else {
+            hashtable_delete_len(worker->htable, key, key_len);
+            hashtable_insert_len(worker->htable, key, key_len, i);
+        }
+    }
+
+    return NULL;
+}
+
+/* Run 'threads' threads performing, all together, 'ops' operations
+   with 'read_pct' percent of reads, and return the throughput in
+   millions of operations per second. */
+double bench_mixed(hashtable* htable, bench_keys* keys, unsigned int threads, unsigned int ops, unsigned int read_pct) {
+    bench_worker workers[threads];
+
+    double start = get_time();
+    for(unsigned int t = 0; t < threads; t++) {
+        workers[t] = (bench_worker){htable, keys, ops / threads, read_pct, 2463534242u + t * 7919u, t, 0};
+        pthread_create(&workers[t].thread, NULL, bench_mixed_worker, &workers[t]);
+    }
+    for(unsigned int t = 0; t < threads; t++)
+        pthread_join(workers[t].thread, NULL);
+
+    return ops / (get_time() - start) / 1e6;
+}
+
+/* Benchmark function: loads all the strings of "rnd_str.txt" in an
+   hash table and measures, for each concurrent synchronization mode,
+   the throughput of 95/5 and 99/1 read/write mixes with 1 to 8
+   threads. */
+void bench_syncmodes() {
+    char* modes_name[] = {"mutex", "rwlock", "seqlock"};
+    hashtable_syncmode modes[] = {HASHTABLE_SYNC_MUTEX, HASHTABLE_SYNC_RWLOCK, HASHTABLE_SYNC_SEQLOCK};
+    unsigned int read_pcts[] = {95, 99};
+    unsigned int threads[] = {1, 2, 4, 8};
+    unsigned int ops = 1000000;
+
+    bench_keys keys = bench_loadkeys("rnd_str.txt");
+
+    printf("\nThroughput (Mops/s), %u operations on %u keys\n", ops, keys.count);
+    printf("%-8s %-6s", "Mode", "Mix");
+    for(unsigned int t = 0; t < 4; t++)
+        printf(" %8u thr", threads[t]);
+    printf("\n");
+
+    for(unsigned int m = 0; m < 3; m++) {
+        for(unsigned int r = 0; r < 2; r++) {
+            hashtable* htable = hashtable_newhashtable(262144);
+            hashtable_setsyncmode(htable, modes[m]);
+            for(unsigned int k = 0; k < keys.count; k++)
+                hashtable_insert_len(htable, keys.keys[k], keys.lens[k], 0);
+
+            printf("%-8s %2u/%-3u", modes_name[m], read_pcts[r], 100 - read_pcts[r]);
+            for(unsigned int t = 0; t < 4; t++) {
+                printf(" %12.2f", bench_mixed(htable, &keys, threads[t], ops, read_pcts[r]));
+                fflush(stdout);
+            }
+            printf("\n");
+
+            hashtable_free(htable);
+        }
+    }
+    printf("\n");
+
+    free(keys.keys);
+    free(keys.lens);
+}
+
+/* Structure that holds the parameters of a growth benchmark thread. */
+typedef struct bench_growth_worker_t {
+    hashtable* htable;
+    bench_keys* keys;
+    unsigned int first;             /* Index of the first key inserted by the thread */
+    unsigned int step;              /* Distance between two keys inserted by the thread */
+    unsigned int* latencies;        /* Latency of each operation, in nanoseconds */
+    unsigned int ops;               /* Number of operations performed */
+
+    pthread_t thread;
+} bench_growth_worker;
+
+/* Benchmark thread: inserts its share of keys, each followed by a
+   lookup of a random key, measuring the latency of every operation. */
+void* bench_growth_thread(void* arg) {
+    bench_growth_worker* worker = (bench_growth_worker*) arg;
+    unsigned int state = 2463534242u + worker->first;
+    unsigned int val;
+
+    bench_pin(worker->first);
+    worker->ops = 0;
+    for(unsigned int k = worker->first; k < worker->keys->count; k += worker->step) {
+        double start = get_time();
+        hashtable_insert_len(worker->htable, worker->keys->keys[k], worker->keys->lens[k], k);
+        double middle = get_time();
+
+        unsigned int r = bench_random(&state) % worker->keys->count;
+        hashtable_lookup_len(worker->htable, worker->keys->keys[r], worker->keys->lens[r], &val);
+        double end = get_time();
+
+        worker->latencies[worker->ops++] = (unsigned int)((middle - start) * 1e9);
+        worker->latencies[worker->ops++] = (unsigned int)((end - middle) * 1e9);
+    }
+
+    return NULL;
+}
+
+/* Comparison function used to sort the latencies. */
+int bench_compare_uint(const void* a, const void* b) {
+    unsigned int x = *(const unsigned int*) a, y = *(const unsigned int*) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Benchmark function: 4 threads fill an hash table (seqlock mode)
+   that starts with 1024 buckets and doubles whenever it holds more
+   than one entry per bucket, so it grows 7 times. For both resize
+   strategies, it reports the latency percentiles of the single
+   operations: the stop-the-world resize shows up in the tail. */
+void bench_growth() {
+    char* modes_name[] = {"cooperative", "stop-the-world"};
+    hashtable_resizemode modes[] = {HASHTABLE_RESIZE_COOPERATIVE, HASHTABLE_RESIZE_STOP};
+    unsigned int threads = 4;
+
+    bench_keys keys = bench_loadkeys("rnd_str.txt");
+    unsigned int* latencies;
+    if((latencies = (unsigned int*)malloc(sizeof(unsigned int) * 2 * (keys.count + threads))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'latencies'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("\nLatency (us) of %u inserts + %u lookups, %u threads, growth from 1024 buckets\n", keys.count, keys.count, threads);
+    printf("%-15s %10s %10s %10s %10s %10s\n", "Resize", "Total (ms)", "p50", "p99", "p99.9", "max");
+
+    for(unsigned int m = 0; m < 2; m++) {
+        hashtable* htable = hashtable_newhashtable(1024);
+        hashtable_setsyncmode(htable, HASHTABLE_SYNC_SEQLOCK);
+        hashtable_setgrowth(htable, 1, modes[m]);
+
+        bench_growth_worker workers[threads];
+        unsigned int offset = 0;
+
+        double start = get_time();
+        for(unsigned int t = 0; t < threads; t++) {
+            workers[t] = (bench_growth_worker){htable, &keys, t, threads, latencies + offset, 0, 0};
+            offset += 2 * ((keys.count - t + threads - 1) / threads);
+            pthread_create(&workers[t].thread, NULL, bench_growth_thread, &workers[t]);
+        }
+        unsigned int ops = 0;
+        for(unsigned int t = 0; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+            ops += workers[t].ops;
+        }
+        double elapsed = get_time() - start;
+
+        qsort(latencies, ops, sizeof(unsigned int), bench_compare_uint);
+        printf("%-15s %10.1f %10.2f %10.2f %10.2f %10.2f\n", modes_name[m], elapsed * 1000,
+               latencies[ops / 2] / 1e3, latencies[(unsigned int)(ops * 0.99)] / 1e3,
+               latencies[(unsigned int)(ops * 0.999)] / 1e3, latencies[ops - 1] / 1e3);
+        hashtable_printstats(htable);
+
+        hashtable_free(htable);
+    }
+    printf("\n");
+
+    free(latencies);
+    free(keys.keys);
+    free(keys.lens);
+}
+
+/* Accumulator of the aggregation benchmark: sum of the values,
+   number of values multiple of 7 and the 10 largest values. */
+typedef struct bench_aggregate_t {
+    unsigned long long sum;
+    unsigned long long multiples;
+    unsigned int top[10];           /* Largest values, in decreasing order */
+    unsigned int top_count;
+} bench_aggregate;
+
+/* Add a value to the 10 largest values of an accumulator. */
+void bench_aggregate_top(bench_aggregate* acc, unsigned int val) {
+    if(acc->top_count == 10 && val <= acc->top[9])
+        return;
+
+    unsigned int i = acc->top_count < 10 ? acc->top_count++ : 9;
+    while(i > 0 && acc->top[i - 1] < val) {
+        acc->top[i] = acc->top[i - 1];
+        i--;
+    }
+    acc->top[i] = val;
+}
+
+void bench_aggregate_map(void* acc, hashtable_entry* entry, void* ctx) {
+    bench_aggregate* aggregate = (bench_aggregate*) acc;
+
+    (void) ctx;
+
+    aggregate->sum += entry->val;
+    if(entry->val % 7 == 0)
+        aggregate->multiples++;
+    bench_aggregate_top(aggregate, entry->val);
+}
+
+void bench_aggregate_combine(void* acc, const void* other, void* ctx) {
+    bench_aggregate* aggregate = (bench_aggregate*) acc;
+    const bench_aggregate* other_aggregate = (const bench_aggregate*) other;
+
+    (void) ctx;
+
+    aggregate->sum += other_aggregate->sum;
+    aggregate->multiples += other_aggregate->multiples;
+    for(unsigned int i = 0; i < other_aggregate->top_count; i++)
+        bench_aggregate_top(aggregate, other_aggregate->top[i]);
+}
+
+/* Benchmark function: fills an hash table with 10 million entries
+   (short keys, pseudo-random values) and measures the time of a
+   parallel aggregation (sum, count of the multiples of 7 and top-10
+   of the values) with 1 to 8 threads. */
+void bench_reduce() {
+    unsigned int entries = 10000000;
+    unsigned int threads[] = {1, 2, 4, 8};
+    unsigned int state = 2463534242u;
+    char key[16];
+
+    hashtable* htable = hashtable_newhashtable(1 << 24);
+    hashtable_setgrowth(htable, 1, HASHTABLE_RESIZE_STOP);
+
+    printf("\nLoading %u entries...\n", entries);
+    for(unsigned int i = 0; i < entries; i++) {
+        int key_len = sprintf(key, "k%u", i);
+        hashtable_insert_len(htable, key, key_len, bench_random(&state) % 1000000000);
+    }
+
+    printf("%-8s %12s %10s  %s\n", "Threads", "Time (ms)", "Speedup", "Result (sum, multiples of 7, top-3)");
+    double base = 0;
+    for(unsigned int t = 0; t < 4; t++) {
+        bench_aggregate result = {0, 0, {0}, 0};
+
+        hashtable_setthreads(htable, threads[t]);
+        double start = get_time();
+        hashtable_parallel_reduce(htable, bench_aggregate_map, bench_aggregate_combine, &result, sizeof(result), NULL);
+        double elapsed = get_time() - start;
+        if(t == 0)
+            base = elapsed;
+
+        printf("%-8u %12.1f %10.2f  %llu, %llu, %u %u %u\n", threads[t], elapsed * 1000, base / elapsed,
+               result.sum, result.multiples, result.top[0], result.top[1], result.top[2]);
+    }
+    printf("\n");
+
+    hashtable_free(htable);
+}
+
+/* Structure that holds a Zipf distribution over 'count' ranks. */
+typedef struct bench_zipf_t {
+    double* cdf;                    /* Cumulative probability of the ranks */
+    unsigned int count;             /* Number of ranks */
+} bench_zipf;
+
+/* Create a Zipf distribution of exponent 's' over 'count' ranks. */
+bench_zipf bench_newzipf(unsigned int count, double s) {
+    bench_zipf zipf = {NULL, count};
+    double sum = 0;
+
+    if((zipf.cdf = (double*)malloc(sizeof(double) * count)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'zipf.cdf'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    for(unsigned int i = 0; i < count; i++) {
+        sum += 1.0 / pow(i + 1, s);
+        zipf.cdf[i] = sum;
+    }
+    for(unsigned int i = 0; i < count; i++)
+        zipf.cdf[i] /= sum;
+
+    return zipf;
+}
+
+/* Return a rank drawn from a Zipf distribution (binary search of a
+   pseudo-random number in the cumulative probabilities). */
+unsigned int bench_zipf_next(bench_zipf* zipf, unsigned int* state) {
+    double u = bench_random(state) / 4294967296.0;
+    unsigned int low = 0, high = zipf->count - 1;
+
+    while(low < high) {
+        unsigned int mid = (low + high) / 2;
+        if(zipf->cdf[mid] < u)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/* Structure that holds the parameters of a delegation benchmark thread. */
+typedef struct bench_delegation_worker_t {
+    hashtable* htable;              /* Striped table (NULL when delegating) */
+    hashtable_delegation* delegation; /* Sharded table (NULL when locking) */
+    bench_keys* keys;
+    bench_zipf* zipf;               /* Skewed key distribution (NULL: uniform) */
+    unsigned int ops;               /* Number of operations to perform */
+    unsigned int seed;              /* Seed of the pseudo-random numbers */
+    unsigned int index;             /* Index of the thread (see bench_pin) */
+
+    pthread_t thread;
+} bench_delegation_worker;
+
+/* Delegation benchmark thread: performs a 80/20 mix of lookups and
+   inserts, either directly on a striped table or sending them, in
+   batches of 16, to the owners of the shards. */
+void* bench_delegation_thread(void* arg) {
+    bench_delegation_worker* worker = (bench_delegation_worker*) arg;
+    hashtable_request requests[16];
+    unsigned int state = worker->seed;
+    unsigned int val;
+
+    bench_pin(worker->index);
+
+    for(unsigned int i = 0; i < worker->ops; i += 16) {
+        unsigned int count = worker->ops - i < 16 ? worker->ops - i : 16;
+
+        for(unsigned int j = 0; j < count; j++) {
+            unsigned int r = bench_random(&state);
+            unsigned int k = worker->zipf != NULL ? bench_zipf_next(worker->zipf, &state) : (r >> 8) % worker->keys->count;
+            hashtable_op op = r % 100 < 80 ? HASHTABLE_OP_GET : HASHTABLE_OP_INSERT;
+
+            if(worker->delegation != NULL) {
+                requests[j] = (hashtable_request){op, worker->keys->keys[k], worker->keys->lens[k], i + j, 0, false, NULL, 0};
+            } else if(op == HASHTABLE_OP_GET) {
+                hashtable_lookup_len(worker->htable, worker->keys->keys[k], worker->keys->lens[k], &val);
+            } else {
+                hashtable_insert_len(worker->htable, worker->keys->keys[k], worker->keys->lens[k], i + j);
+            }
+        }
+        if(worker->delegation != NULL)
+            hashtable_delegation_execute(worker->delegation, requests, count);
+    }
+
+    return NULL;
+}
+
+/* Benchmark function: loads all the strings of "rnd_str.txt" and
+   compares the throughput of a 80/20 read/write mix on a lock striped
+   table (mutex mode) and on a sharded table with delegation (one
+   shard per CPU), with uniform and Zipf (s = 0.99) keys and 1 to 64
+   threads. */
+void bench_delegation() {
+    char* dists_name[] = {"uniform", "zipf"};
+    char* modes_name[] = {"locking", "delegate"};
+    unsigned int threads[] = {1, 4, 16, 64};
+    unsigned int ops = 400000;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    bench_keys keys = bench_loadkeys("rnd_str.txt");
+    bench_zipf zipf = bench_newzipf(keys.count, 0.99);
+
+    printf("\nThroughput (Mops/s), %u operations on %u keys, %ld shards on %d NUMA node(s)\n", ops, keys.count, ncpus, hashtable_numa_nodes());
+    printf("%-8s %-9s", "Keys", "Mode");
+    for(unsigned int t = 0; t < 4; t++)
+        printf(" %8u thr", threads[t]);
+    printf("\n");
+
+    for(unsigned int d = 0; d < 2; d++) {
+        for(unsigned int m = 0; m < 2; m++) {
+            hashtable* htable = NULL;
+            hashtable_delegation* delegation = NULL;
+
+            if(m == 0) {
+                htable = hashtable_newhashtable(262144);
+                hashtable_setsyncmode(htable, HASHTABLE_SYNC_MUTEX);
+                for(unsigned int k = 0; k < keys.count; k++)
+                    hashtable_insert_len(htable, keys.keys[k], keys.lens[k], 0);
+            } else {
+                delegation = hashtable_delegation_new(ncpus > 0 ? ncpus : 1, 262144 / (ncpus > 0 ? ncpus : 1));
+                for(unsigned int k = 0; k < keys.count; k++)
+                    hashtable_delegation_insert(delegation, keys.keys[k], keys.lens[k], 0);
+            }
+
+            printf("%-8s %-9s", dists_name[d], modes_name[m]);
+            for(unsigned int t = 0; t < 4; t++) {
+                bench_delegation_worker workers[64];
+
+                double start = get_time();
+                for(unsigned int w = 0; w < threads[t]; w++) {
+                    workers[w] = (bench_delegation_worker){htable, delegation, &keys, d == 1 ? &zipf : NULL,
+                                                           ops / threads[t], 2463534242u + w * 7919u, w, 0};
+                    pthread_create(&workers[w].thread, NULL, bench_delegation_thread, &workers[w]);
+                }
+                for(unsigned int w = 0; w < threads[t]; w++)
+                    pthread_join(workers[w].thread, NULL);
+
+                printf(" %12.2f", ops / (get_time() - start) / 1e6);
+                fflush(stdout);
+            }
+            printf("\n");
+
+            hashtable_free(htable);
+            hashtable_delegation_free(delegation);
+        }
+    }
+    printf("\n");
+
+    free(zipf.cdf);
+    free(keys.keys);
+    free(keys.lens);
+}
+
+/* Structure that holds the parameters of an update benchmark thread. */
+typedef struct bench_update_worker_t {
+    hashtable* htable;
+    bench_keys* keys;
+    bench_zipf* zipf;               /* Key distribution */
+    unsigned int ops;               /* Number of operations to perform */
+    unsigned int seed;              /* Seed of the pseudo-random numbers */
+    unsigned int index;             /* Index of the thread (see bench_pin) */
+
+    pthread_t thread;
+} bench_update_worker;
+
+/* Update benchmark thread: performs a 80/10/10 mix of increments,
+   inserts and deletes on keys drawn from a Zipf distribution. */
+void* bench_update_thread(void* arg) {
+    bench_update_worker* worker = (bench_update_worker*) arg;
+    unsigned int state = worker->seed;
+
+    bench_pin(worker->index);
+
+    for(unsigned int i = 0; i < worker->ops; i++) {
+        unsigned int r = bench_random(&state) % 100;
+        unsigned int k = bench_zipf_next(worker->zipf, &state);
+        char* key = worker->keys->keys[k];
+        unsigned int key_len = worker->keys->lens[k];
+
+        if(r < 80)
+            hashtable_increment_len(worker->htable, key, key_len, 1);
+        else if(r < 90)
+            hashtable_insert_len(worker->htable, key, key_len, i);
+        else
+            hashtable_delete_len(worker->htable, key, key_len);
+    }
+
+    return NULL;
+}
+
+/* Benchmark function: loads all the strings of "rnd_str.txt" in an
+   hash table (mutex mode) and compares the throughput of a write-only
+   workload (increments, inserts and deletes) on Zipf distributed keys
+   with the writes going straight to the stripes and through the flat
+   combining, with 1 to 64 threads. */
+void bench_combining() {
+    char* modes_name[] = {"striping", "combining"};
+    double skews[] = {0.99, 1.2};
+    unsigned int threads[] = {1, 4, 16, 64};
+    unsigned int ops = 400000;
+
+    bench_keys keys = bench_loadkeys("rnd_str.txt");
+
+    printf("\nThroughput (Mops/s), %u updates on %u keys\n", ops, keys.count);
+    printf("%-10s %-10s", "Zipf s", "Mode");
+    for(unsigned int t = 0; t < 4; t++)
+        printf(" %8u thr", threads[t]);
+    printf("\n");
+
+    for(unsigned int z = 0; z < 2; z++) {
+        bench_zipf zipf = bench_newzipf(keys.count, skews[z]);
+
+        for(unsigned int m = 0; m < 2; m++) {
+            hashtable* htable = hashtable_newhashtable(262144);
+            hashtable_setsyncmode(htable, HASHTABLE_SYNC_MUTEX);
+            hashtable_setcombining(htable, m == 1);
+            for(unsigned int k = 0; k < keys.count; k++)
+                hashtable_insert_len(htable, keys.keys[k], keys.lens[k], 0);
+
+            printf("%-10.2f %-10s", skews[z], modes_name[m]);
+            for(unsigned int t = 0; t < 4; t++) {
+                bench_update_worker workers[64];
+
+                double start = get_time();
+                for(unsigned int w = 0; w < threads[t]; w++) {
+                    workers[w] = (bench_update_worker){htable, &keys, &zipf, ops / threads[t], 2463534242u + w * 7919u, w, 0};
+                    pthread_create(&workers[w].thread, NULL, bench_update_thread, &workers[w]);
+                }
+                for(unsigned int w = 0; w < threads[t]; w++)
+                    pthread_join(workers[w].thread, NULL);
+
+                printf(" %12.2f", ops / (get_time() - start) / 1e6);
+                fflush(stdout);
+            }
+            printf("\n");
+
+            hashtable_free(htable);
+        }
+        free(zipf.cdf);
+    }
+    printf("\n");
+
+    free(keys.keys);
+    free(keys.lens);
+}
+
+/* Benchmark function: loads all the strings of "rnd_str.txt" in a
+   shared-memory table and measures the throughput of a 95/5 read/write
+   mix performed by 1 to 8 processes that attach it, checking at the
+   end that every process has seen all the keys. */
+void bench_shm() {
+    unsigned int processes[] = {1, 2, 4, 8};
+    unsigned int ops = 2000000;
+    const char* name = "/stringhashtable_bench";
+
+    bench_keys keys = bench_loadkeys("rnd_str.txt");
+
+    hashtable_shm_unlink(name);
+    hashtable_shm* shm = hashtable_shm_create(name, 262144, 64 * 1024 * 1024);
+    if(shm == NULL) {
+        printf("[ERROR] There was an error while trying to create the shared memory table. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    for(unsigned int k = 0; k < keys.count; k++)
+        hashtable_shm_insert_len(shm, keys.keys[k], keys.lens[k], k);
+
+    printf("\nThroughput (Mops/s), %u operations (95/5) on %lu keys in shared memory\n", ops, hashtable_shm_count(shm));
+    printf("%-10s %12s %10s\n", "Processes", "Mops/s", "Misses");
+    for(unsigned int p = 0; p < 4; p++) {
+        fflush(stdout);
+
+        double start = get_time();
+        for(unsigned int c = 0; c < processes[p]; c++) {
+            pid_t pid = fork();
+            if(pid == -1) {
+                printf("[ERROR] There was an error while trying to call 'fork'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+            if(pid > 0)
+                continue;
+
+            /* Child: attach the table by name, as an unrelated process
+               would do, and report the keys it did not find. */
+            hashtable_shm* child_shm = hashtable_shm_attach(name);
+            unsigned int state = 2463534242u + c * 7919u;
+            unsigned int misses = 0, val;
+
+            bench_pin(c);
+            for(unsigned int i = 0; i < ops / processes[p]; i++) {
+                unsigned int r = bench_random(&state);
+                unsigned int k = (r >> 8) % keys.count;
+
+                if(r % 100 < 95) {
+                    if(!hashtable_shm_lookup_len(child_shm, keys.keys[k], keys.lens[k], &val) || val != k)
+                        misses++;
+                } else {
+                    hashtable_shm_insert_len(child_shm, keys.keys[k], keys.lens[k], k);
+                }
+            }
+
+            hashtable_shm_detach(child_shm);
+            exit(misses > 255 ? 255 : misses);
+        }
+
+        unsigned int misses = 0;
+        for(unsigned int c = 0; c < processes[p]; c++) {
+            int status;
+            wait(&status);
+            misses += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+        printf("%-10u %12.2f %10u\n", processes[p], ops / (get_time() - start) / 1e6, misses);
+    }
+    printf("\n");
+
+    hashtable_shm_detach(shm);
+    hashtable_shm_unlink(name);
+    free(keys.keys);
+    free(keys.lens);
+}
+
+/* Structure that holds the parameters of a write-ahead log benchmark
+   thread. */
+typedef struct bench_wal_worker_t {
+    hashtable* htable;
+    bench_keys* keys;
+    unsigned int count;             /* Number of keys to insert */
+    unsigned int first;             /* Index of the first key of the thread */
+    unsigned int step;              /* Number of threads */
+
+    pthread_t thread;
+} bench_wal_worker;
+
+/* Write-ahead log benchmark thread: inserts the keys first, first +
+   step, first + 2 * step, ... */
+void* bench_wal_thread(void* arg) {
+    bench_wal_worker* worker = (bench_wal_worker*) arg;
+
+    bench_pin(worker->first);
+
+    for(unsigned int k = worker->first; k < worker->count; k += worker->step)
+        hashtable_insert_len(worker->htable, worker->keys->keys[k], worker->keys->lens[k], k);
+
+    return NULL;
+}
+
+/* Benchmark function: inserts 20.000 strings of "rnd_str.txt" in an
+   hash table (mutex mode) that logs its writes, with every sync policy
+   of the write-ahead log and 1 to 16 threads, printing the throughput
+   and the number of syncs (the group commit makes a single sync cover
+   the writes of many threads). Then checks that replaying the log
+   rebuilds the table. */
+void bench_wal() {
+    char* policies_name[] = {"always", "10 ms", "never"};
+    hashtable_walsync policies[] = {HASHTABLE_WAL_SYNC_ALWAYS, HASHTABLE_WAL_SYNC_INTERVAL, HASHTABLE_WAL_SYNC_NEVER};
+    unsigned int threads[] = {1, 4, 16};
+    const char* path = "wal_bench.log";
+
+    bench_keys keys = bench_loadkeys("rnd_str.txt");
+    unsigned int count = keys.count < 20000 ? keys.count : 20000;
+
+    printf("\nThroughput (Kops/s) and syncs, %u inserts in a logged table\n", count);
+    printf("%-10s", "Policy");
+    for(unsigned int t = 0; t < 3; t++)
+        printf(" %8u thr %8s", threads[t], "syncs");
+    printf(" %10s\n", "Replay");
+
+    for(unsigned int p = 0; p < 3; p++) {
+        bool replayed = true;
+
+        printf("%-10s", policies_name[p]);
+        for(unsigned int t = 0; t < 3; t++) {
+            bench_wal_worker workers[16];
+
+            remove(path);
+            hashtable* htable = hashtable_newhashtable(65536);
+            hashtable_setsyncmode(htable, HASHTABLE_SYNC_MUTEX);
+            hashtable_wal* wal = hashtable_wal_open(path, policies[p], 10);
+            hashtable_setwal(htable, wal);
+
+            double start = get_time();
+            for(unsigned int w = 0; w < threads[t]; w++) {
+                workers[w] = (bench_wal_worker){htable, &keys, count, w, threads[t], 0};
+                pthread_create(&workers[w].thread, NULL, bench_wal_thread, &workers[w]);
+            }
+            for(unsigned int w = 0; w < threads[t]; w++)
+                pthread_join(workers[w].thread, NULL);
+            double elapsed = get_time() - start;
+
+            unsigned long syncs = wal->syncs;
+            hashtable_setwal(htable, NULL);
+            hashtable_wal_close(wal);
+
+            printf(" %12.2f %8lu", count / elapsed / 1e3, syncs);
+            fflush(stdout);
+
+            /* Rebuild the table from the log. */
+            hashtable* replica = hashtable_newhashtable(65536);
+            replayed &= hashtable_wal_replay(replica, path) == (long) count && hashtable_count(replica) == hashtable_count(htable);
+
+            hashtable_free(replica);
+            hashtable_free(htable);
+        }
+        printf(" %10s\n", replayed ? "ok" : "FAILED");
+    }
+    printf("\n");
+
+    remove(path);
+    free(keys.keys);
+    free(keys.lens);
+}
+
+/* Structure that holds the parameters of a snapshot benchmark thread. */
+typedef struct bench_bgsave_worker_t {
+    hashtable* htable;
+    unsigned int entries;           /* Number of keys ("k0", "k1", ...) */
+    unsigned int index;             /* Index of the thread (see bench_pin) */
+    unsigned int* latencies;        /* Latency of every update, in nanoseconds */
+    unsigned int max_ops;           /* Capacity of 'latencies' */
+    unsigned int ops;               /* Number of updates performed */
+    volatile bool* stop;
+
+    pthread_t thread;
+} bench_bgsave_worker;
+
+/* Snapshot benchmark thread: updates random keys until 'stop' is set,
+   recording the latency of every update. */
+void* bench_bgsave_thread(void* arg) {
+    bench_bgsave_worker* worker = (bench_bgsave_worker*) arg;
+    unsigned int state = 2463534242u + worker->index * 7919u;
+    char key[16];
+
+    bench_pin(worker->index);
+
+    worker->ops = 0;
+    while(!*worker->stop && worker->ops < worker->max_ops) {
+        unsigned int r = bench_random(&state);
+        int key_len = sprintf(key, "k%u", r % worker->entries);
+
+        double start = get_time();
+        hashtable_insert_len(worker->htable, key, key_len, r);
+        worker->latencies[worker->ops++] = (unsigned int)((get_time() - start) * 1e9);
+    }
+
+    return NULL;
+}
+
+/* Return the private dirty memory of the process 'pid', in KiB: for a
+   child forked from this process, the pages that are no longer shared
+   with the parent. Return 0 if it is not available. */
+long bench_private_dirty_kb(pid_t pid) {
+    char path[64], line[128];
+    long kb = 0;
+
+    sprintf(path, "/proc/%d/smaps_rollup", (int) pid);
+    FILE* file;
+    if((file = fopen(path, "r")) == NULL)
+        return 0;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        if(sscanf(line, "Private_Dirty: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(file);
+
+    return kb;
+}
+
+/* Benchmark function: fills an hash table (mutex mode) with 4 million
+   entries and, while 2 threads keep updating it, writes a snapshot of
+   it in foreground (hashtable_save) and in background
+   (hashtable_bgsave), comparing the latency of the updates with the
+   one measured without snapshots. For the background snapshot it also
+   prints the progress, the time spent in fork() and the memory copied
+   by the kernel because of the updates (copy-on-write). */
+void bench_bgsave() {
+    char* phases_name[] = {"none", "save", "bgsave"};
+    unsigned int entries = 4000000, threads = 2, max_ops = 20000000;
+    const char* path = "bgsave_bench.snap";
+    char key[16];
+
+    hashtable* htable = hashtable_newhashtable(1 << 22);
+    hashtable_setsyncmode(htable, HASHTABLE_SYNC_MUTEX);
+
+    printf("\nLoading %u entries...\n", entries);
+    for(unsigned int i = 0; i < entries; i++) {
+        int key_len = sprintf(key, "k%u", i);
+        hashtable_insert_len(htable, key, key_len, i);
+    }
+
+    bench_bgsave_worker workers[threads];
+    for(unsigned int w = 0; w < threads; w++) {
+        if((workers[w].latencies = (unsigned int*)malloc(sizeof(unsigned int) * max_ops)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'latencies'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%-8s %10s %12s %12s %12s %10s %10s\n", "Snapshot", "Time (ms)", "Updates", "p99 (us)", "Max (us)", "Fork (ms)", "COW (MiB)");
+    for(unsigned int p = 0; p < 3; p++) {
+        volatile bool stop = false;
+        double fork_time = 0;
+        long cow_kb = 0;
+
+        for(unsigned int w = 0; w < threads; w++) {
+            workers[w] = (bench_bgsave_worker){htable, entries, w, workers[w].latencies, max_ops, 0, &stop, 0};
+            pthread_create(&workers[w].thread, NULL, bench_bgsave_thread, &workers[w]);
+        }
+
+        double start = get_time();
+        if(p == 0) {
+            usleep(500000);
+        } else if(p == 1) {
+            if(hashtable_save(htable, path) != (long) entries)
+                printf("[ERROR] The snapshot has not been written.\n");
+        } else {
+            hashtable_bgsave_job* job = hashtable_bgsave(htable, path);
+            if(job == NULL) {
+                printf("[ERROR] There was an error while trying to call 'hashtable_bgsave'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+            fork_time = get_time() - start;
+
+            double progress, next_report = 0.25;
+            while(hashtable_bgsave_poll(job, &progress) == HASHTABLE_BGSAVE_RUNNING) {
+                long kb = bench_private_dirty_kb(job->pid);
+                cow_kb = kb > cow_kb ? kb : cow_kb;
+                if(progress >= next_report) {
+                    printf("         ... %3.0f%% written\n", progress * 100);
+                    next_report += 0.25;
+                }
+                usleep(1000);
+            }
+            if(hashtable_bgsave_wait(job) != HASHTABLE_BGSAVE_DONE)
+                printf("[ERROR] The snapshot has not been written.\n");
+        }
+        double elapsed = get_time() - start;
+
+        stop = true;
+        unsigned int ops = 0, p99 = 0, max = 0;
+        for(unsigned int w = 0; w < threads; w++) {
+            pthread_join(workers[w].thread, NULL);
+            qsort(workers[w].latencies, workers[w].ops, sizeof(unsigned int), bench_compare_uint);
+            if(workers[w].ops > 0) {
+                unsigned int w_p99 = workers[w].latencies[(unsigned int)(workers[w].ops * 0.99)];
+                p99 = w_p99 > p99 ? w_p99 : p99;
+                max = workers[w].latencies[workers[w].ops - 1] > max ? workers[w].latencies[workers[w].ops - 1] : max;
+            }
+            ops += workers[w].ops;
+        }
+
+        printf("%-8s %10.1f %12u %12.2f %12.2f", phases_name[p], elapsed * 1000, ops, p99 / 1e3, max / 1e3);
+        if(p == 2)
+            printf(" %10.2f %10.1f\n", fork_time * 1000, cow_kb / 1024.0);
+        else
+            printf(" %10s %10s\n", "-", "-");
+    }
+
+    /* Check the snapshot. */
+    hashtable* loaded = hashtable_newhashtable(1 << 22);
+    printf("Snapshot reloaded: %ld entries\n\n", hashtable_wal_replay(loaded, path));
+    hashtable_free(loaded);
+
+    remove(path);
+    for(unsigned int w = 0; w < threads; w++)
+        free(workers[w].latencies);
+    hashtable_free(htable);
+}
+
+/* Benchmark function: loads 1 million entries in an hash table (mutex
+   mode) with a write-ahead log and performs 10 million updates on them
+   with 2 threads, first with the log only and then with a checkpoint
+   every second. For both it prints the throughput and the latency of
+   the updates, the size of the files left and the time needed to
+   rebuild the table from them. */
+void bench_checkpoint() {
+    char* modes_name[] = {"log only", "checkpoint"};
+    unsigned int entries = 1000000, updates = 10000000, threads = 2;
+    const char* wal_path = "checkpoint_bench.log";
+    const char* checkpoint_path = "checkpoint_bench.ckpt";
+    char key[16];
+
+    printf("\n%u entries, %u updates\n", entries, updates);
+    printf("%-11s %10s %10s %10s %6s %10s %10s %12s %10s\n", "Mode", "Mops/s", "p99 (us)", "Max (us)", "Ckpts",
+           "Log (MiB)", "Ckpt (MiB)", "Recovery (s)", "Entries");
+    for(unsigned int m = 0; m < 2; m++) {
+        remove(wal_path);
+        remove(checkpoint_path);
+
+        hashtable* htable = hashtable_newhashtable(1 << 20);
+        hashtable_setsyncmode(htable, HASHTABLE_SYNC_MUTEX);
+        hashtable_wal* wal = hashtable_wal_open(wal_path, HASHTABLE_WAL_SYNC_NEVER, 0);
+        hashtable_setwal(htable, wal);
+
+        for(unsigned int i = 0; i < entries; i++) {
+            int key_len = sprintf(key, "k%u", i);
+            hashtable_insert_len(htable, key, key_len, i);
+        }
+
+        hashtable_checkpointer* checkpointer = m == 1 ? hashtable_checkpointer_start(htable, checkpoint_path, 1000) : NULL;
+
+        /* The updates are performed by the threads of the snapshot
+           benchmark, which record their latencies. */
+        bench_bgsave_worker workers[threads];
+        volatile bool stop = false;
+        double start = get_time();
+        for(unsigned int w = 0; w < threads; w++) {
+            unsigned int* latencies;
+            if((latencies = (unsigned int*)malloc(sizeof(unsigned int) * (updates / threads))) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'malloc' on 'latencies'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+
+            workers[w] = (bench_bgsave_worker){htable, entries, w, latencies, updates / threads, 0, &stop, 0};
+            pthread_create(&workers[w].thread, NULL, bench_bgsave_thread, &workers[w]);
+        }
+
+        unsigned int p99 = 0, max = 0;
+        for(unsigned int w = 0; w < threads; w++) {
+            pthread_join(workers[w].thread, NULL);
+            qsort(workers[w].latencies, workers[w].ops, sizeof(unsigned int), bench_compare_uint);
+            if(workers[w].ops > 0) {
+                unsigned int w_p99 = workers[w].latencies[(unsigned int)(workers[w].ops * 0.99)];
+                p99 = w_p99 > p99 ? w_p99 : p99;
+                max = workers[w].latencies[workers[w].ops - 1] > max ? workers[w].latencies[workers[w].ops - 1] : max;
+            }
+            free(workers[w].latencies);
+        }
+        double elapsed = get_time() - start;
+
+        unsigned long checkpoints = 0;
+        if(checkpointer != NULL) {
+            checkpoints = checkpointer->checkpoints;
+            hashtable_checkpointer_stop(checkpointer);
+        }
+        hashtable_setwal(htable, NULL);
+        hashtable_wal_close(wal);
+
+        struct stat wal_stat, checkpoint_stat;
+        double wal_size = stat(wal_path, &wal_stat) == 0 ? wal_stat.st_size / 1048576.0 : 0;
+        double checkpoint_size = stat(checkpoint_path, &checkpoint_stat) == 0 ? checkpoint_stat.st_size / 1048576.0 : 0;
+
+        /* Restart: rebuild the table from the files. */
+        hashtable* recovered = hashtable_newhashtable(1 << 20);
+        start = get_time();
+        hashtable_recover(recovered, checkpoint_path, wal_path);
+        double recovery = get_time() - start;
+
+        printf("%-11s %10.2f %10.2f %10.2f %6lu %10.1f %10.1f %12.2f %10u%s\n", modes_name[m], updates / elapsed / 1e6, p99 / 1e3, max / 1e3,
+               checkpoints, wal_size, checkpoint_size, recovery, hashtable_count(recovered),
+               hashtable_count(recovered) == hashtable_count(htable) ? "" : " (MISMATCH)");
+
+        hashtable_free(recovered);
+        hashtable_free(htable);
+    }
+    printf("\n");
+
+    remove(wal_path);
+    remove(checkpoint_path);
+}
+
+/* Benchmark function: stores 1 million entries in an in-memory hash
+   table saved with snapshots and in a persistent table with every
+   msync policy, comparing the throughput of random updates and the
+   time needed to have the table back after a restart: loading the
+   snapshot, or opening the file again (after a clean close and after
+   a crash of the process that was updating it). */
+void bench_persistent() {
+    char* modes_name[] = {"snapshot", "always", "100 ms", "never"};
+    hashtable_msync policies[] = {HASHTABLE_MSYNC_NEVER /* unused */, HASHTABLE_MSYNC_ALWAYS, HASHTABLE_MSYNC_INTERVAL, HASHTABLE_MSYNC_NEVER};
+    unsigned int entries = 1000000, updates = 2000000;
+    const char* path = "persistent_bench.tbl";
+    unsigned int state = 2463534242u;
+    char key[16];
+
+    printf("\n%u entries, %u updates (20.000 with always)\n", entries, updates);
+    printf("%-10s %10s %10s %14s %14s %10s\n", "Table", "Load (s)", "Mops/s", "Restart (ms)", "Crash (ms)", "Entries");
+    for(unsigned int m = 0; m < 4; m++) {
+        unsigned int ops = m == 1 ? 20000 : updates;
+        double load, throughput, restart, crash = 0;
+        unsigned long count;
+
+        remove(path);
+        if(m == 0) {
+            hashtable* htable = hashtable_newhashtable(1 << 20);
+
+            double start = get_time();
+            for(unsigned int i = 0; i < entries; i++) {
+                int key_len = sprintf(key, "k%u", i);
+                hashtable_insert_len(htable, key, key_len, i);
+            }
+            load = get_time() - start;
+
+            start = get_time();
+            for(unsigned int i = 0; i < ops; i++) {
+                unsigned int r = bench_random(&state);
+                int key_len = sprintf(key, "k%u", r % entries);
+                hashtable_insert_len(htable, key, key_len, r);
+            }
+            throughput = ops / (get_time() - start) / 1e6;
+
+            hashtable_save(htable, path);
+            hashtable_free(htable);
+
+            /* Restart: load the snapshot. */
+            htable = hashtable_newhashtable(1 << 20);
+            start = get_time();
+            hashtable_wal_replay(htable, path);
+            restart = get_time() - start;
+            count = hashtable_count(htable);
+            hashtable_free(htable);
+        } else {
+            hashtable_shm* table = hashtable_shm_open_file(path, 1 << 20, 96 * 1024 * 1024, policies[m], 100);
+            if(table == NULL) {
+                printf("[ERROR] There was an error while trying to call 'hashtable_shm_open_file'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+
+            /* The initial load is not synced entry by entry. */
+            table->policy = HASHTABLE_MSYNC_NEVER;
+            double start = get_time();
+            for(unsigned int i = 0; i < entries; i++) {
+                int key_len = sprintf(key, "k%u", i);
+                hashtable_shm_insert_len(table, key, key_len, i);
+            }
+            hashtable_shm_sync(table);
+            load = get_time() - start;
+            table->policy = policies[m];
+
+            start = get_time();
+            for(unsigned int i = 0; i < ops; i++) {
+                unsigned int r = bench_random(&state);
+                int key_len = sprintf(key, "k%u", r % entries);
+                hashtable_shm_insert_len(table, key, key_len, r);
+            }
+            throughput = ops / (get_time() - start) / 1e6;
+            hashtable_shm_detach(table);
+
+            /* Restart after a clean close: just map the file. */
+            start = get_time();
+            table = hashtable_shm_open_file(path, 0, 0, policies[m], 100);
+            restart = get_time() - start;
+            hashtable_shm_detach(table);
+
+            /* Restart after a crash: a child updates the table and dies
+               without closing it, so that it is checked when opened. */
+            pid_t pid = fork();
+            if(pid == 0) {
+                table = hashtable_shm_open_file(path, 0, 0, policies[m], 100);
+                for(unsigned int i = 0; i < 1000; i++) {
+                    int key_len = sprintf(key, "k%u", i);
+                    hashtable_shm_insert_len(table, key, key_len, i);
+                }
+                _exit(EXIT_SUCCESS);
+            }
+            waitpid(pid, NULL, 0);
+
+            start = get_time();
+            table = hashtable_shm_open_file(path, 0, 0, policies[m], 100);
+            crash = get_time() - start;
+            count = hashtable_shm_count(table);
+            hashtable_shm_detach(table);
+        }
+
+        printf("%-10s %10.2f %10.3f %14.2f", modes_name[m], load, throughput, restart * 1000);
+        if(m == 0)
+            printf(" %14s %10lu\n", "-", count);
+        else
+            printf(" %14.2f %10lu\n", crash * 1000, count);
+    }
+    printf("\n");
+
+    remove(path);
+}
+
+/* Count the differences found by bench_diff. */
+void bench_diff_count(const char* key, unsigned int key_len, const unsigned int* val_a, const unsigned int* val_b, void* ctx) {
+    (void) key;
+    (void) key_len;
+    (void) val_a;
+    (void) val_b;
+    (*(unsigned long*) ctx)++;
+}
+
+/* Compare two tables that differ in 0.1% of the keys by iterating all
+   the entries of both, and with their Merkle digests. */
+void bench_diff() {
+    unsigned int entries = 1000000, changes = entries / 1000, leaves = 1 << 16;
+    char key[16];
+
+    printf("\n%u entries, %u different keys, %u digest ranges\n", entries, changes, leaves);
+    printf("%-9s %14s\n", "Digests", "Insert (s)");
+    hashtable* tables[2];
+    for(unsigned int d = 0; d < 2; d++) {
+        hashtable* htable = hashtable_newhashtable(1 << 20);
+        if(d == 1)
+            hashtable_setdigests(htable, leaves);
+
+        double start = get_time();
+        for(unsigned int i = 0; i < entries; i++) {
+            int key_len = sprintf(key, "k%u", i);
+            hashtable_insert_len(htable, key, key_len, i);
+        }
+        printf("%-9s %14.3f\n", d == 1 ? "yes" : "no", get_time() - start);
+        tables[d] = htable;
+    }
+
+    /* The second table becomes the copy of the first one (with a
+       different size), then a third of the changes are updates, a
+       third deletes and a third new keys. */
+    hashtable* a = tables[1];
+    hashtable* b = hashtable_newhashtable(1 << 19);
+    hashtable_setdigests(b, leaves);
+    for(unsigned int i = 0; i < entries; i++) {
+        int key_len = sprintf(key, "k%u", i);
+        hashtable_insert_len(b, key, key_len, i);
+    }
+    hashtable_free(tables[0]);
+
+    unsigned int state = 2463534242u;
+    for(unsigned int i = 0; i < changes; i++) {
+        int key_len = sprintf(key, "k%u", bench_random(&state) % entries);
+        if(i % 3 == 0)
+            hashtable_increment_len(b, key, key_len, 1);
+        else if(i % 3 == 1)
+            hashtable_delete_len(b, key, key_len);
+        else
+            hashtable_insert_len(b, key, sprintf(key, "new%u", i), i);
+    }
+
+    /* Full comparison: every entry of each table is looked up in the
+       other one. */
+    unsigned long scan_differences = 0;
+    double start = get_time();
+    for(unsigned int t = 0; t < 2; t++) {
+        hashtable* from = t == 0 ? a : b;
+        hashtable* to = t == 0 ? b : a;
+
+        for(unsigned int i = 0; i < from->buckets->size; i++) {
+            for(hashtable_entry* entry = from->buckets->table[i]; entry != NULL; entry = entry->next) {
+                unsigned int val;
+                bool found = hashtable_lookup_len(to, entry->key, entry->key_len, &val);
+                if(!found || (t == 0 && val != entry->val))
+                    scan_differences++;
+            }
+        }
+    }
+    double scan = get_time() - start;
+
+    unsigned long differences = 0;
+    start = get_time();
+    hashtable_diff(a, b, bench_diff_count, &differences);
+    double diff = get_time() - start;
+
+    printf("\n%-9s %14s %12s\n", "Method", "Time (ms)", "Differences");
+    printf("%-9s %14.3f %12lu\n", "scan", scan * 1e3, scan_differences);
+    printf("%-9s %14.3f %12lu\n", "digests", diff * 1e3, differences);
+
+    hashtable_free(a);
+    hashtable_free(b);
+}
+
+/* Benchmark a disk-backed table with a dataset 4 times the memory it
+   can use: load it, reopen it with a block cache of a quarter of the
+   file and measure lookups with uniform and Zipf-distributed keys. */
+void bench_disk() {
+    char* dists_name[] = {"uniform", "zipf 0.99"};
+    unsigned int entries = 4000000, lookups = 100000;
+    const char* path = "disk_bench.tbl";
+    unsigned int state = 2463534242u;
+    char key[80];
+
+    remove(path);
+    hashtable_disk* disk = hashtable_disk_open(path, 1024 * 1024);
+    if(disk == NULL) {
+        printf("[ERROR] There was an error while trying to call 'hashtable_disk_open'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = get_time();
+    for(unsigned int i = 0; i < entries; i++) {
+        int key_len = sprintf(key, "key:%060u", i);
+        hashtable_disk_insert_len(disk, key, key_len, i);
+    }
+    hashtable_disk_sync(disk);
+    double load = get_time() - start;
+    unsigned long size = disk->size;
+    hashtable_disk_close(disk);
+
+    start = get_time();
+    disk = hashtable_disk_open(path, size / 4);
+    double reopen = get_time() - start;
+
+    printf("\n%u entries of 64 bytes keys, file of %.1f MB, block cache of %.1f MB%s\n", entries, size / 1048576.0,
+           (double) disk->nframes * HASHTABLE_DISK_BLOCK / 1048576.0, disk->read_fd != disk->fd ? " (O_DIRECT)" : "");
+    printf("Load: %.0f inserts/s, reopen: %.2f s, index: %.1f bytes per key\n\n", entries / load, reopen,
+           (double) disk->capacity * sizeof(hashtable_disk_slot) / hashtable_disk_count(disk));
+    printf("%-10s %12s %12s %10s\n", "Keys", "Lookups/s", "Hit ratio", "Found");
+
+    bench_zipf zipf = bench_newzipf(entries, 0.99);
+    for(unsigned int d = 0; d < 2; d++) {
+        unsigned long found = 0;
+
+        /* The first round warms the cache up, the second is measured. */
+        for(unsigned int round = 0; round < 2; round++) {
+            disk->hits = disk->misses = 0;
+            found = 0;
+            start = get_time();
+            for(unsigned int i = 0; i < lookups; i++) {
+                /* The hot keys are scattered across the file. */
+                unsigned int k = d == 0 ? bench_random(&state) % entries : (unsigned int)(bench_zipf_next(&zipf, &state) * 2654435761ul % entries);
+                unsigned int val;
+                int key_len = sprintf(key, "key:%060u", k);
+                found += hashtable_disk_lookup_len(disk, key, key_len, &val) && val == k;
+            }
+        }
+        double elapsed = get_time() - start;
+
+        printf("%-10s %12.0f %11.1f%% %10lu\n", dists_name[d], lookups / elapsed,
+               100.0 * disk->hits / (disk->hits + disk->misses), found);
+    }
+    printf("\n");
+
+    free(zipf.cdf);
+    hashtable_disk_close(disk);
+    remove(path);
+}
+
+/* Structure that holds a strict LRU cache, the reference for
+   bench_cache: an hash table maps every key to its node of a circular
+   doubly-linked list ordered by last use, whose sentinel is the node
+   'capacity'. */
+typedef struct bench_lru_t {
+    hashtable* index;               /* Key -> node */
+    unsigned int* prev;
+    unsigned int* next;
+    unsigned int* keys;             /* Key of every node */
+    unsigned int count;             /* Nodes in use */
+    unsigned int capacity;
+} bench_lru;
+
+/* Move the node 'node' of a strict LRU cache to the front of its list. */
+void bench_lru_front(bench_lru* lru, unsigned int node, bool linked) {
+    unsigned int sentinel = lru->capacity;
+
+    if(linked) {
+        lru->next[lru->prev[node]] = lru->next[node];
+        lru->prev[lru->next[node]] = lru->prev[node];
+    }
+    lru->next[node] = lru->next[sentinel];
+    lru->prev[node] = sentinel;
+    lru->prev[lru->next[sentinel]] = node;
+    lru->next[sentinel] = node;
+}
+
+/* Access a key of a strict LRU cache, inserting it (in place of the
+   least recently used one, if full) if missing. Return true on a hit. */
+bool bench_lru_access(bench_lru* lru, char keys[][16], unsigned int k) {
+    unsigned int node, key_len = (unsigned int) strlen(keys[k]);
+
+    if(hashtable_lookup_len(lru->index, keys[k], key_len, &node)) {
+        bench_lru_front(lru, node, true);
+        return true;
+    }
+
+    bool linked = lru->count == lru->capacity;
+    if(linked) {
+        node = lru->prev[lru->capacity];
+        hashtable_delete(lru->index, keys[lru->keys[node]]);
+    } else
+        node = lru->count++;
+    lru->keys[node] = k;
+    bench_lru_front(lru, node, linked);
+    hashtable_insert_len(lru->index, keys[k], key_len, node);
+
+    return false;
+}
+
+/* Benchmark the cache mode (CLOCK) against a strict LRU on Zipf traces:
+   every access is a lookup followed, on a miss, by an insert. */
+void bench_cache() {
+    unsigned int universe = 1000000, accesses = 4000000;
+    double skews[] = {0.8, 0.99};
+    unsigned int capacities[] = {10000, 100000};
+    unsigned int state = 2463534242u;
+    char (*keys)[16];
+    unsigned int* trace;
+
+    if((keys = (char(*)[16])malloc(sizeof(*keys) * universe)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'keys'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if((trace = (unsigned int*)malloc(sizeof(unsigned int) * accesses)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'trace'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    for(unsigned int i = 0; i < universe; i++)
+        sprintf(keys[i], "key:%u", i);
+
+    /* An insert that evicts must spare the key it has just inserted. */
+    hashtable_syncmode modes[] = {HASHTABLE_SYNC_NONE, HASHTABLE_SYNC_RWLOCK, HASHTABLE_SYNC_SEQLOCK};
+    char* modes_name[] = {"none", "rwlock", "seqlock"};
+    unsigned int small[] = {1, 1000};
+    for(unsigned int m = 0; m < 3; m++) {
+        for(unsigned int c = 0; c < 2; c++) {
+            hashtable* htable = hashtable_newhashtable(16);
+            unsigned long lost = 0;
+            unsigned int val;
+
+            hashtable_setsyncmode(htable, modes[m]);
+            hashtable_setcapacity(htable, small[c]);
+            for(unsigned int i = 0; i < 100 * small[c]; i++) {
+                unsigned int key_len = (unsigned int) strlen(keys[i]);
+
+                if(hashtable_insert_len(htable, keys[i], key_len, i)->val != i || !hashtable_lookup_len(htable, keys[i], key_len, &val))
+                    lost++;
+                if(i % 3 == 0)
+                    hashtable_lookup_len(htable, keys[i / 2], (unsigned int) strlen(keys[i / 2]), &val);
+            }
+            printf("Capacity %4u, %-7s: %lu keys evicted by their own insert %s\n", small[c], modes_name[m], lost, lost == 0 ? "(ok)" : "(FAILED)");
+            hashtable_free(htable);
+        }
+    }
+
+    printf("\n%u keys, %u accesses (the first half warms the caches up)\n", universe, accesses);
+    printf("%-6s %9s %-8s %10s %10s %12s\n", "Skew", "Capacity", "Cache", "Hit ratio", "Mops/s", "Evictions");
+    for(unsigned int z = 0; z < 2; z++) {
+        bench_zipf zipf = bench_newzipf(universe, skews[z]);
+
+        /* The hot keys are scattered among the buckets. */
+        for(unsigned int i = 0; i < accesses; i++)
+            trace[i] = (unsigned int)(bench_zipf_next(&zipf, &state) * 2654435761ul % universe);
+        free(zipf.cdf);
+
+        for(unsigned int c = 0; c < 2; c++) {
+            unsigned int capacity = capacities[c];
+
+            /* CLOCK: the table in cache mode. */
+            hashtable* htable = hashtable_newhashtable(capacity);
+            hashtable_setcapacity(htable, capacity);
+            unsigned long hits = 0;
+            double start = 0;
+            for(unsigned int i = 0; i < accesses; i++) {
+                unsigned int key_len = (unsigned int) strlen(keys[trace[i]]), val;
+
+                if(i == accesses / 2) {
+                    hits = 0;
+                    start = get_time();
+                }
+                if(hashtable_lookup_len(htable, keys[trace[i]], key_len, &val))
+                    hits++;
+                else
+                    hashtable_insert_len(htable, keys[trace[i]], key_len, trace[i]);
+            }
+            double elapsed = get_time() - start;
+            hashtable_stats stats;
+            hashtable_getstats(htable, &stats);
+            printf("%-6.2f %9u %-8s %9.2f%% %10.2f %12lu\n", skews[z], capacity, "CLOCK",
+                   100.0 * hits / (accesses - accesses / 2), (accesses - accesses / 2) / elapsed / 1e6, stats.evictions);
+            hashtable_free(htable);
+
+            /* Strict LRU. */
+            bench_lru lru = {hashtable_newhashtable(capacity), NULL, NULL, NULL, 0, capacity};
+            if((lru.prev = (unsigned int*)malloc(sizeof(unsigned int) * (capacity + 1))) == NULL ||
+               (lru.next = (unsigned int*)malloc(sizeof(unsigned int) * (capacity + 1))) == NULL ||
+               (lru.keys = (unsigned int*)malloc(sizeof(unsigned int) * capacity)) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'malloc' on 'lru'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+            lru.prev[capacity] = lru.next[capacity] = capacity;
+            unsigned long evictions = 0;
+            for(unsigned int i = 0; i < accesses; i++) {
+                if(i == accesses / 2) {
+                    hits = 0;
+                    start = get_time();
+                }
+                if(bench_lru_access(&lru, keys, trace[i]))
+                    hits++;
+                else if(lru.count == capacity)
+                    evictions++;
+            }
+            elapsed = get_time() - start;
+            printf("%-6.2f %9u %-8s %9.2f%% %10.2f %12lu\n", skews[z], capacity, "LRU",
+                   100.0 * hits / (accesses - accesses / 2), (accesses - accesses / 2) / elapsed / 1e6, evictions);
+            hashtable_free(lru.index);
+            free(lru.prev);
+            free(lru.next);
+            free(lru.keys);
+        }
+    }
+    printf("\n");
+
+    free(keys);
+    free(trace);
+}
+
+/* Return the CPU time used by the calling thread, in seconds. */
+double get_cputime() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Count the entries visited by bench_ttl. */
+void bench_ttl_visit(hashtable_entry* entry, void* ctx, unsigned int worker) {
+    (void) entry;
+    (void) worker;
+
+    (*(unsigned long*) ctx)++;
+}
+
+/* Benchmark the expiration of 1M session tokens (random strings of 64
+   characters, like the ones of rnd_str.txt) due within one second,
+   calling hashtable_expire every 10 ms, and compare its CPU time with
+   a scan of the table. */
+void bench_ttl() {
+    unsigned int entries = 1000000;
+    unsigned int state = 2463534242u;
+    const char* alphabet = "abcdefghijklmnopqrstuvwxyz0123456789";
+    char* tokens;
+
+    if((tokens = (char*)malloc((size_t) entries * 64)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'tokens'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t i = 0; i < (size_t) entries * 64; i++)
+        tokens[i] = alphabet[bench_random(&state) % 36];
+
+    hashtable* htable = hashtable_newhashtable(1 << 20);
+
+    /* The cost of the timers, and of deleting the tokens explicitly
+       (in the order they will expire). */
+    double start = get_time();
+    for(unsigned int i = 0; i < entries; i++)
+        hashtable_insert_len(htable, tokens + (size_t) i * 64, 64, i);
+    double plain = get_time() - start;
+    double cpu_start = get_cputime();
+    for(unsigned int j = 0; j < 1000; j++) {
+        for(unsigned int i = j; i < entries; i += 1000)
+            hashtable_delete_len(htable, tokens + (size_t) i * 64, 64);
+    }
+    double deletes = get_cputime() - cpu_start;
+
+    /* The tokens expire between 3 and 4 seconds from now. */
+    start = get_time();
+    for(unsigned int i = 0; i < entries; i++)
+        hashtable_insert_ttl_len(htable, tokens + (size_t) i * 64, 64, i, 3000 + i % 1000);
+    double timed = get_time() - start;
+
+    unsigned long visited = 0;
+    start = get_time();
+    hashtable_parallel_foreach(htable, bench_ttl_visit, &visited, 1);
+    double scan = get_time() - start;
+
+    printf("\n%u tokens: insert %.2f Mops/s, insert with TTL %.2f Mops/s, one scan of the table %.1f ms\n",
+           entries, entries / plain / 1e6, entries / timed / 1e6, scan * 1000);
+
+    unsigned long expired = 0, calls = 0;
+    double cpu = 0, first = 0, last = 0;
+    struct timespec interval = {0, 10000000};
+    while(hashtable_count(htable) > 0) {
+        nanosleep(&interval, NULL);
+
+        cpu_start = get_cputime();
+        unsigned long count = hashtable_expire(htable);
+        cpu += get_cputime() - cpu_start;
+        calls++;
+
+        if(count > 0) {
+            if(expired == 0)
+                first = get_time();
+            last = get_time();
+            expired += count;
+        }
+    }
+
+    printf("Expired %lu tokens in %.2f s with %lu calls: %.1f ms of CPU, %.0f ns per token (a delete: %.0f ns)\n",
+           expired, last - first, calls, cpu * 1000, cpu / expired * 1e9, deletes / entries * 1e9);
+    printf("CPU to expire 1M tokens per second: %.0f ms per second (a scan every 10 ms would take %.0f ms per second)\n\n",
+           cpu / expired * 1e6 * 1000, scan * 100 * 1000);
+
+    hashtable_free(htable);
+    free(tokens);
+}
+
+/* Structure that holds the state of bench_singleflight. */
+typedef struct bench_flight_t {
+    hashtable* htable;
+    pthread_barrier_t barrier;
+    bool single;                    /* Use hashtable_get_or_load instead of a naive read-through */
+    bool missing;                   /* The keys do not exist in the backend */
+    unsigned int rounds;            /* Bursts */
+    unsigned int nthreads;
+    unsigned long calls;            /* Calls to the backend */
+    pthread_mutex_t lock;           /* Protects 'busy' */
+    pthread_cond_t free_slot;       /* Signaled when a call of the backend ends */
+    unsigned int busy;              /* Calls being served by the backend */
+    double* latencies;              /* Latency of every read, in seconds */
+} bench_flight;
+
+/* Backend of bench_singleflight: a lookup that takes 5 ms, with at
+   most 4 calls served at the same time (es. a pool of 4 database
+   connections), the others wait. */
+bool bench_backend(const char* key, unsigned int key_len, unsigned int* val, void* ctx) {
+    bench_flight* bench = (bench_flight*) ctx;
+    struct timespec delay = {0, 5000000};
+
+    (void) key;
+
+    pthread_mutex_lock(&bench->lock);
+    while(bench->busy == 4)
+        pthread_cond_wait(&bench->free_slot, &bench->lock);
+    bench->busy++;
+    bench->calls++;
+    pthread_mutex_unlock(&bench->lock);
+
+    nanosleep(&delay, NULL);
+
+    pthread_mutex_lock(&bench->lock);
+    bench->busy--;
+    pthread_cond_signal(&bench->free_slot);
+    pthread_mutex_unlock(&bench->lock);
+    *val = key_len;
+
+    return !bench->missing;
+}
+
+/* Thread of bench_singleflight: every round all the threads read
+   the same key, missing from the table, at the same time. */
+void* bench_singleflight_thread(void* arg) {
+    bench_flight* bench = (bench_flight*)((void**) arg)[0];
+    unsigned int id = (unsigned int)(unsigned long)((void**) arg)[1];
+    char key[32];
+
+    for(unsigned int r = 0; r < bench->rounds; r++) {
+        int key_len = sprintf(key, "hot:%u", r % (bench->rounds / 2));
+        unsigned int val;
+
+        pthread_barrier_wait(&bench->barrier);
+        double start = get_time();
+        if(bench->single)
+            hashtable_get_or_load_len(bench->htable, key, key_len, &val, bench_backend, bench);
+        else if(!hashtable_lookup_len(bench->htable, key, key_len, &val) && bench_backend(key, key_len, &val, bench))
+            hashtable_insert_len(bench->htable, key, key_len, val);
+        bench->latencies[r * bench->nthreads + id] = get_time() - start;
+
+        /* The next burst starts when this one is over. */
+        pthread_barrier_wait(&bench->barrier);
+    }
+
+    return NULL;
+}
+
+/* Compare two latencies (for qsort). */
+int bench_compare_double(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Benchmark the single-flight loading: bursts of concurrent reads of
+   a hot key missing from the table, served by a backend that takes
+   5 ms (4 calls at a time), with a naive read-through (every thread that misses calls the
+   backend) and with hashtable_get_or_load. Every key is read in two
+   bursts: the second one finds it in the table or, for the keys that
+   the backend does not have, in the negative cache (if enabled). */
+void bench_singleflight() {
+    char* modes_name[] = {"naive", "single-flight", "naive", "single-flight", "single-flight + negative cache"};
+    bool single[] = {false, true, false, true, true};
+    bool missing[] = {false, false, true, true, true};
+    unsigned int nthreads = 32, rounds = 20;
+
+    printf("\n%u threads, %u bursts on %u keys (5 ms per backend call, 4 at a time)\n", nthreads, rounds, rounds / 2);
+    printf("%-8s %-31s %14s %10s %10s\n", "Keys", "Loading", "Backend calls", "Avg (ms)", "p99 (ms)");
+    for(unsigned int m = 0; m < 5; m++) {
+        bench_flight bench;
+        pthread_t threads[nthreads];
+        void* args[nthreads][2];
+
+        bench.htable = hashtable_newhashtable(1024);
+        bench.single = single[m];
+        bench.missing = missing[m];
+        bench.rounds = rounds;
+        bench.nthreads = nthreads;
+        bench.calls = 0;
+        bench.busy = 0;
+        pthread_mutex_init(&bench.lock, NULL);
+        pthread_cond_init(&bench.free_slot, NULL);
+
+        hashtable_setsyncmode(bench.htable, HASHTABLE_SYNC_RWLOCK);
+        if(m == 4)
+            hashtable_setnegativecache(bench.htable, 60000);
+        if((bench.latencies = (double*)malloc(sizeof(double) * rounds * nthreads)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'bench.latencies'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_barrier_init(&bench.barrier, NULL, nthreads);
+
+        for(unsigned int t = 0; t < nthreads; t++) {
+            args[t][0] = &bench;
+            args[t][1] = (void*)(unsigned long) t;
+            pthread_create(&threads[t], NULL, bench_singleflight_thread, args[t]);
+        }
+        for(unsigned int t = 0; t < nthreads; t++)
+            pthread_join(threads[t], NULL);
+
+        double sum = 0;
+        for(unsigned int i = 0; i < rounds * nthreads; i++)
+            sum += bench.latencies[i];
+        qsort(bench.latencies, rounds * nthreads, sizeof(double), bench_compare_double);
+        printf("%-8s %-31s %14lu %10.2f %10.2f\n", missing[m] ? "missing" : "present", modes_name[m], bench.calls,
+               sum / (rounds * nthreads) * 1000, bench.latencies[rounds * nthreads * 99 / 100] * 1000);
+
+        pthread_barrier_destroy(&bench.barrier);
+        pthread_mutex_destroy(&bench.lock);
+        pthread_cond_destroy(&bench.free_slot);
+        free(bench.latencies);
+        hashtable_free(bench.htable);
+    }
+    printf("\n");
+}
+
+/* Benchmark hashtable_random_entry on a table of 1M buckets at 1% and
+   at 50% load, by rejection and with the sampling index, and check
+   that the samples are uniform (chi-square over the entries, about 1
+   per degree of freedom if they are). For comparison, it also times
+   one scan of the same table, which is what a sample would cost
+   without them. */
+void bench_sampling() {
+    unsigned int size = 1 << 20, samples = 1000000;
+    unsigned int loads[] = {1, 50};
+    char key[32];
+
+    printf("\n%-6s %-10s %9s %9s %12s %10s %12s %10s\n", "Load", "Mode", "Entries", "Max chain", "Insert (ns)", "Sample (ns)", "Chi2 / dof", "Scan (us)");
+    for(unsigned int l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+        unsigned int entries = (unsigned int) ((unsigned long) size * loads[l] / 100);
+
+        for(int dense = 0; dense < 2; dense++) {
+            hashtable* htable = hashtable_newhashtable(size);
+            if(dense)
+                hashtable_setsampling(htable, true);
+
+            double start = get_time();
+            for(unsigned int i = 0; i < entries; i++)
+                hashtable_insert_len(htable, key, (unsigned int) sprintf(key, "key:%u", i), i);
+            double insert = get_time() - start;
+
+            unsigned int* hits;
+            if((hits = (unsigned int*)calloc(entries, sizeof(unsigned int))) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'calloc' on 'hits'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+
+            start = get_time();
+            for(unsigned int i = 0; i < samples; i++)
+                hits[hashtable_random_entry(htable)->val]++;
+            double sample = get_time() - start;
+
+            double expected = (double) samples / entries, chi2 = 0;
+            for(unsigned int i = 0; i < entries; i++)
+                chi2 += (hits[i] - expected) * (hits[i] - expected) / expected;
+
+            /* What a sample would cost scanning the buckets. */
+            unsigned long visited = 0;
+            start = get_time();
+            hashtable_parallel_foreach(htable, bench_ttl_visit, &visited, 1);
+            double scan = get_time() - start;
+
+            printf("%-6u %-10s %9u %9u %12.0f %10.0f %12.3f %10.0f\n", loads[l], dense ? "index" : "rejection", entries,
+                   htable->buckets->max_chain, insert / entries * 1e9, sample / samples * 1e9, chi2 / (entries - 1), scan * 1e6);
+
+            free(hits);
+            hashtable_free(htable);
+        }
+    }
+    printf("\n");
+}
+
+/* Snapshot scan callback: counts the entries and sums their values. */
+void bench_mvcc_visit(hashtable_entry* entry, void* ctx, unsigned int worker) {
+    unsigned long* acc = (unsigned long*) ctx;
+
+    (void) worker;
+
+    acc[0]++;
+    acc[1] += entry->val;
+}
+
+/* Benchmark function: fills an hash table (rwlock mode) with 1 million
+   entries and, while 2 threads keep updating it, measures the
+   throughput and the latency of the updates without snapshots, with a
+   snapshot open and with full scans of snapshots (one after the
+   other, each one on a new snapshot) running all the time. Since the
+   scans take CPU time from the updates, it also prints the CPU time
+   of the writers per update. For the snapshots it prints the most
+   bucket versions alive at once, and the entries copied into them. It
+   also checks that the writes made after a snapshot (to 1000 keys
+   read at the start, and a new key) are not visible through it. */
+void bench_mvcc() {
+    char* phases_name[] = {"none", "open", "scans"};
+    unsigned int entries = 1000000, threads = 2, max_ops = 20000000;
+    char key[16];
+
+    hashtable* htable = hashtable_newhashtable(1 << 20);
+    hashtable_setsyncmode(htable, HASHTABLE_SYNC_RWLOCK);
+
+    printf("\nLoading %u entries...\n", entries);
+    for(unsigned int i = 0; i < entries; i++) {
+        int key_len = sprintf(key, "k%u", i);
+        hashtable_insert_len(htable, key, key_len, i);
+    }
+
+    bench_bgsave_worker workers[threads];
+    for(unsigned int w = 0; w < threads; w++) {
+        if((workers[w].latencies = (unsigned int*)malloc(sizeof(unsigned int) * max_ops)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'latencies'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%-6s %10s %10s %8s %10s %9s %7s %10s %10s %10s\n", "Phase", "Time (ms)", "Updates", "Mops/s", "p99 (us)", "CPU (ns)", "Scans", "Scan (ms)", "Versions", "Copied");
+    for(unsigned int p = 0; p < 3; p++) {
+        volatile bool stop = false;
+        unsigned long copies = htable->views.copies, versions = 0;
+        unsigned int scans = 0;
+        double scan_time = 0;
+
+        for(unsigned int w = 0; w < threads; w++) {
+            workers[w] = (bench_bgsave_worker){htable, entries, w, workers[w].latencies, max_ops, 0, &stop, 0};
+            pthread_create(&workers[w].thread, NULL, bench_bgsave_thread, &workers[w]);
+        }
+
+        double start = get_time();
+        double cpu_start = (double) clock() / CLOCKS_PER_SEC, scanner_start = get_cputime();
+        if(p == 0) {
+            usleep(2000000);
+        } else if(p == 1) {
+            /* The writes made after the snapshot, by the workers and by
+               this thread, must not be visible through the view. */
+            unsigned int vals[1000], val;
+            bool changed = false;
+            hashtable_view* view = hashtable_snapshot(htable);
+            for(unsigned int i = 0; i < 1000; i++)
+                hashtable_view_lookup_len(view, key, sprintf(key, "k%u", i), &vals[i]);
+            hashtable_insert_len(htable, "k0", 2, vals[0] + 1);
+            hashtable_insert_len(htable, "new", 3, 1);
+            usleep(2000000);
+            versions = htable->views.versions;
+            for(unsigned int i = 0; i < 1000; i++)
+                changed |= !hashtable_view_lookup_len(view, key, sprintf(key, "k%u", i), &val) || val != vals[i];
+            if(changed || hashtable_view_lookup_len(view, "new", 3, &val))
+                printf("[ERROR] A snapshot shows writes made after it was taken.\n");
+            hashtable_view_release(view);
+            hashtable_delete_len(htable, "new", 3);
+        } else {
+            while(get_time() - start < 2) {
+                unsigned long acc[2] = {0, 0};
+                double scan_start = get_time();
+                hashtable_view* view = hashtable_snapshot(htable);
+                hashtable_view_foreach(view, bench_mvcc_visit, acc);
+                versions = htable->views.versions > versions ? htable->views.versions : versions;
+                hashtable_view_release(view);
+                scan_time += get_time() - scan_start;
+                scans++;
+                if(acc[0] != entries)
+                    printf("[ERROR] A snapshot has %lu entries instead of %u.\n", acc[0], entries);
+            }
+        }
+        double elapsed = get_time() - start;
+
+        stop = true;
+        unsigned int ops = 0, p99 = 0;
+        for(unsigned int w = 0; w < threads; w++)
+            pthread_join(workers[w].thread, NULL);
+        double writers_cpu = (double) clock() / CLOCKS_PER_SEC - cpu_start - (get_cputime() - scanner_start);
+        for(unsigned int w = 0; w < threads; w++) {
+            qsort(workers[w].latencies, workers[w].ops, sizeof(unsigned int), bench_compare_uint);
+            if(workers[w].ops > 0) {
+                unsigned int w_p99 = workers[w].latencies[(unsigned int)(workers[w].ops * 0.99)];
+                p99 = w_p99 > p99 ? w_p99 : p99;
+            }
+            ops += workers[w].ops;
+        }
+
+        printf("%-6s %10.1f %10u %8.2f %10.2f %9.0f", phases_name[p], elapsed * 1000, ops, ops / elapsed / 1e6, p99 / 1e3, writers_cpu / ops * 1e9);
+        if(p == 0)
+            printf(" %7s %10s %10s %10s\n", "-", "-", "-", "-");
+        else
+            printf(" %7u %10.1f %10lu %10lu\n", scans, scans > 0 ? scan_time / scans * 1000 : 0, versions, htable->views.copies - copies);
+    }
+    printf("Versions left after the last release: %lu\n\n", htable->views.versions);
+
+    for(unsigned int w = 0; w < threads; w++)
+        free(workers[w].latencies);
+    hashtable_free(htable);
+}
+
+int main() {
+    /* Print a simple choice menu */
+    printf("Welcome to the String Hash Table implementation in C!\n\n");
+    printf("There are two test functions available:\n");
+    printf("  1) Test with 12 different strings, each 10 characters long\n");
+    printf("  2) Test with 100.000 different strings, each 64 characters long, written in a file called \"rnd_str.txt\"\n");
+    printf("  3) Benchmark the key ownership policies (copy, borrow, arena) loading \"rnd_str.txt\"\n");
+    printf("  4) Benchmark the concurrent modes (mutex, rwlock, seqlock) with 95/5 and 99/1 read/write mixes\n");
+    printf("  5) Benchmark the latency of a growing concurrent hash table (cooperative vs stop-the-world resize)\n");
+    printf("  6) Benchmark a parallel aggregation (map-reduce) over 10.000.000 entries with 1 to 8 threads\n");
+    printf("  7) Benchmark delegation to per-core shards vs lock striping with uniform and Zipf keys\n");
+    printf("  8) Benchmark flat combining vs lock striping on Zipf distributed updates\n");
+    printf("  9) Benchmark a shared memory table read and written by 1 to 8 processes\n");
+    printf(" 10) Benchmark the write-ahead log throughput with every sync policy (always, every 10 ms, never)\n");
+    printf(" 11) Benchmark the latency of the updates while a snapshot is written in foreground or in background (fork)\n");
+    printf(" 12) Benchmark the recovery time from the write-ahead log alone and from a checkpoint plus the log\n");
+    printf(" 13) Benchmark a persistent (memory-mapped) table against an in-memory table with snapshots\n");
+    printf(" 14) Benchmark the comparison of two tables differing in 0.1%% of the keys: full scan vs Merkle digests\n");
+    printf(" 15) Benchmark a disk-backed table 4x its cache (uniform and Zipf lookups)\n");
+    printf(" 16) Benchmark the cache mode (CLOCK eviction) against a strict LRU on Zipf traces\n");
+    printf(" 17) Benchmark the expiration of 1M tokens with a time to live (timer wheel)\n");
+    printf(" 18) Benchmark the single-flight loading of a hot missing key (bursts of concurrent reads)\n");
+    printf(" 19) Benchmark the uniform random sampling of entries (rejection vs sampling index) at 1%% and 50%% load\n");
+    printf(" 20) Benchmark the updates while snapshots (copy-on-write views) are open and scanned\n");
+    printf(" 21) Exit\n");
+    
+    /* Reads from input (stdin) a choice between 1 and 21 */
+    char tmp_buff[16];
+    int option, result;
+    do {
+        printf("Please, choose an option [1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21]: ");
+        if (fgets(tmp_buff, sizeof(tmp_buff), stdin) == NULL) {
+            option = -1;
+            break;
+        }
+        result = sscanf(tmp_buff, "%d", &option);
+    } while(result != 1 || option < 1 || option > 21);
+
+    switch (option) {
+        case 1:
+            test_12_strings();
+            break;
+        case 2:
+            test_100000_strings();
+            break;
+        case 3:
+            bench_keymodes();
+            break;
+        case 4:
+            bench_syncmodes();
+            break;
+        case 5:
+            bench_growth();
+            break;
+        case 6:
+            bench_reduce();
+            break;
+        case 7:
+            bench_delegation();
+            break;
+        case 8:
+            bench_combining();
+            break;
+        case 9:
+            bench_shm();
+            break;
+        case 10:
+            bench_wal();
+            break;
+        case 11:
+            bench_bgsave();
+            break;
+        case 12:
+            bench_checkpoint();
+            break;
+        case 13:
+            bench_persistent();
+            break;
+        case 14:
+            bench_diff();
+            break;
+        case 15:
+            bench_disk();
+            break;
+        case 16:
+            bench_cache();
+            break;
+        case 17:
+            bench_ttl();
+            break;
+        case 18:
+            bench_singleflight();
+            break;
+        case 19:
+            bench_sampling();
+            break;
+        case 20:
+            bench_mvcc();
+            break;
+        case 21:
+            printf("\nGoodbye! :)\n");
+            break;
+        
+        default:
+            printf("[ERROR] There was an error while trying to read the value. Closing...\n");
+            exit(EXIT_FAILURE);
+            break;
+    }
+    
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Load generator for shtserver: every client thread opens its own
+   connection and sends pipelines of requests (a mix of GET and SET on
+   random keys), reading all the replies of a pipeline before sending
+   the next one. At the end it prints the throughput of all the
+   clients together.
+   With -f or -F it also measures the replication lag of a follower of
+   the server: a probe thread writes an increasing value on the leader
+   every 10 ms and polls the follower until it reads it back. */
+
+/* Structure that holds the parameters of a client thread. */
+typedef struct shtbench_client_t {
+    unsigned int requests;          /* Number of requests to send */
+    unsigned int pipeline;          /* Requests per pipeline */
+    unsigned int keyspace;          /* Number of different keys */
+    unsigned int get_pct;           /* Percentage of GET (the remaining are SET) */
+    unsigned int seed;              /* Seed of the pseudo-random numbers */
+    unsigned long errors;           /* Error replies received */
+
+    pthread_t thread;
+} shtbench_client;
+
+/* Structure that holds the replication lag samples of the probe. */
+typedef struct shtbench_probe_t {
+    double* lags;                   /* Lag of every probe, in seconds */
+    unsigned int count;
+    unsigned int size;
+    volatile bool stop;
+
+    pthread_t thread;
+} shtbench_probe;
+
+static const char* host = "127.0.0.1";
+static const char* path = NULL;
+static int port = 6380;
+static const char* follower_path = NULL;
+static int follower_port = 0;
+
+/* Return the current time, in seconds. */
+static double shtbench_time() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Return a pseudo-random number (xorshift32), updating 'state'. */
+static unsigned int shtbench_random(unsigned int* state) {
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+/* Connect to the server on 'port' of 'host' or, if 'path' is not
+   NULL, on a Unix socket. Return the socket, -1 on error. */
+static int shtbench_connect(int port, const char* path) {
+    int fd;
+
+    if(path != NULL) {
+        struct sockaddr_un addr = {0};
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return -1;
+    } else {
+        struct sockaddr_in addr = {0};
+        int one = 1;
+
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, host, &addr.sin_addr);
+        if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return -1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+}
+
+/* Count the complete replies in 'data[0, len)', starting at '*pos'
+   (GET, SET and error replies only: no arrays). Move '*pos' after the
+   last complete one and count the errors in 'errors'. */
+static unsigned int shtbench_countreplies(const char* data, size_t len, size_t* pos, unsigned long* errors) {
+    unsigned int replies = 0;
+
+    while(*pos < len) {
+        const char* line = data + *pos;
+        const char* newline = memchr(line, '\n', len - *pos);
+
+        if(newline == NULL)
+            break;
+
+        size_t next = newline + 1 - data;
+        if(line[0] == '$' && line[1] != '-') {
+            next += strtoul(line + 1, NULL, 10) + 2;
+            if(next > len)
+                break;
+        }
+        if(line[0] == '-')
+            (*errors)++;
+
+        *pos = next;
+        replies++;
+    }
+
+    return replies;
+}
+
+/* Client thread. */
+static void* shtbench_run(void* arg) {
+    shtbench_client* client = (shtbench_client*) arg;
+    unsigned int state = client->seed;
+    size_t request_size = (size_t) client->pipeline * 64;
+    char* request = (char*)malloc(request_size);
+    char* reply = (char*)malloc(1024 * 1024);
+
+    if(request == NULL || reply == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'request'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = shtbench_connect(port, path);
+    if(fd < 0) {
+        printf("[ERROR] There was an error while trying to connect to the server. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(unsigned int sent = 0; sent < client->requests; ) {
+        unsigned int count = client->requests - sent < client->pipeline ? client->requests - sent : client->pipeline;
+        size_t len = 0;
+
+        /* Build the whole pipeline, then send it at once. */
+        for(unsigned int i = 0; i < count; i++) {
+            char key[16];
+            unsigned int r = shtbench_random(&state);
+            int key_len = sprintf(key, "key:%u", (r >> 8) % client->keyspace);
+
+            if(r % 100 < client->get_pct) {
+                len += sprintf(request + len, "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n", key_len, key);
+            } else {
+                char val[16];
+                int val_len = sprintf(val, "%u", r & 0xFFFF);
+                len += sprintf(request + len, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%d\r\n%s\r\n", key_len, key, val_len, val);
+            }
+        }
+
+        for(size_t written = 0; written < len; ) {
+            ssize_t result = write(fd, request + written, len - written);
+            if(result < 0 && errno != EINTR) {
+                printf("[ERROR] There was an error while trying to send the requests. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+            written += result > 0 ? result : 0;
+        }
+
+        /* Read until all the replies of the pipeline have arrived. */
+        unsigned int replies = 0;
+        size_t filled = 0, pos = 0;
+        while(replies < count) {
+            if(pos > 0) {
+                memmove(reply, reply + pos, filled - pos);
+                filled -= pos;
+                pos = 0;
+            }
+
+            ssize_t result = read(fd, reply + filled, 1024 * 1024 - filled);
+            if(result <= 0) {
+                if(result < 0 && errno == EINTR)
+                    continue;
+                printf("[ERROR] The server closed the connection. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+            filled += result;
+            replies += shtbench_countreplies(reply, filled, &pos, &client->errors);
+        }
+
+        sent += count;
+    }
+
+    close(fd);
+    free(request);
+    free(reply);
+
+    return NULL;
+}
+
+/* Send a request and read its reply (a single line or bulk string)
+   into 'reply'. Return the length of the reply. */
+static size_t shtbench_call(int fd, const char* request, char* reply, size_t size) {
+    size_t len = strlen(request), filled = 0, pos = 0;
+    unsigned long errors = 0;
+
+    if(write(fd, request, len) != (ssize_t) len) {
+        printf("[ERROR] There was an error while trying to send the requests. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    while(shtbench_countreplies(reply, filled, &pos, &errors) == 0) {
+        ssize_t result = read(fd, reply + filled, size - filled - 1);
+        if(result <= 0) {
+            if(result < 0 && errno == EINTR)
+                continue;
+            printf("[ERROR] The server closed the connection. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        filled += result;
+    }
+    reply[filled] = '\0';
+
+    return filled;
+}
+
+/* Probe thread: write a new value of "lag:probe" on the leader, then
+   read it from the follower until it has been replicated. */
+static void* shtbench_lag(void* arg) {
+    shtbench_probe* probe = (shtbench_probe*) arg;
+    int leader_fd = shtbench_connect(port, path), follower_fd = shtbench_connect(follower_port, follower_path);
+    char request[128], reply[256], expected[64];
+
+    if(leader_fd < 0 || follower_fd < 0) {
+        printf("[ERROR] There was an error while trying to connect to the leader or to the follower. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(unsigned int seq = 1; !probe->stop; seq++) {
+        int digits = sprintf(expected, "%u", seq);
+
+        sprintf(request, "*3\r\n$3\r\nSET\r\n$9\r\nlag:probe\r\n$%d\r\n%s\r\n", digits, expected);
+        double start = shtbench_time();
+        shtbench_call(leader_fd, request, reply, sizeof(reply));
+
+        sprintf(expected, "$%d\r\n%u\r\n", digits, seq);
+        do {
+            shtbench_call(follower_fd, "*2\r\n$3\r\nGET\r\n$9\r\nlag:probe\r\n", reply, sizeof(reply));
+        } while(strcmp(reply, expected) != 0 && !probe->stop);
+        if(strcmp(reply, expected) != 0)
+            break;
+
+        if(probe->count == probe->size) {
+            probe->size = probe->size == 0 ? 1024 : probe->size * 2;
+            if((probe->lags = (double*)realloc(probe->lags, sizeof(double) * probe->size)) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'realloc' on 'probe->lags'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        probe->lags[probe->count++] = shtbench_time() - start;
+        usleep(10000);
+    }
+
+    close(leader_fd);
+    close(follower_fd);
+
+    return NULL;
+}
+
+/* Compare two lags (used by qsort). */
+static int shtbench_compare(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    unsigned int clients = 4, requests = 1000000, pipeline = 16, keyspace = 100000, get_pct = 80;
+    int option;
+
+    while((option = getopt(argc, argv, "h:p:s:c:n:P:r:g:f:F:")) != -1) {
+        switch(option) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 's': path = optarg; break;
+            case 'c': clients = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'n': requests = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'P': pipeline = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'r': keyspace = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'g': get_pct = (unsigned int) strtoul(optarg, NULL, 10); break;
+            case 'f': follower_port = atoi(optarg); break;
+            case 'F': follower_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-h host] [-p port | -s unix_socket] [-c clients] [-n requests] "
+                                "[-P pipeline] [-r keyspace] [-g get_percentage] [-f follower_port | -F follower_unix_socket]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(clients == 0 || pipeline == 0 || keyspace == 0) {
+        fprintf(stderr, "Clients, pipeline and keyspace must be greater than 0.\n");
+        return EXIT_FAILURE;
+    }
+
+    shtbench_client* workers;
+    if((workers = (shtbench_client*)calloc(clients, sizeof(shtbench_client))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'workers'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    shtbench_probe probe = {0};
+    bool probing = follower_port != 0 || follower_path != NULL;
+    if(probing)
+        pthread_create(&probe.thread, NULL, shtbench_lag, &probe);
+
+    double start = shtbench_time();
+    for(unsigned int c = 0; c < clients; c++) {
+        workers[c] = (shtbench_client){requests / clients, pipeline, keyspace, get_pct, 2463534242u + c * 7919u, 0, 0};
+        pthread_create(&workers[c].thread, NULL, shtbench_run, &workers[c]);
+    }
+
+    unsigned long errors = 0;
+    for(unsigned int c = 0; c < clients; c++) {
+        pthread_join(workers[c].thread, NULL);
+        errors += workers[c].errors;
+    }
+    double elapsed = shtbench_time() - start;
+
+    unsigned int total = requests / clients * clients;
+    printf("%u requests, %u clients, pipeline %u, %u%% GET: %.3f s, %.0f ops/s, %lu errors\n",
+           total, clients, pipeline, get_pct, elapsed, total / elapsed, errors);
+
+    if(probing) {
+        probe.stop = true;
+        pthread_join(probe.thread, NULL);
+
+        if(probe.count > 0) {
+            double sum = 0;
+
+            qsort(probe.lags, probe.count, sizeof(double), shtbench_compare);
+            for(unsigned int i = 0; i < probe.count; i++)
+                sum += probe.lags[i];
+            printf("Replication lag (%u probes): avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", probe.count,
+                   sum / probe.count * 1e3, probe.lags[probe.count / 2] * 1e3,
+                   probe.lags[(unsigned int)(probe.count * 0.99)] * 1e3, probe.lags[probe.count - 1] * 1e3);
+        }
+        free(probe.lags);
+    }
+
+    free(workers);
+
+    return EXIT_SUCCESS;
+}
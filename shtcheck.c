@@ -0,0 +1,383 @@
+#include "stringhashtable.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* Checks of the hash table that can be run unattended (make check):
+   binary keys, write-ahead log replay, shared-memory tables,
+   recovery from a checkpoint plus the log and from a persistent file
+   (also after a crash), snapshots and background saves. Every check
+   prints its name and the outcome; the program stops at the first
+   condition that does not hold, printing it, and exits with
+   EXIT_FAILURE. The files are created in the current directory and
+   removed at the end. */
+
+#define SHTCHECK_ENTRIES 10000
+
+/* Stop the run if 'condition' does not hold. */
+#define SHTCHECK(condition) do {                                                     \
+        if(!(condition)) {                                                           \
+            printf("FAILED\n[ERROR] %s:%d: %s\n", __FILE__, __LINE__, #condition);   \
+            exit(EXIT_FAILURE);                                                      \
+        }                                                                            \
+    } while(0)
+
+/* Write the key "k<i>" in 'key' and return its length. */
+unsigned int shtcheck_key(char* key, unsigned int i) {
+    return (unsigned int) sprintf(key, "k%u", i);
+}
+
+/* Fill 'htable' with the reference content used by the checks: the
+   keys k0, ..., k<SHTCHECK_ENTRIES - 1> are inserted with value i, then
+   the even ones are deleted and the ones multiple of 3 are incremented
+   by 7. */
+void shtcheck_fill(hashtable* htable) {
+    char key[16];
+
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++)
+        hashtable_insert_len(htable, key, shtcheck_key(key, i), i);
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i += 2)
+        hashtable_delete_len(htable, key, shtcheck_key(key, i));
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i += 3)
+        hashtable_increment_len(htable, key, shtcheck_key(key, i), 7);
+}
+
+/* Return true if the value of k<i> in the reference content is known
+   (the key exists), storing it in 'val'. */
+bool shtcheck_expected(unsigned int i, unsigned int* val) {
+    if(i % 2 == 0 && i % 3 != 0)
+        return false;
+
+    /* The increment of a deleted key inserts it again with the delta. */
+    *val = i % 2 == 0 ? 7 : (i % 3 == 0 ? i + 7 : i);
+    return true;
+}
+
+/* Check that 'htable' holds exactly the reference content. */
+void shtcheck_verify(hashtable* htable) {
+    unsigned int count = 0, val, expected;
+    char key[16];
+
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++) {
+        bool found = hashtable_lookup_len(htable, key, shtcheck_key(key, i), &val);
+        SHTCHECK(found == shtcheck_expected(i, &expected));
+        SHTCHECK(!found || val == expected);
+        count += found;
+    }
+    SHTCHECK(hashtable_count(htable) == count);
+}
+
+/* Return the size of the file 'path', -1 if it does not exist. */
+long shtcheck_filesize(const char* path) {
+    struct stat st;
+
+    return stat(path, &st) == 0 ? (long) st.st_size : -1;
+}
+
+/* Keys with embedded NULs, long keys and bytes >= 0x80, whose bucket
+   must be the one given by the original hash of hashtable_gethash. */
+void check_keys() {
+    char long_key[300];
+    unsigned int val, hash = 0;
+
+    printf("%-40s ", "Binary keys");
+    hashtable* htable = hashtable_newhashtable(64);
+    for(unsigned int i = 0; i < sizeof(long_key); i++)
+        long_key[i] = (char)('a' + i % 26);
+
+    SHTCHECK(hashtable_insert_len(htable, "ab\0cd", 5, 1) != NULL);
+    SHTCHECK(hashtable_insert_len(htable, "ab", 2, 2) != NULL);
+    SHTCHECK(hashtable_insert_len(htable, long_key, sizeof(long_key), 3) != NULL);
+    SHTCHECK(hashtable_lookup_len(htable, "ab\0cd", 5, &val) && val == 1);
+    SHTCHECK(hashtable_lookup_len(htable, "ab", 2, &val) && val == 2);
+    SHTCHECK(!hashtable_lookup_len(htable, "ab\0c", 4, &val));
+    SHTCHECK(hashtable_lookup_len(htable, long_key, sizeof(long_key), &val) && val == 3);
+    SHTCHECK(!hashtable_lookup_len(htable, long_key, sizeof(long_key) - 1, &val));
+    SHTCHECK(hashtable_delete_len(htable, "ab\0cd", 5) == 1);
+    SHTCHECK(hashtable_lookup_len(htable, "ab", 2, &val) && val == 2);
+    hashtable_free(htable);
+
+    for(const char* ch = "\xe9t\xe9\xff"; *ch != '\0'; ch++)
+        hash = ((int)(*ch) + (hash << 5) + hash) % 1021;
+    SHTCHECK(hashtable_gethash_len(1021, "\xe9t\xe9\xff", 4) == hash);
+    SHTCHECK(hashtable_gethash(1021, "\xe9t\xe9\xff") == hash);
+    printf("ok\n");
+}
+
+/* Replay of a write-ahead log, also when its last record has been cut
+   by a crash. */
+void check_wal() {
+    const char* path = "shtcheck.log";
+
+    printf("%-40s ", "Write-ahead log replay");
+    remove(path);
+    hashtable* htable = hashtable_newhashtable(1024);
+    hashtable_wal* wal = hashtable_wal_open(path, HASHTABLE_WAL_SYNC_NEVER, 0);
+    SHTCHECK(wal != NULL);
+    SHTCHECK(hashtable_setwal(htable, wal));
+    shtcheck_fill(htable);
+    SHTCHECK(hashtable_setwal(htable, NULL));
+    SHTCHECK(hashtable_wal_close(wal));
+    shtcheck_verify(htable);
+    hashtable_free(htable);
+
+    long records = SHTCHECK_ENTRIES + SHTCHECK_ENTRIES / 2 + (SHTCHECK_ENTRIES + 2) / 3;
+    htable = hashtable_newhashtable(1024);
+    SHTCHECK(hashtable_wal_replay(htable, path) == records);
+    shtcheck_verify(htable);
+    hashtable_free(htable);
+
+    /* A torn record at the end is dropped, and the log truncated. */
+    long size = shtcheck_filesize(path);
+    char record[64];
+    unsigned int record_len = hashtable_wal_encode(record, HASHTABLE_WAL_INSERT, "k0", 2, 1);
+    FILE* file = fopen(path, "ab");
+    SHTCHECK(file != NULL);
+    SHTCHECK(fwrite(record, 1, record_len - 1, file) == record_len - 1);
+    fclose(file);
+
+    htable = hashtable_newhashtable(1024);
+    SHTCHECK(hashtable_wal_replay(htable, path) == records);
+    shtcheck_verify(htable);
+    SHTCHECK(shtcheck_filesize(path) == size);
+    hashtable_free(htable);
+
+    remove(path);
+    printf("ok\n");
+}
+
+/* A shared-memory table written by a child process and read by its
+   parent. */
+void check_shm() {
+    char name[64], key[16];
+    unsigned int val;
+
+    printf("%-40s ", "Shared-memory table");
+    sprintf(name, "/shtcheck.%d", (int) getpid());
+    hashtable_shm_unlink(name);
+    hashtable_shm* shm = hashtable_shm_create(name, 1024, 4 * 1024 * 1024);
+    SHTCHECK(shm != NULL);
+    SHTCHECK(hashtable_shm_create(name, 1024, 4 * 1024 * 1024) == NULL);
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++)
+        SHTCHECK(hashtable_shm_insert_len(shm, key, shtcheck_key(key, i), i));
+
+    pid_t pid = fork();
+    SHTCHECK(pid >= 0);
+    if(pid == 0) {
+        hashtable_shm* child = hashtable_shm_attach(name);
+        bool passed = child != NULL;
+        for(unsigned int i = 0; passed && i < SHTCHECK_ENTRIES; i += 2) {
+            unsigned int key_len = shtcheck_key(key, i);
+            passed = hashtable_shm_lookup_len(child, key, key_len, &val) && val == i;
+            passed = passed && hashtable_shm_delete_len(child, key, key_len, &val) && val == i;
+        }
+        passed = passed && hashtable_shm_insert_len(child, "child", 5, 42);
+        if(child != NULL)
+            hashtable_shm_detach(child);
+        _exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status;
+    SHTCHECK(waitpid(pid, &status, 0) == pid);
+    SHTCHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    SHTCHECK(hashtable_shm_count(shm) == SHTCHECK_ENTRIES / 2 + 1);
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++) {
+        bool found = hashtable_shm_lookup_len(shm, key, shtcheck_key(key, i), &val);
+        SHTCHECK(found == (i % 2 == 1) && (!found || val == i));
+    }
+    SHTCHECK(hashtable_shm_lookup_len(shm, "child", 5, &val) && val == 42);
+
+    hashtable_shm_detach(shm);
+    SHTCHECK(hashtable_shm_unlink(name));
+    SHTCHECK(hashtable_shm_attach(name) == NULL);
+    printf("ok\n");
+}
+
+/* Recovery from a checkpoint followed by the writes logged after it. */
+void check_recover() {
+    const char* wal_path = "shtcheck.log";
+    const char* checkpoint_path = "shtcheck.ckpt";
+    char key[16];
+
+    printf("%-40s ", "Recovery from checkpoint and log");
+    remove(wal_path);
+    remove(checkpoint_path);
+    hashtable* htable = hashtable_newhashtable(1024);
+    SHTCHECK(hashtable_setsyncmode(htable, HASHTABLE_SYNC_MUTEX));
+    hashtable_wal* wal = hashtable_wal_open(wal_path, HASHTABLE_WAL_SYNC_NEVER, 0);
+    SHTCHECK(wal != NULL);
+    SHTCHECK(hashtable_setwal(htable, wal));
+
+    /* The first half of the keys goes in the checkpoint, which must
+       empty the log; the rest only in the log. */
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES / 2; i++)
+        hashtable_insert_len(htable, key, shtcheck_key(key, i), 0);
+    SHTCHECK(hashtable_checkpoint(htable, checkpoint_path));
+    SHTCHECK(shtcheck_filesize(wal_path) == 0);
+    shtcheck_fill(htable);
+    SHTCHECK(hashtable_setwal(htable, NULL));
+    SHTCHECK(hashtable_wal_close(wal));
+    hashtable_free(htable);
+
+    htable = hashtable_newhashtable(1024);
+    SHTCHECK(hashtable_recover(htable, checkpoint_path, wal_path) > 0);
+    shtcheck_verify(htable);
+    hashtable_free(htable);
+
+    remove(wal_path);
+    remove(checkpoint_path);
+    printf("ok\n");
+}
+
+/* A persistent table reopened after a clean close and after the crash
+   of the process that was writing it. */
+void check_persistent() {
+    const char* path = "shtcheck.tbl";
+    char key[16];
+    unsigned int val;
+
+    printf("%-40s ", "Persistent table recovery");
+    remove(path);
+
+    /* An existing table is needed to open a file with no size, and a
+       failed open does not leave a file behind. */
+    SHTCHECK(hashtable_shm_open_file(path, 0, 0, HASHTABLE_MSYNC_NEVER, 0) == NULL);
+    SHTCHECK(shtcheck_filesize(path) == -1);
+
+    hashtable_shm* table = hashtable_shm_open_file(path, 1024, 4 * 1024 * 1024, HASHTABLE_MSYNC_NEVER, 0);
+    SHTCHECK(table != NULL);
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++)
+        SHTCHECK(hashtable_shm_insert_len(table, key, shtcheck_key(key, i), i));
+
+    /* The file is locked by its owner, and not removed by the open
+       that fails. */
+    SHTCHECK(hashtable_shm_open_file(path, 1024, 4 * 1024 * 1024, HASHTABLE_MSYNC_NEVER, 0) == NULL);
+    SHTCHECK(shtcheck_filesize(path) > 0);
+    hashtable_shm_detach(table);
+
+    table = hashtable_shm_open_file(path, 0, 0, HASHTABLE_MSYNC_NEVER, 0);
+    SHTCHECK(table != NULL);
+    SHTCHECK(hashtable_shm_count(table) == SHTCHECK_ENTRIES);
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++)
+        SHTCHECK(hashtable_shm_lookup_len(table, key, shtcheck_key(key, i), &val) && val == i);
+    hashtable_shm_detach(table);
+
+    /* The child deletes the even keys and dies without closing. */
+    pid_t pid = fork();
+    SHTCHECK(pid >= 0);
+    if(pid == 0) {
+        hashtable_shm* child = hashtable_shm_open_file(path, 0, 0, HASHTABLE_MSYNC_ALWAYS, 0);
+        if(child == NULL)
+            _exit(EXIT_FAILURE);
+        for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i += 2)
+            hashtable_shm_delete_len(child, key, shtcheck_key(key, i), &val);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    SHTCHECK(waitpid(pid, &status, 0) == pid);
+    SHTCHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    table = hashtable_shm_open_file(path, 0, 0, HASHTABLE_MSYNC_NEVER, 0);
+    SHTCHECK(table != NULL);
+    SHTCHECK(hashtable_shm_count(table) == SHTCHECK_ENTRIES / 2);
+    for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++) {
+        bool found = hashtable_shm_lookup_len(table, key, shtcheck_key(key, i), &val);
+        SHTCHECK(found == (i % 2 == 1) && (!found || val == i));
+    }
+    hashtable_shm_detach(table);
+
+    remove(path);
+    printf("ok\n");
+}
+
+/* Count the entries of a view and check their values, which must be
+   the ones of the reference content. */
+void check_snapshot_visit(hashtable_entry* entry, void* ctx, unsigned int worker) {
+    unsigned int i, expected;
+    (void) worker;
+
+    SHTCHECK(entry->key_len > 1 && sscanf(entry->key, "k%u", &i) == 1);
+    SHTCHECK(shtcheck_expected(i, &expected) && entry->val == expected);
+    __atomic_add_fetch((unsigned int*) ctx, 1, __ATOMIC_RELAXED);
+}
+
+/* Snapshots, in every concurrent mode: a view keeps showing the table
+   as it was when it was opened, whatever is written afterwards, and a
+   background save writes the table as it was when it was started. */
+void check_snapshot() {
+    hashtable_syncmode modes[] = {HASHTABLE_SYNC_NONE, HASHTABLE_SYNC_MUTEX, HASHTABLE_SYNC_RWLOCK, HASHTABLE_SYNC_SEQLOCK};
+    const char* path = "shtcheck.snap";
+    char key[16];
+    unsigned int val, expected;
+
+    printf("%-40s ", "Snapshots and background saves");
+    for(unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        hashtable* htable = hashtable_newhashtable(64);
+        SHTCHECK(hashtable_setsyncmode(htable, modes[m]));
+        SHTCHECK(hashtable_setgrowth(htable, 2, HASHTABLE_RESIZE_COOPERATIVE));
+        shtcheck_fill(htable);
+        unsigned int count = hashtable_count(htable);
+
+        hashtable_view* view = hashtable_snapshot(htable);
+        SHTCHECK(view != NULL);
+
+        /* Change every key, and add enough of them to grow the table
+           (which is deferred while the view is open). */
+        for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++) {
+            unsigned int key_len = shtcheck_key(key, i);
+            if(i % 2 == 0)
+                hashtable_insert_len(htable, key, key_len, i + 1000000);
+            else
+                hashtable_delete_len(htable, key, key_len);
+        }
+        for(unsigned int i = SHTCHECK_ENTRIES; i < 4 * SHTCHECK_ENTRIES; i++)
+            hashtable_insert_len(htable, key, shtcheck_key(key, i), i);
+
+        for(unsigned int i = 0; i < 4 * SHTCHECK_ENTRIES; i++) {
+            bool found = hashtable_view_lookup_len(view, key, shtcheck_key(key, i), &val);
+            SHTCHECK(found == (i < SHTCHECK_ENTRIES && shtcheck_expected(i, &expected)));
+            SHTCHECK(!found || val == expected);
+        }
+        unsigned int visited = 0;
+        hashtable_view_foreach(view, check_snapshot_visit, &visited);
+        SHTCHECK(visited == count);
+        hashtable_view_release(view);
+
+        SHTCHECK(hashtable_count(htable) == SHTCHECK_ENTRIES / 2 + 3 * SHTCHECK_ENTRIES);
+        SHTCHECK(hashtable_lookup_len(htable, "k0", 2, &val) && val == 1000000);
+        SHTCHECK(!hashtable_lookup_len(htable, "k1", 2, &val));
+        hashtable_free(htable);
+
+        /* The background save sees none of the writes that follow it. */
+        remove(path);
+        htable = hashtable_newhashtable(1024);
+        SHTCHECK(hashtable_setsyncmode(htable, modes[m]));
+        shtcheck_fill(htable);
+        hashtable_bgsave_job* job = hashtable_bgsave(htable, path);
+        SHTCHECK(job != NULL);
+        for(unsigned int i = 0; i < SHTCHECK_ENTRIES; i++)
+            hashtable_insert_len(htable, key, shtcheck_key(key, i), 0);
+        SHTCHECK(hashtable_bgsave_wait(job) == HASHTABLE_BGSAVE_DONE);
+        hashtable_free(htable);
+
+        htable = hashtable_newhashtable(1024);
+        SHTCHECK(hashtable_wal_replay(htable, path) == count);
+        shtcheck_verify(htable);
+        hashtable_free(htable);
+    }
+
+    remove(path);
+    printf("ok\n");
+}
+
+int main() {
+    check_keys();
+    check_wal();
+    check_shm();
+    check_recover();
+    check_persistent();
+    check_snapshot();
+    printf("All the checks passed.\n");
+
+    return EXIT_SUCCESS;
+}
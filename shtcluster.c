@@ -0,0 +1,473 @@
+#include "stringhashtable.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Client-side partitioning of the keys among several shtserver
+   processes: every key belongs to one of the nodes of a consistent
+   hashing ring (see hashtable_hashring) built on their addresses,
+   "host:port" or the path of a Unix socket.
+       shtcluster -n <nodes> load <count>
+           inserts "key:0", ..., "key:<count - 1>" (with values 0, ...)
+           each one on its node;
+       shtcluster -n <nodes> check
+           reads all the keys of every node (SCAN) and counts the ones
+           that are not on the node that owns them;
+       shtcluster -n <nodes> -m <new nodes> rebalance
+           moves to their new owner only the keys whose node changes
+           going from the ring of <nodes> to the ring of <new nodes>
+           (es. with a node added or removed), copying them with SET
+           and then deleting them from the old node.
+   <nodes> is a comma separated list of addresses. The rebalance must
+   not run while clients write to the nodes. */
+
+/* Points of every node on the ring. */
+#define SHTCLUSTER_VNODES 160
+
+/* Requests sent to a node before reading their replies, and entries
+   asked to SCAN at a time. */
+#define SHTCLUSTER_BATCH 1000
+
+/* Structure that holds the connection to a node. */
+typedef struct shtcluster_node_t {
+    char* address;
+    int fd;
+    char* in;                       /* Bytes received and not yet parsed */
+    size_t in_start;
+    size_t in_end;
+    size_t in_size;
+    char* out;                      /* Requests not yet sent */
+    size_t out_len;
+    size_t out_size;
+    unsigned int pending;           /* Replies to read */
+} shtcluster_node;
+
+/* Structure that holds a set of nodes and their ring. */
+typedef struct shtcluster_t {
+    shtcluster_node* nodes;         /* Node 'i' is the node 'i' of the ring */
+    unsigned int count;
+    hashtable_hashring* ring;
+} shtcluster;
+
+/* Return the current time, in seconds. */
+static double shtcluster_time() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Connect to a node ("host:port" or the path of a Unix socket).
+   Return the socket, -1 on error. */
+static int shtcluster_connect(const char* address) {
+    const char* colon = strrchr(address, ':');
+    int fd;
+
+    if(colon == NULL) {
+        struct sockaddr_un addr = {0};
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+        if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return -1;
+    } else {
+        struct addrinfo hints = {0}, *result;
+        char host[256];
+        int one = 1;
+
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host, colon + 1, &hints, &result) != 0)
+            return -1;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool connected = fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) == 0;
+        freeaddrinfo(result);
+        if(!connected)
+            return -1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+}
+
+/* Connect to the comma separated list of nodes 'list' and build
+   their ring. */
+static void shtcluster_open(shtcluster* cluster, const char* list) {
+    char* addresses = strdup(list);
+    char* saveptr = NULL;
+
+    if(addresses == NULL) {
+        printf("[ERROR] There was an error while trying to call 'strdup' on 'addresses'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cluster->nodes = NULL;
+    cluster->count = 0;
+    cluster->ring = hashtable_hashring_new(SHTCLUSTER_VNODES);
+    for(char* address = strtok_r(addresses, ",", &saveptr); address != NULL; address = strtok_r(NULL, ",", &saveptr)) {
+        if(hashtable_hashring_add(cluster->ring, address) != (int) cluster->count) {
+            printf("[ERROR] The node '%s' is listed twice. Closing...\n", address);
+            exit(EXIT_FAILURE);
+        }
+
+        if((cluster->nodes = (shtcluster_node*)realloc(cluster->nodes, sizeof(shtcluster_node) * (cluster->count + 1))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'cluster->nodes'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        shtcluster_node* node = &cluster->nodes[cluster->count++];
+        memset(node, 0, sizeof(shtcluster_node));
+        if((node->address = strdup(address)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'strdup' on 'node->address'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        if((node->fd = shtcluster_connect(address)) < 0) {
+            printf("[ERROR] There was an error while trying to connect to '%s'. Closing...\n", address);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(addresses);
+
+    if(cluster->count == 0) {
+        printf("[ERROR] No node given. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Close the connections of a set of nodes and release it. */
+static void shtcluster_close(shtcluster* cluster) {
+    for(unsigned int i = 0; i < cluster->count; i++) {
+        close(cluster->nodes[i].fd);
+        free(cluster->nodes[i].address);
+        free(cluster->nodes[i].in);
+        free(cluster->nodes[i].out);
+    }
+    free(cluster->nodes);
+    hashtable_hashring_free(cluster->ring);
+}
+
+/* Append to the requests of a node a command of 'argc' arguments. */
+static void shtcluster_command(shtcluster_node* node, unsigned int argc, const char** argv, const unsigned int* lens) {
+    size_t needed = 16;
+
+    for(unsigned int i = 0; i < argc; i++)
+        needed += lens[i] + 16;
+    if(node->out_len + needed > node->out_size) {
+        while(node->out_len + needed > node->out_size)
+            node->out_size = node->out_size == 0 ? 64 * 1024 : node->out_size * 2;
+        if((node->out = (char*)realloc(node->out, node->out_size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'node->out'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    node->out_len += sprintf(node->out + node->out_len, "*%u\r\n", argc);
+    for(unsigned int i = 0; i < argc; i++) {
+        node->out_len += sprintf(node->out + node->out_len, "$%u\r\n", lens[i]);
+        memcpy(node->out + node->out_len, argv[i], lens[i]);
+        node->out_len += lens[i];
+        node->out[node->out_len++] = '\r';
+        node->out[node->out_len++] = '\n';
+    }
+    node->pending++;
+}
+
+/* Send all the requests of a node. */
+static void shtcluster_send(shtcluster_node* node) {
+    for(size_t written = 0; written < node->out_len; ) {
+        ssize_t result = write(node->fd, node->out + written, node->out_len - written);
+        if(result < 0 && errno != EINTR) {
+            printf("[ERROR] There was an error while trying to send the requests to '%s'. Closing...\n", node->address);
+            exit(EXIT_FAILURE);
+        }
+        written += result > 0 ? result : 0;
+    }
+    node->out_len = 0;
+}
+
+/* Read from a node until at least 'len' bytes are buffered. */
+static void shtcluster_fill(shtcluster_node* node, size_t len) {
+    while(node->in_end - node->in_start < len) {
+        if(node->in_start > 0) {
+            memmove(node->in, node->in + node->in_start, node->in_end - node->in_start);
+            node->in_end -= node->in_start;
+            node->in_start = 0;
+        }
+        if(node->in_size - node->in_end < 64 * 1024 || node->in_size < len) {
+            node->in_size = node->in_size == 0 ? 256 * 1024 : node->in_size * 2;
+            if((node->in = (char*)realloc(node->in, node->in_size)) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'realloc' on 'node->in'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        ssize_t result = read(node->fd, node->in + node->in_end, node->in_size - node->in_end);
+        if(result <= 0) {
+            if(result < 0 && errno == EINTR)
+                continue;
+            printf("[ERROR] The node '%s' closed the connection. Closing...\n", node->address);
+            exit(EXIT_FAILURE);
+        }
+        node->in_end += result;
+    }
+}
+
+/* Read a line of a reply of a node and return it, without "\r\n"
+   (valid until the next read). */
+static const char* shtcluster_readline(shtcluster_node* node) {
+    char* newline;
+
+    shtcluster_fill(node, 1);
+    while((newline = memchr(node->in + node->in_start, '\n', node->in_end - node->in_start)) == NULL)
+        shtcluster_fill(node, node->in_end - node->in_start + 1);
+
+    const char* line = node->in + node->in_start;
+    newline[newline > line && newline[-1] == '\r' ? -1 : 0] = '\0';
+    node->in_start = newline + 1 - node->in;
+
+    return line;
+}
+
+/* Read a bulk string reply of a node into a copy ("$<n>\r\n<data>\r\n",
+   NULL if null), storing its length in 'len'. */
+static char* shtcluster_readbulk(shtcluster_node* node, unsigned int* len) {
+    const char* line = shtcluster_readline(node);
+
+    if(line[0] != '$') {
+        printf("[ERROR] Unexpected reply '%s' from '%s'. Closing...\n", line, node->address);
+        exit(EXIT_FAILURE);
+    }
+    if(line[1] == '-')
+        return NULL;
+
+    *len = (unsigned int) strtoul(line + 1, NULL, 10);
+    shtcluster_fill(node, (size_t) *len + 2);
+
+    char* data;
+    if((data = (char*)malloc(*len + 1)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'data'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(data, node->in + node->in_start, *len);
+    data[*len] = '\0';
+    node->in_start += *len + 2;
+
+    return data;
+}
+
+/* Send the requests of a node and read all their replies (single
+   lines, as the ones of SET and DEL), stopping on an error. */
+static void shtcluster_flush(shtcluster_node* node) {
+    shtcluster_send(node);
+    for(; node->pending > 0; node->pending--) {
+        const char* line = shtcluster_readline(node);
+        if(line[0] == '-') {
+            printf("[ERROR] The node '%s' replied '%s'. Closing...\n", node->address, line);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Read the next entries of a node starting at 'cursor', storing up to
+   SHTCLUSTER_BATCH of them in 'keys', 'lens' and 'vals' (the keys must
+   be released by the caller). Return the next cursor (0 at the end). */
+static unsigned long shtcluster_scan(shtcluster_node* node, unsigned long cursor, char** keys, unsigned int* lens, unsigned int* vals, unsigned int* count) {
+    char cursor_digits[24], count_digits[16];
+    const char* argv[] = {"SCAN", cursor_digits, "COUNT", count_digits};
+    unsigned int argv_lens[] = {4, (unsigned int) sprintf(cursor_digits, "%lu", cursor), 5,
+                                (unsigned int) sprintf(count_digits, "%u", SHTCLUSTER_BATCH)};
+
+    shtcluster_command(node, 4, argv, argv_lens);
+    shtcluster_send(node);
+    node->pending--;
+
+    unsigned int len;
+    const char* line = shtcluster_readline(node);
+    if(strcmp(line, "*2") != 0) {
+        printf("[ERROR] Unexpected reply '%s' to SCAN from '%s'. Closing...\n", line, node->address);
+        exit(EXIT_FAILURE);
+    }
+    char* next = shtcluster_readbulk(node, &len);
+    cursor = strtoul(next, NULL, 10);
+    free(next);
+
+    /* A bucket is returned whole, so there can be a few more entries
+       than the ones asked. */
+    unsigned int items = (unsigned int) strtoul(shtcluster_readline(node) + 1, NULL, 10) / 2;
+    *count = 0;
+    for(unsigned int i = 0; i < items; i++) {
+        char* key = shtcluster_readbulk(node, &len);
+        unsigned int key_len = len;
+        char* val = shtcluster_readbulk(node, &len);
+
+        if(*count < SHTCLUSTER_BATCH * 2) {
+            keys[*count] = key;
+            lens[*count] = key_len;
+            vals[*count] = (unsigned int) strtoul(val, NULL, 10);
+            (*count)++;
+        } else {
+            printf("[ERROR] Too many entries in a bucket of '%s'. Closing...\n", node->address);
+            exit(EXIT_FAILURE);
+        }
+        free(val);
+    }
+
+    return cursor;
+}
+
+/* Insert "key:0", ..., "key:<count - 1>" each one on its node. */
+static void shtcluster_load(shtcluster* cluster, unsigned int count) {
+    double start = shtcluster_time();
+    char key[32], val[16];
+
+    for(unsigned int i = 0; i < count; i++) {
+        unsigned int key_len = (unsigned int) sprintf(key, "key:%u", i);
+        const char* argv[] = {"SET", key, val};
+        unsigned int lens[] = {3, key_len, (unsigned int) sprintf(val, "%u", i)};
+        shtcluster_node* node = &cluster->nodes[hashtable_hashring_lookup(cluster->ring, key, key_len)];
+
+        shtcluster_command(node, 3, argv, lens);
+        if(node->pending == SHTCLUSTER_BATCH)
+            shtcluster_flush(node);
+    }
+    for(unsigned int n = 0; n < cluster->count; n++)
+        shtcluster_flush(&cluster->nodes[n]);
+
+    printf("Loaded %u keys on %u nodes in %.3f s\n", count, cluster->count, shtcluster_time() - start);
+}
+
+/* Read all the keys of every node and count the ones that are not on
+   the node that owns them. Return true if there are none. */
+static bool shtcluster_check(shtcluster* cluster) {
+    char* keys[SHTCLUSTER_BATCH * 2];
+    unsigned int lens[SHTCLUSTER_BATCH * 2], vals[SHTCLUSTER_BATCH * 2];
+    unsigned long total = 0, misplaced = 0;
+
+    for(unsigned int n = 0; n < cluster->count; n++) {
+        shtcluster_node* node = &cluster->nodes[n];
+        unsigned long cursor = 0, found = 0;
+        unsigned int count;
+
+        do {
+            cursor = shtcluster_scan(node, cursor, keys, lens, vals, &count);
+            for(unsigned int i = 0; i < count; i++) {
+                if(hashtable_hashring_lookup(cluster->ring, keys[i], lens[i]) != (int) n)
+                    misplaced++;
+                free(keys[i]);
+            }
+            found += count;
+        } while(cursor != 0);
+
+        printf("%-24s %10lu keys\n", node->address, found);
+        total += found;
+    }
+    printf("%lu keys, %lu not on their node\n", total, misplaced);
+
+    return misplaced == 0;
+}
+
+/* Move to their node in 'to' the keys of 'from' whose node changes.
+   Every node of 'from' is scanned: the keys to move are copied on
+   their new node, and only then deleted from the old one. */
+static void shtcluster_rebalance(shtcluster* from, shtcluster* to) {
+    char* keys[SHTCLUSTER_BATCH * 2];
+    unsigned int lens[SHTCLUSTER_BATCH * 2], vals[SHTCLUSTER_BATCH * 2];
+    const char* deleted[SHTCLUSTER_BATCH * 2 + 1];
+    unsigned int deleted_lens[SHTCLUSTER_BATCH * 2 + 1];
+    unsigned long total = 0, moved = 0;
+    double start = shtcluster_time();
+
+    for(unsigned int n = 0; n < from->count; n++) {
+        shtcluster_node* node = &from->nodes[n];
+        unsigned long cursor = 0;
+        unsigned int count;
+
+        do {
+            unsigned int deletes = 0;
+
+            cursor = shtcluster_scan(node, cursor, keys, lens, vals, &count);
+            for(unsigned int i = 0; i < count; i++) {
+                /* The keys moved here from a node scanned before are
+                   counted only there. */
+                if(hashtable_hashring_lookup(from->ring, keys[i], lens[i]) == (int) n)
+                    total++;
+
+                int owner = hashtable_hashring_lookup(to->ring, keys[i], lens[i]);
+                if(strcmp(hashtable_hashring_node(to->ring, owner), node->address) == 0)
+                    continue;
+
+                char val[16];
+                const char* argv[] = {"SET", keys[i], val};
+                unsigned int argv_lens[] = {3, lens[i], (unsigned int) sprintf(val, "%u", vals[i])};
+                shtcluster_command(&to->nodes[owner], 3, argv, argv_lens);
+
+                deleted[1 + deletes] = keys[i];
+                deleted_lens[1 + deletes] = lens[i];
+                deletes++;
+            }
+
+            for(unsigned int t = 0; t < to->count; t++)
+                shtcluster_flush(&to->nodes[t]);
+            if(deletes > 0) {
+                deleted[0] = "DEL";
+                deleted_lens[0] = 3;
+                shtcluster_command(node, deletes + 1, deleted, deleted_lens);
+                shtcluster_flush(node);
+            }
+
+            for(unsigned int i = 0; i < count; i++)
+                free(keys[i]);
+            moved += deletes;
+        } while(cursor != 0);
+    }
+
+    printf("Moved %lu of %lu keys (%.2f%%) in %.3f s\n", moved, total, total > 0 ? 100.0 * moved / total : 0, shtcluster_time() - start);
+}
+
+int main(int argc, char** argv) {
+    const char* nodes = NULL;
+    const char* new_nodes = NULL;
+    int option;
+
+    while((option = getopt(argc, argv, "n:m:")) != -1) {
+        switch(option) {
+            case 'n': nodes = optarg; break;
+            case 'm': new_nodes = optarg; break;
+            default: nodes = NULL; optind = argc + 1; break;
+        }
+    }
+
+    const char* command = optind < argc ? argv[optind] : "";
+    bool valid = nodes != NULL && ((strcmp(command, "load") == 0 && optind + 2 == argc) ||
+                                   (strcmp(command, "check") == 0 && optind + 1 == argc) ||
+                                   (strcmp(command, "rebalance") == 0 && optind + 1 == argc && new_nodes != NULL));
+    if(!valid) {
+        fprintf(stderr, "Usage: %s -n node,... load <count>\n"
+                        "       %s -n node,... check\n"
+                        "       %s -n node,... -m new_node,... rebalance\n"
+                        "A node is \"host:port\" or the path of a Unix socket.\n", argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    shtcluster cluster;
+    shtcluster_open(&cluster, nodes);
+
+    bool success = true;
+    if(strcmp(command, "load") == 0) {
+        shtcluster_load(&cluster, (unsigned int) strtoul(argv[optind + 1], NULL, 10));
+    } else if(strcmp(command, "check") == 0) {
+        success = shtcluster_check(&cluster);
+    } else {
+        shtcluster target;
+        shtcluster_open(&target, new_nodes);
+        shtcluster_rebalance(&cluster, &target);
+        shtcluster_close(&target);
+    }
+    shtcluster_close(&cluster);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
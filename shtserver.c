@@ -0,0 +1,813 @@
+#include "stringhashtable.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+/* Key-value server sharing a single hash table among many processes.
+   It speaks a subset of the Redis protocol (RESP): the requests are
+   arrays of bulk strings, es. "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n", and
+   the supported commands are GET, SET, DEL, INCR, MGET, PING, INFO
+   and SCAN.
+   The values of the table are unsigned integers, so SET accepts only
+   a decimal value in their range.
+   A single thread serves all the clients with a non-blocking epoll
+   loop: every readable connection is drained into its input buffer,
+   all the complete requests found there (pipelining) are parsed in
+   place, without copying the arguments, and their replies are
+   appended to the output buffer, which is written when the socket
+   is writable.
+   Replication: a follower (started with -R) connects to its leader
+   and sends SYNC; the leader replies "+FULLSYNC <offset> <bytes>\r\n"
+   followed by <bytes> of write-ahead log records (a CLEAR and an
+   INSERT for every key), then streams on the same connection a record
+   for every write it executes (INCR as the INSERT of its result). The
+   offset counts the bytes of the stream, so a follower that has
+   applied up to offset 'o' has all the writes of the leader before
+   'o'; it sends it back with "REPLACK <o>" every 100 ms, and INFO
+   reports the lag of every follower. Followers serve reads from their
+   own table and reject writes. */
+
+/* Initial size of the input and output buffers of a connection. */
+#define SHTSERVER_BUFFER_SIZE (16*1024)
+
+/* Maximum size of a request (and of a single bulk string). */
+#define SHTSERVER_MAX_REQUEST (64*1024*1024)
+
+/* Maximum number of events handled by a call to epoll_wait. */
+#define SHTSERVER_MAX_EVENTS 256
+
+/* Output a follower can leave unsent before being dropped. */
+#define SHTSERVER_MAX_REPLICA_BUFFER (256*1024*1024)
+
+/* Interval between the acknowledgements of a follower, in ms. */
+#define SHTSERVER_ACK_INTERVAL 100
+
+/* Structure that holds a growable buffer. */
+typedef struct shtserver_buffer_t {
+    char* data;
+    size_t start;                   /* First byte not yet consumed */
+    size_t end;                     /* First free byte */
+    size_t size;                    /* Allocated bytes */
+} shtserver_buffer;
+
+/* Structure that holds an argument of a request, pointing inside the
+   input buffer of its connection. */
+typedef struct shtserver_arg_t {
+    const char* data;
+    unsigned int len;
+} shtserver_arg;
+
+/* Structure that holds a client connection. */
+typedef struct shtserver_conn_t {
+    int fd;
+    shtserver_buffer in;            /* Bytes received and not yet parsed */
+    shtserver_buffer out;           /* Replies not yet sent */
+    shtserver_arg* args;            /* Arguments of the request being executed */
+    unsigned int args_size;         /* Allocated arguments */
+    bool writing;                   /* True if the connection is waiting for EPOLLOUT */
+    bool closing;                   /* True if the connection must be closed once 'out' is sent */
+    bool replica;                   /* True if the connection is a follower receiving the stream */
+    bool upstream;                  /* True if the connection is the one of a follower to its leader */
+    bool synced;                    /* True once the full sync has been received ('upstream' only) */
+    unsigned long sync_left;        /* Bytes of the full sync still to apply ('upstream' only) */
+    unsigned long ack;              /* Last offset acknowledged ('replica' only) */
+} shtserver_conn;
+
+static hashtable* htable;
+static int epoll_fd;
+
+static bool follower;               /* True if the server is a follower (it rejects writes) */
+static shtserver_conn* leader;      /* Connection to the leader, NULL if lost or not a follower */
+static unsigned long repl_offset;   /* Bytes of the stream produced (leader) or applied (follower) */
+static shtserver_buffer stream;     /* Records not yet appended to the followers */
+static shtserver_conn** replicas;   /* Connected followers */
+static unsigned int replicas_count, replicas_size;
+
+/* Make room for at least 'needed' more bytes at the end of a buffer,
+   moving the unconsumed bytes at its beginning first. */
+static void shtserver_reserve(shtserver_buffer* buffer, size_t needed) {
+    if(buffer->start > 0 && buffer->size - buffer->end < needed) {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+    }
+
+    if(buffer->size - buffer->end >= needed)
+        return;
+
+    while(buffer->size - buffer->end < needed)
+        buffer->size = buffer->size == 0 ? SHTSERVER_BUFFER_SIZE : buffer->size * 2;
+
+    if((buffer->data = (char*)realloc(buffer->data, buffer->size)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'realloc' on 'buffer->data'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Append 'len' bytes to a buffer. */
+static void shtserver_append(shtserver_buffer* buffer, const char* data, size_t len) {
+    shtserver_reserve(buffer, len);
+    memcpy(buffer->data + buffer->end, data, len);
+    buffer->end += len;
+}
+
+/* Append an integer reply (":<n>\r\n"). */
+static void shtserver_reply_int(shtserver_conn* conn, unsigned long n) {
+    char reply[32];
+
+    shtserver_append(&conn->out, reply, sprintf(reply, ":%lu\r\n", n));
+}
+
+/* Append the value of a key as a bulk string reply, or a null reply
+   if the key was not found. */
+static void shtserver_reply_val(shtserver_conn* conn, bool found, unsigned int val) {
+    char reply[32];
+
+    if(!found) {
+        shtserver_append(&conn->out, "$-1\r\n", 5);
+        return;
+    }
+
+    char digits[16];
+    int len = sprintf(digits, "%u", val);
+    shtserver_append(&conn->out, reply, sprintf(reply, "$%d\r\n%s\r\n", len, digits));
+}
+
+/* Append an error reply. */
+static void shtserver_reply_error(shtserver_conn* conn, const char* message) {
+    shtserver_append(&conn->out, "-ERR ", 5);
+    shtserver_append(&conn->out, message, strlen(message));
+    shtserver_append(&conn->out, "\r\n", 2);
+}
+
+/* Parse an unsigned integer of 'len' decimal digits. Return false if
+   it is not valid or it does not fit in 'max'. */
+static bool shtserver_parseuint(const char* data, unsigned int len, unsigned long max, unsigned long* n) {
+    if(len == 0 || len > 20)
+        return false;
+
+    *n = 0;
+    for(unsigned int i = 0; i < len; i++) {
+        if(data[i] < '0' || data[i] > '9')
+            return false;
+        if(*n > (max - (data[i] - '0')) / 10)
+            return false;
+        *n = *n * 10 + (data[i] - '0');
+    }
+
+    return true;
+}
+
+/* Return true if an argument is equal (ignoring case) to 'name'. */
+static bool shtserver_iscommand(shtserver_arg* arg, const char* name) {
+    return arg->len == strlen(name) && strncasecmp(arg->data, name, arg->len) == 0;
+}
+
+/* Return the current time, in milliseconds. */
+static unsigned long shtserver_time() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+/* Add the record of a write to the stream of the followers. */
+static void shtserver_propagate(hashtable_walop op, const char* key, unsigned int key_len, unsigned int val) {
+    if(replicas_count == 0)
+        return;
+
+    shtserver_reserve(&stream, (size_t) key_len + HASHTABLE_WAL_OVERHEAD);
+    unsigned int len = hashtable_wal_encode(stream.data + stream.end, op, key, key_len, val);
+    stream.end += len;
+    repl_offset += len;
+}
+
+/* Append the records of the stream not sent yet to the output buffer
+   of all the followers (they are written by shtserver_replicate). */
+static void shtserver_publish() {
+    for(unsigned int i = 0; i < replicas_count; i++)
+        shtserver_append(&replicas[i]->out, stream.data + stream.start, stream.end - stream.start);
+    stream.start = stream.end = 0;
+}
+
+/* Append a record of the full sync of a follower (used by
+   hashtable_parallel_foreach). */
+static void shtserver_syncentry(hashtable_entry* entry, void* ctx, unsigned int worker) {
+    shtserver_buffer* out = (shtserver_buffer*) ctx;
+    (void) worker;
+
+    shtserver_reserve(out, (size_t) entry->key_len + HASHTABLE_WAL_OVERHEAD);
+    out->end += hashtable_wal_encode_entry(out->data + out->end, entry);
+}
+
+/* Turn a connection into a follower: send it the full content of the
+   table, then the stream from the current offset. */
+static void shtserver_sync(shtserver_conn* conn) {
+    shtserver_buffer dump = {0};
+    char header[64];
+
+    /* The records not published yet precede the offset of the sync. */
+    shtserver_publish();
+
+    shtserver_reserve(&dump, HASHTABLE_WAL_OVERHEAD);
+    dump.end += hashtable_wal_encode(dump.data, HASHTABLE_WAL_CLEAR, "", 0, 0);
+    hashtable_parallel_foreach(htable, shtserver_syncentry, &dump, 1);
+
+    shtserver_append(&conn->out, header, sprintf(header, "+FULLSYNC %lu %zu\r\n", repl_offset, dump.end));
+    shtserver_append(&conn->out, dump.data, dump.end);
+    free(dump.data);
+
+    if(replicas_count == replicas_size) {
+        replicas_size = replicas_size == 0 ? 4 : replicas_size * 2;
+        if((replicas = (shtserver_conn**)realloc(replicas, sizeof(shtserver_conn*) * replicas_size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'replicas'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    replicas[replicas_count++] = conn;
+    conn->replica = true;
+    conn->ack = repl_offset;
+}
+
+/* Append the INFO reply: role, offset and, on a leader, the offset
+   acknowledged by every follower and its lag in bytes. */
+static void shtserver_info(shtserver_conn* conn) {
+    shtserver_buffer info = {0};
+    char line[128];
+
+    if(follower) {
+        shtserver_append(&info, line, sprintf(line, "role:follower\r\nrepl_offset:%lu\r\nlink:%s\r\n",
+                                              repl_offset, leader != NULL && leader->synced ? "up" : "down"));
+    } else {
+        shtserver_append(&info, line, sprintf(line, "role:leader\r\nrepl_offset:%lu\r\nfollowers:%u\r\n", repl_offset, replicas_count));
+        for(unsigned int i = 0; i < replicas_count; i++)
+            shtserver_append(&info, line, sprintf(line, "follower%u:ack=%lu,lag=%lu\r\n", i, replicas[i]->ack, repl_offset - replicas[i]->ack));
+    }
+
+    shtserver_append(&conn->out, line, sprintf(line, "$%zu\r\n", info.end));
+    shtserver_append(&conn->out, info.data, info.end);
+    shtserver_append(&conn->out, "\r\n", 2);
+    free(info.data);
+}
+
+/* Append the reply of "SCAN <cursor> [COUNT <n>]": the entries of the
+   buckets from 'cursor' on, until at least 'n' (default 100) have
+   been collected, as "*2" followed by the next cursor (0 at the end)
+   and an array of keys and values. The cursor is the index of a
+   bucket, and the table only grows by doubling: a key in the bucket
+   'b' then moves to 'b' or 'b' + the old size, so the keys present
+   during the whole iteration are always returned (some more than
+   once, if the table grows). */
+static void shtserver_scan(shtserver_conn* conn, unsigned int argc) {
+    shtserver_arg* args = conn->args;
+    unsigned long cursor, count = 100;
+    shtserver_buffer body = {0};
+    unsigned int entries = 0;
+    char reply[64];
+
+    if(!shtserver_parseuint(args[1].data, args[1].len, 0xFFFFFFFFUL, &cursor) ||
+       (argc == 4 && (!shtserver_parseuint(args[3].data, args[3].len, 0xFFFFFFFFUL, &count) || count == 0))) {
+        shtserver_reply_error(conn, "invalid cursor or count");
+        return;
+    }
+
+    hashtable_buckets* buckets = htable->buckets;
+    while(cursor < buckets->size && entries < count) {
+        for(hashtable_entry* entry = buckets->table[cursor]; entry != NULL; entry = entry->next) {
+            shtserver_append(&body, reply, sprintf(reply, "$%u\r\n", entry->key_len));
+            shtserver_append(&body, entry->key, entry->key_len);
+            char digits[16];
+            int digits_len = sprintf(digits, "%u", entry->val);
+            shtserver_append(&body, reply, sprintf(reply, "\r\n$%d\r\n%s\r\n", digits_len, digits));
+            entries++;
+        }
+        cursor++;
+    }
+    if(cursor >= buckets->size)
+        cursor = 0;
+
+    char digits[24];
+    int len = sprintf(digits, "%lu", cursor);
+    shtserver_append(&conn->out, reply, sprintf(reply, "*2\r\n$%d\r\n%s\r\n*%u\r\n", len, digits, entries * 2));
+    shtserver_append(&conn->out, body.data, body.end);
+    free(body.data);
+}
+
+/* Execute a request of 'argc' arguments, appending its reply. */
+static void shtserver_execute(shtserver_conn* conn, unsigned int argc) {
+    shtserver_arg* args = conn->args;
+    unsigned int val;
+    unsigned long n;
+
+    /* A follower only acknowledges the stream: nothing can be replied
+       in the middle of it. */
+    if(conn->replica) {
+        if(shtserver_iscommand(&args[0], "REPLACK") && argc == 2 && shtserver_parseuint(args[1].data, args[1].len, repl_offset, &n))
+            conn->ack = n;
+        return;
+    }
+
+    if(follower && argc >= 2 && (shtserver_iscommand(&args[0], "SET") || shtserver_iscommand(&args[0], "DEL") || shtserver_iscommand(&args[0], "INCR"))) {
+        shtserver_reply_error(conn, "write commands are not allowed on a follower");
+        return;
+    }
+
+    if(shtserver_iscommand(&args[0], "GET") && argc == 2) {
+        bool found = hashtable_lookup_len(htable, args[1].data, args[1].len, &val);
+        shtserver_reply_val(conn, found, val);
+    } else if(shtserver_iscommand(&args[0], "SET") && argc == 3) {
+        if(!shtserver_parseuint(args[2].data, args[2].len, 0xFFFFFFFFUL, &n)) {
+            shtserver_reply_error(conn, "value is not an integer or out of range");
+            return;
+        }
+        hashtable_insert_len(htable, args[1].data, args[1].len, (unsigned int) n);
+        shtserver_propagate(HASHTABLE_WAL_INSERT, args[1].data, args[1].len, (unsigned int) n);
+        shtserver_append(&conn->out, "+OK\r\n", 5);
+    } else if(shtserver_iscommand(&args[0], "DEL") && argc >= 2) {
+        unsigned long deleted = 0;
+
+        for(unsigned int i = 1; i < argc; i++) {
+            if(hashtable_lookup_len(htable, args[i].data, args[i].len, &val)) {
+                hashtable_delete_len(htable, args[i].data, args[i].len);
+                shtserver_propagate(HASHTABLE_WAL_DELETE, args[i].data, args[i].len, 0);
+                deleted++;
+            }
+        }
+        shtserver_reply_int(conn, deleted);
+    } else if(shtserver_iscommand(&args[0], "INCR") && argc == 2) {
+        val = hashtable_increment_len(htable, args[1].data, args[1].len, 1);
+        shtserver_propagate(HASHTABLE_WAL_INSERT, args[1].data, args[1].len, val);
+        shtserver_reply_int(conn, val);
+    } else if(shtserver_iscommand(&args[0], "MGET") && argc >= 2) {
+        char reply[32];
+
+        shtserver_append(&conn->out, reply, sprintf(reply, "*%u\r\n", argc - 1));
+        for(unsigned int i = 1; i < argc; i++) {
+            bool found = hashtable_lookup_len(htable, args[i].data, args[i].len, &val);
+            shtserver_reply_val(conn, found, val);
+        }
+    } else if(shtserver_iscommand(&args[0], "PING") && argc == 1) {
+        shtserver_append(&conn->out, "+PONG\r\n", 7);
+    } else if(shtserver_iscommand(&args[0], "SCAN") && (argc == 2 || (argc == 4 && shtserver_iscommand(&args[2], "COUNT")))) {
+        shtserver_scan(conn, argc);
+    } else if(shtserver_iscommand(&args[0], "INFO") && argc == 1) {
+        shtserver_info(conn);
+    } else if(shtserver_iscommand(&args[0], "SYNC") && argc == 1 && !follower) {
+        shtserver_sync(conn);
+    } else {
+        shtserver_reply_error(conn, "unknown command or wrong number of arguments");
+    }
+}
+
+/* Parse a line "<prefix><n>\r\n" starting at 'pos', storing 'n' and
+   moving 'pos' after the line. Return 1 on success, 0 if the line is
+   not complete yet, -1 if it is not valid. */
+static int shtserver_parseline(const char* data, size_t end, size_t* pos, char prefix, unsigned long* n) {
+    const char* line = data + *pos;
+    const char* newline = memchr(line, '\r', end - *pos);
+
+    if(newline == NULL || newline + 1 >= data + end)
+        return (end - *pos > 32) ? -1 : 0;
+    if(line[0] != prefix || newline[1] != '\n')
+        return -1;
+    if(!shtserver_parseuint(line + 1, newline - line - 1, SHTSERVER_MAX_REQUEST, n))
+        return -1;
+
+    *pos = newline + 2 - data;
+    return 1;
+}
+
+/* Apply the stream received from the leader: first the line that
+   announces the full sync, then the records. Return false if the
+   stream is not valid. */
+static bool shtserver_follow(shtserver_conn* conn) {
+    shtserver_buffer* in = &conn->in;
+
+    if(!conn->synced) {
+        const char* line = in->data + in->start;
+        const char* newline = memchr(line, '\n', in->end - in->start);
+        unsigned long offset, bytes;
+
+        if(newline == NULL)
+            return in->end - in->start < 64;
+
+        /* The buffer is not NUL-terminated: parse only the bytes of the
+           line, es. "+FULLSYNC 1234 5678\r\n". */
+        const char* fields = line + strlen("+FULLSYNC ");
+        const char* space;
+        if(newline - line < (long) strlen("+FULLSYNC 0 0\r") || newline[-1] != '\r' ||
+           memcmp(line, "+FULLSYNC ", strlen("+FULLSYNC ")) != 0)
+            return false;
+        space = memchr(fields, ' ', newline - fields);
+        if(space == NULL ||
+           !shtserver_parseuint(fields, space - fields, ULONG_MAX, &offset) ||
+           !shtserver_parseuint(space + 1, newline - 1 - (space + 1), ULONG_MAX, &bytes))
+            return false;
+
+        in->start = newline + 1 - in->data;
+        repl_offset = offset;
+        conn->sync_left = bytes;
+        conn->synced = true;
+    }
+
+    size_t consumed;
+    bool corrupted;
+    hashtable_wal_apply(htable, in->data + in->start, in->end - in->start, &consumed, &corrupted);
+    if(corrupted)
+        return false;
+
+    /* The records of the full sync do not move the offset. */
+    size_t sync_bytes = consumed < conn->sync_left ? consumed : conn->sync_left;
+    if(conn->sync_left > 0 && sync_bytes == conn->sync_left) {
+        printf("Full sync from the leader completed at offset %lu\n", repl_offset);
+        fflush(stdout);
+    }
+    conn->sync_left -= sync_bytes;
+    repl_offset += consumed - sync_bytes;
+
+    in->start += consumed;
+    if(in->start == in->end)
+        in->start = in->end = 0;
+
+    return true;
+}
+
+/* Parse and execute all the complete requests in the input buffer of
+   a connection. Return false on a protocol error. */
+static bool shtserver_process(shtserver_conn* conn) {
+    shtserver_buffer* in = &conn->in;
+
+    if(conn->upstream)
+        return shtserver_follow(conn);
+
+    while(in->start < in->end) {
+        size_t pos = in->start;
+        unsigned long argc, len;
+        int result;
+
+        if((result = shtserver_parseline(in->data, in->end, &pos, '*', &argc)) <= 0)
+            return result == 0;
+        if(argc == 0 || argc > SHTSERVER_MAX_REQUEST / 4)
+            return false;
+
+        if(argc > conn->args_size) {
+            conn->args_size = argc;
+            if((conn->args = (shtserver_arg*)realloc(conn->args, sizeof(shtserver_arg) * argc)) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'realloc' on 'conn->args'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        for(unsigned int i = 0; i < argc; i++) {
+            if((result = shtserver_parseline(in->data, in->end, &pos, '$', &len)) <= 0)
+                return result == 0;
+            if(in->end - pos < len + 2)
+                return true;
+            if(in->data[pos + len] != '\r' || in->data[pos + len + 1] != '\n')
+                return false;
+
+            conn->args[i].data = in->data + pos;
+            conn->args[i].len = (unsigned int) len;
+            pos += len + 2;
+        }
+
+        shtserver_execute(conn, argc);
+        in->start = pos;
+    }
+
+    in->start = in->end = 0;
+    return true;
+}
+
+/* Release a connection. */
+static void shtserver_close(shtserver_conn* conn) {
+    if(conn->replica) {
+        for(unsigned int i = 0; i < replicas_count; i++) {
+            if(replicas[i] == conn) {
+                replicas[i] = replicas[--replicas_count];
+                break;
+            }
+        }
+    }
+    if(conn->upstream) {
+        printf("Connection to the leader lost: serving the last replicated state\n");
+        fflush(stdout);
+        leader = NULL;
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->args);
+    free(conn);
+}
+
+/* Send as much as possible of the output buffer of a connection,
+   waiting for EPOLLOUT if the socket is full. Return false if the
+   connection has been closed. */
+static bool shtserver_flush(shtserver_conn* conn) {
+    shtserver_buffer* out = &conn->out;
+
+    while(out->start < out->end) {
+        ssize_t sent = write(conn->fd, out->data + out->start, out->end - out->start);
+
+        if(sent < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN) {
+                shtserver_close(conn);
+                return false;
+            }
+            break;
+        }
+        out->start += sent;
+    }
+
+    bool pending = out->start < out->end;
+    if(!pending) {
+        out->start = out->end = 0;
+        if(conn->closing) {
+            shtserver_close(conn);
+            return false;
+        }
+    }
+
+    if(pending != conn->writing || (pending && conn->closing)) {
+        /* A connection being closed is not read any more. */
+        struct epoll_event event = {pending ? (conn->closing ? EPOLLOUT : EPOLLIN | EPOLLOUT) : EPOLLIN, {.ptr = conn}};
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->writing = pending;
+    }
+
+    return true;
+}
+
+/* Read everything available on a connection and serve the requests.
+   Return false if the connection has been closed. */
+static bool shtserver_read(shtserver_conn* conn) {
+    while(true) {
+        shtserver_reserve(&conn->in, SHTSERVER_BUFFER_SIZE / 2);
+
+        ssize_t received = read(conn->fd, conn->in.data + conn->in.end, conn->in.size - conn->in.end);
+        if(received == 0) {
+            shtserver_close(conn);
+            return false;
+        }
+        if(received < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                break;
+            shtserver_close(conn);
+            return false;
+        }
+        conn->in.end += received;
+
+        if(!shtserver_process(conn) || conn->in.end - conn->in.start > SHTSERVER_MAX_REQUEST) {
+            shtserver_reply_error(conn, "protocol error");
+            conn->closing = true;
+            break;
+        }
+    }
+
+    return shtserver_flush(conn);
+}
+
+/* Accept all the pending connections of a listening socket. */
+static void shtserver_accept(int listen_fd) {
+    int fd;
+
+    while((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        shtserver_conn* conn;
+        if((conn = (shtserver_conn*)calloc(1, sizeof(shtserver_conn))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'calloc' on 'conn'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+
+        struct epoll_event event = {EPOLLIN, {.ptr = conn}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+/* Send the stream to the followers, once per iteration of the event
+   loop, so that a batch of writes costs a single write to each of
+   them. A follower that does not keep up is dropped. */
+static void shtserver_replicate() {
+    shtserver_publish();
+
+    /* Going backward, because closing a follower moves the last one
+       in its place. */
+    for(unsigned int i = replicas_count; i-- > 0; ) {
+        shtserver_conn* conn = replicas[i];
+
+        if(conn->out.end - conn->out.start > SHTSERVER_MAX_REPLICA_BUFFER) {
+            printf("Dropping a follower that does not keep up with the stream\n");
+            fflush(stdout);
+            shtserver_close(conn);
+        } else if(!conn->writing && conn->out.start < conn->out.end) {
+            shtserver_flush(conn);
+        }
+    }
+}
+
+/* Send the offset applied by a follower to its leader. */
+static void shtserver_ack() {
+    char request[64], digits[24];
+    int len = sprintf(digits, "%lu", repl_offset);
+
+    shtserver_append(&leader->out, request, sprintf(request, "*2\r\n$7\r\nREPLACK\r\n$%d\r\n%s\r\n", len, digits));
+    if(!leader->writing)
+        shtserver_flush(leader);
+}
+
+/* Connect to the leader 'address' ("host:port" or the path of a Unix
+   socket) and ask for the full sync. Return false on error. */
+static bool shtserver_connect(const char* address) {
+    const char* colon = strrchr(address, ':');
+    int fd;
+
+    if(colon == NULL) {
+        struct sockaddr_un addr = {0};
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+        if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return false;
+    } else {
+        struct addrinfo hints = {0}, *result;
+        char host[256];
+        int one = 1;
+
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host, colon + 1, &hints, &result) != 0)
+            return false;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool connected = fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) == 0;
+        freeaddrinfo(result);
+        if(!connected)
+            return false;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    const char* request = "*1\r\n$4\r\nSYNC\r\n";
+    if(write(fd, request, strlen(request)) != (ssize_t) strlen(request))
+        return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if((leader = (shtserver_conn*)calloc(1, sizeof(shtserver_conn))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'leader'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    leader->fd = fd;
+    leader->upstream = true;
+
+    struct epoll_event event = {EPOLLIN, {.ptr = leader}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+    return true;
+}
+
+/* Create a non-blocking listening socket on a TCP port of the
+   loopback interface or, if 'path' is not NULL, on a Unix socket. */
+static int shtserver_listen(int port, const char* path) {
+    int fd;
+
+    if(path != NULL) {
+        struct sockaddr_un addr = {0};
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+        unlink(path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return -1;
+    } else {
+        struct sockaddr_in addr = {0};
+        int one = 1;
+
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return -1;
+    }
+
+    if(listen(fd, 511) < 0)
+        return -1;
+
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+    const char* leader_address = NULL;
+    unsigned int size = 1024;
+    int port = 6380;
+    int option;
+
+    while((option = getopt(argc, argv, "p:s:b:R:")) != -1) {
+        switch(option) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 's':
+                path = optarg;
+                break;
+            case 'b':
+                size = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                leader_address = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port | -s unix_socket] [-b initial_buckets] [-R leader_host:port | -R leader_unix_socket]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* The table is used only by the event loop: no synchronization is
+       needed, and it doubles its size as it fills up. */
+    htable = hashtable_newhashtable(size < 2 ? 2 : size);
+    hashtable_setgrowth(htable, 1, HASHTABLE_RESIZE_STOP);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = shtserver_listen(port, path);
+    if(listen_fd < 0) {
+        printf("[ERROR] There was an error while trying to listen on '%s'. Closing...\n", path != NULL ? path : "127.0.0.1");
+        exit(EXIT_FAILURE);
+    }
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        printf("[ERROR] There was an error while trying to call 'epoll_create1'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event = {EPOLLIN, {.ptr = NULL}};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    if(path != NULL)
+        printf("Listening on %s\n", path);
+    else
+        printf("Listening on 127.0.0.1:%d\n", port);
+
+    if(leader_address != NULL) {
+        if(!shtserver_connect(leader_address)) {
+            printf("[ERROR] There was an error while trying to connect to the leader '%s'. Closing...\n", leader_address);
+            exit(EXIT_FAILURE);
+        }
+        follower = true;
+        printf("Following %s\n", leader_address);
+    }
+    fflush(stdout);
+
+    struct epoll_event events[SHTSERVER_MAX_EVENTS];
+    unsigned long last_ack = shtserver_time();
+    while(true) {
+        int count = epoll_wait(epoll_fd, events, SHTSERVER_MAX_EVENTS, leader != NULL ? SHTSERVER_ACK_INTERVAL : -1);
+
+        for(int i = 0; i < count; i++) {
+            shtserver_conn* conn = (shtserver_conn*) events[i].data.ptr;
+
+            if(conn == NULL) {
+                shtserver_accept(listen_fd);
+            } else if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                shtserver_close(conn);
+            } else if((events[i].events & EPOLLIN) && !conn->closing) {
+                shtserver_read(conn);
+            } else if(events[i].events & EPOLLOUT) {
+                shtserver_flush(conn);
+            }
+        }
+
+        if(replicas_count > 0 || stream.end > 0)
+            shtserver_replicate();
+        if(leader != NULL && leader->synced && shtserver_time() - last_ack >= SHTSERVER_ACK_INTERVAL) {
+            shtserver_ack();
+            last_ack = shtserver_time();
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,234 +1,6559 @@
-#include <ctype.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
+#include "stringhashtable.h"
 
+/* Marker of a bucket that has been migrated to the new array. */
+static hashtable_entry hashtable_moved;
+#define HASHTABLE_MOVED (&hashtable_moved)
 
-/* Structure that holds information of an hash table entry. */
-typedef struct hashtable_entry_t {
-    char* key;                      /* Entry key */
-    unsigned int val;               /* Entry value */
 
-    struct hashtable_entry_t* next; /* Pointer to next entry */
+/* Releases the memory occupied by a pointer and, for security
+   reasons, clears its entire contents. */
+void erease(void* pointer, unsigned int size) {
+    if(pointer == NULL || size == 0)
+        return;
+    
+    memset(pointer, '\0', size);
+    free(pointer);
+}
+
+static __thread int counter_shard_id = -1;
+static unsigned int counter_next_shard = 0;
+
+/* Return the counter shard of an hash table that the calling thread
+   updates: the first one without synchronization, otherwise the one
+   assigned (round-robin) to the thread the first time it calls it. */
+static inline hashtable_counter_shard* hashtable_countershard(hashtable* htable) {
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        return &htable->counters[0];
+
+    if(counter_shard_id < 0)
+        counter_shard_id = __atomic_fetch_add(&counter_next_shard, 1, __ATOMIC_RELAXED) % HASHTABLE_COUNTER_SHARDS;
+
+    return &htable->counters[counter_shard_id];
+}
+
+/* Add 'delta' to one of the counters of an hash table (see
+   hashtable_counter). In the concurrent modes the shard of the
+   thread is updated atomically, but it is hardly ever shared. */
+#define HASHTABLE_COUNTER_ADD(htable, counter, delta) \
+    do { \
+        if((htable)->syncmode == HASHTABLE_SYNC_NONE) \
+            (htable)->counters[0].value[counter] += (delta); \
+        else \
+            __atomic_add_fetch(&hashtable_countershard(htable)->value[counter], (delta), __ATOMIC_RELAXED); \
+    } while(0)
+
+/* Return the value of one of the counters of an hash table, summing
+   all its shards. */
+static unsigned long hashtable_countervalue(hashtable* htable, hashtable_counter counter) {
+    long value = 0;
+
+    for(unsigned int i = 0; i < HASHTABLE_COUNTER_SHARDS; i++)
+        value += __atomic_load_n(&htable->counters[i].value[counter], __ATOMIC_RELAXED);
+
+    return value < 0 ? 0 : (unsigned long) value;
+}
+
+
+/* Epoch-based reclamation (EBR).
+   In HASHTABLE_SYNC_SEQLOCK mode readers traverse the chaining lists
+   without taking any lock, so an entry removed by a writer can still
+   be in use by a reader and cannot be released immediately. Every
+   reader announces the global epoch it observed when it starts
+   (hashtable_ebr_enter) and clears it when it ends (hashtable_ebr_exit).
+   Removed memory is "retired" in a list of the current epoch, private
+   to the thread that removed it, and the epoch can advance only when
+   every active reader has observed it: memory retired two epochs ago
+   is then unreachable by anyone and is released. */
+
+/* Structure that holds a pointer waiting to be released. */
+typedef struct hashtable_ebr_node_t {
+    void (*release)(void* owner, void* pointer); /* Function that releases 'pointer' */
+    void* owner;                    /* First argument of 'release' (es. the hash table) */
+    void* pointer;                  /* Retired pointer */
+} hashtable_ebr_node;
+
+/* Structure that holds a block of retired pointers of a limbo list. */
+typedef struct hashtable_ebr_block_t {
+    struct hashtable_ebr_block_t* next;
+    unsigned int count;             /* Used nodes */
+    hashtable_ebr_node nodes[HASHTABLE_EBR_BATCH];
+} hashtable_ebr_block;
+
+/* Structure that holds the epoch announced by a thread and the
+   pointers it has retired. The limbo lists are private to the thread,
+   but their lock lets the thread that advances the epoch, or
+   hashtable_ebr_flush, release them too. */
+typedef struct hashtable_ebr_slot_t {
+    unsigned long state;            /* (epoch << 1) | 1 while the thread is reading, 0 otherwise */
+    bool in_use;                    /* True if the slot is owned by a thread */
+    pthread_mutex_t lock;           /* Protects the fields below */
+    hashtable_ebr_block* limbo[3];  /* Retired pointers, by epoch (modulo 3) */
+    unsigned long limbo_epoch[3];   /* Epoch in which the pointers of each list have been retired */
+
+} __attribute__((aligned(64))) hashtable_ebr_slot;
+
+static hashtable_ebr_slot ebr_slots[HASHTABLE_MAX_THREADS];
+static unsigned long ebr_epoch = 1;
+static pthread_mutex_t ebr_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ebr_key;
+static pthread_once_t ebr_once = PTHREAD_ONCE_INIT;
+static __thread int ebr_slot_id = -1;
+
+/* Release the EBR slot of a thread when it terminates. Its limbo
+   lists are released later, by the next advances of the epoch. */
+static void hashtable_ebr_threadexit(void* slot) {
+    __atomic_store_n(&((hashtable_ebr_slot*)slot)->state, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&((hashtable_ebr_slot*)slot)->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void hashtable_ebr_init() {
+    pthread_key_create(&ebr_key, hashtable_ebr_threadexit);
+    for(int i = 0; i < HASHTABLE_MAX_THREADS; i++)
+        pthread_mutex_init(&ebr_slots[i].lock, NULL);
+}
+
+/* Return the EBR slot of the calling thread, assigning a free one
+   the first time a thread calls it. */
+static hashtable_ebr_slot* hashtable_ebr_slot_get() {
+    if(ebr_slot_id >= 0)
+        return &ebr_slots[ebr_slot_id];
+
+    pthread_once(&ebr_once, hashtable_ebr_init);
+
+    for(int i = 0; i < HASHTABLE_MAX_THREADS; i++) {
+        bool expected = false;
+        if(__atomic_compare_exchange_n(&ebr_slots[i].in_use, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            ebr_slot_id = i;
+            pthread_setspecific(ebr_key, &ebr_slots[i]);
+
+            return &ebr_slots[i];
+        }
+    }
+
+    printf("[ERROR] There are more than %d threads using the hash tables. Closing...\n", HASHTABLE_MAX_THREADS);
+    exit(EXIT_FAILURE);
+}
+
+/* Announce that the calling thread starts reading shared memory. */
+void hashtable_ebr_enter() {
+    hashtable_ebr_slot* slot = hashtable_ebr_slot_get();
+    unsigned long epoch = __atomic_load_n(&ebr_epoch, __ATOMIC_SEQ_CST);
+
+    __atomic_store_n(&slot->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+/* Announce that the calling thread does not hold any more
+   references to shared memory. */
+void hashtable_ebr_exit() {
+    __atomic_store_n(&ebr_slots[ebr_slot_id].state, 0, __ATOMIC_RELEASE);
+}
+
+/* Release all the pointers of a chain of blocks. */
+static void hashtable_ebr_releaselist(hashtable_ebr_block* block) {
+    while(block != NULL) {
+        hashtable_ebr_block* next_block = block->next;
+
+        for(unsigned int i = 0; i < block->count; i++)
+            block->nodes[i].release(block->nodes[i].owner, block->nodes[i].pointer);
+        free(block);
+        block = next_block;
+    }
+}
+
+/* Detach from a slot, and return as a single chain, the limbo lists
+   retired at least two epochs before 'epoch': no reader can reach
+   their pointers any more. The caller holds the lock of the slot. */
+static hashtable_ebr_block* hashtable_ebr_collect(hashtable_ebr_slot* slot, unsigned long epoch) {
+    hashtable_ebr_block* expired = NULL;
+
+    for(int i = 0; i < 3; i++) {
+        if(slot->limbo[i] == NULL || slot->limbo_epoch[i] + 2 > epoch)
+            continue;
+
+        hashtable_ebr_block* last = slot->limbo[i];
+        while(last->next != NULL)
+            last = last->next;
+        last->next = expired;
+        expired = slot->limbo[i];
+        __atomic_store_n(&slot->limbo[i], NULL, __ATOMIC_RELAXED);
+    }
+
+    return expired;
+}
+
+/* Try to advance the global epoch and release the memory retired two
+   epochs ago by every thread (the slots busy at the moment are left
+   to the next attempt). It must be called holding 'ebr_lock'. */
+static void hashtable_ebr_advance() {
+    unsigned long epoch = __atomic_load_n(&ebr_epoch, __ATOMIC_SEQ_CST);
+
+    for(int i = 0; i < HASHTABLE_MAX_THREADS; i++) {
+        unsigned long state = __atomic_load_n(&ebr_slots[i].state, __ATOMIC_SEQ_CST);
+
+        if((state & 1) && (state >> 1) != epoch)
+            return;
+    }
+
+    __atomic_store_n(&ebr_epoch, ++epoch, __ATOMIC_SEQ_CST);
+
+    for(int i = 0; i < HASHTABLE_MAX_THREADS; i++) {
+        hashtable_ebr_slot* slot = &ebr_slots[i];
+        bool empty = true;
+
+        for(int l = 0; l < 3; l++)
+            empty &= __atomic_load_n(&slot->limbo[l], __ATOMIC_RELAXED) == NULL;
+        if(empty || pthread_mutex_trylock(&slot->lock) != 0)
+            continue;
+        hashtable_ebr_block* expired = hashtable_ebr_collect(slot, epoch);
+        pthread_mutex_unlock(&slot->lock);
+        hashtable_ebr_releaselist(expired);
+    }
+}
+
+/* Retire a pointer that is no more reachable by new readers: it will
+   be released calling 'release(owner, pointer)' once all the readers
+   that could still reference it are done. The pointer goes in a limbo
+   list of the calling thread, so that the writers do not serialize on
+   a global lock: 'ebr_lock' is taken, without waiting, only when a
+   block of HASHTABLE_EBR_BATCH pointers is full, to try to advance
+   the epoch. */
+void hashtable_ebr_retire(void (*release)(void*, void*), void* owner, void* pointer) {
+    hashtable_ebr_slot* slot = hashtable_ebr_slot_get();
+    unsigned long epoch = __atomic_load_n(&ebr_epoch, __ATOMIC_SEQ_CST);
+    unsigned int index = epoch % 3;
+    hashtable_ebr_block* expired = NULL;
+
+    pthread_mutex_lock(&slot->lock);
+
+    /* The list of the same index is at least three epochs old. */
+    if(slot->limbo_epoch[index] != epoch) {
+        expired = hashtable_ebr_collect(slot, epoch);
+        slot->limbo_epoch[index] = epoch;
+    }
+
+    hashtable_ebr_block* block = slot->limbo[index];
+    if(block == NULL || block->count == HASHTABLE_EBR_BATCH) {
+        if((block = (hashtable_ebr_block*)malloc(sizeof(hashtable_ebr_block))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'block'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        block->next = slot->limbo[index];
+        block->count = 0;
+        __atomic_store_n(&slot->limbo[index], block, __ATOMIC_RELAXED);
+    }
+    block->nodes[block->count].release = release;
+    block->nodes[block->count].owner = owner;
+    block->nodes[block->count].pointer = pointer;
+    bool full = ++block->count == HASHTABLE_EBR_BATCH;
+
+    pthread_mutex_unlock(&slot->lock);
+    hashtable_ebr_releaselist(expired);
+
+    if(full && pthread_mutex_trylock(&ebr_lock) == 0) {
+        hashtable_ebr_advance();
+        pthread_mutex_unlock(&ebr_lock);
+    }
+}
+
+/* Immediately release every pointer retired by a specific owner.
+   It must be called only when no thread is using the owner anymore
+   (es. when an hash table is released). */
+void hashtable_ebr_flush(void* owner) {
+    pthread_once(&ebr_once, hashtable_ebr_init);
+
+    for(int i = 0; i < HASHTABLE_MAX_THREADS; i++) {
+        hashtable_ebr_slot* slot = &ebr_slots[i];
+
+        pthread_mutex_lock(&slot->lock);
+        for(int l = 0; l < 3; l++) {
+            for(hashtable_ebr_block* block = slot->limbo[l]; block != NULL; block = block->next) {
+                unsigned int kept = 0;
+
+                for(unsigned int n = 0; n < block->count; n++) {
+                    if(block->nodes[n].owner == owner)
+                        block->nodes[n].release(block->nodes[n].owner, block->nodes[n].pointer);
+                    else
+                        block->nodes[kept++] = block->nodes[n];
+                }
+                block->count = kept;
+            }
+        }
+        pthread_mutex_unlock(&slot->lock);
+    }
+}
+
+/* Work-stealing thread pool.
+   A parallel loop over the range [begin, end) is split in equal parts,
+   one for each participating thread (the calling one included). Every
+   thread takes chunks from the front of its own part, each one a
+   fraction of what is left (so chunks shrink as the part empties), and
+   when its part is exhausted it steals the second half of the largest
+   part of another thread. This way a thread that meets long chaining
+   lists does not keep the others idle until the end.
+   The part of each thread is packed in a single 64 bit word,
+   (begin << 32) | end, so owner and thieves can update it with a
+   single compare-and-swap. */
+
+/* Structure that holds the part of the range owned by a thread. */
+typedef struct hashtable_pool_part_t {
+    unsigned long long range;       /* (begin << 32) | end */
+
+} __attribute__((aligned(64))) hashtable_pool_part;
+
+/* Structure that holds the thread pool. */
+typedef struct hashtable_pool_t {
+    pthread_mutex_t job_lock;       /* Serializes the jobs submitted by different threads */
+    pthread_mutex_t lock;           /* Protects the fields below */
+    pthread_cond_t wakeup;          /* Signaled when a new job is available */
+    pthread_cond_t done;            /* Signaled when the last pool thread completes a job */
+
+    unsigned int nthreads;          /* Number of pool threads (the calling one excluded) */
+    unsigned long job;              /* Identifier of the current job */
+    unsigned int participants;      /* Threads taking part in the current job (the calling one included) */
+    unsigned int pending;           /* Pool threads still working on the current job */
+    unsigned int grain;             /* Minimum chunk size of the current job */
+    hashtable_range_fn fn;          /* Function of the current job */
+    void* ctx;                      /* Context of the current job */
+
+    hashtable_pool_part parts[HASHTABLE_MAX_POOL_THREADS];
+} hashtable_pool;
+
+static hashtable_pool pool = {
+    .job_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+
+/* True in the threads that are working on a job of the pool: a job
+   that starts another parallel loop runs it in the same thread. */
+static __thread bool pool_inside = false;
+
+/* Default number of threads of the bulk operations of the hash
+   tables that do not set their own (see hashtable_setthreads). */
+static unsigned int pool_default_threads = 1;
+
+/* Take the next chunk of the part of thread 'worker', storing it in
+   'begin' and 'end'. Return false if the part is empty. */
+static bool hashtable_pool_take(unsigned int worker, unsigned int participants, unsigned int* begin, unsigned int* end) {
+    unsigned long long range = __atomic_load_n(&pool.parts[worker].range, __ATOMIC_ACQUIRE);
+
+    while(true) {
+        unsigned int first = range >> 32, last = (unsigned int) range;
+        if(first >= last)
+            return false;
+
+        unsigned int chunk = (last - first) / (2 * participants);
+        if(chunk < pool.grain)
+            chunk = pool.grain;
+        if(chunk > last - first)
+            chunk = last - first;
+
+        unsigned long long new_range = ((unsigned long long)(first + chunk) << 32) | last;
+        if(__atomic_compare_exchange_n(&pool.parts[worker].range, &range, new_range, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *begin = first;
+            *end = first + chunk;
+            return true;
+        }
+    }
+}
+
+/* Steal the second half of the largest part among the other threads,
+   making it the new part of thread 'worker'. Return false if there is
+   nothing left to steal. */
+static bool hashtable_pool_steal(unsigned int worker, unsigned int participants) {
+    while(true) {
+        unsigned int victim = participants, victim_size = 0;
+        unsigned long long victim_range = 0;
+
+        for(unsigned int i = 0; i < participants; i++) {
+            unsigned long long range = __atomic_load_n(&pool.parts[i].range, __ATOMIC_ACQUIRE);
+            unsigned int first = range >> 32, last = (unsigned int) range;
+
+            if(i != worker && first < last && last - first > victim_size) {
+                victim = i;
+                victim_size = last - first;
+                victim_range = range;
+            }
+        }
+        if(victim == participants)
+            return false;
+
+        unsigned int first = victim_range >> 32, last = (unsigned int) victim_range;
+        unsigned int middle = first + (last - first) / 2;
+        unsigned long long new_range = ((unsigned long long) first << 32) | middle;
+
+        if(__atomic_compare_exchange_n(&pool.parts[victim].range, &victim_range, new_range, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&pool.parts[worker].range, ((unsigned long long) middle << 32) | last, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+/* Work on the current job as thread 'worker' until there is nothing
+   left, neither in its own part nor in the others. */
+static void hashtable_pool_work(unsigned int worker, unsigned int participants) {
+    unsigned int begin, end;
+
+    do {
+        while(hashtable_pool_take(worker, participants, &begin, &end))
+            pool.fn(pool.ctx, begin, end, worker);
+    } while(hashtable_pool_steal(worker, participants));
+}
+
+/* Main function of a pool thread: waits for a job, works on it if it
+   takes part in it, and notifies the calling thread when done. */
+static void* hashtable_pool_thread(void* arg) {
+    unsigned int worker = (unsigned int)(unsigned long) arg;
+    unsigned long job = 0;
+
+    pool_inside = true;
+
+    pthread_mutex_lock(&pool.lock);
+    while(true) {
+        while(pool.job == job)
+            pthread_cond_wait(&pool.wakeup, &pool.lock);
+        job = pool.job;
+
+        if(worker >= pool.participants)
+            continue;
+        unsigned int participants = pool.participants;
+        pthread_mutex_unlock(&pool.lock);
+
+        hashtable_pool_work(worker, participants);
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.pending == 0)
+            pthread_cond_signal(&pool.done);
+    }
+
+    return NULL;
+}
+
+/* Run 'fn' on the whole range [begin, end) using 'nthreads' threads
+   (the calling one included), in chunks of at least 'grain' elements,
+   and return when it has been completed. Pool threads are created the
+   first time they are needed. 'fn' must not start another parallel
+   loop itself. */
+void hashtable_pool_run(unsigned int nthreads, unsigned int begin, unsigned int end, unsigned int grain, hashtable_range_fn fn, void* ctx) {
+    if(grain == 0)
+        grain = 1;
+    if(nthreads > HASHTABLE_MAX_POOL_THREADS)
+        nthreads = HASHTABLE_MAX_POOL_THREADS;
+    if(nthreads > 1 && (end - begin) / grain < nthreads)
+        nthreads = (end - begin) / grain > 1 ? (end - begin) / grain : 1;
+
+    if(nthreads <= 1 || begin >= end || pool_inside) {
+        if(begin < end)
+            fn(ctx, begin, end, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.job_lock);
+
+    while(pool.nthreads < nthreads - 1) {
+        pthread_t thread;
+
+        if(pthread_create(&thread, NULL, hashtable_pool_thread, (void*)(unsigned long)(pool.nthreads + 1)) != 0) {
+            printf("[ERROR] There was an error while trying to call 'pthread_create' on 'thread'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+        pool.nthreads++;
+    }
+
+    /* Split the range in equal parts, one for each thread. */
+    unsigned int part_size = (end - begin) / nthreads;
+    for(unsigned int i = 0; i < nthreads; i++) {
+        unsigned int first = begin + i * part_size;
+        unsigned int last = (i == nthreads - 1) ? end : first + part_size;
+
+        pool.parts[i].range = ((unsigned long long) first << 32) | last;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.grain = grain;
+    pool.participants = nthreads;
+    pool.pending = nthreads - 1;
+    pool.job++;
+    pthread_cond_broadcast(&pool.wakeup);
+    pthread_mutex_unlock(&pool.lock);
+
+    pool_inside = true;
+    hashtable_pool_work(0, nthreads);
+    pool_inside = false;
+
+    pthread_mutex_lock(&pool.lock);
+    while(pool.pending > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.job_lock);
+}
+
+/* Set the default number of threads used by the bulk operations of
+   the hash tables that do not set their own (0: one per online CPU). */
+void hashtable_setdefaultthreads(unsigned int nthreads) {
+    if(nthreads == 0)
+        nthreads = (unsigned int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    pool_default_threads = nthreads > HASHTABLE_MAX_POOL_THREADS ? HASHTABLE_MAX_POOL_THREADS : nthreads;
+}
+
+/* Calculate hash value (integer) of a key made of 'key_len' bytes
+   and return it. The key can contain any byte, including '\0'.
+   The algorithm used consists in adding all the integer values
+   corresponding to each byte of the key, adding the
+   previous result multiplied by 33 each time.
+   To optimize the speed, the multiplication by 33 is done by making
+   a 5 bit shift to the left, which corresponds to a multiplication
+   by 2^5 = 32, and then the last value is added.
+   At each step, to prevent the value from overflowing and above all
+   to prevent it from exceeding the maximum size of the hash table,
+   the modulo operation is used.
+   Each byte is added as a char, like hashtable_gethash always did, so
+   that keys with bytes >= 0x80 keep their buckets. */
+unsigned int hashtable_gethash_len(unsigned int hashtable_size, const char* key, unsigned int key_len) {
+    unsigned int hash = 0;
+
+    for (unsigned int i = 0; i < key_len; i++) {
+        hash = ((int)key[i] + (hash << 5) + hash) % hashtable_size;
+    }
+
+    return hash;
+}
+
+/* Calculate hash value (integer) of a NUL-terminated string (key)
+   and return it. */
+unsigned int hashtable_gethash(unsigned int hashtable_size, char* key) {
+    return hashtable_gethash_len(hashtable_size, key, (unsigned int) strlen(key));
+}
+
+/* Calculate a 32 bit hash value of a key made of 'key_len' bytes,
+   independent of any hash table size: the same as hashtable_gethash_len
+   without the modulo, whose bits are then mixed with the finalizer of
+   MurmurHash3. It is used to route keys among shards, which must not
+   depend on the buckets the keys will have in the shards. */
+unsigned int hashtable_fullhash(const char* key, unsigned int key_len) {
+    unsigned int hash = 0;
+
+    for (unsigned int i = 0; i < key_len; i++)
+        hash = (int)key[i] + (hash << 5) + hash;
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/* Return true if the key of 'entry' is equal to the 'key_len' bytes
+   pointed by 'key', false otherwise. The lengths are compared first,
+   so that 'memcmp' is called only on keys of the same size. */
+static inline bool hashtable_keyequals(hashtable_entry* entry, const char* key, unsigned int key_len) {
+    return entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0;
+}
+
+/* Raise the bound of the length of the chaining lists of a bucket
+   array to 'length', if it is lower. The bound never decreases (the
+   deletes leave it as it is) until the array is cleared. */
+static inline void hashtable_boundchain(hashtable_buckets* buckets, unsigned int length) {
+    unsigned int bound = __atomic_load_n(&buckets->max_chain, __ATOMIC_RELAXED);
+
+    while(length > bound && !__atomic_compare_exchange_n(&buckets->max_chain, &bound, length, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Return the length of the chaining list that starts with 'entry'. */
+static inline unsigned int hashtable_chainlength(hashtable_entry* entry) {
+    unsigned int length = 0;
+
+    for(; entry != NULL; entry = entry->next)
+        length++;
+
+    return length;
+}
+
+/* Allocate the lock stripes of a bucket array, as required by the
+   synchronization mode 'syncmode' (none in HASHTABLE_SYNC_NONE). */
+static void hashtable_newstripes(hashtable_syncmode syncmode, hashtable_buckets* buckets) {
+    if(syncmode == HASHTABLE_SYNC_NONE)
+        return;
+
+    if(posix_memalign((void**)&buckets->stripes, 64, sizeof(hashtable_stripe) * HASHTABLE_STRIPES) != 0) {
+        printf("[ERROR] There was an error while trying to call 'posix_memalign' on 'buckets->stripes'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(unsigned int i = 0; i < HASHTABLE_STRIPES; i++) {
+        if(syncmode == HASHTABLE_SYNC_RWLOCK)
+            pthread_rwlock_init(&buckets->stripes[i].lock.rwlock, NULL);
+        else
+            pthread_mutex_init(&buckets->stripes[i].lock.mutex, NULL);
+        buckets->stripes[i].seq = 0;
+    }
+}
+
+/* Create a new bucket array with a specific size, all buckets set
+   to NULL and, in the concurrent modes, its own lock stripes, and
+   return it. */
+static hashtable_buckets* hashtable_newbuckets(hashtable_syncmode syncmode, unsigned int size) {
+    hashtable_buckets* buckets;
+
+    if((buckets = (hashtable_buckets*)malloc(sizeof(hashtable_buckets))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'buckets'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buckets->size = size;
+    buckets->stripes = NULL;
+    buckets->max_chain = 0;
+    buckets->versions = NULL;
+    buckets->next = NULL;
+    buckets->transfer_index = 0;
+    buckets->transferred = 0;
+
+    if((buckets->table = (hashtable_entry**)malloc(sizeof(hashtable_entry*)*size)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'buckets->table'. Closing...\n");
+		exit(EXIT_FAILURE);
+    }
+
+    /* Initialize all entries to NULL */
+    for(unsigned int i = 0; i < size; i++)
+        buckets->table[i] = NULL;
+
+    hashtable_newstripes(syncmode, buckets);
+
+    return buckets;
+}
+
+/* Destroy the lock stripes of a bucket array, if present. */
+static void hashtable_freestripes(hashtable_syncmode syncmode, hashtable_buckets* buckets) {
+    if(buckets->stripes == NULL)
+        return;
+
+    for(unsigned int i = 0; i < HASHTABLE_STRIPES; i++) {
+        if(syncmode == HASHTABLE_SYNC_RWLOCK)
+            pthread_rwlock_destroy(&buckets->stripes[i].lock.rwlock);
+        else
+            pthread_mutex_destroy(&buckets->stripes[i].lock.mutex);
+    }
+
+    free(buckets->stripes);
+    buckets->stripes = NULL;
+}
+
+/* Release a bucket array (but not the entries it contains). */
+static void hashtable_freebuckets(hashtable* htable, hashtable_buckets* buckets) {
+    hashtable_freestripes(htable->syncmode, buckets);
+    free(buckets->versions);
+    erease(buckets->table, sizeof(hashtable_entry*) * buckets->size);
+    erease(buckets, sizeof(hashtable_buckets));
+}
+
+/* Adapter of hashtable_freebuckets for hashtable_ebr_retire. */
+static void hashtable_freebuckets_retired(void* htable, void* buckets) {
+    hashtable_freebuckets((hashtable*) htable, (hashtable_buckets*) buckets);
+}
+
+/* Create a new hash table with a specific size and key ownership
+   policy and return it. */
+hashtable* hashtable_newhashtable_keymode(unsigned int size, hashtable_keymode keymode) {
+    if(size < 2)
+        return NULL;
+    
+    hashtable* htable = NULL;
+
+    if((htable = (hashtable*)malloc(sizeof(hashtable))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'htable'. Closing...\n");
+		exit(EXIT_FAILURE);
+    }
+
+    /* Initialize hash table */    
+    if(posix_memalign((void**)&htable->counters, 64, sizeof(hashtable_counter_shard) * HASHTABLE_COUNTER_SHARDS) != 0) {
+        printf("[ERROR] There was an error while trying to call 'posix_memalign' on 'htable->counters'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(htable->counters, 0, sizeof(hashtable_counter_shard) * HASHTABLE_COUNTER_SHARDS);
+    htable->keymode = keymode;
+    htable->arena = NULL;
+    pthread_mutex_init(&htable->arena_lock, NULL);
+    htable->syncmode = HASHTABLE_SYNC_NONE;
+    htable->resizemode = HASHTABLE_RESIZE_COOPERATIVE;
+    htable->max_load = 0;
+    htable->nthreads = 0;
+    htable->combiner = NULL;
+    htable->wal = NULL;
+    htable->digests = NULL;
+    htable->digest_leaves = 0;
+    htable->max_entries = 0;
+    htable->clock_hand = 0;
+    htable->wheel = NULL;
+    htable->flights = NULL;
+    htable->sampler = NULL;
+    memset(&htable->views, 0, sizeof(hashtable_views));
+    pthread_mutex_init(&htable->views.lock, NULL);
+    htable->buckets = hashtable_newbuckets(HASHTABLE_SYNC_NONE, size);
+    
+    return htable;
+}
+
+/* Create a new hash table with a specific size and return it.
+   Every entry will own a private copy of its key. */
+hashtable* hashtable_newhashtable(unsigned int size) {
+    return hashtable_newhashtable_keymode(size, HASHTABLE_KEY_COPY);
+}
+
+/* Acquire, as a writer, the stripe of a bucket array that protects
+   the bucket 'hash'. In HASHTABLE_SYNC_SEQLOCK mode, the sequence
+   counter becomes odd before any change is made to the bucket. */
+static inline void hashtable_writelock(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        return;
+
+    hashtable_stripe* stripe = &buckets->stripes[hash % HASHTABLE_STRIPES];
+
+    if(htable->syncmode == HASHTABLE_SYNC_RWLOCK) {
+        pthread_rwlock_wrlock(&stripe->lock.rwlock);
+        return;
+    }
+
+    pthread_mutex_lock(&stripe->lock.mutex);
+    if(htable->syncmode == HASHTABLE_SYNC_SEQLOCK) {
+        __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+/* Release the stripe acquired by hashtable_writelock. */
+static inline void hashtable_writeunlock(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        return;
+
+    hashtable_stripe* stripe = &buckets->stripes[hash % HASHTABLE_STRIPES];
+
+    if(htable->syncmode == HASHTABLE_SYNC_RWLOCK) {
+        pthread_rwlock_unlock(&stripe->lock.rwlock);
+        return;
+    }
+
+    if(htable->syncmode == HASHTABLE_SYNC_SEQLOCK)
+        __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stripe->lock.mutex);
+}
+
+/* Acquire, as a reader, the stripe of a bucket array that protects
+   the bucket 'hash' (HASHTABLE_SYNC_MUTEX and HASHTABLE_SYNC_RWLOCK
+   modes only: seqlock readers do not lock). */
+static inline void hashtable_readlock(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    if(htable->syncmode == HASHTABLE_SYNC_RWLOCK)
+        pthread_rwlock_rdlock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.rwlock);
+    else if(htable->syncmode == HASHTABLE_SYNC_MUTEX)
+        pthread_mutex_lock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.mutex);
+}
+
+/* Release the stripe acquired by hashtable_readlock. */
+static inline void hashtable_readunlock(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    if(htable->syncmode == HASHTABLE_SYNC_RWLOCK)
+        pthread_rwlock_unlock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.rwlock);
+    else if(htable->syncmode == HASHTABLE_SYNC_MUTEX)
+        pthread_mutex_unlock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.mutex);
+}
+
+/* Acquire the stripe of the bucket 'hash' of a bucket array to read
+   it for a view or a checkpoint: as a reader in HASHTABLE_SYNC_RWLOCK
+   mode, otherwise its mutex, which also excludes the writers in
+   HASHTABLE_SYNC_SEQLOCK mode (without changing the sequence). */
+static inline void hashtable_viewlock(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    if(htable->syncmode == HASHTABLE_SYNC_RWLOCK)
+        pthread_rwlock_rdlock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.rwlock);
+    else if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_lock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.mutex);
+}
+
+/* Release the stripe acquired by hashtable_viewlock. */
+static inline void hashtable_viewunlock(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    if(htable->syncmode == HASHTABLE_SYNC_RWLOCK)
+        pthread_rwlock_unlock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.rwlock);
+    else if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_unlock(&buckets->stripes[hash % HASHTABLE_STRIPES].lock.mutex);
+}
+
+/* Start an operation on an hash table. In the concurrent modes the
+   thread enters an EBR critical section, so that neither the entries
+   nor the bucket arrays it meets are released until it is done. */
+static inline void hashtable_enter(hashtable* htable) {
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        hashtable_ebr_enter();
+}
+
+/* End an operation started with hashtable_enter. */
+static inline void hashtable_exit(hashtable* htable) {
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        hashtable_ebr_exit();
+}
+
+/* Create a new hash table entry (key, val), where 'key' is made of
+   'key_len' bytes, and return it. */
+hashtable_entry* hashtable_newentry_len(const char* key, unsigned int key_len, unsigned int val) {
+    if(key == NULL)
+        return NULL;
+
+    hashtable_entry* new_entry;
+
+	if((new_entry = (hashtable_entry*)malloc(sizeof(hashtable_entry))) == NULL ) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'new_entry'. Closing...\n");
+		exit(EXIT_FAILURE);
+	}
+
+    /* One more byte is allocated so that the stored key is always
+       NUL-terminated, even if the caller's one was not. */
+	if((new_entry->key = (char*)malloc(key_len + 1)) == NULL ) {
+		printf("[ERROR] There was an error while trying to call 'malloc' on 'new_entry->key'. Closing...\n");
+		exit(EXIT_FAILURE);
+	}
+
+    /* Initialize entry with key,val and "next" pointer set to NULL */
+    memcpy(new_entry->key, key, key_len);
+    new_entry->key[key_len] = '\0';
+    new_entry->key_len = key_len;
+    new_entry->val = val;
+    new_entry->referenced = false;
+    new_entry->sample_index = 0;
+    new_entry->timer = NULL;
+    new_entry->next = NULL;
+
+	return new_entry;
+}
+
+/* Create a new hash table entry (key, val) and return it. */
+hashtable_entry* hashtable_newentry(char* key, unsigned int val) {
+    if(key == NULL)
+        return NULL;
+
+    return hashtable_newentry_len(key, (unsigned int) strlen(key), val);
+}
+
+/* Copy a key made of 'key_len' bytes (plus the string terminator)
+   at the end of the key arena of an hash table and return the copy.
+   When the current block is full, a new one is allocated; keys
+   bigger than a block get a block of their own. */
+char* hashtable_arena_storekey(hashtable* htable, const char* key, unsigned int key_len) {
+    hashtable_arena_block* block = htable->arena;
+
+    if(block == NULL || block->size - block->used < key_len + 1) {
+        unsigned int block_size = HASHTABLE_ARENA_BLOCK_SIZE;
+        if(key_len + 1 > block_size)
+            block_size = key_len + 1;
+
+        if((block = (hashtable_arena_block*)malloc(sizeof(hashtable_arena_block) + block_size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'block'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = htable->arena;
+        htable->arena = block;
+    }
+
+    char* stored_key = block->data + block->used;
+    memcpy(stored_key, key, key_len);
+    stored_key[key_len] = '\0';
+    block->used += key_len + 1;
+
+    return stored_key;
+}
+
+/* Create a new entry (key, val) for a specific hash table, storing
+   its key according to the key ownership policy of the table, and
+   return it. */
+hashtable_entry* hashtable_allocentry(hashtable* htable, const char* key, unsigned int key_len, unsigned int val) {
+    if(htable->keymode == HASHTABLE_KEY_COPY)
+        return hashtable_newentry_len(key, key_len, val);
+
+    hashtable_entry* new_entry;
+
+	if((new_entry = (hashtable_entry*)malloc(sizeof(hashtable_entry))) == NULL ) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'new_entry'. Closing...\n");
+		exit(EXIT_FAILURE);
+	}
+
+    if(htable->keymode == HASHTABLE_KEY_ARENA) {
+        /* The arena is shared by all the stripes. */
+        if(htable->syncmode != HASHTABLE_SYNC_NONE)
+            pthread_mutex_lock(&htable->arena_lock);
+        new_entry->key = hashtable_arena_storekey(htable, key, key_len);
+        if(htable->syncmode != HASHTABLE_SYNC_NONE)
+            pthread_mutex_unlock(&htable->arena_lock);
+    }
+    else
+        new_entry->key = (char*) key;   /* HASHTABLE_KEY_BORROW: the caller keeps it alive */
+    new_entry->key_len = key_len;
+    new_entry->val = val;
+    new_entry->referenced = false;
+    new_entry->sample_index = 0;
+    new_entry->timer = NULL;
+    new_entry->next = NULL;
+
+    return new_entry;
+}
+
+/* Release an entry of a specific hash table, together with its key
+   if the table owns it. Keys stored in the arena are only cleared:
+   their space is released together with the whole arena. */
+void hashtable_freeentry(hashtable* htable, hashtable_entry* entry) {
+    free(entry->timer);
+    if(htable->keymode == HASHTABLE_KEY_COPY)
+        erease(entry->key, entry->key_len + 1);
+    else if(htable->keymode == HASHTABLE_KEY_ARENA)
+        memset(entry->key, '\0', entry->key_len);
+
+    erease(entry, sizeof(hashtable_entry));
+}
+
+/* Adapter of hashtable_freeentry for hashtable_ebr_retire. */
+static void hashtable_freeentry_retired(void* htable, void* entry) {
+    hashtable_freeentry((hashtable*) htable, (hashtable_entry*) entry);
+}
+
+/* Release an entry just removed from an hash table. In
+   HASHTABLE_SYNC_SEQLOCK mode a reader could still be traversing it,
+   so it is retired and released only when no reader can reach it. */
+static void hashtable_releaseentry(hashtable* htable, hashtable_entry* entry) {
+    if(htable->syncmode == HASHTABLE_SYNC_SEQLOCK)
+        hashtable_ebr_retire(hashtable_freeentry_retired, htable, entry);
+    else
+        hashtable_freeentry(htable, entry);
+}
+
+/* Return the number of entries of an hash table. */
+unsigned int hashtable_count(hashtable* htable) {
+    if(htable == NULL)
+        return 0;
+
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        return htable->counters[0].value[HASHTABLE_COUNTER_DIFFERENT_ENTRIES] +
+               htable->counters[0].value[HASHTABLE_COUNTER_COLLISIONS];
+
+    return hashtable_countervalue(htable, HASHTABLE_COUNTER_DIFFERENT_ENTRIES) +
+           hashtable_countervalue(htable, HASHTABLE_COUNTER_COLLISIONS);
+}
+
+/* Store in 'stats' the statistics and operation counters of an hash
+   table. While other threads are using the table the values are
+   approximate, since the counters are not read all at the same time.
+   Return true on success, false otherwise. */
+bool hashtable_getstats(hashtable* htable, hashtable_stats* stats) {
+    if(htable == NULL || stats == NULL)
+        return false;
+
+    stats->size = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE)->size;
+    stats->different_entries = hashtable_countervalue(htable, HASHTABLE_COUNTER_DIFFERENT_ENTRIES);
+    stats->collisions = hashtable_countervalue(htable, HASHTABLE_COUNTER_COLLISIONS);
+    stats->entries = stats->different_entries + stats->collisions;
+    stats->lookups = hashtable_countervalue(htable, HASHTABLE_COUNTER_LOOKUPS);
+    stats->hits = hashtable_countervalue(htable, HASHTABLE_COUNTER_HITS);
+    stats->misses = stats->lookups > stats->hits ? stats->lookups - stats->hits : 0;
+    stats->inserts = hashtable_countervalue(htable, HASHTABLE_COUNTER_INSERTS);
+    stats->updates = hashtable_countervalue(htable, HASHTABLE_COUNTER_UPDATES);
+    stats->deletes = hashtable_countervalue(htable, HASHTABLE_COUNTER_DELETES);
+    stats->resizes = hashtable_countervalue(htable, HASHTABLE_COUNTER_RESIZES);
+    stats->evictions = hashtable_countervalue(htable, HASHTABLE_COUNTER_EVICTIONS);
+
+    return true;
+}
+
+/* Print the statistics and operation counters of an hash table. */
+void hashtable_printstats(hashtable* htable) {
+    hashtable_stats stats;
+
+    if(!hashtable_getstats(htable, &stats)) {
+        printf("This hash table does not exist.\n");
+        return;
+    }
+
+    printf("Buckets: %u, entries: %lu (%lu different, %lu collisions), resizes: %lu\n",
+           stats.size, stats.entries, stats.different_entries, stats.collisions, stats.resizes);
+    printf("Lookups: %lu (%lu hits, %lu misses), inserts: %lu, updates: %lu, deletes: %lu, evictions: %lu\n",
+           stats.lookups, stats.hits, stats.misses, stats.inserts, stats.updates, stats.deletes, stats.evictions);
+}
+
+/* Move all the entries of the bucket 'i' of a bucket array to the new
+   array that is replacing it (buckets->next), then mark the bucket as
+   migrated. If 'locked' is false the stripe of the bucket is acquired
+   here, otherwise the caller already holds it. The stripes of the new
+   array are always acquired after the ones of the old array, so two
+   migrating threads (or a writer) can never deadlock.
+   The entries are relinked, not copied: a lock-free reader walking
+   the old chain could end up in the new one, but the change of the
+   sequence counter makes it repeat the search anyway. */
+static void hashtable_migratebucket(hashtable* htable, hashtable_buckets* buckets, unsigned int i, bool locked) {
+    hashtable_buckets* new_buckets = __atomic_load_n(&buckets->next, __ATOMIC_ACQUIRE);
+    unsigned int moved_entries = 0;
+
+    if(!locked)
+        hashtable_writelock(htable, buckets, i);
+
+    hashtable_entry* current_entry = buckets->table[i];
+    while(current_entry != NULL) {
+        hashtable_entry* next_entry = current_entry->next;
+        unsigned int hash = hashtable_gethash_len(new_buckets->size, current_entry->key, current_entry->key_len);
+
+        __atomic_store_n(&buckets->table[i], next_entry, __ATOMIC_RELAXED);
+
+        /* Push the entry at the head of its new chaining list. */
+        hashtable_writelock(htable, new_buckets, hash);
+        hashtable_entry* head = new_buckets->table[hash];
+        __atomic_store_n(&current_entry->next, head, __ATOMIC_RELAXED);
+        __atomic_store_n(&new_buckets->table[hash], current_entry, __ATOMIC_RELEASE);
+        if(head == NULL)
+            HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_DIFFERENT_ENTRIES, 1);
+        else
+            HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_COLLISIONS, 1);
+        hashtable_boundchain(new_buckets, hashtable_chainlength(current_entry));
+        hashtable_writeunlock(htable, new_buckets, hash);
+
+        moved_entries++;
+        current_entry = next_entry;
+    }
+    __atomic_store_n(&buckets->table[i], HASHTABLE_MOVED, __ATOMIC_RELEASE);
+
+    /* The old chaining list counted as one different entry plus
+       (moved_entries - 1) collisions. */
+    if(moved_entries > 0) {
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_DIFFERENT_ENTRIES, -1);
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_COLLISIONS, -(long)(moved_entries - 1));
+    }
+
+    if(!locked)
+        hashtable_writeunlock(htable, buckets, i);
+}
+
+/* Complete a resize whose buckets have all been migrated: the new
+   array becomes the current one, and the old one is released as soon
+   as no thread can be using it. */
+static void hashtable_finishresize(hashtable* htable, hashtable_buckets* buckets) {
+    __atomic_store_n(&htable->buckets, __atomic_load_n(&buckets->next, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        hashtable_freebuckets(htable, buckets);
+    else
+        hashtable_ebr_retire(hashtable_freebuckets_retired, htable, buckets);
+}
+
+/* Claim the next chunk of HASHTABLE_RESIZE_CHUNK buckets of an array
+   being resized and migrate it, as the "transfer" of Java's
+   ConcurrentHashMap does. The thread that migrates the last chunk
+   completes the resize. Return false if there was nothing left to
+   claim. */
+static bool hashtable_transferchunk(hashtable* htable, hashtable_buckets* buckets) {
+    if(__atomic_load_n(&buckets->transfer_index, __ATOMIC_RELAXED) >= buckets->size)
+        return false;
+
+    unsigned int start = __atomic_fetch_add(&buckets->transfer_index, HASHTABLE_RESIZE_CHUNK, __ATOMIC_RELAXED);
+    if(start >= buckets->size)
+        return false;
+
+    unsigned int end = start + HASHTABLE_RESIZE_CHUNK;
+    if(end > buckets->size || end < start)
+        end = buckets->size;
+
+    for(unsigned int i = start; i < end; i++)
+        hashtable_migratebucket(htable, buckets, i, false);
+
+    if(__atomic_add_fetch(&buckets->transferred, end - start, __ATOMIC_ACQ_REL) == buckets->size)
+        hashtable_finishresize(htable, buckets);
+
+    return true;
+}
+
+/* Return the number of threads used by the bulk operations of an
+   hash table. */
+static unsigned int hashtable_threads(hashtable* htable) {
+    return htable->nthreads != 0 ? htable->nthreads : pool_default_threads;
+}
+
+/* Structure that holds the context of a parallel migration. */
+typedef struct hashtable_migration_t {
+    hashtable* htable;
+    hashtable_buckets* buckets;     /* Array being resized */
+} hashtable_migration;
+
+/* Migrate the buckets [begin, end) of an array being resized, as part
+   of a parallel migration. No writer can reach the new array in the
+   meantime, but other threads of the pool can push entries on the
+   same new bucket, so entries are pushed with a compare-and-swap.
+   The counters are accumulated locally and updated once at the end. */
+static void hashtable_migraterange(void* ctx, unsigned int begin, unsigned int end, unsigned int worker) {
+    hashtable_migration* migration = (hashtable_migration*) ctx;
+    hashtable_buckets* buckets = migration->buckets;
+    hashtable_buckets* new_buckets = buckets->next;
+    int different_entries = 0, collisions = 0;
+
+    (void) worker;
+
+    for(unsigned int i = begin; i < end; i++) {
+        hashtable_entry* current_entry = buckets->table[i];
+        int moved_entries = 0;
+
+        while(current_entry != NULL) {
+            hashtable_entry* next_entry = current_entry->next;
+            unsigned int hash = hashtable_gethash_len(new_buckets->size, current_entry->key, current_entry->key_len);
+            hashtable_entry* head = __atomic_load_n(&new_buckets->table[hash], __ATOMIC_RELAXED);
+
+            do {
+                __atomic_store_n(&current_entry->next, head, __ATOMIC_RELAXED);
+            } while(!__atomic_compare_exchange_n(&new_buckets->table[hash], &head, current_entry, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+            /* The entries after this one are not pushed by anyone else. */
+            hashtable_boundchain(new_buckets, hashtable_chainlength(current_entry));
+
+            if(head == NULL)
+                different_entries++;
+            else
+                collisions++;
+
+            moved_entries++;
+            current_entry = next_entry;
+        }
+        __atomic_store_n(&buckets->table[i], HASHTABLE_MOVED, __ATOMIC_RELEASE);
+
+        if(moved_entries > 0) {
+            different_entries--;
+            collisions -= moved_entries - 1;
+        }
+    }
+
+    hashtable_counter_shard* shard = hashtable_countershard(migration->htable);
+    __atomic_add_fetch(&shard->value[HASHTABLE_COUNTER_DIFFERENT_ENTRIES], different_entries, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shard->value[HASHTABLE_COUNTER_COLLISIONS], collisions, __ATOMIC_RELAXED);
+}
+
+/* Start to resize a bucket array to 'new_size' buckets, unless some
+   other thread has already started it. Return false if the array
+   cannot be resized because it is pinned (see hashtable_pin), true
+   otherwise.
+   Without synchronization, all the buckets are migrated immediately.
+   With HASHTABLE_RESIZE_STOP, the calling thread acquires every stripe
+   and migrates all the buckets while the other threads wait (in both
+   cases, with the threads of the pool if the table uses more than
+   one for its bulk operations). With
+   HASHTABLE_RESIZE_COOPERATIVE, it migrates only the first chunk: the
+   following ones are migrated by the threads that write to the table,
+   while readers look for their keys in both arrays. */
+static bool hashtable_startresize(hashtable* htable, hashtable_buckets* buckets, unsigned int new_size) {
+    hashtable_buckets* new_buckets = hashtable_newbuckets(htable->syncmode, new_size);
+    hashtable_buckets* expected = NULL;
+
+    /* The check of the snapshots and the start of the resize are
+       atomic with respect to hashtable_snapshot. */
+    pthread_mutex_lock(&htable->views.lock);
+    bool pinned = htable->views.pins > 0;
+    bool started = !pinned && __atomic_compare_exchange_n(&buckets->next, &expected, new_buckets, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&htable->views.lock);
+    if(!started) {
+        hashtable_freebuckets(htable, new_buckets);
+        return !pinned;
+    }
+    HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_RESIZES, 1);
+
+    if(htable->syncmode != HASHTABLE_SYNC_NONE && htable->resizemode == HASHTABLE_RESIZE_COOPERATIVE) {
+        hashtable_transferchunk(htable, buckets);
+        return true;
+    }
+
+    __atomic_store_n(&buckets->transfer_index, buckets->size, __ATOMIC_RELAXED);
+
+    for(unsigned int s = 0; s < HASHTABLE_STRIPES && htable->syncmode != HASHTABLE_SYNC_NONE; s++)
+        hashtable_writelock(htable, buckets, s);
+
+    if(hashtable_threads(htable) > 1) {
+        hashtable_migration migration = {htable, buckets};
+        hashtable_pool_run(hashtable_threads(htable), 0, buckets->size, HASHTABLE_RESIZE_CHUNK, hashtable_migraterange, &migration);
+    } else {
+        for(unsigned int i = 0; i < buckets->size; i++)
+            hashtable_migratebucket(htable, buckets, i, true);
+    }
+
+    for(unsigned int s = 0; s < HASHTABLE_STRIPES && htable->syncmode != HASHTABLE_SYNC_NONE; s++)
+        hashtable_writeunlock(htable, buckets, s);
+
+    buckets->transferred = buckets->size;
+    hashtable_finishresize(htable, buckets);
+
+    return true;
+}
+
+/* Return the current bucket array of an hash table. If it is being
+   resized cooperatively, a chunk of its buckets is migrated first. */
+static hashtable_buckets* hashtable_helpresize(hashtable* htable) {
+    hashtable_buckets* buckets = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE);
+
+    if(htable->resizemode == HASHTABLE_RESIZE_COOPERATIVE && __atomic_load_n(&buckets->next, __ATOMIC_ACQUIRE) != NULL)
+        hashtable_transferchunk(htable, buckets);
+
+    return buckets;
+}
+
+/* Wait for the resize in progress (if any) to be completed, helping
+   to migrate the buckets that are still unclaimed. */
+static void hashtable_completeresize(hashtable* htable) {
+    hashtable_buckets* buckets;
+
+    hashtable_enter(htable);
+    while(__atomic_load_n(&(buckets = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE))->next, __ATOMIC_ACQUIRE) != NULL) {
+        if(!hashtable_transferchunk(htable, buckets))
+            sched_yield();
+    }
+    hashtable_exit(htable);
+}
+
+/* Start a growth of an hash table, doubling its size, if its average
+   number of entries per bucket has exceeded the maximum load. While
+   the bucket array is pinned the growth is only counted in
+   'views.deferred', and it is started when the last pin is released. */
+static void hashtable_grow(hashtable* htable) {
+    hashtable_buckets* buckets = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE);
+
+    if(__atomic_load_n(&buckets->next, __ATOMIC_ACQUIRE) != NULL || buckets->size > 0x7FFFFFFF ||
+       hashtable_count(htable) <= (unsigned long long) htable->max_load * buckets->size)
+        return;
+
+    if(__atomic_load_n(&htable->views.pins, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&htable->views.lock);
+        bool pinned = htable->views.pins > 0;
+        if(pinned)
+            htable->views.deferred++;
+        pthread_mutex_unlock(&htable->views.lock);
+        if(pinned)
+            return;
+    }
+
+    hashtable_startresize(htable, buckets, buckets->size * 2);
+}
+
+static __thread unsigned int growth_checks = 0;
+
+/* Check the growth of an hash table (see hashtable_grow) after an
+   entry has been added. In the concurrent modes counting the entries
+   means summing all the counter shards, so a thread checks only every
+   HASHTABLE_GROWTH_CHECK entries it adds. */
+static void hashtable_checkgrowth(hashtable* htable) {
+    if(htable->max_load == 0)
+        return;
+    if(htable->syncmode != HASHTABLE_SYNC_NONE && ++growth_checks % HASHTABLE_GROWTH_CHECK != 0)
+        return;
+
+    hashtable_grow(htable);
+}
+
+/* Keep the current bucket array of an hash table from being resized
+   (after completing the resize in progress, if any) and return it. The
+   array stays the current one until hashtable_unpin is called. */
+static hashtable_buckets* hashtable_pin(hashtable* htable) {
+    pthread_mutex_lock(&htable->views.lock);
+    htable->views.pins++;
+    pthread_mutex_unlock(&htable->views.lock);
+    hashtable_completeresize(htable);
+
+    return __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE);
+}
+
+/* Allow again the resize of a bucket array pinned by hashtable_pin.
+   The last pin released starts the growth deferred meanwhile, if
+   any. */
+static void hashtable_unpin(hashtable* htable) {
+    pthread_mutex_lock(&htable->views.lock);
+    bool grow = --htable->views.pins == 0 && htable->views.deferred > 0;
+    if(grow)
+        htable->views.deferred = 0;
+    pthread_mutex_unlock(&htable->views.lock);
+
+    if(grow && htable->max_load != 0) {
+        hashtable_enter(htable);
+        hashtable_grow(htable);
+        hashtable_exit(htable);
+    }
+}
+
+/* Resize an hash table to 'new_size' buckets, returning only when the
+   resize has been completed. Return true on success, false otherwise
+   (also while a snapshot of the table is open or a checkpoint is being
+   written). */
+bool hashtable_resize(hashtable* htable, unsigned int new_size) {
+    if(htable == NULL || new_size < 2)
+        return false;
+
+    hashtable_completeresize(htable);
+
+    hashtable_enter(htable);
+    bool resized = hashtable_startresize(htable, __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE), new_size);
+    hashtable_exit(htable);
+
+    hashtable_completeresize(htable);
+
+    return resized;
+}
+
+/* Make an hash table double its size every time its average number
+   of entries per bucket exceeds 'max_load' (0 disables the growth),
+   using the resize strategy 'resizemode' in the concurrent modes.
+   Return true on success, false otherwise. */
+bool hashtable_setgrowth(hashtable* htable, unsigned int max_load, hashtable_resizemode resizemode) {
+    if(htable == NULL || resizemode > HASHTABLE_RESIZE_STOP)
+        return false;
+
+    hashtable_completeresize(htable);
+    htable->max_load = max_load;
+    htable->resizemode = resizemode;
+
+    return true;
+}
+
+/* Change the synchronization mode of an hash table, replacing the
+   lock stripes of its bucket array. It must be called while no other
+   thread is using the table (es. right after its creation). Return
+   true on success, false otherwise. */
+bool hashtable_setsyncmode(hashtable* htable, hashtable_syncmode syncmode) {
+    if(htable == NULL || syncmode > HASHTABLE_SYNC_SEQLOCK)
+        return false;
+
+    hashtable_completeresize(htable);
+
+    /* Without synchronization only the first counter shard is used:
+       gather all the counters there. */
+    for(unsigned int i = 1; i < HASHTABLE_COUNTER_SHARDS; i++) {
+        for(unsigned int c = 0; c < HASHTABLE_COUNTERS; c++) {
+            htable->counters[0].value[c] += htable->counters[i].value[c];
+            htable->counters[i].value[c] = 0;
+        }
+    }
+
+    hashtable_freestripes(htable->syncmode, htable->buckets);
+    htable->syncmode = syncmode;
+    hashtable_newstripes(syncmode, htable->buckets);
+    if(htable->flights != NULL)
+        hashtable_setsyncmode(htable->flights->negative, syncmode);
+
+    return true;
+}
+
+/* Enable (or disable) the flat combining of the writes (insert,
+   delete and increment) of an hash table. It must be called while no
+   other thread is using the table. Return true on success, false
+   otherwise. */
+bool hashtable_setcombining(hashtable* htable, bool enabled) {
+    if(htable == NULL)
+        return false;
+
+    if(!enabled) {
+        free(htable->combiner);
+        htable->combiner = NULL;
+        return true;
+    }
+    if(htable->combiner != NULL)
+        return true;
+
+    if(posix_memalign((void**)&htable->combiner, 64, sizeof(hashtable_combiner)) != 0) {
+        printf("[ERROR] There was an error while trying to call 'posix_memalign' on 'htable->combiner'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(htable->combiner, 0, sizeof(hashtable_combiner));
+
+    return true;
+}
+
+/* Find the bucket of 'key' starting from the bucket array '*buckets'
+   and acquire its stripe as a writer. If the bucket has already been
+   migrated by a resize in progress, the search moves to the new array.
+   Return the bucket, storing its array in '*buckets'. */
+static unsigned int hashtable_writelock_key(hashtable* htable, hashtable_buckets** buckets, const char* key, unsigned int key_len) {
+    while(true) {
+        unsigned int hash = hashtable_gethash_len((*buckets)->size, key, key_len);
+
+        hashtable_writelock(htable, *buckets, hash);
+        if((*buckets)->table[hash] != HASHTABLE_MOVED)
+            return hash;
+        hashtable_writeunlock(htable, *buckets, hash);
+
+        *buckets = __atomic_load_n(&(*buckets)->next, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Same as hashtable_writelock_key, but the stripe is acquired as a
+   reader. */
+static unsigned int hashtable_readlock_key(hashtable* htable, hashtable_buckets** buckets, const char* key, unsigned int key_len) {
+    while(true) {
+        unsigned int hash = hashtable_gethash_len((*buckets)->size, key, key_len);
+
+        hashtable_readlock(htable, *buckets, hash);
+        if((*buckets)->table[hash] != HASHTABLE_MOVED)
+            return hash;
+        hashtable_readunlock(htable, *buckets, hash);
+
+        *buckets = __atomic_load_n(&(*buckets)->next, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Merkle digests.
+   When enabled (see hashtable_setdigests) the keys are split into
+   'digest_leaves' ranges by hashtable_gethash_len(digest_leaves, key),
+   and every range keeps the XOR of the 64 bit digests of its entries
+   (key and value), updated by every write. The ranges are the leaves
+   of a Merkle tree whose inner nodes are the XOR of their children,
+   built only when needed: two tables with the same content have the
+   same tree, and hashtable_diff descends only into the subtrees whose
+   digests differ.
+   Since the bucket of a key is the same hash modulo the size of the
+   table, when the size is a multiple of 'digest_leaves' the entries
+   of range 'l' are all in the buckets l, l + digest_leaves, ... */
+
+/* Return the range of a key, and store its 64 bit hash in 'hash'. */
+static inline unsigned int hashtable_digest_leaf(hashtable* htable, const char* key, unsigned int key_len, unsigned long* hash) {
+    unsigned int leaf = 0, mask = htable->digest_leaves - 1;
+
+    *hash = 14695981039346656037UL;
+    for(unsigned int i = 0; i < key_len; i++) {
+        leaf = ((int)key[i] + (leaf << 5) + leaf) & mask;
+        *hash = (*hash ^ (unsigned char)key[i]) * 1099511628211UL;
+    }
+
+    return leaf;
+}
+
+/* Return the digest of an entry, from the hash of its key and its
+   value (the finalizer of SplitMix64). */
+static inline unsigned long hashtable_digest_entry(unsigned long hash, unsigned int val) {
+    unsigned long digest = hash ^ (val * 0x9E3779B97F4A7C15UL);
+
+    digest = (digest ^ (digest >> 30)) * 0xBF58476D1CE4E5B9UL;
+    digest = (digest ^ (digest >> 27)) * 0x94D049BB133111EBUL;
+
+    return digest ^ (digest >> 31);
+}
+
+/* Update the digest of the range of a key whose value changes from
+   'old_val' to 'new_val' (NULL if the key was not present or has been
+   deleted). Different stripes can share a range, so it is updated
+   atomically in the concurrent modes. */
+static void hashtable_digest_change(hashtable* htable, const char* key, unsigned int key_len, const unsigned int* old_val, const unsigned int* new_val) {
+    unsigned long hash, delta = 0;
+    unsigned int leaf = hashtable_digest_leaf(htable, key, key_len, &hash);
+
+    if(old_val != NULL)
+        delta ^= hashtable_digest_entry(hash, *old_val);
+    if(new_val != NULL)
+        delta ^= hashtable_digest_entry(hash, *new_val);
+
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        htable->digests[leaf] ^= delta;
+    else
+        __atomic_fetch_xor(&htable->digests[leaf], delta, __ATOMIC_RELAXED);
+}
+
+/* Expiration.
+   An entry inserted with a time to live (see hashtable_insert_ttl_len)
+   has a timer with its expiration time. The lookups ignore an expired
+   entry (lazy expiry) and hashtable_expire deletes the expired entries
+   proactively, finding them without any scan of the table: the timers
+   are kept in a hierarchical timer wheel, as the ones of the Linux
+   kernel. Level 'l' has HASHTABLE_WHEEL_SLOTS slots of 256^l
+   milliseconds, and a timer goes in the lowest level that reaches its
+   expiration from the current time; when the wheel has gone through
+   all the slots of a level, the next slot of the level above is
+   cascaded into the lower ones. So adding or removing a timer costs
+   O(1), and a timer is cascaded at most HASHTABLE_WHEEL_LEVELS - 1
+   times. The wheel has its own lock, always acquired after the stripe
+   of the entry: while its timer is in the wheel, an entry cannot be
+   released. */
+
+/* Return the current time, in milliseconds of CLOCK_MONOTONIC. */
+static unsigned long hashtable_millis() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+/* Return true if an entry has expired (the clock is read only for the
+   entries with a timer). It is safe for the lock-free readers, since
+   the timers are retired as the entries. */
+static inline bool hashtable_expired(hashtable_entry* entry) {
+    hashtable_timer* timer = __atomic_load_n(&entry->timer, __ATOMIC_ACQUIRE);
+
+    return timer != NULL && __atomic_load_n(&timer->expires, __ATOMIC_RELAXED) <= hashtable_millis();
+}
+
+/* Put a timer in the slot of a wheel that expires with it (the next
+   one, if its time has already passed). The caller holds the lock of
+   the wheel. */
+static void hashtable_wheel_link(hashtable_wheel* wheel, hashtable_timer* timer) {
+    unsigned long expires = timer->expires < wheel->current ? wheel->current : timer->expires;
+    unsigned long distance = expires - wheel->current;
+    unsigned int level = 0;
+
+    if(distance > 0xFFFFFFFFUL)
+        expires = wheel->current + 0xFFFFFFFFUL;
+    while(level < HASHTABLE_WHEEL_LEVELS - 1 && distance >= 1UL << (HASHTABLE_WHEEL_BITS * (level + 1)))
+        level++;
+
+    hashtable_timer** slot = &wheel->slots[level][(expires >> (HASHTABLE_WHEEL_BITS * level)) & (HASHTABLE_WHEEL_SLOTS - 1)];
+    timer->next = *slot;
+    timer->pprev = slot;
+    if(*slot != NULL)
+        (*slot)->pprev = &timer->next;
+    *slot = timer;
+}
+
+/* Remove a timer from its wheel, if it is there. The caller holds the
+   lock of the wheel. */
+static void hashtable_wheel_unlink(hashtable_wheel* wheel, hashtable_timer* timer) {
+    if(timer->pprev == NULL)
+        return;
+
+    *timer->pprev = timer->next;
+    if(timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+    wheel->count--;
+}
+
+/* Move the timers of the slot 'slot' of the level 'level' of a wheel
+   to the lower levels, and return 'slot'. */
+static unsigned int hashtable_wheel_cascade(hashtable_wheel* wheel, unsigned int level, unsigned int slot) {
+    hashtable_timer* timer = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    while(timer != NULL) {
+        hashtable_timer* next = timer->next;
+        hashtable_wheel_link(wheel, timer);
+        timer = next;
+    }
+
+    return slot;
+}
+
+/* Adapter of free for hashtable_ebr_retire. */
+static void hashtable_freetimer_retired(void* htable, void* timer) {
+    (void) htable;
+
+    free(timer);
+}
+
+/* Set the expiration time of an entry to 'expires' (0 removes it),
+   creating its timer if needed. The caller holds the stripe of the
+   entry. */
+static void hashtable_settimer(hashtable* htable, hashtable_entry* entry, unsigned long expires) {
+    hashtable_wheel* wheel = htable->wheel;
+    hashtable_timer* timer = entry->timer;
+
+    if(timer == NULL && expires == 0)
+        return;
+    if(timer == NULL) {
+        if((timer = (hashtable_timer*)malloc(sizeof(hashtable_timer))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'timer'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        timer->pprev = NULL;
+        timer->entry = entry;
+    }
+
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_lock(&wheel->lock);
+    hashtable_wheel_unlink(wheel, timer);
+    if(expires != 0) {
+        __atomic_store_n(&timer->expires, expires, __ATOMIC_RELAXED);
+        hashtable_wheel_link(wheel, timer);
+        wheel->count++;
+    }
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_unlock(&wheel->lock);
+
+    if(expires != 0) {
+        __atomic_store_n(&entry->timer, timer, __ATOMIC_RELEASE);
+        return;
+    }
+
+    /* A lock-free reader could still be checking the timer. */
+    __atomic_store_n(&entry->timer, NULL, __ATOMIC_RELAXED);
+    if(htable->syncmode == HASHTABLE_SYNC_SEQLOCK)
+        hashtable_ebr_retire(hashtable_freetimer_retired, htable, timer);
+    else
+        free(timer);
+}
+
+/* Snapshots.
+   hashtable_snapshot opens a read-only view of an hash table as it is
+   at that moment, while the writers keep changing it. Opening a view
+   only takes a generation number: the buckets are copied on write.
+   The first write to a bucket after a snapshot saves a copy of its
+   chaining list (a version) before changing it, and a view reads, for
+   every bucket, the oldest version saved after the view was opened
+   or, if there is none, the bucket itself, which has not changed
+   since. The versions of a bucket are pushed on the head of its list
+   while its stripe is held, and read with the stripe held, so a view
+   never sees a bucket in the middle of a write. A write that checked
+   for views just before a snapshot still holds its stripe: the view,
+   like any other reader, waits for it, so the write precedes the
+   snapshot. When a view is released the versions that no open view
+   can read anymore are released as well: without views, a write only
+   checks a counter. The list heads of a bucket array are allocated by
+   its first version. While a view is open its bucket array is not
+   resized: the growth is deferred until the last view is released. */
+
+/* Return a private copy of the chaining list that starts with
+   'entry': keys and expiration times are copied too. */
+static hashtable_entry* hashtable_copychain(hashtable_entry* entry, unsigned long* copies) {
+    hashtable_entry* head = NULL;
+    hashtable_entry** tail = &head;
+
+    for(; entry != NULL; entry = entry->next) {
+        hashtable_entry* copy = hashtable_newentry_len(entry->key, entry->key_len, entry->val);
+
+        if(entry->timer != NULL) {
+            if((copy->timer = (hashtable_timer*)calloc(1, sizeof(hashtable_timer))) == NULL) {
+                printf("[ERROR] There was an error while trying to call 'calloc' on 'copy->timer'. Closing...\n");
+                exit(EXIT_FAILURE);
+            }
+            copy->timer->entry = copy;
+            copy->timer->expires = entry->timer->expires;
+        }
+        *tail = copy;
+        tail = &copy->next;
+        (*copies)++;
+    }
+
+    return head;
+}
+
+/* Release a version of a bucket, with its copy of the chaining list. */
+static void hashtable_freeversion(hashtable_version* version) {
+    hashtable_entry* entry = version->entries;
+
+    while(entry != NULL) {
+        hashtable_entry* next_entry = entry->next;
+        free(entry->timer);
+        erease(entry->key, entry->key_len + 1);
+        erease(entry, sizeof(hashtable_entry));
+        entry = next_entry;
+    }
+    free(version);
+}
+
+/* Save a version of the bucket 'hash' of a bucket array, which is
+   about to be written, if a view opened since its last version could
+   read it. The caller must hold the stripe of the bucket. */
+static void hashtable_preserve(hashtable* htable, hashtable_buckets* buckets, unsigned int hash) {
+    hashtable_views* views = &htable->views;
+    unsigned long generation = __atomic_load_n(&views->generation, __ATOMIC_ACQUIRE);
+    hashtable_version** versions = __atomic_load_n(&buckets->versions, __ATOMIC_ACQUIRE);
+
+    /* The writers of different stripes can race to allocate the heads. */
+    if(versions == NULL) {
+        hashtable_version** expected = NULL;
+
+        if((versions = (hashtable_version**)calloc(buckets->size, sizeof(hashtable_version*))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'calloc' on 'versions'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        if(!__atomic_compare_exchange_n(&buckets->versions, &expected, versions, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(versions);
+            versions = expected;
+        }
+    }
+    hashtable_version* head = versions[hash];
+    if(head != NULL && head->generation >= generation)
+        return;
+
+    hashtable_version* version;
+    unsigned long copies = 0;
+
+    if((version = (hashtable_version*)malloc(sizeof(hashtable_version))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'version'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    version->entries = hashtable_copychain(buckets->table[hash], &copies);
+    version->bucket = hash;
+    version->next = head;
+    version->newer = NULL;
+
+    /* The last view could have been released meanwhile. A view opened
+       meanwhile reads this version too: the bucket has not changed
+       since it was opened, since the stripe is held. */
+    pthread_mutex_lock(&views->lock);
+    if(views->active == 0) {
+        pthread_mutex_unlock(&views->lock);
+        hashtable_freeversion(version);
+        return;
+    }
+    version->generation = views->generation;
+    if(views->newest != NULL)
+        views->newest->newer = version;
+    else
+        views->oldest = version;
+    views->newest = version;
+    views->versions++;
+    views->copies += copies;
+    __atomic_store_n(&versions[hash], version, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&views->lock);
+}
+
+/* Return the chaining list of the bucket 'hash' as seen by a view:
+   the oldest version saved after the view was opened, if any, or the
+   bucket itself. The caller must hold the stripe of the bucket (or be
+   the child of hashtable_bgsave, whose image of the table is frozen). */
+static hashtable_entry* hashtable_viewchain(hashtable_view* view, unsigned int hash) {
+    hashtable_version** versions = __atomic_load_n(&view->buckets->versions, __ATOMIC_ACQUIRE);
+    hashtable_version* found = NULL;
+
+    for(hashtable_version* version = versions != NULL ? versions[hash] : NULL; version != NULL && version->generation >= view->generation; version = version->next)
+        found = version;
+
+    return found != NULL ? found->entries : view->buckets->table[hash];
+}
+
+/* Return true if an entry read through a view had not expired when
+   the view was opened. */
+static inline bool hashtable_viewvisible(hashtable_view* view, hashtable_entry* entry) {
+    return entry->timer == NULL || entry->timer->expires > view->time;
+}
+
+/* Publish a view of the bucket array 'buckets', which the caller has
+   pinned: from now on the writers save the buckets before changing
+   them. */
+static void hashtable_openview(hashtable* htable, hashtable_view* view, hashtable_buckets* buckets) {
+    hashtable_views* views = &htable->views;
+
+    view->htable = htable;
+    view->buckets = buckets;
+    view->time = hashtable_millis();
+
+    /* The writers see the view as soon as 'active' is incremented. */
+    pthread_mutex_lock(&views->lock);
+    view->generation = __atomic_add_fetch(&views->generation, 1, __ATOMIC_ACQ_REL);
+    view->next = views->open;
+    views->open = view;
+    __atomic_add_fetch(&views->active, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&views->lock);
+}
+
+/* Add a new entry to the sampling index of an hash table, if enabled.
+   The index has its own lock, always acquired after the stripe of the
+   entry. */
+static void hashtable_sampler_add(hashtable* htable, hashtable_entry* entry) {
+    hashtable_sampler* sampler = htable->sampler;
+
+    if(sampler == NULL)
+        return;
+
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_lock(&sampler->lock);
+    if(sampler->count == sampler->size) {
+        sampler->size = sampler->size == 0 ? 1024 : sampler->size * 2;
+        if((sampler->entries = (hashtable_entry**)realloc(sampler->entries, sizeof(hashtable_entry*) * sampler->size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'sampler->entries'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    entry->sample_index = sampler->count;
+    sampler->entries[sampler->count++] = entry;
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_unlock(&sampler->lock);
+}
+
+/* Remove an entry from the sampling index of an hash table, if
+   enabled, moving the last entry of the index in its place. */
+static void hashtable_sampler_remove(hashtable* htable, hashtable_entry* entry) {
+    hashtable_sampler* sampler = htable->sampler;
+
+    if(sampler == NULL)
+        return;
+
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_lock(&sampler->lock);
+    hashtable_entry* last = sampler->entries[--sampler->count];
+    sampler->entries[entry->sample_index] = last;
+    last->sample_index = entry->sample_index;
+    if(htable->syncmode != HASHTABLE_SYNC_NONE)
+        pthread_mutex_unlock(&sampler->lock);
+}
+
+/* Insert a new entry (or, if already present, update it) in the
+   bucket 'hash' of a bucket array, expiring at the time 'expires' (0:
+   never), and return the entry just inserted/updated, setting 'added'
+   to true if it is a new one. The caller must hold the stripe of the
+   bucket.
+   New entries are published with a release store, so that a
+   lock-free reader that finds them also sees them initialized. */
+static hashtable_entry* hashtable_insert_bucket(hashtable* htable, hashtable_buckets* buckets, unsigned int hash, const char* key, unsigned int key_len, unsigned int val, unsigned long expires, bool* added) {
+    hashtable_entry* current_entry = buckets->table[hash];
+    
+    *added = true;
+    if(__atomic_load_n(&htable->views.active, __ATOMIC_ACQUIRE) != 0)
+        hashtable_preserve(htable, buckets, hash);
+
+    /* Check if the new entry is the first one with that hash value, then
+       add it as the head of the chaining list. */
+    if(current_entry == NULL) {
+        hashtable_entry* new_entry = hashtable_allocentry(htable, key, key_len, val);
+        if(expires != 0)
+            hashtable_settimer(htable, new_entry, expires);
+        hashtable_sampler_add(htable, new_entry);
+        hashtable_boundchain(buckets, 1);
+        __atomic_store_n(&buckets->table[hash], new_entry, __ATOMIC_RELEASE);
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_DIFFERENT_ENTRIES, 1);
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_INSERTS, 1);
+        if(htable->digests != NULL)
+            hashtable_digest_change(htable, key, key_len, NULL, &val);
+
+        return new_entry;
+    }
+
+    /* There is already at least one entry with the same hash value. Search
+       if the key is already present in the chaining list. */
+    int found = false;
+    unsigned int length = 1;
+    while(true) {
+        if(hashtable_keyequals(current_entry, key, key_len)) {
+            found = true;
+            break;
+        }
+        if(current_entry->next == NULL)
+            break;
+        
+        current_entry = current_entry->next;
+        length++;
+    }
+    
+    /* The key is already present, so update its value. */
+    if(found) {
+        if(htable->digests != NULL)
+            hashtable_digest_change(htable, key, key_len, &current_entry->val, &val);
+        __atomic_store_n(&current_entry->val, val, __ATOMIC_RELAXED);
+        hashtable_settimer(htable, current_entry, expires);
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_UPDATES, 1);
+        *added = false;
+
+        return current_entry;
+    }
+
+    /* The key is not present, so insert it at the end of the chaining list. */
+    hashtable_entry* new_entry = hashtable_allocentry(htable, key, key_len, val);
+    if(expires != 0)
+        hashtable_settimer(htable, new_entry, expires);
+    hashtable_sampler_add(htable, new_entry);
+    hashtable_boundchain(buckets, length + 1);
+    __atomic_store_n(&current_entry->next, new_entry, __ATOMIC_RELEASE);
+    HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_COLLISIONS, 1);
+    HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_INSERTS, 1);
+    if(htable->digests != NULL)
+        hashtable_digest_change(htable, key, key_len, NULL, &val);
+
+    return new_entry;
+}
+
+/* Search an entry by 'key' in the bucket 'hash' of a bucket array
+   and delete it if found, storing its value in 'val'. Return true if
+   'key' was found, false otherwise: an expired entry is unlinked too,
+   but as a key that was not found ('val' is left unchanged). The
+   caller must hold the stripe of the bucket. */
+static bool hashtable_delete_bucket(hashtable* htable, hashtable_buckets* buckets, unsigned int hash, const char* key, unsigned int key_len, unsigned int* val) {
+    hashtable_entry* current_entry = buckets->table[hash];
+
+    if(current_entry == NULL) {
+        return false;
+    }
+
+    /* Search the entry in the chaining list */
+    hashtable_entry* previous_entry = current_entry;
+    while(current_entry != NULL && !hashtable_keyequals(current_entry, key, key_len)) {
+        previous_entry = current_entry;
+        current_entry = current_entry->next;
+    }
+    
+    if(current_entry != NULL) {
+        bool expired = hashtable_expired(current_entry);
+
+        if(!expired)
+            *val = current_entry->val;
+        if(htable->digests != NULL)
+            hashtable_digest_change(htable, key, key_len, &current_entry->val, NULL);
+        if(__atomic_load_n(&htable->views.active, __ATOMIC_ACQUIRE) != 0)
+            hashtable_preserve(htable, buckets, hash);
+
+        /* Check if the entry is the head of the chaining list (buckets->table[i]).
+           The removed entry is left untouched, since a lock-free reader
+           could still be traversing it. */
+        if(previous_entry == current_entry) {
+            if(current_entry->next == NULL) {   /* Check if it is the only entry. */
+                __atomic_store_n(&buckets->table[hash], NULL, __ATOMIC_RELAXED);
+                HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_DIFFERENT_ENTRIES, -1);
+            }
+            else {
+                __atomic_store_n(&buckets->table[hash], current_entry->next, __ATOMIC_RELAXED);
+                HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_COLLISIONS, -1);
+            }
+        } else {
+            __atomic_store_n(&previous_entry->next, current_entry->next, __ATOMIC_RELAXED);
+            HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_COLLISIONS, -1);
+        }
+
+        /* Releases the memory of both the string in the entry and the entry itself.*/
+        hashtable_settimer(htable, current_entry, 0);
+        hashtable_sampler_remove(htable, current_entry);
+        hashtable_releaseentry(htable, current_entry);
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_DELETES, 1);
+
+        return !expired;
+    }
+
+    return false;
+}
+
+/* Search an entry by 'key' in the bucket 'hash' of a bucket array
+   and return it if found, NULL otherwise. The caller must hold the
+   stripe of the bucket (as a reader, at least). */
+static hashtable_entry* hashtable_get_bucket(hashtable_buckets* buckets, unsigned int hash, const char* key, unsigned int key_len) {
+    hashtable_entry* current_entry = buckets->table[hash];
+
+    while(true) {
+        /* The end of the chaining list has been reached and the
+           entry was not found. */
+        if(current_entry == NULL)
+            return NULL;
+        if(hashtable_keyequals(current_entry, key, key_len)) {
+            return current_entry;
+        }
+        current_entry = current_entry->next;
+    }
+}
+
+/* Add 'delta' to the value of the entry 'key' in the bucket 'hash' of
+   a bucket array, inserting it with value 'delta' if not present, and
+   return the entry, setting 'added' to true if it is a new one. The
+   caller must hold the stripe of the bucket. */
+static hashtable_entry* hashtable_increment_bucket(hashtable* htable, hashtable_buckets* buckets, unsigned int hash, const char* key, unsigned int key_len, unsigned int delta, bool* added) {
+    hashtable_entry* entry = hashtable_get_bucket(buckets, hash, key, key_len);
+
+    if(entry == NULL)
+        return hashtable_insert_bucket(htable, buckets, hash, key, key_len, delta, 0, added);
+    if(__atomic_load_n(&htable->views.active, __ATOMIC_ACQUIRE) != 0)
+        hashtable_preserve(htable, buckets, hash);
+
+    /* An expired entry starts again from 0, without expiration. */
+    unsigned int val = entry->val + delta;
+    if(hashtable_expired(entry)) {
+        val = delta;
+        hashtable_settimer(htable, entry, 0);
+    }
+    if(htable->digests != NULL)
+        hashtable_digest_change(htable, key, key_len, &entry->val, &val);
+    __atomic_store_n(&entry->val, val, __ATOMIC_RELAXED);
+    HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_UPDATES, 1);
+    *added = false;
+
+    return entry;
+}
+
+/* Write-ahead log.
+   Every insert (or increment) and delete of a table with a log is
+   recorded, while the stripe of its bucket is still held (so that the
+   records of a key are in the same order as its writes), as a compact
+   binary record:
+       op (1 byte), key length (varint), value (varint, inserts only),
+       expiration (8 bytes, little endian, HASHTABLE_WAL_INSERT_TTL
+       only), key, CRC-32 of all the previous bytes (4 bytes, little
+       endian).
+   The expiration of a key is stored as wall-clock milliseconds since
+   the epoch, since the timers of the entries count the milliseconds of
+   CLOCK_MONOTONIC, which start again at every boot: a key replayed
+   after its expiration is deleted.
+   The writer then waits for the record to be durable as required by
+   the policy of the log. After a crash the table is rebuilt replaying
+   the log: a record cut by the crash fails its checksum, and the log
+   is truncated there. A failed sync is latched: from then on the
+   writers do not wait for durability any more, and hashtable_wal_sync
+   and hashtable_wal_close return false. */
+
+static unsigned int crc32_table[256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void hashtable_crc32_init() {
+    for(unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        crc32_table[i] = crc;
+    }
+}
+
+/* Update the CRC-32 'crc' (0 at the beginning) with 'len' bytes. */
+unsigned int hashtable_crc32(unsigned int crc, const void* data, size_t len) {
+    const unsigned char* bytes = (const unsigned char*) data;
+
+    pthread_once(&crc32_once, hashtable_crc32_init);
+
+    crc = ~crc;
+    for(size_t i = 0; i < len; i++)
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+/* Write 'n' as a varint (7 bits per byte, least significant first) and
+   return the number of bytes written. */
+static unsigned int hashtable_putvarint(unsigned char* out, unsigned int n) {
+    unsigned int len = 0;
+
+    while(n >= 0x80) {
+        out[len++] = (unsigned char)(n | 0x80);
+        n >>= 7;
+    }
+    out[len++] = (unsigned char) n;
+
+    return len;
+}
+
+/* Read a varint from 'in' (at most 'avail' bytes) into 'n' and return
+   the number of bytes read, 0 if it is not valid. */
+static unsigned int hashtable_getvarint(const unsigned char* in, size_t avail, unsigned int* n) {
+    *n = 0;
+    for(unsigned int i = 0; i < 5 && i < avail; i++) {
+        *n |= (unsigned int)(in[i] & 0x7F) << (7 * i);
+        if((in[i] & 0x80) == 0)
+            return i + 1;
+    }
+
+    return 0;
+}
+
+/* Return the wall-clock time, in milliseconds since the epoch. */
+static unsigned long hashtable_wallmillis() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+}
+
+/* Encode a record: store in 'header' (at least HASHTABLE_WAL_OVERHEAD
+   - 4 bytes) the bytes that precede the key, in 'trailer' the checksum
+   that follows it, and return the length of the header. 'expires' is
+   the expiration time of a HASHTABLE_WAL_INSERT_TTL record, in
+   milliseconds of CLOCK_MONOTONIC as the timers. */
+static unsigned int hashtable_wal_record(unsigned char* header, unsigned char* trailer, hashtable_walop op, const char* key, unsigned int key_len, unsigned int val, unsigned long expires) {
+    unsigned int header_len = 0;
+
+    header[header_len++] = (unsigned char) op;
+    header_len += hashtable_putvarint(header + header_len, key_len);
+    if(op == HASHTABLE_WAL_INSERT || op == HASHTABLE_WAL_INSERT_TTL)
+        header_len += hashtable_putvarint(header + header_len, val);
+    if(op == HASHTABLE_WAL_INSERT_TTL) {
+        unsigned long wall = expires - hashtable_millis() + hashtable_wallmillis();
+
+        for(unsigned int i = 0; i < 8; i++)
+            header[header_len++] = (unsigned char)(wall >> (8 * i));
+    }
+
+    unsigned int crc = hashtable_crc32(hashtable_crc32(0, header, header_len), key, key_len);
+    trailer[0] = crc & 0xFF;
+    trailer[1] = (crc >> 8) & 0xFF;
+    trailer[2] = (crc >> 16) & 0xFF;
+    trailer[3] = crc >> 24;
+
+    return header_len;
+}
+
+/* Write a group of records: take the buffer of a log, write it out of
+   the lock and, if 'sync', make it durable. The caller holds the lock
+   of the log; only one thread at a time writes a group. A failed
+   fdatasync is latched in 'failed' and the group is not counted as
+   synced: after it the kernel may have dropped the pages, so no record
+   of the log can be reported durable any more. */
+static void hashtable_wal_flush(hashtable_wal* wal, bool sync) {
+    while(wal->flushing)
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    if(wal->buffer_len == 0 && (!sync || wal->synced == wal->appended))
+        return;
+
+    char* data = wal->buffer;
+    size_t len = wal->buffer_len, size = wal->buffer_size;
+    unsigned long target = wal->appended;
+
+    wal->buffer = wal->spare;
+    wal->buffer_size = wal->spare_size;
+    wal->buffer_len = 0;
+    wal->flushing = true;
+    pthread_mutex_unlock(&wal->lock);
+
+    for(size_t written = 0; written < len; ) {
+        ssize_t result = write(wal->fd, data + written, len - written);
+
+        if(result < 0 && errno != EINTR) {
+            printf("[ERROR] There was an error while trying to call 'write' on the write-ahead log. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        written += result > 0 ? result : 0;
+    }
+    bool synced = sync && fdatasync(wal->fd) == 0;
+
+    pthread_mutex_lock(&wal->lock);
+    wal->spare = data;
+    wal->spare_size = size;
+    wal->flushing = false;
+    if(sync) {
+        wal->syncs++;
+        if(!synced)
+            wal->failed = true;
+        else if(!wal->failed)
+            wal->synced = target;
+    }
+    pthread_cond_broadcast(&wal->cond);
+}
+
+/* Append a record to a log and return its sequence number (from 1). */
+static unsigned long hashtable_wal_append(hashtable_wal* wal, hashtable_walop op, const char* key, unsigned int key_len, unsigned int val, unsigned long expires) {
+    unsigned char header[HASHTABLE_WAL_OVERHEAD - 4], trailer[4];
+    unsigned int header_len = hashtable_wal_record(header, trailer, op, key, key_len, val, expires);
+    size_t record_len = header_len + key_len + 4;
+
+    pthread_mutex_lock(&wal->lock);
+    if(wal->buffer_len + record_len > wal->buffer_size) {
+        while(wal->buffer_len + record_len > wal->buffer_size)
+            wal->buffer_size = wal->buffer_size == 0 ? 4096 : wal->buffer_size * 2;
+        if((wal->buffer = (char*)realloc(wal->buffer, wal->buffer_size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'wal->buffer'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(wal->buffer + wal->buffer_len, header, header_len);
+    memcpy(wal->buffer + wal->buffer_len + header_len, key, key_len);
+    memcpy(wal->buffer + wal->buffer_len + header_len + key_len, trailer, 4);
+    wal->buffer_len += record_len;
+    unsigned long lsn = ++wal->appended;
+    pthread_mutex_unlock(&wal->lock);
+
+    return lsn;
+}
+
+/* Wait for the record 'lsn' of a log to be durable, as required by its
+   policy. With HASHTABLE_WAL_SYNC_ALWAYS, the first waiter writes and
+   syncs all the records appended so far, while the others wait for it:
+   a single fdatasync makes a whole group durable. Return false if the
+   log has failed (see hashtable_wal_flush), true otherwise. */
+static bool hashtable_wal_commit(hashtable_wal* wal, unsigned long lsn) {
+    if(lsn == 0)
+        return true;
+
+    pthread_mutex_lock(&wal->lock);
+    if(wal->policy == HASHTABLE_WAL_SYNC_ALWAYS) {
+        while(wal->synced < lsn && !wal->failed) {
+            if(wal->flushing)
+                pthread_cond_wait(&wal->cond, &wal->lock);
+            else
+                hashtable_wal_flush(wal, true);
+        }
+    } else if(wal->buffer_len >= HASHTABLE_WAL_BUFFER && !wal->flushing) {
+        hashtable_wal_flush(wal, false);
+    }
+    bool success = !wal->failed;
+    pthread_mutex_unlock(&wal->lock);
+
+    return success;
+}
+
+/* Main function of the thread that syncs a log periodically
+   (HASHTABLE_WAL_SYNC_INTERVAL). It waits on its own condition, so
+   that the groups written meanwhile do not wake it up before the
+   interval has elapsed. */
+static void* hashtable_wal_flusher(void* arg) {
+    hashtable_wal* wal = (hashtable_wal*) arg;
+
+    pthread_mutex_lock(&wal->lock);
+    while(!wal->stop) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wal->interval_ms / 1000;
+        deadline.tv_nsec += (long)(wal->interval_ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        while(!wal->stop && pthread_cond_timedwait(&wal->flusher_cond, &wal->lock, &deadline) != ETIMEDOUT);
+        if(!wal->stop)
+            hashtable_wal_flush(wal, true);
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return NULL;
+}
+
+/* Open (or create) the write-ahead log 'path', appending new records
+   after the existing ones, with the durability policy 'policy'
+   ('interval_ms' is the sync interval of HASHTABLE_WAL_SYNC_INTERVAL).
+   A log with records must be replayed (see hashtable_wal_replay)
+   before being opened. Return the log, or NULL on error. */
+hashtable_wal* hashtable_wal_open(const char* path, hashtable_walsync policy, unsigned int interval_ms) {
+    if(path == NULL || policy > HASHTABLE_WAL_SYNC_NEVER || (policy == HASHTABLE_WAL_SYNC_INTERVAL && interval_ms == 0))
+        return NULL;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return NULL;
+
+    hashtable_wal* wal;
+    if((wal = (hashtable_wal*)calloc(1, sizeof(hashtable_wal))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'wal'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    wal->fd = fd;
+    if((wal->path = strdup(path)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'strdup' on 'wal->path'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    wal->policy = policy;
+    wal->interval_ms = interval_ms;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->cond, NULL);
+    pthread_cond_init(&wal->flusher_cond, NULL);
+
+    if(policy == HASHTABLE_WAL_SYNC_INTERVAL) {
+        if(pthread_create(&wal->flusher, NULL, hashtable_wal_flusher, wal) != 0) {
+            printf("[ERROR] There was an error while trying to call 'pthread_create' on 'wal->flusher'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        wal->has_flusher = true;
+    }
+
+    return wal;
+}
+
+/* Write and sync all the records appended to a log. Return true on
+   success, false otherwise (also if a previous sync has failed). */
+bool hashtable_wal_sync(hashtable_wal* wal) {
+    if(wal == NULL)
+        return false;
+
+    pthread_mutex_lock(&wal->lock);
+    hashtable_wal_flush(wal, true);
+    bool success = !wal->failed;
+    pthread_mutex_unlock(&wal->lock);
+
+    return success;
+}
+
+/* Sync and close a log. No table must be using it any more. Return
+   true if all its records are durable, false otherwise. */
+bool hashtable_wal_close(hashtable_wal* wal) {
+    if(wal == NULL)
+        return false;
+
+    if(wal->has_flusher) {
+        pthread_mutex_lock(&wal->lock);
+        wal->stop = true;
+        pthread_cond_signal(&wal->flusher_cond);
+        pthread_mutex_unlock(&wal->lock);
+        pthread_join(wal->flusher, NULL);
+    }
+    bool success = hashtable_wal_sync(wal);
+
+    close(wal->fd);
+    pthread_cond_destroy(&wal->flusher_cond);
+    pthread_cond_destroy(&wal->cond);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->buffer);
+    free(wal->spare);
+    free(wal->path);
+    free(wal);
+
+    return success;
+}
+
+/* Encode a record into 'out', which must have room for 'key_len' +
+   HASHTABLE_WAL_OVERHEAD bytes, and return its length (0 for an
+   HASHTABLE_WAL_INSERT_TTL, see hashtable_wal_encode_entry). */
+unsigned int hashtable_wal_encode(char* out, hashtable_walop op, const char* key, unsigned int key_len, unsigned int val) {
+    if(out == NULL || op < HASHTABLE_WAL_INSERT || op > HASHTABLE_WAL_CLEAR)
+        return 0;
+
+    unsigned char header[HASHTABLE_WAL_OVERHEAD - 4], trailer[4];
+    unsigned int header_len = hashtable_wal_record(header, trailer, op, key, key_len, val, 0);
+
+    memcpy(out, header, header_len);
+    memcpy(out + header_len, key, key_len);
+    memcpy(out + header_len + key_len, trailer, 4);
+
+    return header_len + key_len + 4;
+}
+
+/* Return the type of the record that inserts 'entry', storing in
+   'expires' its expiration time if it has one. The caller holds the
+   stripe of the entry, or no writer is running. */
+static hashtable_walop hashtable_wal_entryop(hashtable_entry* entry, unsigned long* expires) {
+    hashtable_timer* timer = __atomic_load_n(&entry->timer, __ATOMIC_ACQUIRE);
+
+    *expires = timer != NULL ? __atomic_load_n(&timer->expires, __ATOMIC_RELAXED) : 0;
+
+    return timer != NULL ? HASHTABLE_WAL_INSERT_TTL : HASHTABLE_WAL_INSERT;
+}
+
+/* Encode into 'out', which must have room for the key of the entry +
+   HASHTABLE_WAL_OVERHEAD bytes, the record that inserts 'entry' (with
+   its expiration, if it has one), and return its length. */
+unsigned int hashtable_wal_encode_entry(char* out, hashtable_entry* entry) {
+    if(out == NULL || entry == NULL)
+        return 0;
+
+    unsigned long expires;
+    hashtable_walop op = hashtable_wal_entryop(entry, &expires);
+    unsigned char header[HASHTABLE_WAL_OVERHEAD - 4], trailer[4];
+    unsigned int header_len = hashtable_wal_record(header, trailer, op, entry->key, entry->key_len, entry->val, expires);
+
+    memcpy(out, header, header_len);
+    memcpy(out + header_len, entry->key, entry->key_len);
+    memcpy(out + header_len + entry->key_len, trailer, 4);
+
+    return header_len + entry->key_len + 4;
+}
+
+/* Apply to an hash table the complete records in 'data[0, len)', es.
+   a stream of records received from another process. Store in
+   '*consumed' the bytes of the records applied: the rest is an
+   incomplete record, or a corrupted one if '*corrupted' (which can be
+   NULL) is set. Return the number of records applied. */
+long hashtable_wal_apply(hashtable* htable, const char* data, size_t len, size_t* consumed, bool* corrupted) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    bool invalid = false;
+    long records = 0;
+    size_t valid = 0;
+
+    if(htable == NULL || (data == NULL && len > 0))
+        return -1;
+
+    while(valid < len) {
+        unsigned int key_len, val = 0, varint_len;
+        unsigned long wall = 0;
+        size_t pos = valid;
+        hashtable_walop op = (hashtable_walop) bytes[pos++];
+
+        if(op < HASHTABLE_WAL_INSERT || op > HASHTABLE_WAL_INSERT_TTL) {
+            invalid = true;
+            break;
+        }
+        if((varint_len = hashtable_getvarint(bytes + pos, len - pos, &key_len)) == 0) {
+            invalid = len - pos >= 5;
+            break;
+        }
+        pos += varint_len;
+        if(op == HASHTABLE_WAL_INSERT || op == HASHTABLE_WAL_INSERT_TTL) {
+            if((varint_len = hashtable_getvarint(bytes + pos, len - pos, &val)) == 0) {
+                invalid = len - pos >= 5;
+                break;
+            }
+            pos += varint_len;
+        }
+        if(op == HASHTABLE_WAL_INSERT_TTL) {
+            if(len - pos < 8)
+                break;
+            for(unsigned int i = 0; i < 8; i++)
+                wall |= (unsigned long) bytes[pos + i] << (8 * i);
+            pos += 8;
+        }
+        if(len - pos < (size_t) key_len + 4)
+            break;
+
+        const char* key = data + pos;
+        const unsigned char* trailer = bytes + pos + key_len;
+        unsigned int crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned int) trailer[3] << 24);
+        if(hashtable_crc32(0, bytes + valid, pos - valid + key_len) != crc) {
+            invalid = true;
+            break;
+        }
+
+        /* A key that has expired in the meantime is deleted. */
+        unsigned long now = hashtable_wallmillis();
+        if(op == HASHTABLE_WAL_INSERT)
+            hashtable_insert_len(htable, key, key_len, val);
+        else if(op == HASHTABLE_WAL_INSERT_TTL && wall > now)
+            hashtable_insert_ttl_len(htable, key, key_len, val, wall - now < UINT_MAX ? (unsigned int)(wall - now) : UINT_MAX);
+        else if(op == HASHTABLE_WAL_DELETE || op == HASHTABLE_WAL_INSERT_TTL)
+            hashtable_delete_len(htable, key, key_len);
+        else
+            hashtable_clear(htable);
+        records++;
+        valid = pos + key_len + 4;
+    }
+
+    if(consumed != NULL)
+        *consumed = valid;
+    if(corrupted != NULL)
+        *corrupted = invalid;
+
+    return records;
+}
+
+/* Rebuild the content of an hash table replaying the write-ahead log
+   'path'. The replay stops at the first record that is not complete
+   or fails its checksum (es. cut by a crash), and the log is
+   truncated there, so that new records follow the last valid one.
+   Return the number of records replayed (0 if the log does not
+   exist), -1 on error. */
+long hashtable_wal_replay(hashtable* htable, const char* path) {
+    if(htable == NULL || path == NULL)
+        return -1;
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if(fd < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    struct stat info;
+    if(fstat(fd, &info) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = info.st_size;
+    unsigned char* data = NULL;
+    if(size > 0 && (data = (unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    /* The replayed writes must not be logged again. */
+    hashtable_wal* wal = htable->wal;
+    htable->wal = NULL;
+
+    size_t valid = 0;
+    long records = size > 0 ? hashtable_wal_apply(htable, (const char*) data, size, &valid, NULL) : 0;
+
+    htable->wal = wal;
+
+    /* Drop the invalid tail, if any. */
+    if(size > 0)
+        munmap(data, size);
+    if(valid < size && ftruncate(fd, valid) < 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    return records;
+}
+
+/* Make an hash table log its writes to 'wal' (NULL disables the log).
+   It must be called while no other thread is using the table. Return
+   true on success, false otherwise. */
+bool hashtable_setwal(hashtable* htable, hashtable_wal* wal) {
+    if(htable == NULL)
+        return false;
+
+    htable->wal = wal;
+
+    return true;
+}
+
+/* Snapshots.
+   A snapshot is a file of HASHTABLE_WAL_INSERT (or, for the keys that
+   expire, HASHTABLE_WAL_INSERT_TTL) records, one per entry,
+   so it is loaded with hashtable_wal_replay. It is written to
+   "<path>.tmp" and then renamed, so that 'path' is always either the
+   previous snapshot or the complete new one.
+   To take a consistent image of the table, every stripe of every
+   bucket array (old and new, if a resize is in progress) is acquired:
+   no write can be half done. hashtable_save writes the snapshot while
+   holding them. hashtable_bgsave holds them only to open a view (see
+   hashtable_snapshot) and releases them before the fork(): the child
+   writes the view from its copy-on-write image of the memory while the
+   parent goes on serving. A write in progress during the fork() has
+   saved its bucket before changing it, so the child reads the view
+   without locks. It must not take any: it inherits, locked forever,
+   every mutex held by the other threads of the parent at the time of
+   the fork() (stripes, log, arena), since no handler is registered
+   with pthread_atfork. */
+
+/* Acquire every stripe of every bucket array of an hash table, so
+   that no write is in progress, storing in '*last' the last array
+   locked. Return the first one. The caller must be in an EBR critical
+   section. */
+static hashtable_buckets* hashtable_lockall(hashtable* htable, hashtable_buckets** last) {
+    hashtable_buckets* first = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE);
+
+    *last = NULL;
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        return first;
+
+    for(hashtable_buckets* buckets = first; buckets != NULL; buckets = __atomic_load_n(&buckets->next, __ATOMIC_ACQUIRE)) {
+        for(unsigned int s = 0; s < HASHTABLE_STRIPES; s++)
+            hashtable_writelock(htable, buckets, s);
+        *last = buckets;
+    }
+    pthread_mutex_lock(&htable->arena_lock);
+
+    return first;
+}
+
+/* Release the stripes acquired by hashtable_lockall. */
+static void hashtable_unlockall(hashtable* htable, hashtable_buckets* first, hashtable_buckets* last) {
+    if(htable->syncmode == HASHTABLE_SYNC_NONE)
+        return;
+
+    pthread_mutex_unlock(&htable->arena_lock);
+    for(hashtable_buckets* buckets = first; buckets != NULL; buckets = buckets->next) {
+        for(unsigned int s = 0; s < HASHTABLE_STRIPES; s++)
+            hashtable_writeunlock(htable, buckets, s);
+        if(buckets == last)
+            break;
+    }
+}
+
+/* Structure that holds a snapshot file being written. */
+typedef struct hashtable_snapfile_t {
+    int fd;                         /* Temporary file, renamed at the end */
+    char* tmp_path;
+    char* buffer;                   /* Records not yet written */
+    size_t buffer_len;
+    size_t buffer_size;
+    unsigned long entries;          /* Number of entries added */
+    bool success;                   /* False after a write error */
+} hashtable_snapfile;
+
+/* Create the temporary file of a snapshot that will be stored in
+   'path'. Return true on success, false otherwise. */
+static bool hashtable_snapfile_open(hashtable_snapfile* file, const char* path) {
+    size_t path_len = strlen(path);
+
+    memset(file, 0, sizeof(hashtable_snapfile));
+    if((file->tmp_path = (char*)malloc(path_len + 5)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'file->tmp_path'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(file->tmp_path, path, path_len);
+    memcpy(file->tmp_path + path_len, ".tmp", 5);
+
+    if((file->fd = open(file->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        free(file->tmp_path);
+        return false;
+    }
+
+    file->buffer_size = HASHTABLE_WAL_BUFFER;
+    if((file->buffer = (char*)malloc(file->buffer_size)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'file->buffer'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    file->success = true;
+
+    return true;
+}
+
+/* Add an entry to a snapshot, in memory only (see
+   hashtable_snapfile_drain), so that it can be called while holding a
+   stripe. An expired entry is left out. */
+static void hashtable_snapfile_add(hashtable_snapfile* file, hashtable_entry* entry) {
+    if(hashtable_expired(entry))
+        return;
+
+    unsigned long expires;
+    hashtable_walop op = hashtable_wal_entryop(entry, &expires);
+    unsigned char header[HASHTABLE_WAL_OVERHEAD - 4], trailer[4];
+    unsigned int header_len = hashtable_wal_record(header, trailer, op, entry->key, entry->key_len, entry->val, expires);
+    size_t record_len = header_len + entry->key_len + 4;
+
+    if(file->buffer_len + record_len > file->buffer_size) {
+        while(file->buffer_len + record_len > file->buffer_size)
+            file->buffer_size *= 2;
+        if((file->buffer = (char*)realloc(file->buffer, file->buffer_size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'file->buffer'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(file->buffer + file->buffer_len, header, header_len);
+    memcpy(file->buffer + file->buffer_len + header_len, entry->key, entry->key_len);
+    memcpy(file->buffer + file->buffer_len + header_len + entry->key_len, trailer, 4);
+    file->buffer_len += record_len;
+    file->entries++;
+}
+
+/* Write the entries added to a snapshot, if they are at least 'min'
+   bytes. */
+static void hashtable_snapfile_drain(hashtable_snapfile* file, size_t min) {
+    if(file->buffer_len < min || file->buffer_len == 0)
+        return;
+
+    if(file->success && write(file->fd, file->buffer, file->buffer_len) != (ssize_t) file->buffer_len)
+        file->success = false;
+    file->buffer_len = 0;
+}
+
+/* Complete a snapshot: write and sync its temporary file and, if
+   there were no errors, rename it to 'path' (otherwise it is
+   removed). Return true on success, false otherwise. */
+static bool hashtable_snapfile_close(hashtable_snapfile* file, const char* path) {
+    hashtable_snapfile_drain(file, 0);
+    if(file->success && fdatasync(file->fd) < 0)
+        file->success = false;
+    close(file->fd);
+
+    if(file->success && rename(file->tmp_path, path) < 0)
+        file->success = false;
+    if(!file->success)
+        unlink(file->tmp_path);
+
+    free(file->buffer);
+    free(file->tmp_path);
+
+    return file->success;
+}
+
+/* Write a snapshot of the entries of the bucket array 'first' (and of
+   the arrays that are replacing it) to 'path', storing in '*written'
+   the number of entries written so far. Return true on success,
+   false otherwise. */
+static bool hashtable_writesnapshot(hashtable_buckets* first, const char* path, unsigned long* written) {
+    hashtable_snapfile file;
+
+    if(!hashtable_snapfile_open(&file, path))
+        return false;
+
+    for(hashtable_buckets* buckets = first; buckets != NULL && file.success; buckets = buckets->next) {
+        for(unsigned int i = 0; i < buckets->size && file.success; i++) {
+            /* The entries of a migrated bucket are in the next array. */
+            if(buckets->table[i] == HASHTABLE_MOVED)
+                continue;
+
+            for(hashtable_entry* current_entry = buckets->table[i]; current_entry != NULL; current_entry = current_entry->next)
+                hashtable_snapfile_add(&file, current_entry);
+            hashtable_snapfile_drain(&file, HASHTABLE_WAL_BUFFER);
+
+            if((i & 1023) == 0)
+                __atomic_store_n(written, file.entries, __ATOMIC_RELAXED);
+        }
+    }
+
+    bool success = hashtable_snapfile_close(&file, path);
+    __atomic_store_n(written, file.entries, __ATOMIC_RELEASE);
+
+    return success;
+}
+
+/* Write the entries of a view to the snapshot 'path', without taking
+   the stripes (see hashtable_bgsave), storing the number of entries
+   written so far in 'written'. Return true on success, false
+   otherwise. */
+static bool hashtable_writeview(hashtable_view* view, const char* path, unsigned long* written) {
+    hashtable_snapfile file;
+
+    if(!hashtable_snapfile_open(&file, path))
+        return false;
+
+    for(unsigned int i = 0; i < view->buckets->size && file.success; i++) {
+        for(hashtable_entry* current_entry = hashtable_viewchain(view, i); current_entry != NULL; current_entry = current_entry->next) {
+            if(hashtable_viewvisible(view, current_entry))
+                hashtable_snapfile_add(&file, current_entry);
+        }
+        hashtable_snapfile_drain(&file, HASHTABLE_WAL_BUFFER);
+
+        if((i & 1023) == 0)
+            __atomic_store_n(written, file.entries, __ATOMIC_RELAXED);
+    }
+
+    bool success = hashtable_snapfile_close(&file, path);
+    __atomic_store_n(written, file.entries, __ATOMIC_RELEASE);
+
+    return success;
+}
+
+/* Write a snapshot of an hash table to 'path', blocking all the
+   writers of the table until it is complete (readers are blocked too
+   in HASHTABLE_SYNC_MUTEX and HASHTABLE_SYNC_RWLOCK modes). Return
+   the number of entries written, or -1 on error. */
+long hashtable_save(hashtable* htable, const char* path) {
+    if(htable == NULL || path == NULL)
+        return -1;
+
+    unsigned long written = 0;
+    hashtable_buckets* last;
+
+    hashtable_enter(htable);
+    hashtable_buckets* first = hashtable_lockall(htable, &last);
+    bool success = hashtable_writesnapshot(first, path, &written);
+    hashtable_unlockall(htable, first, last);
+    hashtable_exit(htable);
+
+    return success ? (long) written : -1;
+}
+
+/* Start writing a snapshot of an hash table to 'path' in a child
+   process, returning as soon as it has been created. The table can be
+   used as usual in the meantime: the child sees it as it was at the
+   time of the fork(), and the kernel copies only the pages that are
+   modified afterwards. The writers wait only while a view is opened,
+   not during the fork(), whose pause grows with the memory of the
+   process (the copy of its page tables). The progress is followed with
+   hashtable_bgsave_poll, and the job must be released with
+   hashtable_bgsave_wait. If the table has a write-ahead log, the
+   snapshot includes exactly its records up to the one stored in the
+   'lsn' field of the job. Return the job, or NULL on error. */
+hashtable_bgsave_job* hashtable_bgsave(hashtable* htable, const char* path) {
+    if(htable == NULL || path == NULL)
+        return NULL;
+
+    /* The job is shared with the child, which updates its progress. */
+    hashtable_bgsave_job* job = (hashtable_bgsave_job*)mmap(NULL, sizeof(hashtable_bgsave_job), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(job == MAP_FAILED)
+        return NULL;
+    memset(job, 0, sizeof(hashtable_bgsave_job));
+    job->state = HASHTABLE_BGSAVE_RUNNING;
+
+    hashtable_view* view;
+    if((view = (hashtable_view*)malloc(sizeof(hashtable_view))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'view'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The view is opened with every stripe held, so that it includes
+       exactly the writes logged up to 'lsn', and no write that missed
+       it is still in progress. */
+    hashtable_buckets* buckets = hashtable_pin(htable);
+    hashtable_buckets* last;
+
+    hashtable_enter(htable);
+    hashtable_buckets* first = hashtable_lockall(htable, &last);
+    hashtable_openview(htable, view, buckets);
+    job->total = hashtable_count(htable);
+    if(htable->wal != NULL) {
+        pthread_mutex_lock(&htable->wal->lock);
+        job->lsn = htable->wal->appended;
+        pthread_mutex_unlock(&htable->wal->lock);
+    }
+    hashtable_unlockall(htable, first, last);
+    hashtable_exit(htable);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        /* Child: only this thread exists, and the locks held by the
+           other ones will never be released, so the table is only read
+           through the view. */
+        _exit(hashtable_writeview(view, path, &job->written) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    hashtable_view_release(view);
+
+    if(pid < 0) {
+        munmap(job, sizeof(hashtable_bgsave_job));
+        return NULL;
+    }
+    job->pid = pid;
+
+    return job;
+}
+
+/* Return the state of a snapshot started by hashtable_bgsave, storing
+   in 'progress' (if not NULL) the fraction of the entries written so
+   far, between 0 and 1. */
+hashtable_bgsave_state hashtable_bgsave_poll(hashtable_bgsave_job* job, double* progress) {
+    if(job == NULL)
+        return HASHTABLE_BGSAVE_FAILED;
+
+    if(job->state == HASHTABLE_BGSAVE_RUNNING) {
+        int status;
+        pid_t result = waitpid(job->pid, &status, WNOHANG);
+
+        if(result == job->pid)
+            job->state = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? HASHTABLE_BGSAVE_DONE : HASHTABLE_BGSAVE_FAILED;
+        else if(result < 0)
+            job->state = HASHTABLE_BGSAVE_FAILED;
+    }
+
+    if(progress != NULL) {
+        unsigned long written = __atomic_load_n(&job->written, __ATOMIC_ACQUIRE);
+
+        *progress = job->state == HASHTABLE_BGSAVE_DONE || job->total == 0 ? 1.0 : (double) written / job->total;
+    }
+
+    return job->state;
+}
+
+/* Wait for a snapshot started by hashtable_bgsave to be complete,
+   release its job and return its final state. */
+hashtable_bgsave_state hashtable_bgsave_wait(hashtable_bgsave_job* job) {
+    if(job == NULL)
+        return HASHTABLE_BGSAVE_FAILED;
+
+    if(job->state == HASHTABLE_BGSAVE_RUNNING) {
+        int status;
+        pid_t result;
+
+        while((result = waitpid(job->pid, &status, 0)) < 0 && errno == EINTR);
+        job->state = result == job->pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? HASHTABLE_BGSAVE_DONE : HASHTABLE_BGSAVE_FAILED;
+    }
+
+    hashtable_bgsave_state state = job->state;
+    munmap(job, sizeof(hashtable_bgsave_job));
+
+    return state;
+}
+
+/* Checkpoints.
+   A checkpoint bounds the write-ahead log of a table: it writes a
+   snapshot of the table and then drops from the log the records that
+   the snapshot makes useless, so that hashtable_recover loads the
+   snapshot and replays only the tail of the log.
+   The snapshot is fuzzy: it is written while the table is in use,
+   visiting one bucket at a time and holding only its stripe, so it
+   does not correspond to a single instant. This is enough because
+   replaying a record is idempotent (an increment is logged as the
+   insert of its result) and the log is replayed from a point that
+   precedes the whole visit, so every write that the snapshot could
+   have missed is replayed on top of it. For the same reason the log
+   is truncated only once the snapshot has been renamed to its path:
+   after a crash in between, recovery replays some more records. */
+
+/* Write all the records appended to a log so far, storing in
+   '*offset' the size of the file, which then contains them all.
+   Return true on success, false otherwise. */
+static bool hashtable_wal_mark(hashtable_wal* wal, off_t* offset) {
+    struct stat info;
+    bool success;
+
+    pthread_mutex_lock(&wal->lock);
+    hashtable_wal_flush(wal, false);
+    success = fstat(wal->fd, &info) == 0;
+    pthread_mutex_unlock(&wal->lock);
+
+    *offset = info.st_size;
+
+    return success;
+}
+
+/* Copy the bytes from 'offset' to the end of the file 'in' at the end
+   of the file 'out'. Return the offset reached, -1 on error. */
+static off_t hashtable_copytail(int in, int out, off_t offset) {
+    char buffer[65536];
+    ssize_t len;
+
+    while((len = pread(in, buffer, sizeof(buffer), offset)) > 0) {
+        if(write(out, buffer, len) != len)
+            return -1;
+        offset += len;
+    }
+
+    return len == 0 ? offset : -1;
+}
+
+/* Drop the first 'offset' bytes of a log, replacing it with a copy of
+   the following records. Most of them are copied while the log is in
+   use; the last ones, and the switch to the new file, with its lock
+   held. Return true on success, false otherwise (the log is left as
+   it was). */
+static bool hashtable_wal_truncate(hashtable_wal* wal, off_t offset) {
+    size_t path_len = strlen(wal->path);
+    char tmp_path[path_len + 5];
+
+    memcpy(tmp_path, wal->path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    int in = open(wal->path, O_RDONLY | O_CLOEXEC);
+    int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(in < 0 || out < 0) {
+        if(in >= 0)
+            close(in);
+        if(out >= 0) {
+            close(out);
+            unlink(tmp_path);
+        }
+        return false;
+    }
+
+    bool success = (offset = hashtable_copytail(in, out, offset)) >= 0;
+
+    pthread_mutex_lock(&wal->lock);
+    if(success) {
+        hashtable_wal_flush(wal, false);
+        success = hashtable_copytail(in, out, offset) >= 0 && fdatasync(out) == 0 && rename(tmp_path, wal->path) == 0;
+    }
+    if(success) {
+        /* The records not yet written will go to the new file. */
+        close(wal->fd);
+        wal->fd = out;
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    close(in);
+    if(!success) {
+        close(out);
+        unlink(tmp_path);
+    }
+
+    return success;
+}
+
+/* Write a checkpoint of an hash table with a write-ahead log to
+   'path', then drop from the log the records that precede it. The
+   table can be used by other threads in the meantime: the writers
+   wait at most for the visit of a bucket, while the growth of the
+   table waits for the end of the checkpoint. Only one checkpoint at a
+   time can be written for the same table. Return true on success,
+   false otherwise. */
+bool hashtable_checkpoint(hashtable* htable, const char* path) {
+    if(htable == NULL || path == NULL || htable->wal == NULL)
+        return false;
+
+    hashtable_snapfile file;
+    off_t offset;
+
+    if(!hashtable_wal_mark(htable->wal, &offset) || !hashtable_snapfile_open(&file, path))
+        return false;
+
+    /* The array is pinned, so it is not resized (the growth waits for
+       the end of the visit) nor released. An epoch is entered only for
+       the visit of a bucket, never across the writes to the file, so
+       that the entries retired meanwhile can be reclaimed. */
+    hashtable_buckets* buckets = hashtable_pin(htable);
+    for(unsigned int i = 0; i < buckets->size && file.success; i++) {
+        hashtable_enter(htable);
+
+        /* In HASHTABLE_SYNC_SEQLOCK mode, the stripe is acquired
+           without changing its sequence counter: the optimistic
+           readers do not need to repeat their searches. */
+        hashtable_viewlock(htable, buckets, i);
+        for(hashtable_entry* current_entry = buckets->table[i]; current_entry != NULL; current_entry = current_entry->next)
+            hashtable_snapfile_add(&file, current_entry);
+        hashtable_viewunlock(htable, buckets, i);
+
+        hashtable_exit(htable);
+
+        hashtable_snapfile_drain(&file, HASHTABLE_WAL_BUFFER);
+    }
+    hashtable_unpin(htable);
+
+    if(!hashtable_snapfile_close(&file, path))
+        return false;
+
+    return hashtable_wal_truncate(htable->wal, offset);
+}
+
+/* Main function of the thread that writes the checkpoints of a
+   table periodically. */
+static void* hashtable_checkpointer_run(void* arg) {
+    hashtable_checkpointer* checkpointer = (hashtable_checkpointer*) arg;
+
+    pthread_mutex_lock(&checkpointer->lock);
+    while(!checkpointer->stop) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += checkpointer->interval_ms / 1000;
+        deadline.tv_nsec += (long)(checkpointer->interval_ms % 1000) * 1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&checkpointer->cond, &checkpointer->lock, &deadline);
+        if(checkpointer->stop)
+            break;
+
+        pthread_mutex_unlock(&checkpointer->lock);
+        bool success = hashtable_checkpoint(checkpointer->htable, checkpointer->path);
+        pthread_mutex_lock(&checkpointer->lock);
+
+        if(success)
+            checkpointer->checkpoints++;
+        else
+            checkpointer->failures++;
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+
+    return NULL;
+}
+
+/* Start a thread that writes a checkpoint of an hash table (which
+   must have a write-ahead log and a concurrent synchronization mode)
+   to 'path' every 'interval_ms' milliseconds. Return the thread, or
+   NULL on error. */
+hashtable_checkpointer* hashtable_checkpointer_start(hashtable* htable, const char* path, unsigned int interval_ms) {
+    if(htable == NULL || path == NULL || htable->wal == NULL || htable->syncmode == HASHTABLE_SYNC_NONE || interval_ms == 0)
+        return NULL;
+
+    hashtable_checkpointer* checkpointer;
+    if((checkpointer = (hashtable_checkpointer*)calloc(1, sizeof(hashtable_checkpointer))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'checkpointer'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if((checkpointer->path = strdup(path)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'strdup' on 'checkpointer->path'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    checkpointer->htable = htable;
+    checkpointer->interval_ms = interval_ms;
+    pthread_mutex_init(&checkpointer->lock, NULL);
+    pthread_cond_init(&checkpointer->cond, NULL);
+
+    if(pthread_create(&checkpointer->thread, NULL, hashtable_checkpointer_run, checkpointer) != 0) {
+        printf("[ERROR] There was an error while trying to call 'pthread_create' on 'checkpointer->thread'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return checkpointer;
+}
+
+/* Stop a thread started by hashtable_checkpointer_start, waiting for
+   the checkpoint in progress (if any), and release it. */
+void hashtable_checkpointer_stop(hashtable_checkpointer* checkpointer) {
+    if(checkpointer == NULL)
+        return;
+
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->stop = true;
+    pthread_cond_broadcast(&checkpointer->cond);
+    pthread_mutex_unlock(&checkpointer->lock);
+    pthread_join(checkpointer->thread, NULL);
+
+    pthread_cond_destroy(&checkpointer->cond);
+    pthread_mutex_destroy(&checkpointer->lock);
+    free(checkpointer->path);
+    free(checkpointer);
+}
+
+/* Rebuild the content of an hash table after a restart, loading the
+   checkpoint 'checkpoint_path' (if it exists) and then replaying the
+   write-ahead log 'wal_path'. Return the number of entries and
+   records loaded, -1 on error. */
+long hashtable_recover(hashtable* htable, const char* checkpoint_path, const char* wal_path) {
+    if(htable == NULL || checkpoint_path == NULL || wal_path == NULL)
+        return -1;
+
+    long entries = hashtable_wal_replay(htable, checkpoint_path);
+    if(entries < 0)
+        return -1;
+
+    long records = hashtable_wal_replay(htable, wal_path);
+    if(records < 0)
+        return -1;
+
+    return entries + records;
+}
+
+/* Cache mode.
+   With a capacity (see hashtable_setcapacity) an hash table is a
+   cache: an insert that brings the entries beyond 'max_entries'
+   evicts one, chosen with the CLOCK approximation of LRU. Every entry
+   has a reference bit, set by the lookups that find it; the hand
+   sweeps the buckets in order, clearing the bits it finds set and
+   evicting the first entry of a bucket whose bit was already clear,
+   that is one not read since the previous pass. A new entry starts
+   with the bit clear, so a key inserted and never read again goes
+   before the keys in use, but never the entry whose insert caused
+   the eviction: it is returned to the caller, which must find it
+   alive (in the concurrent modes the insert of another thread can
+   still evict it, as it could delete it). The hand reads the buckets
+   as a lookup does and clears the bits with atomic stores: only the
+   bucket of the victim is write-locked, so that in seqlock mode the
+   sweep does not make the lock-free readers retry. Every eviction
+   visits at most HASHTABLE_EVICT_BUCKETS buckets (the empty ones are
+   skipped without locking them) and HASHTABLE_EVICT_ENTRIES entries:
+   if all of them have been read, the last one is evicted anyway, so
+   the cost of an insert does not grow with the table. Unlike a strict
+   LRU, a hit only sets a bit of the entry and moves no list. */
+
+/* Return true if 'entry' is one of the 'nkeep' entries of 'keep'. */
+static bool hashtable_kept(hashtable_entry* entry, hashtable_entry* const* keep, unsigned int nkeep) {
+    for(unsigned int i = 0; i < nkeep; i++) {
+        if(keep[i] == entry)
+            return true;
+    }
+
+    return false;
+}
+
+/* Evict an entry of an hash table other than the 'nkeep' entries of
+   'keep', logging its deletion. Return the sequence number of the
+   record (0 without a log), storing in 'evicted' whether an entry was
+   found. */
+static unsigned long hashtable_evict(hashtable* htable, hashtable_entry* const* keep, unsigned int nkeep, bool* evicted) {
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    unsigned int examined = 0;
+
+    *evicted = false;
+    for(unsigned int visited = 0; visited < HASHTABLE_EVICT_BUCKETS && examined < HASHTABLE_EVICT_ENTRIES; visited++) {
+        unsigned int hash = __atomic_fetch_add(&htable->clock_hand, 1, __ATOMIC_RELAXED) % buckets->size;
+        hashtable_entry* victim = NULL;
+
+        if(__atomic_load_n(&buckets->table[hash], __ATOMIC_RELAXED) == NULL)
+            continue;
+
+        hashtable_readlock(htable, buckets, hash);
+        hashtable_entry* entry = buckets->table[hash];
+        if(entry == HASHTABLE_MOVED) {
+            hashtable_readunlock(htable, buckets, hash);
+            buckets = hashtable_helpresize(htable);
+            continue;
+        }
+        for(; entry != NULL && victim == NULL; entry = entry->next) {
+            if(hashtable_kept(entry, keep, nkeep))
+                continue;
+            if(__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED) && ++examined < HASHTABLE_EVICT_ENTRIES)
+                __atomic_store_n(&entry->referenced, false, __ATOMIC_RELAXED);
+            else {
+                __atomic_store_n(&entry->referenced, false, __ATOMIC_RELAXED);
+                victim = entry;
+            }
+        }
+        hashtable_readunlock(htable, buckets, hash);
+        if(victim == NULL)
+            continue;
+
+        /* The victim may have been read, deleted or moved by a resize
+           since: it is evicted only if still there and not read. */
+        hashtable_writelock(htable, buckets, hash);
+        for(entry = buckets->table[hash]; entry != HASHTABLE_MOVED && entry != NULL && entry != victim; entry = entry->next);
+        if(entry == HASHTABLE_MOVED || entry == NULL || __atomic_load_n(&victim->referenced, __ATOMIC_RELAXED) || hashtable_kept(victim, keep, nkeep)) {
+            hashtable_writeunlock(htable, buckets, hash);
+            continue;
+        }
+
+        /* The record is appended before the key is released. */
+        unsigned long lsn = 0;
+        unsigned int val;
+        if(htable->wal != NULL)
+            lsn = hashtable_wal_append(htable->wal, HASHTABLE_WAL_DELETE, victim->key, victim->key_len, 0, 0);
+        hashtable_delete_bucket(htable, buckets, hash, victim->key, victim->key_len, &val);
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_EVICTIONS, 1);
+        hashtable_writeunlock(htable, buckets, hash);
+
+        *evicted = true;
+        return lsn;
+    }
+
+    return 0;
+}
+
+/* Evict entries from an hash table in cache mode until it is back
+   within its capacity, sparing the 'nkeep' entries of 'keep' (the ones
+   just written by the caller). Return the sequence number of the last
+   record logged (0 without a log), to be committed by the caller. */
+static unsigned long hashtable_checkcapacity(hashtable* htable, hashtable_entry* const* keep, unsigned int nkeep) {
+    unsigned long lsn = 0;
+    bool evicted = true;
+
+    while(htable->max_entries != 0 && evicted && hashtable_count(htable) > htable->max_entries) {
+        unsigned long record = hashtable_evict(htable, keep, nkeep, &evicted);
+        lsn = record > lsn ? record : lsn;
+    }
+
+    return lsn;
+}
+
+/* Make an hash table a cache of at most 'max_entries' entries (0
+   removes the limit), evicting at once the entries beyond it. In the
+   concurrent modes the limit can be exceeded briefly, by the entries
+   inserted at the same time by other threads, and so it can when the
+   hand finds no entry in HASHTABLE_EVICT_BUCKETS buckets (a table much
+   larger than its capacity). It must be called while
+   no other thread is using the table. Return true on success, false
+   otherwise. */
+bool hashtable_setcapacity(hashtable* htable, unsigned int max_entries) {
+    if(htable == NULL)
+        return false;
+
+    hashtable_completeresize(htable);
+    htable->max_entries = max_entries;
+
+    /* An eviction that meets only empty buckets is simply repeated. */
+    unsigned long lsn = 0;
+    hashtable_enter(htable);
+    while(max_entries != 0 && hashtable_count(htable) > max_entries) {
+        unsigned long record = hashtable_checkcapacity(htable, NULL, 0);
+        lsn = record > lsn ? record : lsn;
+    }
+    hashtable_exit(htable);
+    if(lsn != 0)
+        hashtable_wal_commit(htable->wal, lsn);
+
+    return true;
+}
+
+/* Execute a request on the bucket 'hash' of a bucket array, setting
+   'added' to true if a new entry has been inserted. The caller must
+   hold the stripe of the bucket. If the table has a write-ahead log,
+   return the sequence number of the record of the write (to be
+   committed once the stripe is released), 0 otherwise. */
+static unsigned long hashtable_execute_bucket(hashtable* htable, hashtable_buckets* buckets, unsigned int hash, hashtable_request* request, bool* added) {
+    *added = false;
+
+    switch(request->op) {
+        case HASHTABLE_OP_GET:
+            request->entry = hashtable_get_bucket(buckets, hash, request->key, request->key_len);
+            request->found = request->entry != NULL;
+            if(request->found)
+                request->result = request->entry->val;
+            break;
+        case HASHTABLE_OP_INSERT:
+            request->entry = hashtable_insert_bucket(htable, buckets, hash, request->key, request->key_len, request->val, 0, added);
+            request->result = request->val;
+            request->found = !*added;
+            break;
+        case HASHTABLE_OP_DELETE:
+            request->result = 0;
+            request->found = hashtable_delete_bucket(htable, buckets, hash, request->key, request->key_len, &request->result);
+            request->entry = NULL;
+            break;
+        case HASHTABLE_OP_INCREMENT:
+            request->entry = hashtable_increment_bucket(htable, buckets, hash, request->key, request->key_len, request->val, added);
+            request->result = request->entry->val;
+            request->found = !*added;
+            break;
+    }
+
+    /* An increment is logged as the insert of its result, with the
+       expiration the key keeps. */
+    if(htable->wal == NULL || request->op == HASHTABLE_OP_GET || (request->op == HASHTABLE_OP_DELETE && !request->found))
+        return 0;
+    if(request->op == HASHTABLE_OP_DELETE)
+        return hashtable_wal_append(htable->wal, HASHTABLE_WAL_DELETE, request->key, request->key_len, 0, 0);
+
+    unsigned long expires;
+    hashtable_walop op = hashtable_wal_entryop(request->entry, &expires);
+    return hashtable_wal_append(htable->wal, op, request->key, request->key_len, request->result, expires);
+}
+
+/* Flat combining.
+   When it is enabled (see hashtable_setcombining) the writes do not
+   compete for the stripes: every thread publishes its request in its
+   own slot and then either waits for the response or, if no other
+   thread is doing it, becomes the combiner. The combiner collects all
+   the pending requests, sorts them by bucket and executes them in a
+   single pass, taking every stripe once for all the requests that
+   fall in it, so that under contention (es. hot keys) the locks and
+   the cache lines of the table are acquired once per batch instead of
+   once per operation. Readers are not affected. */
+
+/* Structure that holds a request collected by the combiner. */
+typedef struct hashtable_combined_t {
+    unsigned int hash;              /* Bucket of the key in the current array */
+    hashtable_request* request;
+} hashtable_combined;
+
+static int hashtable_compare_combined(const void* a, const void* b) {
+    unsigned int hash_a = ((const hashtable_combined*)a)->hash;
+    unsigned int hash_b = ((const hashtable_combined*)b)->hash;
+    unsigned int stripe_a = hash_a % HASHTABLE_STRIPES, stripe_b = hash_b % HASHTABLE_STRIPES;
+
+    if(stripe_a != stripe_b)
+        return stripe_a < stripe_b ? -1 : 1;
+
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+/* Execute a batch of 'count' requests collected by the combiner,
+   in order of stripe. A request whose bucket has already been migrated
+   by a resize in progress is executed on its own in the new array.
+   The evictions spare the entries of the batch and 'own', the entry
+   of the request of the combiner if served by a previous batch.
+   Return the sequence number of the last record logged, if any. */
+static unsigned long hashtable_combine_batch(hashtable* htable, hashtable_combined* batch, unsigned int count, hashtable_entry* own) {
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    bool grown = false, added;
+    unsigned long lsn = 0, record;
+    int held = -1;
+
+    for(unsigned int i = 0; i < count; i++)
+        batch[i].hash = hashtable_gethash_len(buckets->size, batch[i].request->key, batch[i].request->key_len);
+    qsort(batch, count, sizeof(hashtable_combined), hashtable_compare_combined);
+
+    for(unsigned int i = 0; i < count; i++) {
+        unsigned int hash = batch[i].hash;
+
+        if(held != (int)(hash % HASHTABLE_STRIPES)) {
+            if(held >= 0)
+                hashtable_writeunlock(htable, buckets, held);
+            held = hash % HASHTABLE_STRIPES;
+            hashtable_writelock(htable, buckets, held);
+        }
+
+        if(buckets->table[hash] != HASHTABLE_MOVED) {
+            record = hashtable_execute_bucket(htable, buckets, hash, batch[i].request, &added);
+        } else {
+            hashtable_writeunlock(htable, buckets, held);
+            held = -1;
+
+            hashtable_buckets* new_buckets = buckets;
+            hash = hashtable_writelock_key(htable, &new_buckets, batch[i].request->key, batch[i].request->key_len);
+            record = hashtable_execute_bucket(htable, new_buckets, hash, batch[i].request, &added);
+            hashtable_writeunlock(htable, new_buckets, hash);
+        }
+        grown |= added;
+        lsn = record > lsn ? record : lsn;
+    }
+    if(held >= 0)
+        hashtable_writeunlock(htable, buckets, held);
+
+    /* The entries returned to the requesters must survive the evictions. */
+    if(grown) {
+        hashtable_entry* keep[HASHTABLE_MAX_THREADS + 1];
+        unsigned int nkeep = 0;
+
+        if(own != NULL)
+            keep[nkeep++] = own;
+        for(unsigned int i = 0; i < count; i++) {
+            if(batch[i].request->entry != NULL)
+                keep[nkeep++] = batch[i].request->entry;
+        }
+        hashtable_checkgrowth(htable);
+        record = hashtable_checkcapacity(htable, keep, nkeep);
+        lsn = record > lsn ? record : lsn;
+    }
+
+    return lsn;
+}
+
+/* Execute a request through the flat combining of an hash table,
+   returning when it has been completed. */
+static void hashtable_combine(hashtable* htable, hashtable_request* request) {
+    hashtable_combiner* combiner = htable->combiner;
+    unsigned int slot = hashtable_ebr_slot_get() - ebr_slots;
+    unsigned int nslots = __atomic_load_n(&combiner->nslots, __ATOMIC_RELAXED);
+    unsigned int spins = 0;
+
+    while(nslots <= slot && !__atomic_compare_exchange_n(&combiner->nslots, &nslots, slot + 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    request->done = 0;
+    __atomic_store_n(&combiner->slots[slot].request, request, __ATOMIC_RELEASE);
+
+    while(!__atomic_load_n(&request->done, __ATOMIC_ACQUIRE)) {
+        if(__atomic_load_n(&combiner->lock, __ATOMIC_RELAXED) != 0 ||
+           __atomic_exchange_n(&combiner->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+            if(++spins > 64)
+                sched_yield();
+            continue;
+        }
+
+        /* This thread is the combiner: serve the pending requests
+           (including its own) until there are no more, or for at most
+           HASHTABLE_COMBINE_PASSES batches. */
+        hashtable_combined batch[HASHTABLE_MAX_THREADS];
+
+        hashtable_enter(htable);
+        for(unsigned int pass = 0; pass < HASHTABLE_COMBINE_PASSES; pass++) {
+            unsigned int count = 0;
+
+            nslots = __atomic_load_n(&combiner->nslots, __ATOMIC_ACQUIRE);
+            for(unsigned int i = 0; i < nslots; i++) {
+                if(__atomic_load_n(&combiner->slots[i].request, __ATOMIC_RELAXED) != NULL)
+                    batch[count++].request = __atomic_exchange_n(&combiner->slots[i].request, NULL, __ATOMIC_ACQUIRE);
+            }
+            if(count == 0)
+                break;
+
+            /* The whole batch is committed to the log at once. */
+            unsigned long lsn = hashtable_combine_batch(htable, batch, count, request->entry);
+            if(lsn != 0)
+                hashtable_wal_commit(htable->wal, lsn);
+            for(unsigned int i = 0; i < count; i++)
+                __atomic_store_n(&batch[i].request->done, 1, __ATOMIC_RELEASE);
+        }
+        hashtable_exit(htable);
+
+        __atomic_store_n(&combiner->lock, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Forget a key remembered as not found by the negative cache of the
+   loads of an hash table (see hashtable_setnegativecache). */
+static inline void hashtable_forgetnegative(hashtable* htable, const char* key, unsigned int key_len) {
+    hashtable_flights* flights = __atomic_load_n(&htable->flights, __ATOMIC_ACQUIRE);
+
+    if(flights != NULL && flights->negative != NULL)
+        hashtable_delete_len(flights->negative, key, key_len);
+}
+
+/* Insert a new entry (or, if already present, update it) in
+   the hash table, where 'key' is made of 'key_len' bytes, and
+   return the entry just inserted/updated. */
+hashtable_entry* hashtable_insert_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int val) {
+    if(htable == NULL || key == NULL)
+        return NULL;
+
+    hashtable_forgetnegative(htable, key, key_len);
+
+    if(htable->combiner != NULL) {
+        hashtable_request request = {HASHTABLE_OP_INSERT, key, key_len, val, 0, false, NULL, 0};
+
+        hashtable_combine(htable, &request);
+        return request.entry;
+    }
+
+    hashtable_enter(htable);
+
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    unsigned int hash = hashtable_writelock_key(htable, &buckets, key, key_len);
+
+    // printf("Insert: %s -> %u\n", key, hash);
+
+    bool added;
+    unsigned long lsn = 0;
+    hashtable_entry* entry = hashtable_insert_bucket(htable, buckets, hash, key, key_len, val, 0, &added);
+    if(htable->wal != NULL)
+        lsn = hashtable_wal_append(htable->wal, HASHTABLE_WAL_INSERT, key, key_len, val, 0);
+    hashtable_writeunlock(htable, buckets, hash);
+
+    if(added) {
+        hashtable_checkgrowth(htable);
+        unsigned long record = hashtable_checkcapacity(htable, &entry, 1);
+        lsn = record > lsn ? record : lsn;
+    }
+    hashtable_exit(htable);
+
+    if(lsn != 0)
+        hashtable_wal_commit(htable->wal, lsn);
+
+    return entry;
+}
+
+/* Insert a new entry (or, if already present, update it) in
+   the hash table and return the entry just inserted/updated. */
+hashtable_entry* hashtable_insert(hashtable* htable, char* key, unsigned int val) {
+    if(htable == NULL || key == NULL)
+        return NULL;
+
+    return hashtable_insert_len(htable, key, (unsigned int) strlen(key), val);
+}
+
+/* Insert a new entry (or, if already present, update it) in the hash
+   table, where 'key' is made of 'key_len' bytes, expiring after
+   'ttl_ms' milliseconds, and return the entry just inserted/updated.
+   An insert without a time to live removes the expiration of a key,
+   an increment keeps it. An expired entry is not found by the lookups
+   any more, but it is released only by hashtable_expire (until then,
+   it is still counted and visited by the bulk operations). The
+   write-ahead log and the snapshots record the expiration with the
+   key. A 'ttl_ms' of 0 means no expiration, as hashtable_insert_len. */
+hashtable_entry* hashtable_insert_ttl_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int val, unsigned int ttl_ms) {
+    if(htable == NULL || key == NULL)
+        return NULL;
+    if(ttl_ms == 0)
+        return hashtable_insert_len(htable, key, key_len, val);
+
+    hashtable_forgetnegative(htable, key, key_len);
+
+    /* The wheel is created by the first insert with a time to live. */
+    if(__atomic_load_n(&htable->wheel, __ATOMIC_ACQUIRE) == NULL) {
+        hashtable_wheel* wheel;
+        if((wheel = (hashtable_wheel*)calloc(1, sizeof(hashtable_wheel))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'calloc' on 'wheel'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&wheel->lock, NULL);
+        wheel->current = hashtable_millis();
+
+        hashtable_wheel* expected = NULL;
+        if(!__atomic_compare_exchange_n(&htable->wheel, &expected, wheel, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_destroy(&wheel->lock);
+            free(wheel);
+        }
+    }
+
+    hashtable_enter(htable);
+
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    unsigned int hash = hashtable_writelock_key(htable, &buckets, key, key_len);
+
+    bool added;
+    unsigned long lsn = 0;
+    unsigned long expires = hashtable_millis() + ttl_ms;
+    hashtable_entry* entry = hashtable_insert_bucket(htable, buckets, hash, key, key_len, val, expires, &added);
+    if(htable->wal != NULL)
+        lsn = hashtable_wal_append(htable->wal, HASHTABLE_WAL_INSERT_TTL, key, key_len, val, expires);
+    hashtable_writeunlock(htable, buckets, hash);
+
+    if(added) {
+        hashtable_checkgrowth(htable);
+        unsigned long record = hashtable_checkcapacity(htable, &entry, 1);
+        lsn = record > lsn ? record : lsn;
+    }
+    hashtable_exit(htable);
+
+    if(lsn != 0)
+        hashtable_wal_commit(htable->wal, lsn);
+
+    return entry;
+}
+
+/* Insert a new entry (or, if already present, update it) in the hash
+   table, expiring after 'ttl_ms' milliseconds, and return the entry
+   just inserted/updated. */
+hashtable_entry* hashtable_insert_ttl(hashtable* htable, char* key, unsigned int val, unsigned int ttl_ms) {
+    if(htable == NULL || key == NULL)
+        return NULL;
+
+    return hashtable_insert_ttl_len(htable, key, (unsigned int) strlen(key), val, ttl_ms);
+}
+
+/* Delete the entries of an hash table that have expired, advancing its
+   timer wheel to the current time, and return their number. It is
+   meant to be called periodically (es. every 10 ms): the cost is O(1)
+   per expired entry plus one step per millisecond elapsed since the
+   previous call. The timers due are collected with the wheel locked,
+   copying their keys (an entry cannot be released while its timer is
+   in the wheel), about HASHTABLE_EXPIRE_BATCH at a time; then every
+   key is deleted, as by hashtable_delete_len, if it has not been
+   updated in the meantime. */
+unsigned long hashtable_expire(hashtable* htable) {
+    hashtable_wheel* wheel;
+
+    if(htable == NULL)
+        return 0;
+
+    /* The negative cache of the loads expires with the table. */
+    hashtable_flights* flights = __atomic_load_n(&htable->flights, __ATOMIC_ACQUIRE);
+    if(flights != NULL)
+        hashtable_expire(__atomic_load_n(&flights->negative, __ATOMIC_ACQUIRE));
+
+    if((wheel = __atomic_load_n(&htable->wheel, __ATOMIC_ACQUIRE)) == NULL)
+        return 0;
+
+    unsigned long now = hashtable_millis(), expired = 0;
+    char* keys = NULL;
+    size_t keys_size = 0;
+    bool done = false;
+
+    /* The keys are deleted in batches, while their entries are still
+       in the cache. */
+    while(!done) {
+        unsigned int batch = 0;
+        size_t keys_len = 0;
+
+        if(htable->syncmode != HASHTABLE_SYNC_NONE)
+            pthread_mutex_lock(&wheel->lock);
+        if(wheel->count == 0 && wheel->current <= now)
+            wheel->current = now + 1;
+        for(; wheel->current <= now && batch < HASHTABLE_EXPIRE_BATCH; wheel->current++) {
+            unsigned int slot = wheel->current & (HASHTABLE_WHEEL_SLOTS - 1);
+
+            for(unsigned int level = 1, index = slot; index == 0 && level < HASHTABLE_WHEEL_LEVELS; level++)
+                index = hashtable_wheel_cascade(wheel, level, (wheel->current >> (HASHTABLE_WHEEL_BITS * level)) & (HASHTABLE_WHEEL_SLOTS - 1));
+
+            /* Every key is stored after its length. */
+            while(wheel->slots[0][slot] != NULL) {
+                hashtable_timer* timer = wheel->slots[0][slot];
+                unsigned int key_len = timer->entry->key_len;
+
+                if(keys_len + sizeof(unsigned int) + key_len > keys_size) {
+                    keys_size = keys_size == 0 ? 4096 : keys_size * 2;
+                    if(keys_size < keys_len + sizeof(unsigned int) + key_len)
+                        keys_size = keys_len + sizeof(unsigned int) + key_len;
+                    if((keys = (char*)realloc(keys, keys_size)) == NULL) {
+                        printf("[ERROR] There was an error while trying to call 'realloc' on 'keys'. Closing...\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                memcpy(keys + keys_len, &key_len, sizeof(unsigned int));
+                memcpy(keys + keys_len + sizeof(unsigned int), timer->entry->key, key_len);
+                keys_len += sizeof(unsigned int) + key_len;
+                batch++;
+
+                hashtable_wheel_unlink(wheel, timer);
+            }
+        }
+        done = wheel->current > now;
+        if(htable->syncmode != HASHTABLE_SYNC_NONE)
+            pthread_mutex_unlock(&wheel->lock);
+
+        for(size_t pos = 0; pos < keys_len; ) {
+            unsigned int key_len, val;
+            memcpy(&key_len, keys + pos, sizeof(unsigned int));
+            const char* key = keys + pos + sizeof(unsigned int);
+            pos += sizeof(unsigned int) + key_len;
+
+            hashtable_enter(htable);
+
+            hashtable_buckets* buckets = hashtable_helpresize(htable);
+            unsigned int hash = hashtable_writelock_key(htable, &buckets, key, key_len);
+
+            /* The key could have been deleted or given a new expiration. */
+            unsigned long lsn = 0;
+            hashtable_entry* entry = hashtable_get_bucket(buckets, hash, key, key_len);
+            if(entry != NULL && hashtable_expired(entry)) {
+                if(htable->wal != NULL)
+                    lsn = hashtable_wal_append(htable->wal, HASHTABLE_WAL_DELETE, key, key_len, 0, 0);
+                hashtable_delete_bucket(htable, buckets, hash, key, key_len, &val);
+                expired++;
+            }
+            hashtable_writeunlock(htable, buckets, hash);
+
+            hashtable_exit(htable);
+
+            if(lsn != 0)
+                hashtable_wal_commit(htable->wal, lsn);
+        }
+    }
+    free(keys);
+
+    return expired;
+}
+
+/* Search an entry by 'key' (made of 'key_len' bytes) and delete it
+   if found, returning its value. Return 0 if 'key' was not found (an
+   expired entry is released, but not logged, as a missing key). */
+unsigned int hashtable_delete_len(hashtable* htable, const char* key, unsigned int key_len) {
+    if(htable == NULL || key == NULL)
+        return 0;
+
+    unsigned int val = 0;
+
+    if(htable->combiner != NULL) {
+        hashtable_request request = {HASHTABLE_OP_DELETE, key, key_len, 0, 0, false, NULL, 0};
+
+        hashtable_combine(htable, &request);
+        return request.result;
+    }
+
+    hashtable_enter(htable);
+
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    unsigned int hash = hashtable_writelock_key(htable, &buckets, key, key_len);
+
+    // printf("Delete: %s -> %u\n", key, hash);
+
+    unsigned long lsn = 0;
+    if(hashtable_delete_bucket(htable, buckets, hash, key, key_len, &val) && htable->wal != NULL)
+        lsn = hashtable_wal_append(htable->wal, HASHTABLE_WAL_DELETE, key, key_len, 0, 0);
+    hashtable_writeunlock(htable, buckets, hash);
+
+    hashtable_exit(htable);
+
+    if(lsn != 0)
+        hashtable_wal_commit(htable->wal, lsn);
+
+    return val;
+}
+
+/* Search an entry by 'key' and delete it if found, returning
+   its value. Return 0 if 'key' was not found. */
+unsigned int hashtable_delete(hashtable* htable, char* key) {
+    if(htable == NULL || key == NULL)
+        return 0;
+
+    return hashtable_delete_len(htable, key, (unsigned int) strlen(key));
+}
+
+/* Add 'delta' to the value of 'key' (made of 'key_len' bytes),
+   inserting it with value 'delta' if not present, and return the
+   new value. */
+unsigned int hashtable_increment_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int delta) {
+    if(htable == NULL || key == NULL)
+        return 0;
+
+    hashtable_forgetnegative(htable, key, key_len);
+
+    hashtable_request request = {HASHTABLE_OP_INCREMENT, key, key_len, delta, 0, false, NULL, 0};
+
+    if(htable->combiner != NULL) {
+        hashtable_combine(htable, &request);
+        return request.result;
+    }
+
+    hashtable_enter(htable);
+
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    unsigned int hash = hashtable_writelock_key(htable, &buckets, key, key_len);
+
+    bool added;
+    unsigned long lsn = hashtable_execute_bucket(htable, buckets, hash, &request, &added);
+    hashtable_writeunlock(htable, buckets, hash);
+
+    if(added) {
+        hashtable_checkgrowth(htable);
+        unsigned long record = hashtable_checkcapacity(htable, &request.entry, 1);
+        lsn = record > lsn ? record : lsn;
+    }
+    hashtable_exit(htable);
+
+    if(lsn != 0)
+        hashtable_wal_commit(htable->wal, lsn);
+
+    return request.result;
+}
+
+/* Add 'delta' to the value of 'key', inserting it with value 'delta'
+   if not present, and return the new value. */
+unsigned int hashtable_increment(hashtable* htable, char* key, unsigned int delta) {
+    if(htable == NULL || key == NULL)
+        return 0;
+
+    return hashtable_increment_len(htable, key, (unsigned int) strlen(key), delta);
+}
+
+/* Search an entry by 'key' starting from the bucket array 'buckets' of
+   an hash table in HASHTABLE_SYNC_SEQLOCK mode, without taking any
+   lock, and return it if found (storing its value in 'val'), NULL
+   otherwise. The caller must be in an EBR critical section.
+   The chaining list is read optimistically: if the sequence counter
+   of the stripe was odd, or has changed by the end of the search, a
+   writer has (or could have) modified the bucket and the search is
+   repeated. If the bucket has been migrated by a resize, the search
+   moves to the new array. */
+static hashtable_entry* hashtable_get_optimistic(hashtable_buckets* buckets, const char* key, unsigned int key_len, unsigned int* val) {
+    hashtable_entry* current_entry;
+    hashtable_stripe* stripe;
+    unsigned int hash, seq;
+
+    do {
+        hash = hashtable_gethash_len(buckets->size, key, key_len);
+        stripe = &buckets->stripes[hash % HASHTABLE_STRIPES];
+
+        while((seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE)) & 1)
+            sched_yield();
+
+        current_entry = __atomic_load_n(&buckets->table[hash], __ATOMIC_ACQUIRE);
+        if(current_entry == HASHTABLE_MOVED) {
+            buckets = __atomic_load_n(&buckets->next, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        while(current_entry != NULL && !hashtable_keyequals(current_entry, key, key_len))
+            current_entry = __atomic_load_n(&current_entry->next, __ATOMIC_ACQUIRE);
+
+        if(current_entry != NULL)
+            *val = __atomic_load_n(&current_entry->val, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&stripe->seq, __ATOMIC_RELAXED) == seq)
+            return current_entry;
+    } while(true);
+}
+
+/* Search an entry by 'key' (made of 'key_len' bytes) and, if found,
+   return it and store its value in 'val', NULL otherwise. */
+static hashtable_entry* hashtable_find(hashtable* htable, const char* key, unsigned int key_len, unsigned int* val) {
+    hashtable_enter(htable);
+
+    hashtable_buckets* buckets = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE);
+    hashtable_entry* entry;
+
+    /* An expired entry is not found (lazy expiry). In cache mode a hit
+       marks the entry, while it cannot be released (the bit is written
+       only if clear, to spare the cache line). */
+    if(htable->syncmode == HASHTABLE_SYNC_SEQLOCK) {
+        entry = hashtable_get_optimistic(buckets, key, key_len, val);
+        if(entry != NULL && hashtable_expired(entry))
+            entry = NULL;
+        if(entry != NULL && htable->max_entries != 0 && !__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED))
+            __atomic_store_n(&entry->referenced, true, __ATOMIC_RELAXED);
+    } else {
+        unsigned int hash = hashtable_readlock_key(htable, &buckets, key, key_len);
+
+        entry = hashtable_get_bucket(buckets, hash, key, key_len);
+        if(entry != NULL && hashtable_expired(entry))
+            entry = NULL;
+        if(entry != NULL) {
+            *val = entry->val;
+            if(htable->max_entries != 0 && !__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED))
+                __atomic_store_n(&entry->referenced, true, __ATOMIC_RELAXED);
+        }
+        hashtable_readunlock(htable, buckets, hash);
+    }
+
+    hashtable_exit(htable);
+
+    HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_LOOKUPS, 1);
+    if(entry != NULL)
+        HASHTABLE_COUNTER_ADD(htable, HASHTABLE_COUNTER_HITS, 1);
+
+    return entry;
+}
+
+/* Search an entry by 'key' (made of 'key_len' bytes) and return
+   the entry (key, val) if found, NULL otherwise. In the concurrent
+   modes, the entry is valid until 'key' is deleted: to read its
+   value safely, use hashtable_lookup_len instead. */
+hashtable_entry* hashtable_get_len(hashtable* htable, const char* key, unsigned int key_len) {
+    if(htable == NULL || key == NULL)
+        return NULL;
+
+    unsigned int val;
+
+    return hashtable_find(htable, key, key_len, &val);
+}
+
+/* Search an entry by 'key' (made of 'key_len' bytes) and, if found,
+   store its value in 'val' and return true, false otherwise. Unlike
+   hashtable_get_len, the value is read while the entry is protected,
+   so it is safe to call it in every mode. */
+bool hashtable_lookup_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int* val) {
+    if(htable == NULL || key == NULL || val == NULL)
+        return false;
+
+    return hashtable_find(htable, key, key_len, val) != NULL;
+}
+
+/* Search an entry by 'key' and return the entry (key, val) if
+   found, NULL otherwise. */
+hashtable_entry* hashtable_get(hashtable* htable, char* key) {
+    if(htable == NULL || key == NULL)
+        return NULL;
+
+    return hashtable_get_len(htable, key, (unsigned int) strlen(key));
+}
+
+/* Single-flight loading.
+   hashtable_get_or_load_len reads a key through the table, loading it
+   (es. from a database) when it is missing. The callers that miss the
+   same key at the same time do not all call the loader: the first one
+   registers a load in progress (a "flight") and calls it, the others
+   find the flight and wait for its result. The loaded key is inserted
+   before its flight is removed, so a caller that misses the key and
+   finds no flight can only have missed a load just completed: the
+   table is checked again before loading. With the negative cache, the
+   keys the loader did not find are remembered for a while, in a table
+   of keys with a time to live, so that they are not loaded again. */
+
+/* Return the loads in progress of an hash table, creating them the
+   first time. */
+static hashtable_flights* hashtable_getflights(hashtable* htable) {
+    hashtable_flights* flights = __atomic_load_n(&htable->flights, __ATOMIC_ACQUIRE);
+
+    if(flights != NULL)
+        return flights;
+
+    if((flights = (hashtable_flights*)calloc(1, sizeof(hashtable_flights))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'flights'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&flights->lock, NULL);
+
+    hashtable_flights* expected = NULL;
+    if(!__atomic_compare_exchange_n(&htable->flights, &expected, flights, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_destroy(&flights->lock);
+        free(flights);
+        return expected;
+    }
+
+    return flights;
+}
+
+/* Release a flight. */
+static void hashtable_freeflight(hashtable_flight* flight) {
+    pthread_cond_destroy(&flight->cond);
+    free(flight->key);
+    free(flight);
+}
+
+/* Insert a key loaded by hashtable_get_or_load_len, unless a writer
+   has inserted it while it was being loaded: the search and the insert
+   are done with the stripe of the bucket held, so the loaded value
+   never overwrites a newer one. Return true if the key has been
+   inserted, false if it was found (storing its value in 'val'). */
+static bool hashtable_insert_loaded(hashtable* htable, const char* key, unsigned int key_len, unsigned int* val) {
+    hashtable_enter(htable);
+
+    hashtable_buckets* buckets = hashtable_helpresize(htable);
+    unsigned int hash = hashtable_writelock_key(htable, &buckets, key, key_len);
+
+    for(hashtable_entry* current_entry = buckets->table[hash]; current_entry != NULL; current_entry = current_entry->next) {
+        if(hashtable_keyequals(current_entry, key, key_len) && !hashtable_expired(current_entry)) {
+            *val = current_entry->val;
+            hashtable_writeunlock(htable, buckets, hash);
+            hashtable_exit(htable);
+
+            return false;
+        }
+    }
+
+    bool added;
+    unsigned long lsn = 0;
+    hashtable_entry* entry = hashtable_insert_bucket(htable, buckets, hash, key, key_len, *val, 0, &added);
+    if(htable->wal != NULL)
+        lsn = hashtable_wal_append(htable->wal, HASHTABLE_WAL_INSERT, key, key_len, *val, 0);
+    hashtable_writeunlock(htable, buckets, hash);
+
+    if(added) {
+        hashtable_checkgrowth(htable);
+        unsigned long record = hashtable_checkcapacity(htable, &entry, 1);
+        lsn = record > lsn ? record : lsn;
+    }
+    hashtable_exit(htable);
+
+    if(lsn != 0)
+        hashtable_wal_commit(htable->wal, lsn);
+
+    return true;
+}
+
+/* Search the value of 'key' (made of 'key_len' bytes) and, if it is
+   missing, load it with 'loader' (called with 'ctx'), inserting it if
+   found (a value written meanwhile is kept and returned instead).
+   Concurrent callers that miss the same key share a single call of the
+   loader. Store the value in 'val' and return true if the key exists, false otherwise (also when the negative cache remembers
+   it as not found, see hashtable_setnegativecache). */
+bool hashtable_get_or_load_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int* val, hashtable_load_fn loader, void* ctx) {
+    if(htable == NULL || key == NULL || val == NULL || loader == NULL)
+        return false;
+
+    if(hashtable_lookup_len(htable, key, key_len, val))
+        return true;
+
+    hashtable_flights* flights = hashtable_getflights(htable);
+    hashtable* negative = __atomic_load_n(&flights->negative, __ATOMIC_ACQUIRE);
+    unsigned int unused;
+    if(negative != NULL && hashtable_lookup_len(negative, key, key_len, &unused))
+        return false;
+
+    unsigned int hash = hashtable_fullhash(key, key_len);
+    hashtable_flight** list = &flights->lists[hash % HASHTABLE_FLIGHT_BUCKETS];
+    hashtable_flight* flight;
+
+    pthread_mutex_lock(&flights->lock);
+    for(flight = *list; flight != NULL; flight = flight->next) {
+        if(flight->hash == hash && flight->key_len == key_len && memcmp(flight->key, key, key_len) == 0)
+            break;
+    }
+
+    /* Another caller is loading the key: wait for its result. */
+    if(flight != NULL) {
+        flight->waiters++;
+        flights->shared++;
+        while(!flight->done)
+            pthread_cond_wait(&flight->cond, &flights->lock);
+
+        bool found = flight->found;
+        *val = flight->val;
+        if(--flight->waiters == 0)
+            hashtable_freeflight(flight);
+        pthread_mutex_unlock(&flights->lock);
+
+        return found;
+    }
+
+    if((flight = (hashtable_flight*)malloc(sizeof(hashtable_flight))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'flight'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if((flight->key = (char*)malloc(key_len + 1)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'flight->key'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(flight->key, key, key_len);
+    flight->key_len = key_len;
+    flight->hash = hash;
+    flight->waiters = 0;
+    flight->done = false;
+    pthread_cond_init(&flight->cond, NULL);
+    flight->next = *list;
+    *list = flight;
+    pthread_mutex_unlock(&flights->lock);
+
+    /* Load the key, unless a load has just completed it. */
+    bool loaded = false, found = hashtable_lookup_len(htable, key, key_len, val);
+    if(!found && (negative == NULL || !hashtable_lookup_len(negative, key, key_len, &unused))) {
+        loaded = true;
+        found = loader(key, key_len, val, ctx);
+
+        /* A value written during the load wins over the loaded one, and
+           over the miss of the loader. */
+        if(found)
+            hashtable_insert_loaded(htable, key, key_len, val);
+        else if(hashtable_lookup_len(htable, key, key_len, val))
+            found = true;
+        else if(negative != NULL)
+            hashtable_insert_ttl_len(negative, key, key_len, 0, flights->negative_ttl);
+    }
+
+    pthread_mutex_lock(&flights->lock);
+    hashtable_flight** link = list;
+    while(*link != flight)
+        link = &(*link)->next;
+    *link = flight->next;
+    if(loaded)
+        flights->loads++;
+    flight->done = true;
+    flight->found = found;
+    flight->val = found ? *val : 0;
+    if(flight->waiters > 0)
+        pthread_cond_broadcast(&flight->cond);
+    else
+        hashtable_freeflight(flight);
+    pthread_mutex_unlock(&flights->lock);
+
+    return found;
+}
+
+/* Search the value of 'key' and, if it is missing, load it with
+   'loader' (see hashtable_get_or_load_len). Return true if the key
+   exists, false otherwise. */
+bool hashtable_get_or_load(hashtable* htable, char* key, unsigned int* val, hashtable_load_fn loader, void* ctx) {
+    if(htable == NULL || key == NULL)
+        return false;
+
+    return hashtable_get_or_load_len(htable, key, (unsigned int) strlen(key), val, loader, ctx);
+}
+
+/* Make hashtable_get_or_load_len remember, for 'ttl_ms' milliseconds,
+   the keys that its loader did not find (0 disables it). A key is
+   forgotten as soon as it is inserted (or incremented), and the
+   expired ones are released by hashtable_expire. It must be called
+   while no other thread is using the table. Return true on success,
+   false otherwise. */
+bool hashtable_setnegativecache(hashtable* htable, unsigned int ttl_ms) {
+    if(htable == NULL)
+        return false;
+
+    hashtable_flights* flights = hashtable_getflights(htable);
+    if(ttl_ms == 0) {
+        hashtable_free(flights->negative);
+        flights->negative = NULL;
+    } else if(flights->negative == NULL) {
+        flights->negative = hashtable_newhashtable(1024);
+        hashtable_setsyncmode(flights->negative, htable->syncmode);
+        hashtable_setgrowth(flights->negative, 1, HASHTABLE_RESIZE_COOPERATIVE);
+    }
+    flights->negative_ttl = ttl_ms;
+
+    return true;
+}
+
+/* Random sampling.
+   hashtable_random_entry picks an entry uniformly at random (es. to
+   choose eviction candidates, or to estimate statistics of a huge
+   table) without scanning the buckets, in one of two ways:
+   - with the sampling index (see hashtable_setsampling), a dense
+     array of all the entries, a random position of the array: O(1),
+     at the cost of a pointer per entry and of a lock that all the
+     inserts and deletes share;
+   - otherwise, by rejection: a random bucket and a random position
+     in [0, max_chain) are drawn, and the attempt succeeds if the
+     chaining list has an entry there. Every entry has the same
+     probability, 1 / (size * max_chain), of being drawn by an
+     attempt, so the result is uniform, but about
+     size * max_chain / count attempts are needed: the lower the load
+     of the table, the higher the cost of a sample.
+   Expired entries are never picked. As with hashtable_get_len, in the
+   concurrent modes an entry picked is valid until its key is deleted. */
+
+static __thread unsigned long sample_state = 0;
+
+/* Return a random number in [0, n), from a xorshift64* generator
+   private to the calling thread. */
+static unsigned int hashtable_random(unsigned int n) {
+    if(sample_state == 0) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sample_state = ((now.tv_sec * 1000000000UL + now.tv_nsec) ^ (unsigned long) &sample_state) | 1;
+    }
+    sample_state ^= sample_state >> 12;
+    sample_state ^= sample_state << 25;
+    sample_state ^= sample_state >> 27;
+
+    return (unsigned int) (((unsigned __int128) (sample_state * 0x2545F4914F6CDD1DUL) * n) >> 64);
+}
+
+/* Return the entry at position 'index' of the chaining list of the
+   bucket 'hash' of a bucket array, NULL if the list is shorter or the
+   entry has expired, HASHTABLE_MOVED if the bucket has been migrated
+   by a resize. The caller must be in an EBR critical section. */
+static hashtable_entry* hashtable_pickbucket(hashtable* htable, hashtable_buckets* buckets, unsigned int hash, unsigned int index) {
+    hashtable_entry* entry;
+
+    if(htable->syncmode == HASHTABLE_SYNC_SEQLOCK) {
+        hashtable_stripe* stripe = &buckets->stripes[hash % HASHTABLE_STRIPES];
+        unsigned int seq;
+
+        do {
+            while((seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE)) & 1)
+                sched_yield();
+
+            entry = __atomic_load_n(&buckets->table[hash], __ATOMIC_ACQUIRE);
+            for(unsigned int i = 0; i < index && entry != NULL && entry != HASHTABLE_MOVED; i++)
+                entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while(__atomic_load_n(&stripe->seq, __ATOMIC_RELAXED) != seq);
+
+        if(entry != NULL && entry != HASHTABLE_MOVED && hashtable_expired(entry))
+            entry = NULL;
+    } else {
+        /* The entry can be released as soon as the stripe is, so its
+           timer is checked before. */
+        hashtable_readlock(htable, buckets, hash);
+        entry = buckets->table[hash];
+        for(unsigned int i = 0; i < index && entry != NULL && entry != HASHTABLE_MOVED; i++)
+            entry = entry->next;
+        if(entry != NULL && entry != HASHTABLE_MOVED && hashtable_expired(entry))
+            entry = NULL;
+        hashtable_readunlock(htable, buckets, hash);
+    }
+
+    return entry;
+}
+
+/* Pick 'k' random entries of an hash table, storing them in 'out',
+   and return how many have been picked: fewer than 'k' only if, for a
+   sample, no entry has been found in HASHTABLE_SAMPLE_TRIES times the
+   expected number of attempts (es. the table is empty, or all its
+   entries have expired). */
+static unsigned int hashtable_pick(hashtable* htable, unsigned int k, hashtable_entry** out) {
+    hashtable_sampler* sampler = htable->sampler;
+    unsigned int picked = 0;
+
+    if(sampler != NULL) {
+        if(htable->syncmode != HASHTABLE_SYNC_NONE)
+            pthread_mutex_lock(&sampler->lock);
+        while(picked < k && sampler->count > 0) {
+            hashtable_entry* entry = NULL;
+
+            for(unsigned int t = 0; t < HASHTABLE_SAMPLE_TRIES && entry == NULL; t++) {
+                entry = sampler->entries[hashtable_random(sampler->count)];
+                if(hashtable_expired(entry))
+                    entry = NULL;
+            }
+            if(entry == NULL)
+                break;
+            out[picked++] = entry;
+        }
+        if(htable->syncmode != HASHTABLE_SYNC_NONE)
+            pthread_mutex_unlock(&sampler->lock);
+
+        return picked;
+    }
+
+    /* A resize moves the entries from an array to the other one, so
+       the sampling waits for it to be completed. */
+    while(picked < k) {
+        hashtable_completeresize(htable);
+
+        unsigned long count = hashtable_count(htable);
+        if(count == 0)
+            break;
+
+        hashtable_enter(htable);
+        hashtable_buckets* buckets = __atomic_load_n(&htable->buckets, __ATOMIC_ACQUIRE);
+        unsigned int bound = __atomic_load_n(&buckets->max_chain, __ATOMIC_RELAXED);
+        if(bound == 0)
+            bound = 1;
+        unsigned long limit = HASHTABLE_SAMPLE_TRIES * ((unsigned long) buckets->size * bound / count + 1);
+        bool moved = false;
+
+        while(picked < k && !moved) {
+            hashtable_entry* entry = NULL;
+
+            for(unsigned long t = 0; t < limit && entry == NULL; t++)
+                entry = hashtable_pickbucket(htable, buckets, hashtable_random(buckets->size), hashtable_random(bound));
+            if(entry == NULL)
+                break;
+            if(entry == HASHTABLE_MOVED)
+                moved = true;
+            else
+                out[picked++] = entry;
+        }
+        hashtable_exit(htable);
+
+        if(!moved)
+            break;
+    }
+
+    return picked;
+}
+
+/* Return an entry of an hash table picked uniformly at random, NULL
+   if the table is empty. */
+hashtable_entry* hashtable_random_entry(hashtable* htable) {
+    if(htable == NULL)
+        return NULL;
+
+    hashtable_entry* entry;
+
+    return hashtable_pick(htable, 1, &entry) == 1 ? entry : NULL;
+}
+
+/* Store in 'out' 'k' entries of an hash table, each one picked
+   uniformly at random and independently of the others (so the same
+   entry can appear more than once), and return the number of entries
+   stored: fewer than 'k' only if the table is (or has become) empty. */
+unsigned int hashtable_sample(hashtable* htable, unsigned int k, hashtable_entry** out) {
+    if(htable == NULL || out == NULL)
+        return 0;
+
+    return hashtable_pick(htable, k, out);
+}
+
+/* Enable (or disable) the sampling index of an hash table, which
+   makes hashtable_random_entry O(1) whatever the load of the table,
+   and add all its entries to the index. It must be called while no
+   other thread is using the table. Return true on success, false
+   otherwise. */
+bool hashtable_setsampling(hashtable* htable, bool enabled) {
+    if(htable == NULL)
+        return false;
+
+    hashtable_completeresize(htable);
+
+    if(!enabled && htable->sampler != NULL) {
+        pthread_mutex_destroy(&htable->sampler->lock);
+        free(htable->sampler->entries);
+        free(htable->sampler);
+        htable->sampler = NULL;
+    } else if(enabled && htable->sampler == NULL) {
+        if((htable->sampler = (hashtable_sampler*)calloc(1, sizeof(hashtable_sampler))) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'calloc' on 'htable->sampler'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&htable->sampler->lock, NULL);
+
+        hashtable_buckets* buckets = htable->buckets;
+        for(unsigned int i = 0; i < buckets->size; i++) {
+            for(hashtable_entry* entry = buckets->table[i]; entry != NULL; entry = entry->next)
+                hashtable_sampler_add(htable, entry);
+        }
+    }
+
+    return true;
+}
+
+/* Open a read-only view of an hash table as it is now, which is not
+   affected by the following writes, and return it. Opening it costs
+   O(1): the writers copy the buckets they change while the view is
+   open (the first copy of a bucket array allocates a pointer per
+   bucket), and the table is not resized in the meantime (see
+   hashtable_resize; the growth is deferred). The view must be released with
+   hashtable_view_release, before the table is. */
+hashtable_view* hashtable_snapshot(hashtable* htable) {
+    if(htable == NULL)
+        return NULL;
+
+    hashtable_view* view;
+
+    if((view = (hashtable_view*)malloc(sizeof(hashtable_view))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'view'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* No resize can start from now on, and the one in progress, if
+       any, is completed before choosing the array. */
+    hashtable_openview(htable, view, hashtable_pin(htable));
+
+    return view;
+}
+
+/* Search 'key' (made of 'key_len' bytes) in a view and, if it was in
+   the table when the view was opened, store its value at that time in
+   'val' and return true, false otherwise. */
+bool hashtable_view_lookup_len(hashtable_view* view, const char* key, unsigned int key_len, unsigned int* val) {
+    if(view == NULL || key == NULL || val == NULL)
+        return false;
+
+    hashtable* htable = view->htable;
+    unsigned int hash = hashtable_gethash_len(view->buckets->size, key, key_len);
+    bool found = false;
+
+    hashtable_viewlock(htable, view->buckets, hash);
+    for(hashtable_entry* entry = hashtable_viewchain(view, hash); entry != NULL && !found; entry = entry->next) {
+        if(hashtable_keyequals(entry, key, key_len) && hashtable_viewvisible(view, entry)) {
+            *val = entry->val;
+            found = true;
+        }
+    }
+    hashtable_viewunlock(htable, view->buckets, hash);
+
+    return found;
+}
+
+/* Call 'fn' (with 'worker' 0) on every entry of a view, while the
+   writers keep using the table. The entry is valid only during the
+   call, during which the stripe of its bucket is held: 'fn' must not
+   write to the table. */
+void hashtable_view_foreach(hashtable_view* view, hashtable_foreach_fn fn, void* ctx) {
+    if(view == NULL || fn == NULL)
+        return;
+
+    hashtable* htable = view->htable;
+
+    for(unsigned int i = 0; i < view->buckets->size; i++) {
+        hashtable_viewlock(htable, view->buckets, i);
+        for(hashtable_entry* entry = hashtable_viewchain(view, i); entry != NULL; entry = entry->next) {
+            if(hashtable_viewvisible(view, entry))
+                fn(entry, ctx, 0);
+        }
+        hashtable_viewunlock(htable, view->buckets, i);
+    }
+}
+
+/* Release a view, and the versions of the buckets that no other open
+   view can read: the ones saved before the oldest view still open. */
+void hashtable_view_release(hashtable_view* view) {
+    if(view == NULL)
+        return;
+
+    hashtable* htable = view->htable;
+    hashtable_views* views = &htable->views;
+    hashtable_version* released = NULL;
+
+    /* The array cannot be released while its versions are unlinked. */
+    hashtable_enter(htable);
+
+    pthread_mutex_lock(&views->lock);
+    hashtable_view** link = &views->open;
+    while(*link != view)
+        link = &(*link)->next;
+    *link = view->next;
+    __atomic_store_n(&views->active, views->active - 1, __ATOMIC_RELEASE);
+
+    unsigned long oldest = ULONG_MAX;
+    for(hashtable_view* open = views->open; open != NULL; open = open->next)
+        oldest = open->generation < oldest ? open->generation : oldest;
+    while(views->oldest != NULL && views->oldest->generation < oldest) {
+        hashtable_version* version = views->oldest;
+        views->oldest = version->newer;
+        version->newer = released;
+        released = version;
+        views->versions--;
+    }
+    if(views->oldest == NULL)
+        views->newest = NULL;
+    pthread_mutex_unlock(&views->lock);
+
+    /* Unlink the versions released from their buckets. */
+    while(released != NULL) {
+        hashtable_version* next_version = released->newer;
+        unsigned int hash = released->bucket;
+
+        hashtable_writelock(htable, view->buckets, hash);
+        hashtable_version** version_link = &view->buckets->versions[hash];
+        while(*version_link != released)
+            version_link = &(*version_link)->next;
+        *version_link = released->next;
+        hashtable_writeunlock(htable, view->buckets, hash);
+
+        hashtable_freeversion(released);
+        released = next_version;
+    }
+
+    hashtable_exit(htable);
+    free(view);
+
+    hashtable_unpin(htable);
+}
+
+/* Release an hash table, with all its entries and, if present,
+   its key arena. */
+void hashtable_free(hashtable* htable) {
+    if(htable == NULL)
+        return;
+
+    hashtable_completeresize(htable);
+
+    /* Release the entries and the bucket arrays removed by the last
+       operations, which could still be waiting for the readers. */
+    hashtable_ebr_flush(htable);
+
+    hashtable_buckets* buckets = htable->buckets;
+    for(unsigned int i = 0; i < buckets->size; i++) {
+        hashtable_entry* current_entry = buckets->table[i];
+
+        while(current_entry != NULL) {
+            hashtable_entry* next_entry = current_entry->next;
+            hashtable_freeentry(htable, current_entry);
+            current_entry = next_entry;
+        }
+    }
+    hashtable_freebuckets(htable, buckets);
+    pthread_mutex_destroy(&htable->arena_lock);
+    free(htable->combiner);
+    free(htable->counters);
+    free(htable->digests);
+    if(htable->wheel != NULL) {
+        pthread_mutex_destroy(&htable->wheel->lock);
+        free(htable->wheel);
+    }
+    if(htable->flights != NULL) {
+        hashtable_free(htable->flights->negative);
+        pthread_mutex_destroy(&htable->flights->lock);
+        free(htable->flights);
+    }
+    if(htable->sampler != NULL) {
+        pthread_mutex_destroy(&htable->sampler->lock);
+        free(htable->sampler->entries);
+        free(htable->sampler);
+    }
+    while(htable->views.oldest != NULL) {
+        hashtable_version* next_version = htable->views.oldest->newer;
+        hashtable_freeversion(htable->views.oldest);
+        htable->views.oldest = next_version;
+    }
+    pthread_mutex_destroy(&htable->views.lock);
+
+    hashtable_arena_block* block = htable->arena;
+    while(block != NULL) {
+        hashtable_arena_block* next_block = block->next;
+        erease(block, sizeof(hashtable_arena_block) + block->size);
+        block = next_block;
+    }
+
+    erease(htable, sizeof(hashtable));
+}
+
+/* Write the key of an entry to a file. Since keys are binary-safe,
+   every byte that is not printable (including '\0') or that is a
+   space is written as an escape sequence (es. '\x00'). */
+void hashtable_fprintkey(FILE* file, hashtable_entry* entry) {
+    for(unsigned int i = 0; i < entry->key_len; i++) {
+        unsigned char ch = (unsigned char) entry->key[i];
+
+        if(isgraph(ch) && ch != '\\')
+            fputc(ch, file);
+        else
+            fprintf(file, "\\x%02x", ch);
+    }
+}
+
+/* Print the key of an entry (see hashtable_fprintkey). */
+void hashtable_printkey(hashtable_entry* entry) {
+    hashtable_fprintkey(stdout, entry);
+}
+
+/* Set the number of threads used by the bulk operations of an hash
+   table (parallel loops, resizes without cooperation, clear, build
+   and export). With 0, the default number is used (see
+   hashtable_setdefaultthreads). Return true on success, false
+   otherwise. */
+bool hashtable_setthreads(hashtable* htable, unsigned int nthreads) {
+    if(htable == NULL || nthreads > HASHTABLE_MAX_POOL_THREADS)
+        return false;
+
+    htable->nthreads = nthreads;
+
+    return true;
+}
+
+/* Run 'fn' on all the buckets of an hash table, in ranges
+   [begin, end) of its current bucket array (htable->buckets), using
+   the threads of the table. The chunk sizes adapt to the work: a
+   thread that meets long chaining lists has its remaining buckets
+   stolen by the others. A resize in progress is completed first. */
+void hashtable_parallel_for(hashtable* htable, hashtable_range_fn fn, void* ctx) {
+    if(htable == NULL || fn == NULL)
+        return;
+
+    hashtable_completeresize(htable);
+    hashtable_pool_run(hashtable_threads(htable), 0, htable->buckets->size, 16, fn, ctx);
+}
+
+/* Release all the entries in the buckets [begin, end) of an hash
+   table, as part of hashtable_clear. */
+static void hashtable_clearrange(void* ctx, unsigned int begin, unsigned int end, unsigned int worker) {
+    hashtable* htable = (hashtable*) ctx;
+    hashtable_buckets* buckets = htable->buckets;
+
+    (void) worker;
+
+    for(unsigned int i = begin; i < end; i++) {
+        hashtable_entry* current_entry = buckets->table[i];
+
+        if(current_entry != NULL && __atomic_load_n(&htable->views.active, __ATOMIC_ACQUIRE) != 0)
+            hashtable_preserve(htable, buckets, i);
+        while(current_entry != NULL) {
+            hashtable_entry* next_entry = current_entry->next;
+            hashtable_freeentry(htable, current_entry);
+            current_entry = next_entry;
+        }
+        buckets->table[i] = NULL;
+    }
+}
+
+/* Remove all the entries of an hash table, keeping its size. It must
+   be called while no other thread is using the table. */
+void hashtable_clear(hashtable* htable) {
+    if(htable == NULL)
+        return;
+
+    hashtable_completeresize(htable);
+    hashtable_ebr_flush(htable);
+
+    hashtable_parallel_for(htable, hashtable_clearrange, htable);
+
+    /* The keys in the arena have been cleared, now release it all. */
+    hashtable_arena_block* block = htable->arena;
+    while(block != NULL) {
+        hashtable_arena_block* next_block = block->next;
+        erease(block, sizeof(hashtable_arena_block) + block->size);
+        block = next_block;
+    }
+    htable->arena = NULL;
+
+    memset(htable->counters, 0, sizeof(hashtable_counter_shard) * HASHTABLE_COUNTER_SHARDS);
+    if(htable->digests != NULL)
+        memset(htable->digests, 0, sizeof(unsigned long) * htable->digest_leaves);
+
+    /* The timers have been released with their entries. */
+    if(htable->wheel != NULL) {
+        memset(htable->wheel->slots, 0, sizeof(htable->wheel->slots));
+        htable->wheel->count = 0;
+    }
+    if(htable->flights != NULL)
+        hashtable_clear(htable->flights->negative);
+    if(htable->sampler != NULL)
+        htable->sampler->count = 0;
+    htable->buckets->max_chain = 0;
+
+    if(htable->wal != NULL)
+        hashtable_wal_commit(htable->wal, hashtable_wal_append(htable->wal, HASHTABLE_WAL_CLEAR, "", 0, 0, 0));
+}
+
+/* Structure that holds the context of hashtable_build. */
+typedef struct hashtable_build_t {
+    hashtable* htable;
+    const char** keys;
+    const unsigned int* keys_len;
+    const unsigned int* vals;
+} hashtable_build_ctx;
+
+/* Insert the entries [begin, end) of hashtable_build. */
+static void hashtable_buildrange(void* ctx, unsigned int begin, unsigned int end, unsigned int worker) {
+    hashtable_build_ctx* build = (hashtable_build_ctx*) ctx;
+
+    (void) worker;
+
+    for(unsigned int i = begin; i < end; i++)
+        hashtable_insert_len(build->htable, build->keys[i], build->keys_len[i], build->vals != NULL ? build->vals[i] : 0);
+}
+
+/* Insert 'count' entries (keys[i], vals[i]), where keys[i] is made of
+   keys_len[i] bytes, in an hash table. If 'vals' is NULL, all the
+   values are 0. The entries are inserted in parallel by the threads
+   of the table only if it is in a concurrent mode. */
+void hashtable_build(hashtable* htable, const char** keys, const unsigned int* keys_len, const unsigned int* vals, unsigned int count) {
+    if(htable == NULL || keys == NULL || keys_len == NULL)
+        return;
+
+    hashtable_build_ctx build = {htable, keys, keys_len, vals};
+    unsigned int nthreads = htable->syncmode != HASHTABLE_SYNC_NONE ? hashtable_threads(htable) : 1;
+
+    hashtable_pool_run(nthreads, 0, count, 256, hashtable_buildrange, &build);
+}
+
+/* Structure that holds the context of hashtable_export. */
+typedef struct hashtable_export_t {
+    hashtable* htable;
+    FILE* streams[HASHTABLE_MAX_POOL_THREADS]; /* In-memory output of each thread */
+    char* buffers[HASHTABLE_MAX_POOL_THREADS];
+    size_t sizes[HASHTABLE_MAX_POOL_THREADS];
+    unsigned int entries[HASHTABLE_MAX_POOL_THREADS];
+} hashtable_export_ctx;
+
+/* Write the entries in the buckets [begin, end) of hashtable_export
+   to the in-memory output of the thread. */
+static void hashtable_exportrange(void* ctx, unsigned int begin, unsigned int end, unsigned int worker) {
+    hashtable_export_ctx* export = (hashtable_export_ctx*) ctx;
+    hashtable_buckets* buckets = export->htable->buckets;
+
+    if(export->streams[worker] == NULL &&
+       (export->streams[worker] = open_memstream(&export->buffers[worker], &export->sizes[worker])) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'open_memstream' on 'export->streams'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(unsigned int i = begin; i < end; i++) {
+        for(hashtable_entry* current_entry = buckets->table[i]; current_entry != NULL; current_entry = current_entry->next) {
+            hashtable_fprintkey(export->streams[worker], current_entry);
+            fprintf(export->streams[worker], " %u\n", current_entry->val);
+            export->entries[worker]++;
+        }
+    }
+}
+
+/* Export all the entries of an hash table to a text file, one per
+   line in the form "<key> <val>", where the key is escaped as in
+   hashtable_fprintkey. Every thread of the table formats its buckets
+   in memory, then the outputs are written one after the other. It
+   must be called while no other thread is writing to the table.
+   Return the number of entries exported, or -1 on error. */
+long hashtable_export(hashtable* htable, char* path) {
+    if(htable == NULL || path == NULL)
+        return -1;
+
+    hashtable_export_ctx* export;
+    if((export = (hashtable_export_ctx*)calloc(1, sizeof(hashtable_export_ctx))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'export'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    export->htable = htable;
+
+    hashtable_parallel_for(htable, hashtable_exportrange, export);
+
+    FILE* file = fopen(path, "w");
+    long entries = 0;
+    for(unsigned int t = 0; t < HASHTABLE_MAX_POOL_THREADS; t++) {
+        if(export->streams[t] == NULL)
+            continue;
+
+        fclose(export->streams[t]);
+        if(file != NULL && fwrite(export->buffers[t], 1, export->sizes[t], file) != export->sizes[t])
+            entries = -1;
+        if(entries >= 0)
+            entries += export->entries[t];
+        free(export->buffers[t]);
+    }
+    if(file == NULL || fclose(file) != 0)
+        entries = -1;
+
+    free(export);
+
+    return entries;
+}
+
+/* Structure that holds the context of hashtable_parallel_foreach. */
+typedef struct hashtable_foreach_t {
+    hashtable* htable;
+    hashtable_foreach_fn fn;
+    void* ctx;
+} hashtable_foreach_ctx;
+
+/* Call the function of hashtable_parallel_foreach on all the entries
+   in the buckets [begin, end). */
+static void hashtable_foreachrange(void* ctx, unsigned int begin, unsigned int end, unsigned int worker) {
+    hashtable_foreach_ctx* foreach = (hashtable_foreach_ctx*) ctx;
+    hashtable_buckets* buckets = foreach->htable->buckets;
+
+    for(unsigned int i = begin; i < end; i++) {
+        for(hashtable_entry* current_entry = buckets->table[i]; current_entry != NULL; current_entry = current_entry->next)
+            foreach->fn(current_entry, foreach->ctx, worker);
+    }
+}
+
+/* Call 'fn' on every entry of an hash table, partitioning the bucket
+   array among 'nthreads' threads (0: the threads of the table).
+   It must not run while other threads write to the table. */
+void hashtable_parallel_foreach(hashtable* htable, hashtable_foreach_fn fn, void* ctx, unsigned int nthreads) {
+    if(htable == NULL || fn == NULL)
+        return;
+
+    hashtable_foreach_ctx foreach = {htable, fn, ctx};
+
+    hashtable_completeresize(htable);
+    hashtable_pool_run(nthreads != 0 ? nthreads : hashtable_threads(htable), 0, htable->buckets->size, 16, hashtable_foreachrange, &foreach);
+}
+
+/* Structure that holds the context of hashtable_parallel_reduce. */
+typedef struct hashtable_reduce_t {
+    hashtable_map_fn map;
+    void* ctx;
+    void* init;                     /* Initial value of every accumulator */
+    size_t acc_size;                /* Size of an accumulator, in bytes */
+    size_t acc_stride;              /* Distance between two accumulators (a multiple of the cache line) */
+    char* accs;                     /* Accumulators, one for each thread */
+    bool used[HASHTABLE_MAX_POOL_THREADS]; /* True if the accumulator of the thread has been initialized */
+} hashtable_reduce_ctx;
+
+/* Add an entry to the accumulator of the thread, initializing it the
+   first time (used by hashtable_parallel_reduce). */
+static void hashtable_reduceentry(hashtable_entry* entry, void* ctx, unsigned int worker) {
+    hashtable_reduce_ctx* reduce = (hashtable_reduce_ctx*) ctx;
+    void* acc = reduce->accs + worker * reduce->acc_stride;
+
+    if(!reduce->used[worker]) {
+        memcpy(acc, reduce->init, reduce->acc_size);
+        reduce->used[worker] = true;
+    }
+    reduce->map(acc, entry, reduce->ctx);
+}
+
+/* Aggregate all the entries of an hash table: every thread of the
+   table adds the entries of its buckets to a private accumulator of
+   'acc_size' bytes, starting from a copy of 'init', calling 'map';
+   at the end the accumulators are merged into 'init' calling
+   'combine'. Hence 'init' must hold the identity value of the
+   aggregation (es. 0 for a sum). Return true on success, false
+   otherwise. It must not run while other threads write to the table. */
+bool hashtable_parallel_reduce(hashtable* htable, hashtable_map_fn map, hashtable_combine_fn combine, void* init, size_t acc_size, void* ctx) {
+    if(htable == NULL || map == NULL || combine == NULL || init == NULL || acc_size == 0)
+        return false;
+
+    hashtable_reduce_ctx* reduce;
+    if((reduce = (hashtable_reduce_ctx*)calloc(1, sizeof(hashtable_reduce_ctx))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'reduce'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    reduce->map = map;
+    reduce->ctx = ctx;
+    reduce->init = init;
+    reduce->acc_size = acc_size;
+    reduce->acc_stride = (acc_size + 63) / 64 * 64;
+
+    if(posix_memalign((void**)&reduce->accs, 64, reduce->acc_stride * HASHTABLE_MAX_POOL_THREADS) != 0) {
+        printf("[ERROR] There was an error while trying to call 'posix_memalign' on 'reduce->accs'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    hashtable_parallel_foreach(htable, hashtable_reduceentry, reduce, 0);
+
+    for(unsigned int t = 0; t < HASHTABLE_MAX_POOL_THREADS; t++) {
+        if(reduce->used[t])
+            combine(init, reduce->accs + t * reduce->acc_stride, ctx);
+    }
+
+    free(reduce->accs);
+    free(reduce);
+
+    return true;
+}
+
+/* Enable the Merkle digests of an hash table, splitting its keys into
+   'leaves' ranges (a power of 2, es. 65536; 0 disables them), and
+   compute them on the current entries. The enumeration of a range is
+   fast when the size of the table is a multiple of 'leaves' (or the
+   opposite). It must be called while no other thread is using the
+   table. Return true on success, false otherwise. */
+bool hashtable_setdigests(hashtable* htable, unsigned int leaves) {
+    if(htable == NULL || leaves == 1 || (leaves & (leaves - 1)) != 0)
+        return false;
+
+    free(htable->digests);
+    htable->digests = NULL;
+    htable->digest_leaves = 0;
+    if(leaves == 0)
+        return true;
+
+    unsigned long* digests;
+    if((digests = (unsigned long*)calloc(leaves, sizeof(unsigned long))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'digests'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    htable->digests = digests;
+    htable->digest_leaves = leaves;
+
+    hashtable_completeresize(htable);
+    hashtable_buckets* buckets = htable->buckets;
+    for(unsigned int i = 0; i < buckets->size; i++) {
+        for(hashtable_entry* current_entry = buckets->table[i]; current_entry != NULL; current_entry = current_entry->next) {
+            unsigned long hash;
+            unsigned int leaf = hashtable_digest_leaf(htable, current_entry->key, current_entry->key_len, &hash);
+            digests[leaf] ^= hashtable_digest_entry(hash, current_entry->val);
+        }
+    }
+
+    return true;
+}
+
+/* Build the Merkle tree of the digests of an hash table in 'tree',
+   which must have room for 2 * digest_leaves nodes: the root is
+   tree[1], the children of node 'i' are 2i and 2i + 1, and the range
+   'l' is the leaf digest_leaves + l. Comparing the trees of two
+   tables (es. exchanged with a replica) tells which ranges differ.
+   Return false if the digests are not enabled. */
+bool hashtable_digest_tree(hashtable* htable, unsigned long* tree) {
+    if(htable == NULL || htable->digests == NULL || tree == NULL)
+        return false;
+
+    unsigned int leaves = htable->digest_leaves;
+    for(unsigned int l = 0; l < leaves; l++)
+        tree[leaves + l] = __atomic_load_n(&htable->digests[l], __ATOMIC_RELAXED);
+    for(unsigned int i = leaves - 1; i > 0; i--)
+        tree[i] = tree[2 * i] ^ tree[2 * i + 1];
+    tree[0] = 0;
+
+    return true;
+}
+
+/* Structure that holds the context of hashtable_diff. */
+typedef struct hashtable_diff_t {
+    hashtable* a;
+    hashtable* b;
+    unsigned long* tree_a;
+    unsigned long* tree_b;
+    hashtable_diff_fn fn;
+    void* ctx;
+    long differences;
+} hashtable_diff_ctx;
+
+/* Compare the entries of 'from' in the range 'leaf' with 'to',
+   calling the function of hashtable_diff on the keys missing from
+   'to' or, if 'values', with a different value there. */
+static void hashtable_diffleaf(hashtable_diff_ctx* diff, hashtable* from, hashtable* to, unsigned int leaf, bool values) {
+    hashtable_buckets* buckets = from->buckets;
+    unsigned int leaves = from->digest_leaves, first = 0, step = 1;
+    bool filter = true;
+
+    /* Beyond 2^32 / 33 buckets hashtable_gethash_len overflows, and the
+       bucket is no longer the hash modulo the size. */
+    if(buckets->size > 0xFFFFFFFFU / 33) {
+        /* Scan all the buckets. */
+    } else if(buckets->size % leaves == 0) {
+        first = leaf;
+        step = leaves;
+        filter = false;
+    } else if(leaves % buckets->size == 0) {
+        first = leaf % buckets->size;
+        step = buckets->size;
+    }
+
+    for(unsigned int i = first; i < buckets->size; i += step) {
+        for(hashtable_entry* current_entry = buckets->table[i]; current_entry != NULL; current_entry = current_entry->next) {
+            if(filter && hashtable_gethash_len(leaves, current_entry->key, current_entry->key_len) != leaf)
+                continue;
+
+            hashtable_entry* other = hashtable_get_bucket(to->buckets, hashtable_gethash_len(to->buckets->size, current_entry->key, current_entry->key_len),
+                                                          current_entry->key, current_entry->key_len);
+            if(other != NULL && (!values || other->val == current_entry->val))
+                continue;
+
+            const unsigned int* val_other = other != NULL ? &other->val : NULL;
+            if(from == diff->a)
+                diff->fn(current_entry->key, current_entry->key_len, &current_entry->val, val_other, diff->ctx);
+            else
+                diff->fn(current_entry->key, current_entry->key_len, val_other, &current_entry->val, diff->ctx);
+            diff->differences++;
+        }
+    }
+}
+
+/* Descend into the node 'node' of the Merkle trees of hashtable_diff,
+   skipping it if its digests are equal. */
+static void hashtable_diffnode(hashtable_diff_ctx* diff, unsigned int node) {
+    unsigned int leaves = diff->a->digest_leaves;
+
+    if(diff->tree_a[node] == diff->tree_b[node])
+        return;
+
+    if(node < leaves) {
+        hashtable_diffnode(diff, 2 * node);
+        hashtable_diffnode(diff, 2 * node + 1);
+        return;
+    }
+
+    /* The keys of 'a' missing from 'b' or different there, then the
+       keys of 'b' missing from 'a'. */
+    hashtable_diffleaf(diff, diff->a, diff->b, node - leaves, true);
+    hashtable_diffleaf(diff, diff->b, diff->a, node - leaves, false);
+}
+
+/* Compare two hash tables with digests enabled on the same number of
+   ranges, calling 'fn' on every key whose value differs (see
+   hashtable_diff_fn). Only the ranges whose digests differ are
+   visited, so the cost depends on the differences, not on the size
+   of the tables. They must not be written during the comparison.
+   Return the number of different keys, -1 on error. */
+long hashtable_diff(hashtable* a, hashtable* b, hashtable_diff_fn fn, void* ctx) {
+    if(a == NULL || b == NULL || fn == NULL || a->digests == NULL || b->digests == NULL || a->digest_leaves != b->digest_leaves)
+        return -1;
+
+    hashtable_diff_ctx diff = {a, b, NULL, NULL, fn, ctx, 0};
+    unsigned int leaves = a->digest_leaves;
+
+    if((diff.tree_a = (unsigned long*)malloc(sizeof(unsigned long) * 2 * leaves)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'diff.tree_a'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if((diff.tree_b = (unsigned long*)malloc(sizeof(unsigned long) * 2 * leaves)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'diff.tree_b'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    hashtable_completeresize(a);
+    hashtable_completeresize(b);
+    hashtable_digest_tree(a, diff.tree_a);
+    hashtable_digest_tree(b, diff.tree_b);
+    hashtable_diffnode(&diff, 1);
+
+    free(diff.tree_a);
+    free(diff.tree_b);
+
+    return diff.differences;
+}
+
+/* Delegation-based sharded execution.
+   The keys are split among 'nshards' shards, each one a private hash
+   table (without synchronization) owned by a single thread pinned to
+   a CPU. Other threads never touch a shard: they send their requests
+   to its owner through a bounded multi-producer single-consumer ring
+   and wait for the response. The owner drains the requests in
+   batches, executes them on its table (which stays in its cache) and
+   then publishes all the responses. */
+
+/* Initialize a request ring: cell 'i' is ready to be filled at
+   position 'i'. */
+static void hashtable_ring_init(hashtable_ring* ring) {
+    ring->tail = 0;
+    ring->head = 0;
+    for(unsigned long i = 0; i < HASHTABLE_RING_SIZE; i++) {
+        ring->cells[i].seq = i;
+        ring->cells[i].request = NULL;
+    }
+}
+
+/* Append a request to a ring. A producer claims position 'pos' with a
+   compare-and-swap on the tail only if the cell there is ready for it
+   (seq == pos), then publishes the request setting seq to pos + 1.
+   Return false if the ring is full. */
+static bool hashtable_ring_push(hashtable_ring* ring, hashtable_request* request) {
+    unsigned long pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    while(true) {
+        hashtable_ring_cell* cell = &ring->cells[pos % HASHTABLE_RING_SIZE];
+        long diff = (long) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long) pos;
+
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->request = request;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Remove the oldest request from a ring (owner only) and return it, or
+   NULL if the ring is empty. The cell becomes ready for the position
+   one lap later. */
+static hashtable_request* hashtable_ring_pop(hashtable_ring* ring) {
+    hashtable_ring_cell* cell = &ring->cells[ring->head % HASHTABLE_RING_SIZE];
+
+    if(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != ring->head + 1)
+        return NULL;
+
+    hashtable_request* request = cell->request;
+    __atomic_store_n(&cell->seq, ring->head + HASHTABLE_RING_SIZE, __ATOMIC_RELEASE);
+    ring->head++;
+
+    return request;
+}
+
+/* Execute a request on a (private) hash table. */
+static void hashtable_execute(hashtable* htable, hashtable_request* request) {
+    switch(request->op) {
+        case HASHTABLE_OP_GET:
+            request->found = hashtable_lookup_len(htable, request->key, request->key_len, &request->result);
+            break;
+        case HASHTABLE_OP_INSERT:
+            hashtable_insert_len(htable, request->key, request->key_len, request->val);
+            request->result = request->val;
+            request->found = true;
+            break;
+        case HASHTABLE_OP_DELETE:
+            request->found = hashtable_get_len(htable, request->key, request->key_len) != NULL;
+            request->result = hashtable_delete_len(htable, request->key, request->key_len);
+            break;
+        case HASHTABLE_OP_INCREMENT:
+            request->result = hashtable_increment_len(htable, request->key, request->key_len, request->val);
+            request->found = true;
+            break;
+    }
+}
+
+/* Parse a list of CPUs or NUMA nodes in the format of the kernel
+   (es. "0-3,8,10-11") into 'set'. Return the number of elements. */
+static int hashtable_parselist(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+
+    while(*list != '\0' && *list != '\n') {
+        char* end;
+        long first = strtol(list, &end, 10), last = first;
+
+        if(end == list)
+            break;
+        if(*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for(long i = first; i <= last && i < CPU_SETSIZE; i++)
+            CPU_SET(i, set);
+
+        list = *end == ',' ? end + 1 : end;
+    }
+
+    return CPU_COUNT(set);
+}
+
+/* Read a list of CPUs or NUMA nodes from a file of sysfs into 'set'.
+   Return the number of elements, 0 if the file cannot be read. */
+static int hashtable_readlist(const char* path, cpu_set_t* set) {
+    char list[4096];
+    FILE* file = fopen(path, "r");
+
+    CPU_ZERO(set);
+    if(file == NULL)
+        return 0;
+    if(fgets(list, sizeof(list), file) == NULL) {
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    return hashtable_parselist(list, set);
+}
+
+/* Return the number of NUMA nodes of the machine (1 if the machine
+   has a single node, or if they cannot be determined). The nodes are
+   assumed to be numbered from 0. */
+int hashtable_numa_nodes() {
+    cpu_set_t nodes;
+    int count = hashtable_readlist("/sys/devices/system/node/online", &nodes);
+
+    if(count <= 1)
+        return 1;
+
+    return count < HASHTABLE_MAX_NODES ? count : HASHTABLE_MAX_NODES;
+}
+
+/* Return the 'index'-th CPU (modulo their number) of a NUMA node, or
+   -1 if the CPUs of the node cannot be determined. */
+int hashtable_numa_cpu(int node, unsigned int index) {
+    char path[64];
+    cpu_set_t cpus;
+
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    int count = hashtable_readlist(path, &cpus);
+    if(count == 0)
+        return -1;
+
+    index %= count;
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, &cpus) && index-- == 0)
+            return cpu;
+    }
+
+    return -1;
+}
+
+/* Make the memory allocated from now on by the calling thread be
+   placed on a NUMA node (when possible: if the node is full, the
+   kernel falls back to the others). Since the policy applies when a
+   page is first touched, it covers every bucket array, entry and key
+   that the thread allocates and initializes. Return false if it is
+   not possible (es. a kernel without NUMA support). */
+bool hashtable_numa_bind(int node) {
+    if(node < 0 || node >= HASHTABLE_MAX_NODES)
+        return false;
+
+    unsigned long nodemask = 1UL << node;
+
+    return syscall(SYS_set_mempolicy, HASHTABLE_MPOL_PREFERRED, &nodemask, HASHTABLE_MAX_NODES + 1) == 0;
+}
+
+/* Pin the calling thread to a CPU. Return false if it is not possible
+   (es. the CPU does not exist). */
+bool hashtable_pincpu(int cpu) {
+    cpu_set_t cpus;
+
+    if(cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+/* Main function of the owner of a shard. The table is created by the
+   owner itself, after pinning, so that its memory is first touched on
+   the owner's CPU. Requests are drained in batches of up to
+   HASHTABLE_DELEGATION_BATCH: all of them are executed before their
+   responses are published. */
+static void* hashtable_shard_owner(void* arg) {
+    hashtable_shard* shard = (hashtable_shard*) arg;
+    hashtable_request* batch[HASHTABLE_DELEGATION_BATCH];
+    unsigned int idle = 0;
+
+    hashtable_pincpu(shard->cpu);
+    if(shard->node >= 0)
+        hashtable_numa_bind(shard->node);
+    shard->htable = hashtable_newhashtable(shard->size);
+    hashtable_setgrowth(shard->htable, 1, HASHTABLE_RESIZE_STOP);
+    __atomic_store_n(&shard->ready, true, __ATOMIC_RELEASE);
+
+    while(!__atomic_load_n(&shard->stop, __ATOMIC_ACQUIRE)) {
+        unsigned int count = 0;
+
+        while(count < HASHTABLE_DELEGATION_BATCH && (batch[count] = hashtable_ring_pop(&shard->ring)) != NULL)
+            count++;
+
+        if(count == 0) {
+            /* Nothing to do: spin for a while, then leave the CPU. */
+            if(++idle > 64)
+                sched_yield();
+            continue;
+        }
+        idle = 0;
+
+        for(unsigned int i = 0; i < count; i++)
+            hashtable_execute(shard->htable, batch[i]);
+        for(unsigned int i = 0; i < count; i++)
+            __atomic_store_n(&batch[i]->done, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+/* Create a sharded table with delegation made of 'nshards' shards,
+   each one starting with 'size' buckets, and start their owners.
+   The memory of the i-th shard is placed on the NUMA node 'nodes[i]'
+   and its owner is pinned to a CPU of that node. If 'nodes' is NULL
+   the shards are spread round-robin among the nodes. On a machine
+   with a single node the owner of the i-th shard is simply pinned to
+   CPU 'i % number of CPUs' and its memory is placed by first touch.
+   Return it, or NULL if the arguments are not valid. */
+hashtable_delegation* hashtable_delegation_new_placed(unsigned int nshards, unsigned int size, const int* nodes) {
+    if(nshards == 0 || size < 2)
+        return NULL;
+
+    hashtable_delegation* delegation;
+    if((delegation = (hashtable_delegation*)malloc(sizeof(hashtable_delegation))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'delegation'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if(posix_memalign((void**)&delegation->shards, 64, sizeof(hashtable_shard) * nshards) != 0) {
+        printf("[ERROR] There was an error while trying to call 'posix_memalign' on 'delegation->shards'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    delegation->nshards = nshards;
+
+    int ncpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int nnodes = hashtable_numa_nodes();
+    unsigned int node_shards[HASHTABLE_MAX_NODES] = {0};     /* Shards placed so far on every node */
+    for(unsigned int i = 0; i < nshards; i++) {
+        hashtable_shard* shard = &delegation->shards[i];
+
+        hashtable_ring_init(&shard->ring);
+        shard->htable = NULL;
+        shard->size = size;
+        shard->cpu = ncpus > 0 ? (int)(i % ncpus) : -1;
+        shard->node = -1;
+        if(nnodes > 1) {
+            shard->node = nodes != NULL && nodes[i] >= 0 ? nodes[i] % nnodes : (int)(i % nnodes);
+            shard->cpu = hashtable_numa_cpu(shard->node, node_shards[shard->node]++);
+        }
+        shard->stop = false;
+        shard->ready = false;
+
+        if(pthread_create(&shard->owner, NULL, hashtable_shard_owner, shard) != 0) {
+            printf("[ERROR] There was an error while trying to call 'pthread_create' on 'shard->owner'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for(unsigned int i = 0; i < nshards; i++) {
+        while(!__atomic_load_n(&delegation->shards[i].ready, __ATOMIC_ACQUIRE))
+            sched_yield();
+    }
+
+    return delegation;
+}
+
+/* Create a sharded table with delegation made of 'nshards' shards,
+   each one starting with 'size' buckets, spread among the NUMA nodes
+   (see hashtable_delegation_new_placed). */
+hashtable_delegation* hashtable_delegation_new(unsigned int nshards, unsigned int size) {
+    return hashtable_delegation_new_placed(nshards, size, NULL);
+}
+
+/* Stop the owners of a sharded table with delegation and release it,
+   with all its shards. No request must be pending. */
+void hashtable_delegation_free(hashtable_delegation* delegation) {
+    if(delegation == NULL)
+        return;
+
+    for(unsigned int i = 0; i < delegation->nshards; i++) {
+        __atomic_store_n(&delegation->shards[i].stop, true, __ATOMIC_RELEASE);
+        pthread_join(delegation->shards[i].owner, NULL);
+        hashtable_free(delegation->shards[i].htable);
+    }
+
+    free(delegation->shards);
+    free(delegation);
+}
+
+/* Send a request to the owner of the shard of its key, without
+   waiting for the response (see hashtable_delegation_wait). If the
+   ring of the shard is full, wait until there is room. */
+void hashtable_delegation_submit(hashtable_delegation* delegation, hashtable_request* request) {
+    hashtable_shard* shard = &delegation->shards[hashtable_fullhash(request->key, request->key_len) % delegation->nshards];
+
+    request->done = 0;
+    while(!hashtable_ring_push(&shard->ring, request))
+        sched_yield();
+}
+
+/* Wait for the response to a request. */
+void hashtable_delegation_wait(hashtable_request* request) {
+    unsigned int spins = 0;
+
+    while(!__atomic_load_n(&request->done, __ATOMIC_ACQUIRE)) {
+        if(++spins > 64)
+            sched_yield();
+    }
+}
+
+/* Send 'count' requests to the owners of their shards and wait for
+   all the responses. */
+void hashtable_delegation_execute(hashtable_delegation* delegation, hashtable_request* requests, unsigned int count) {
+    if(delegation == NULL || requests == NULL)
+        return;
+
+    for(unsigned int i = 0; i < count; i++)
+        hashtable_delegation_submit(delegation, &requests[i]);
+    for(unsigned int i = 0; i < count; i++)
+        hashtable_delegation_wait(&requests[i]);
+}
+
+/* Search 'key' (made of 'key_len' bytes) in a sharded table with
+   delegation and, if found, store its value in 'val' and return true,
+   false otherwise. */
+bool hashtable_delegation_lookup(hashtable_delegation* delegation, const char* key, unsigned int key_len, unsigned int* val) {
+    hashtable_request request = {HASHTABLE_OP_GET, key, key_len, 0, 0, false, NULL, 0};
+
+    hashtable_delegation_execute(delegation, &request, 1);
+    if(request.found)
+        *val = request.result;
+
+    return request.found;
+}
+
+/* Insert (or update) the entry (key, val) in a sharded table with
+   delegation. */
+void hashtable_delegation_insert(hashtable_delegation* delegation, const char* key, unsigned int key_len, unsigned int val) {
+    hashtable_request request = {HASHTABLE_OP_INSERT, key, key_len, val, 0, false, NULL, 0};
+
+    hashtable_delegation_execute(delegation, &request, 1);
+}
+
+/* Delete 'key' from a sharded table with delegation, returning its
+   value (0 if it was not found). */
+unsigned int hashtable_delegation_delete(hashtable_delegation* delegation, const char* key, unsigned int key_len) {
+    hashtable_request request = {HASHTABLE_OP_DELETE, key, key_len, 0, 0, false, NULL, 0};
+
+    hashtable_delegation_execute(delegation, &request, 1);
+
+    return request.result;
+}
+
+/* Consistent hashing.
+   The position of a key on the ring is its hashtable_fullhash, and
+   the points of a node are the hashes of "<name>#<i>", so the owner of
+   a key depends only on the names of the nodes, not on the order in
+   which they were added. Adding a node moves to it only the keys that
+   fall just before its points (about 1 / nodes of them), and removing
+   one moves only its keys, to the nodes that follow its points. */
+
+/* Create a ring whose nodes own 'vnodes' points each (es. 160) and
+   return it. */
+hashtable_hashring* hashtable_hashring_new(unsigned int vnodes) {
+    hashtable_hashring* ring;
+
+    if(vnodes == 0)
+        return NULL;
+
+    if((ring = (hashtable_hashring*)calloc(1, sizeof(hashtable_hashring))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'ring'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    ring->vnodes = vnodes;
+
+    return ring;
+}
+
+/* Release a ring. */
+void hashtable_hashring_free(hashtable_hashring* ring) {
+    if(ring == NULL)
+        return;
+
+    for(unsigned int i = 0; i < ring->nodes_count; i++)
+        free(ring->nodes[i]);
+    free(ring->nodes);
+    free(ring->points);
+    free(ring);
+}
+
+/* Order of the points of a ring: by position and, on a tie, by the
+   name of their node, so that the order does not depend on the
+   indexes of the nodes (used by qsort_r). */
+static int hashtable_compare_points(const void* a, const void* b, void* ring) {
+    const hashtable_hashring_point* x = (const hashtable_hashring_point*) a;
+    const hashtable_hashring_point* y = (const hashtable_hashring_point*) b;
+    char** nodes = ((hashtable_hashring*) ring)->nodes;
+
+    if(x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    return strcmp(nodes[x->node], nodes[y->node]);
+}
+
+/* Return the index of the node 'name' of a ring, -1 if not present. */
+static int hashtable_hashring_find(hashtable_hashring* ring, const char* name) {
+    for(unsigned int i = 0; i < ring->nodes_count; i++) {
+        if(ring->nodes[i] != NULL && strcmp(ring->nodes[i], name) == 0)
+            return (int) i;
+    }
+
+    return -1;
+}
+
+/* Add the node 'name' to a ring. Return its index (stable until it is
+   removed), -1 if it was already present. It must not run together
+   with other operations on the ring. */
+int hashtable_hashring_add(hashtable_hashring* ring, const char* name) {
+    if(ring == NULL || name == NULL || hashtable_hashring_find(ring, name) >= 0)
+        return -1;
+
+    if(ring->nodes_count == ring->nodes_size) {
+        ring->nodes_size = ring->nodes_size == 0 ? 8 : ring->nodes_size * 2;
+        if((ring->nodes = (char**)realloc(ring->nodes, sizeof(char*) * ring->nodes_size)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'ring->nodes'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    unsigned int node = ring->nodes_count++;
+    if((ring->nodes[node] = strdup(name)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'strdup' on 'ring->nodes[node]'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if((ring->points = (hashtable_hashring_point*)realloc(ring->points, sizeof(hashtable_hashring_point) * (ring->points_count + ring->vnodes))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'realloc' on 'ring->points'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t name_len = strlen(name);
+    char* point_name;
+    if((point_name = (char*)malloc(name_len + 16)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'point_name'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    for(unsigned int i = 0; i < ring->vnodes; i++) {
+        int len = sprintf(point_name, "%s#%u", name, i);
+        ring->points[ring->points_count++] = (hashtable_hashring_point){hashtable_fullhash(point_name, len), node};
+    }
+    free(point_name);
+
+    qsort_r(ring->points, ring->points_count, sizeof(hashtable_hashring_point), hashtable_compare_points, ring);
+
+    return (int) node;
+}
+
+/* Remove the node 'name' from a ring. Return true on success, false
+   if it was not present. It must not run together with other
+   operations on the ring. */
+bool hashtable_hashring_remove(hashtable_hashring* ring, const char* name) {
+    int node;
+
+    if(ring == NULL || name == NULL || (node = hashtable_hashring_find(ring, name)) < 0)
+        return false;
+
+    /* Removing points keeps the others sorted. */
+    unsigned int kept = 0;
+    for(unsigned int i = 0; i < ring->points_count; i++) {
+        if(ring->points[i].node != (unsigned int) node)
+            ring->points[kept++] = ring->points[i];
+    }
+    ring->points_count = kept;
+
+    free(ring->nodes[node]);
+    ring->nodes[node] = NULL;
+
+    return true;
+}
+
+/* Return the index of the node that owns the 'key_len' bytes of 'key',
+   -1 if the ring is empty. */
+int hashtable_hashring_lookup(hashtable_hashring* ring, const char* key, unsigned int key_len) {
+    if(ring == NULL || ring->points_count == 0)
+        return -1;
+
+    /* First point at or after the hash of the key, wrapping around. */
+    unsigned int hash = hashtable_fullhash(key, key_len);
+    unsigned int low = 0, high = ring->points_count;
+    while(low < high) {
+        unsigned int middle = low + (high - low) / 2;
+
+        if(ring->points[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return (int) ring->points[low == ring->points_count ? 0 : low].node;
+}
+
+/* Return the name of the node 'node' of a ring, NULL if not present. */
+const char* hashtable_hashring_node(hashtable_hashring* ring, int node) {
+    if(ring == NULL || node < 0 || (unsigned int) node >= ring->nodes_count)
+        return NULL;
+
+    return ring->nodes[node];
+}
+
+/* Shared-memory tables.
+   A shared-memory table lives entirely in a POSIX shared memory
+   segment (header, lock stripes, bucket array and entries), so every
+   process that attaches it reads and writes the same table with plain
+   memory accesses. Since the segment can be mapped at a different
+   address in every process, the links are offsets from its beginning.
+   Writers take the process-shared lock of the stripe of their bucket;
+   readers take no lock at all, validating their search with the
+   sequence counter of the stripe (as in HASHTABLE_SYNC_SEQLOCK mode).
+   Released entries are recycled by later inserts, possibly while a
+   reader is still traversing them: the reader then sees the counter
+   changed and repeats the search, and every offset it follows is
+   checked against the size of the segment. The number of buckets is
+   fixed and the heap does not grow.
+   The same layout can be mapped from a regular file (see
+   hashtable_shm_open_file), making the table persistent. */
+
+/* Acquire a process-shared robust lock. If its owner died holding it,
+   a modification could have been left half done: the links are always
+   published with a single store, so the list is still consistent, and
+   only the sequence counter 'seq' (if any) must be made even again. */
+static void hashtable_shm_lock(pthread_mutex_t* lock, unsigned int* seq) {
+    if(pthread_mutex_lock(lock) == EOWNERDEAD) {
+        if(seq != NULL && (*seq & 1))
+            __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+        pthread_mutex_consistent(lock);
+    }
+}
+
+/* Initialize a process-shared robust lock. */
+static void hashtable_shm_initlock(pthread_mutex_t* lock) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* Return the size of the block of an entry with a key of 'key_len'
+   bytes (a multiple of 16). */
+static inline unsigned long hashtable_shm_blocksize(unsigned int key_len) {
+    return (sizeof(hashtable_shm_entry) + key_len + 1 + 15) & ~15UL;
+}
+
+/* Allocate a block of 'bytes' bytes (a multiple of 16) in the heap of
+   a segment, reusing a released one of the same class if possible.
+   Return its offset, 0 if the segment is full. */
+static unsigned long hashtable_shm_alloc(hashtable_shm* shm, unsigned long bytes) {
+    hashtable_shm_header* header = shm->header;
+    unsigned long class = bytes / 16 - 1, offset = 0;
+
+    hashtable_shm_lock(&header->alloc_lock, NULL);
+    if(class < HASHTABLE_SHM_CLASSES && header->free_lists[class] != 0) {
+        offset = header->free_lists[class];
+        header->free_lists[class] = ((unsigned long*)(shm->base + offset))[1];
+    } else if(header->heap + bytes <= header->segment_size) {
+        offset = header->heap;
+        header->heap += bytes;
+    }
+    pthread_mutex_unlock(&header->alloc_lock);
+
+    return offset;
+}
+
+/* Release the block of an entry, adding it to the list of its class.
+   Its 'next' link is left untouched, since a lock-free reader could
+   still be traversing it: the list of released blocks is linked
+   through the word after it instead (the key length and the value). */
+static void hashtable_shm_release(hashtable_shm* shm, unsigned long offset) {
+    hashtable_shm_header* header = shm->header;
+    hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + offset);
+    unsigned long class = hashtable_shm_blocksize(entry->key_len) / 16 - 1;
+
+    if(class >= HASHTABLE_SHM_CLASSES)
+        return;
+
+    hashtable_shm_lock(&header->alloc_lock, NULL);
+    ((unsigned long*)entry)[1] = header->free_lists[class];
+    header->free_lists[class] = offset;
+    pthread_mutex_unlock(&header->alloc_lock);
+}
+
+/* Map a shared memory segment (or a file) already open as 'fd'. The
+   caller still owns 'fd'. */
+static hashtable_shm* hashtable_shm_map(int fd, size_t segment_size) {
+    void* base = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED)
+        return NULL;
+
+    hashtable_shm* shm;
+    if((shm = (hashtable_shm*)malloc(sizeof(hashtable_shm))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'shm'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    shm->base = (char*) base;
+    shm->header = (hashtable_shm_header*) base;
+    shm->segment_size = segment_size;
+    shm->fd = -1;
+    shm->policy = HASHTABLE_MSYNC_NEVER;
+    shm->interval_ms = 0;
+    shm->last_sync = 0;
+
+    return shm;
+}
+
+/* Return the offset of the heap of a segment with 'size' buckets (the
+   bucket array starts right after the header). */
+static inline unsigned long hashtable_shm_heapstart(unsigned int size) {
+    unsigned long buckets = (sizeof(hashtable_shm_header) + 63) & ~63UL;
+
+    return (buckets + sizeof(unsigned long) * (unsigned long) size + 63) & ~63UL;
+}
+
+/* Initialize the header of a zero-filled segment (all the buckets are
+   empty and every free list is empty), except for its magic number. */
+static void hashtable_shm_format(hashtable_shm* shm, unsigned int size) {
+    hashtable_shm_header* header = shm->header;
+
+    header->size = size;
+    header->segment_size = shm->segment_size;
+    header->buckets = (sizeof(hashtable_shm_header) + 63) & ~63UL;
+    header->heap = hashtable_shm_heapstart(size);
+    hashtable_shm_initlock(&header->alloc_lock);
+    for(unsigned int s = 0; s < HASHTABLE_STRIPES; s++)
+        hashtable_shm_initlock(&header->stripes[s].lock);
+    shm->buckets = (unsigned long*)(shm->base + header->buckets);
+}
+
+/* Create a shared-memory table named 'name' (es. "/mytable") with
+   'size' buckets, in a segment of 'segment_size' bytes, and attach it.
+   Return it, or NULL if the segment already exists or cannot be
+   created. */
+hashtable_shm* hashtable_shm_create(const char* name, unsigned int size, size_t segment_size) {
+    if(name == NULL || size < 2 || segment_size <= hashtable_shm_heapstart(size))
+        return NULL;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0)
+        return NULL;
+    if(ftruncate(fd, segment_size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    hashtable_shm* shm = hashtable_shm_map(fd, segment_size);
+    close(fd);
+    if(shm == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    hashtable_shm_format(shm, size);
+
+    /* Other processes can use the table only after this store. */
+    __atomic_store_n(&shm->header->magic, HASHTABLE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+/* Attach the shared-memory table named 'name'. Return it, or NULL if
+   it does not exist or it is not a valid (initialized) table. */
+hashtable_shm* hashtable_shm_attach(const char* name) {
+    struct stat info;
+
+    if(name == NULL)
+        return NULL;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &info) < 0 || (size_t) info.st_size < sizeof(hashtable_shm_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    hashtable_shm* shm = hashtable_shm_map(fd, info.st_size);
+    close(fd);
+    if(shm == NULL)
+        return NULL;
+
+    if(__atomic_load_n(&shm->header->magic, __ATOMIC_ACQUIRE) != HASHTABLE_SHM_MAGIC ||
+       shm->header->segment_size != shm->segment_size) {
+        hashtable_shm_detach(shm);
+        return NULL;
+    }
+    shm->buckets = (unsigned long*)(shm->base + shm->header->buckets);
+
+    return shm;
+}
+
+/* Detach a shared-memory table from this process. The table survives
+   until it is removed with hashtable_shm_unlink. */
+void hashtable_shm_detach(hashtable_shm* shm) {
+    if(shm == NULL)
+        return;
+
+    /* A persistent table is marked clean once everything is on disk,
+       so that it is not checked when opened again. */
+    if(shm->fd >= 0) {
+        msync(shm->base, shm->segment_size, MS_SYNC);
+        shm->header->clean = 1;
+        msync(shm->base, sizeof(hashtable_shm_header), MS_SYNC);
+        close(shm->fd);
+    }
+
+    munmap(shm->base, shm->segment_size);
+    free(shm);
+}
+
+/* Remove the shared-memory table named 'name': it is released when
+   the last process detaches it. Return true on success, false
+   otherwise. */
+bool hashtable_shm_unlink(const char* name) {
+    return name != NULL && shm_unlink(name) == 0;
+}
+
+/* Acquire the stripe of bucket 'hash' of a shared-memory table as a
+   writer, making its sequence counter odd. */
+static void hashtable_shm_writelock(hashtable_shm* shm, unsigned int hash) {
+    hashtable_shm_stripe* stripe = &shm->header->stripes[hash % HASHTABLE_STRIPES];
+
+    hashtable_shm_lock(&stripe->lock, &stripe->seq);
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void hashtable_shm_writeunlock(hashtable_shm* shm, unsigned int hash) {
+    hashtable_shm_stripe* stripe = &shm->header->stripes[hash % HASHTABLE_STRIPES];
+
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/* Write to disk the bytes [offset, offset + len) of a persistent table
+   (HASHTABLE_MSYNC_ALWAYS). */
+static void hashtable_shm_persist(hashtable_shm* shm, unsigned long offset, unsigned long len) {
+    unsigned long page = (unsigned long) sysconf(_SC_PAGESIZE);
+    unsigned long start = offset & ~(page - 1);
+
+    msync(shm->base + start, offset + len - start, MS_SYNC);
+}
+
+/* Sync a persistent table if its interval has expired since the last
+   sync (HASHTABLE_MSYNC_INTERVAL). Only one of the threads that find
+   it expired does it. */
+static void hashtable_shm_tick(hashtable_shm* shm) {
+    if(shm->policy != HASHTABLE_MSYNC_INTERVAL)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    unsigned long now_ms = now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+    unsigned long last = __atomic_load_n(&shm->last_sync, __ATOMIC_RELAXED);
+    if(now_ms - last >= shm->interval_ms && __atomic_compare_exchange_n(&shm->last_sync, &last, now_ms, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        msync(shm->base, shm->segment_size, MS_SYNC);
+}
+
+/* Search 'key' in the bucket 'hash' of a shared-memory table, holding
+   its stripe, and return its offset (0 if not found), storing the
+   offset of the link that points to it in 'link'. */
+static unsigned long hashtable_shm_find(hashtable_shm* shm, unsigned int hash, const char* key, unsigned int key_len, unsigned long** link) {
+    *link = &shm->buckets[hash];
+
+    while(**link != 0) {
+        hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + **link);
+
+        if(entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0)
+            return **link;
+        *link = &entry->next;
+    }
+
+    return 0;
+}
+
+/* Insert (or update) the entry (key, val) in a shared-memory table,
+   where 'key' is made of 'key_len' bytes. Return false if the segment
+   is full. */
+bool hashtable_shm_insert_len(hashtable_shm* shm, const char* key, unsigned int key_len, unsigned int val) {
+    if(shm == NULL || key == NULL)
+        return false;
+
+    unsigned int hash = hashtable_gethash_len(shm->header->size, key, key_len);
+    unsigned long* link;
+
+    hashtable_shm_writelock(shm, hash);
+
+    unsigned long offset = hashtable_shm_find(shm, hash, key, key_len, &link);
+    if(offset != 0) {
+        hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + offset);
+
+        __atomic_store_n(&entry->val, val, __ATOMIC_RELAXED);
+        if(shm->policy == HASHTABLE_MSYNC_ALWAYS)
+            hashtable_shm_persist(shm, (char*)&entry->val - shm->base, sizeof(entry->val));
+        hashtable_shm_writeunlock(shm, hash);
+        hashtable_shm_tick(shm);
+        return true;
+    }
+
+    unsigned long bytes = hashtable_shm_blocksize(key_len);
+    if(bytes > shm->segment_size || (offset = hashtable_shm_alloc(shm, bytes)) == 0) {
+        hashtable_shm_writeunlock(shm, hash);
+        return false;
+    }
+
+    /* Initialize the entry, then publish it at the end of the list. */
+    hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + offset);
+    __atomic_store_n(&entry->next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->key_len, key_len, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->val, val, __ATOMIC_RELAXED);
+    memcpy(entry->key, key, key_len);
+    entry->key[key_len] = '\0';
+
+    /* In a persistent table, the entry reaches the disk before the
+       link: after a crash, a link never points to a partial entry. */
+    if(shm->policy == HASHTABLE_MSYNC_ALWAYS)
+        hashtable_shm_persist(shm, offset, bytes);
+    __atomic_store_n(link, offset, __ATOMIC_RELEASE);
+    if(shm->policy == HASHTABLE_MSYNC_ALWAYS)
+        hashtable_shm_persist(shm, (char*)link - shm->base, sizeof(unsigned long));
+    __atomic_add_fetch(&shm->header->entries, 1, __ATOMIC_RELAXED);
+
+    hashtable_shm_writeunlock(shm, hash);
+    hashtable_shm_tick(shm);
+
+    return true;
+}
+
+/* Delete 'key' (made of 'key_len' bytes) from a shared-memory table,
+   storing its value in 'val' (if not NULL). Return true if 'key' was
+   found, false otherwise. */
+bool hashtable_shm_delete_len(hashtable_shm* shm, const char* key, unsigned int key_len, unsigned int* val) {
+    if(shm == NULL || key == NULL)
+        return false;
+
+    unsigned int hash = hashtable_gethash_len(shm->header->size, key, key_len);
+    unsigned long* link;
+
+    hashtable_shm_writelock(shm, hash);
+
+    unsigned long offset = hashtable_shm_find(shm, hash, key, key_len, &link);
+    if(offset != 0) {
+        hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + offset);
+
+        if(val != NULL)
+            *val = entry->val;
+        __atomic_store_n(link, entry->next, __ATOMIC_RELAXED);
+        if(shm->policy == HASHTABLE_MSYNC_ALWAYS)
+            hashtable_shm_persist(shm, (char*)link - shm->base, sizeof(unsigned long));
+        __atomic_sub_fetch(&shm->header->entries, 1, __ATOMIC_RELAXED);
+    }
+
+    /* The entry can be recycled only after the counter has changed,
+       so that a reader still traversing it repeats its search. */
+    hashtable_shm_writeunlock(shm, hash);
+    if(offset != 0)
+        hashtable_shm_release(shm, offset);
+    hashtable_shm_tick(shm);
+
+    return offset != 0;
+}
+
+/* Search 'key' (made of 'key_len' bytes) in a shared-memory table
+   without taking any lock and, if found, store its value in 'val'.
+   Return true if 'key' was found, false otherwise. */
+bool hashtable_shm_lookup_len(hashtable_shm* shm, const char* key, unsigned int key_len, unsigned int* val) {
+    if(shm == NULL || key == NULL || val == NULL)
+        return false;
+
+    unsigned int hash = hashtable_gethash_len(shm->header->size, key, key_len);
+    hashtable_shm_stripe* stripe = &shm->header->stripes[hash % HASHTABLE_STRIPES];
+    unsigned long limit = shm->segment_size - sizeof(hashtable_shm_entry);
+
+    while(true) {
+        unsigned int seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        unsigned long offset = __atomic_load_n(&shm->buckets[hash], __ATOMIC_ACQUIRE);
+        unsigned long steps = shm->segment_size / 16;
+        bool found = false;
+        unsigned int found_val = 0;
+
+        /* The links could be stale: never leave the segment, and never
+           follow more links than there can be entries. */
+        while(offset != 0 && offset <= limit && steps-- > 0) {
+            hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + offset);
+
+            if(__atomic_load_n(&entry->key_len, __ATOMIC_RELAXED) == key_len && offset + key_len <= limit &&
+               memcmp(entry->key, key, key_len) == 0) {
+                found_val = __atomic_load_n(&entry->val, __ATOMIC_RELAXED);
+                found = true;
+                break;
+            }
+            offset = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&stripe->seq, __ATOMIC_RELAXED) == seq) {
+            if(found)
+                *val = found_val;
+            return found;
+        }
+    }
+}
+
+/* Return the number of entries of a shared-memory table. */
+unsigned long hashtable_shm_count(hashtable_shm* shm) {
+    if(shm == NULL)
+        return 0;
+
+    return __atomic_load_n(&shm->header->entries, __ATOMIC_RELAXED);
+}
+
+/* Persistent tables.
+   A persistent table is a shared-memory table mapped from a regular
+   file: the table itself is what is stored, so opening it again needs
+   no loading. An update never modifies an entry reachable by a search
+   (apart from its value): a new entry is written in a free block and
+   then published with a single store of the link that points to it,
+   and a deleted one is unlinked with a single store. With
+   HASHTABLE_MSYNC_ALWAYS the entry is written to disk before the link,
+   and each update before returning, so after a crash the file holds
+   all the updates completed, in order. With the other policies the
+   kernel writes the pages back in any order, so a crash of the system
+   can lose the updates after the last sync (a crash of the process
+   alone loses nothing: the pages are in the page cache).
+   The geometry of the table is protected by a checksum, and a file
+   that was not closed cleanly is checked when opened: every link is
+   validated (it must point to an entry of its own bucket, inside the
+   heap) and a chain is cut at the first invalid one. The released
+   blocks are forgotten, since their lists may be stale, and the size
+   of the heap and the number of entries are recomputed.
+   A persistent table is used by a single process (it is locked with
+   flock), with any number of threads. */
+
+/* Return the checksum of the geometry of a table. */
+static unsigned int hashtable_shm_checksum(hashtable_shm_header* header) {
+    unsigned long geometry[3] = {header->size, header->segment_size, header->buckets};
+
+    return hashtable_crc32(0, geometry, sizeof(geometry));
+}
+
+/* Check the content of a persistent table that was not closed cleanly,
+   repairing it as described above. Return the number of links cut. */
+static unsigned long hashtable_shm_recover(hashtable_shm* shm) {
+    hashtable_shm_header* header = shm->header;
+    unsigned long heap = hashtable_shm_heapstart(header->size), end = heap, entries = 0, cut = 0;
+
+    for(unsigned int i = 0; i < header->size; i++) {
+        unsigned long* link = &shm->buckets[i];
+        unsigned long steps = shm->segment_size / 16;
+
+        while(*link != 0) {
+            unsigned long offset = *link;
+            hashtable_shm_entry* entry = (hashtable_shm_entry*)(shm->base + offset);
+
+            if(offset < heap || (offset & 15) != 0 || offset + sizeof(hashtable_shm_entry) > shm->segment_size ||
+               entry->key_len > shm->segment_size || offset + hashtable_shm_blocksize(entry->key_len) > shm->segment_size ||
+               hashtable_gethash_len(header->size, entry->key, entry->key_len) != i || steps-- == 0) {
+                *link = 0;
+                cut++;
+                break;
+            }
+
+            if(offset + hashtable_shm_blocksize(entry->key_len) > end)
+                end = offset + hashtable_shm_blocksize(entry->key_len);
+            entries++;
+            link = &entry->next;
+        }
+    }
+
+    if(header->heap < end || header->heap > shm->segment_size)
+        header->heap = end;
+    memset(header->free_lists, 0, sizeof(header->free_lists));
+    header->entries = entries;
+
+    return cut;
+}
+
+/* Close the file 'fd' of a table that could not be opened, removing
+   it only if it was created by hashtable_shm_open_file ('owned'). An
+   empty file of the caller that has been 'extended' is truncated back
+   to 0 bytes. Return NULL. */
+static hashtable_shm* hashtable_shm_abandon(int fd, const char* path, bool owned, bool extended) {
+    if(owned) {
+        unlink(path);
+    } else if(extended) {
+        int result = ftruncate(fd, 0);
+        (void) result;
+    }
+    close(fd);
+
+    return NULL;
+}
 
-} hashtable_entry;
+/* Open the persistent table stored in the file 'path', or create it
+   with 'size' buckets in a file of 'segment_size' bytes if it does not
+   exist (the size of an existing table cannot change). The updates are
+   made durable according to 'policy' ('interval_ms' is the sync
+   interval of HASHTABLE_MSYNC_INTERVAL). The table is closed with
+   hashtable_shm_detach. Return it, or NULL if the file is not a valid
+   table, is already open or cannot be created. */
+hashtable_shm* hashtable_shm_open_file(const char* path, unsigned int size, size_t segment_size, hashtable_msync policy, unsigned int interval_ms) {
+    struct stat info;
 
-/* Structure that holds information of an hash table. */
-typedef struct hashtable_t {
-    unsigned int size;              /* Hash table size */
-    unsigned int different_entries; /* Number of different entries */
-    unsigned int collisions;        /* Number of collisions */
+    if(path == NULL || policy > HASHTABLE_MSYNC_NEVER || (policy == HASHTABLE_MSYNC_INTERVAL && interval_ms == 0))
+        return NULL;
 
-    struct hashtable_entry_t** table; /* Hash table array */
-} hashtable;
+    /* Only a file created by this call is removed on error: an existing
+       one, even if empty, belongs to the caller. */
+    bool owned = true;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0 && errno == EEXIST) {
+        owned = false;
+        fd = open(path, O_RDWR | O_CLOEXEC);
+    }
+    if(fd < 0)
+        return NULL;
+    /* If the lock is taken, another process has opened the new file
+       too, and is using it. */
+    if(flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if(fstat(fd, &info) < 0)
+        return hashtable_shm_abandon(fd, path, owned, false);
 
+    bool created = info.st_size == 0;
+    if(created) {
+        if(size < 2 || segment_size <= hashtable_shm_heapstart(size) || ftruncate(fd, segment_size) < 0)
+            return hashtable_shm_abandon(fd, path, owned, false);
+    } else if((size_t) info.st_size < sizeof(hashtable_shm_header)) {
+        close(fd);
+        return NULL;
+    } else {
+        segment_size = info.st_size;
+    }
 
-/* Releases the memory occupied by a pointer and, for security
-   reasons, clears its entire contents. */
-void erease(void* pointer, unsigned int size) {
-    if(pointer == NULL || size == 0)
-        return;
-    
-    memset(pointer, '\0', size);
-    free(pointer);
-}
+    hashtable_shm* shm = hashtable_shm_map(fd, segment_size);
+    if(shm == NULL)
+        return hashtable_shm_abandon(fd, path, owned, created);
+    hashtable_shm_header* header = shm->header;
 
-/* Calculate hash value (integer) of a string (key) and return it.
-   The algorithm used consists in adding all the integer values
-   corresponding to each character of the string, adding the
-   previous result multiplied by 33 each time.
-   To optimize the speed, the multiplication by 33 is done by making
-   a 5 bit shift to the left, which corresponds to a multiplication
-   by 2^5 = 32, and then the last value is added.
-   At each step, to prevent the value from overflowing and above all
-   to prevent it from exceeding the maximum size of the hash table,
-   the modulo operation is used. */
-unsigned int hashtable_gethash(unsigned int hashtable_size, char* key) {
-    unsigned int hash = 0;
+    if(created) {
+        hashtable_shm_format(shm, size);
+        header->checksum = hashtable_shm_checksum(header);
+        header->magic = HASHTABLE_SHM_MAGIC;
+    } else {
+        if(header->magic != HASHTABLE_SHM_MAGIC || header->checksum != hashtable_shm_checksum(header) ||
+           header->segment_size != segment_size || header->buckets != ((sizeof(hashtable_shm_header) + 63) & ~63UL) ||
+           hashtable_shm_heapstart(header->size) >= segment_size) {
+            hashtable_shm_detach(shm);
+            close(fd);
+            return NULL;
+        }
+        shm->buckets = (unsigned long*)(shm->base + header->buckets);
 
-    for (char* ch = key; *ch != '\0'; ch++) {
-        hash = ((int)(*ch) + (hash << 5) + hash) % hashtable_size;
+        /* The locks of the previous process are meaningless. */
+        hashtable_shm_initlock(&header->alloc_lock);
+        for(unsigned int s = 0; s < HASHTABLE_STRIPES; s++)
+            hashtable_shm_initlock(&header->stripes[s].lock);
+
+        if(!header->clean) {
+            hashtable_shm_recover(shm);
+            msync(shm->base, shm->segment_size, MS_SYNC);
+        }
     }
 
-    return hash;
+    /* Until it is closed, the file is not clean. */
+    header->clean = 0;
+    msync(shm->base, sizeof(hashtable_shm_header), MS_SYNC);
+
+    shm->fd = fd;
+    shm->policy = policy;
+    shm->interval_ms = interval_ms;
+
+    return shm;
 }
 
-/* Create a new hash table with a specific size and return it. */
-hashtable* hashtable_newhashtable(unsigned int size) {
-    if(size < 2)
-        return NULL;
-    
-    hashtable* htable = NULL;
+/* Write to disk all the updates of a persistent table. Return true on
+   success, false otherwise. */
+bool hashtable_shm_sync(hashtable_shm* shm) {
+    if(shm == NULL || shm->fd < 0)
+        return false;
 
-    if((htable = (hashtable*)malloc(sizeof(hashtable))) == NULL) {
-        printf("[ERROR] There was an error while trying to call 'malloc' on 'htable'. Closing...\n");
-		exit(EXIT_FAILURE);
-    }
+    return msync(shm->base, shm->segment_size, MS_SYNC) == 0;
+}
 
-    /* Initialize hash table */    
-    htable->size = size;
-    htable->different_entries = 0;
-    htable->collisions = 0;
+/* Disk-backed tables.
+   A disk-backed table keeps in memory only an index of the keys (their
+   hash and the position of their record, 16 bytes per slot), while
+   the keys and the values live in a log file of write-ahead log
+   records (see hashtable_wal_encode) after the magic string: every
+   insert or delete appends a record, so the file is written only
+   sequentially, and the index points to the last record of every
+   key. The records are read with pread, in blocks of
+   HASHTABLE_DISK_BLOCK bytes, through a cache of hot blocks with CLOCK
+   replacement; the file is read with O_DIRECT (when supported), so
+   the blocks that are not in the cache really come from the disk and
+   not from the page cache of the system. The records of overwritten
+   or deleted keys stay in the file until hashtable_disk_compact. */
 
-    if((htable->table = (hashtable_entry**)malloc(sizeof(hashtable_entry*)*size)) == NULL) {
-        printf("[ERROR] There was an error while trying to call 'malloc' on 'htable->table'. Closing...\n");
-		exit(EXIT_FAILURE);
+/* Remove the block in the frame 'frame' from the buckets of the cache. */
+static void hashtable_disk_unlink(hashtable_disk* disk, int frame) {
+    int* link = &disk->cache_buckets[disk->frames[frame].block % disk->nframes];
+
+    while(*link != frame)
+        link = &disk->frames[*link].next;
+    *link = disk->frames[frame].next;
+    disk->frames[frame].block = ULONG_MAX;
+}
+
+/* Drop a block from the cache, if present. */
+static void hashtable_disk_evict(hashtable_disk* disk, unsigned long block) {
+    for(int frame = disk->cache_buckets[block % disk->nframes]; frame >= 0; frame = disk->frames[frame].next) {
+        if(disk->frames[frame].block == block) {
+            hashtable_disk_unlink(disk, frame);
+            return;
+        }
     }
+}
 
-    /* Initialize all entries to NULL */
-    for(unsigned int i = 0; i < size; i++)
-        htable->table[i] = NULL;
-    
-    return htable;
+/* Drop all the blocks from the cache. */
+static void hashtable_disk_resetcache(hashtable_disk* disk) {
+    for(unsigned int i = 0; i < disk->nframes; i++) {
+        disk->frames[i] = (hashtable_disk_frame){ULONG_MAX, 0, -1, false};
+        disk->cache_buckets[i] = -1;
+    }
+    disk->hand = 0;
 }
 
-/* Create a new hash table entry (key, val) and return it. */
-hashtable_entry* hashtable_newentry(char* key, unsigned int val) {
-    if(key == NULL)
-        return NULL;
+/* Return the frame that holds the block 'block' of the file, reading
+   it (in place of a block not used recently) if it is not cached.
+   Return -1 on a read error. */
+static int hashtable_disk_block(hashtable_disk* disk, unsigned long block) {
+    int* bucket = &disk->cache_buckets[block % disk->nframes];
 
-    hashtable_entry* new_entry;
+    for(int frame = *bucket; frame >= 0; frame = disk->frames[frame].next) {
+        if(disk->frames[frame].block == block) {
+            disk->frames[frame].referenced = true;
+            disk->hits++;
+            return frame;
+        }
+    }
 
-	if((new_entry = (hashtable_entry*)malloc(sizeof(hashtable_entry))) == NULL ) {
-        printf("[ERROR] There was an error while trying to call 'malloc' on 'new_entry'. Closing...\n");
-		exit(EXIT_FAILURE);
-	}
+    /* CLOCK: the hand clears the bits of the frames used since its last
+       pass, and stops at the first one that was not used. */
+    while(disk->frames[disk->hand].referenced) {
+        disk->frames[disk->hand].referenced = false;
+        disk->hand = (disk->hand + 1) % disk->nframes;
+    }
+    int frame = (int) disk->hand;
+    disk->hand = (disk->hand + 1) % disk->nframes;
+    if(disk->frames[frame].block != ULONG_MAX)
+        hashtable_disk_unlink(disk, frame);
 
-	if((new_entry->key = (char*)malloc(65)) == NULL ) {
-		printf("[ERROR] There was an error while trying to call 'malloc' on 'new_entry->key'. Closing...\n");
-		exit(EXIT_FAILURE);
-	}
+    ssize_t valid;
+    do {
+        valid = pread(disk->read_fd, disk->cache + (size_t) frame * HASHTABLE_DISK_BLOCK, HASHTABLE_DISK_BLOCK, block * HASHTABLE_DISK_BLOCK);
+    } while(valid < 0 && errno == EINTR);
+    if(valid < 0)
+        return -1;
+    disk->misses++;
 
-    /* Initialize entry with key,val and "next" pointer set to NULL */
-    strcpy(new_entry->key, key);
-    new_entry->val = val;
-    new_entry->next = NULL;
+    disk->frames[frame] = (hashtable_disk_frame){block, (unsigned int) valid, *bucket, true};
+    *bucket = frame;
 
-	return new_entry;
+    return frame;
 }
 
-/* Insert a new entry (or, if already present, update it) in
-   the hash table and return the entry just inserted/updated. */
-hashtable_entry* hashtable_insert(hashtable* htable, char* key, unsigned int val) {
-    if(htable == NULL || key == NULL)
-        return NULL;
+/* Read the 'len' bytes at 'offset' of the file (or of the records not
+   yet written) into the record buffer and return it, NULL on error. */
+static const char* hashtable_disk_read(hashtable_disk* disk, unsigned long offset, unsigned int len) {
+    if(len > disk->record_size) {
+        disk->record_size = len;
+        if((disk->record = (char*)realloc(disk->record, len)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'realloc' on 'disk->record'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    unsigned int hash = hashtable_gethash(htable->size, key);
+    /* A record is either all written or all in the buffer. */
+    if(offset >= disk->size) {
+        if(offset - disk->size + len > disk->buffer_len)
+            return NULL;
+        memcpy(disk->record, disk->buffer + (offset - disk->size), len);
+        return disk->record;
+    }
 
-    // printf("Insert: %s -> %u\n", key, hash);
+    for(unsigned int copied = 0; copied < len; ) {
+        unsigned long block = (offset + copied) / HASHTABLE_DISK_BLOCK;
+        unsigned int within = (offset + copied) % HASHTABLE_DISK_BLOCK;
+        unsigned int count = len - copied < HASHTABLE_DISK_BLOCK - within ? len - copied : HASHTABLE_DISK_BLOCK - within;
+        int frame = hashtable_disk_block(disk, block);
 
-    hashtable_entry* current_entry = htable->table[hash];
-    
-    /* Check if the new entry is the first one with that hash value, then
-       add it as the head of the chaining list. */
-    if(current_entry == NULL) {
-        hashtable_entry* new_entry = hashtable_newentry(key, val);
-        htable->table[hash] = new_entry;
-        (htable->different_entries)++;
+        if(frame < 0 || within + count > disk->frames[frame].valid)
+            return NULL;
+        memcpy(disk->record + copied, disk->cache + (size_t) frame * HASHTABLE_DISK_BLOCK + within, count);
+        copied += count;
+    }
 
-        return new_entry;
+    return disk->record;
+}
+
+/* Decode the record at the start of 'data' (at most 'avail' bytes),
+   storing its key, its value and its length. Return its type, 0 if it
+   is not complete or fails its checksum. */
+static hashtable_walop hashtable_disk_decode(const char* data, size_t avail, const char** key, unsigned int* key_len, unsigned int* val, unsigned int* length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    unsigned int varint_len;
+    size_t pos = 1;
+
+    *val = 0;
+    if(avail < 2 || bytes[0] < HASHTABLE_WAL_INSERT || bytes[0] > HASHTABLE_WAL_CLEAR ||
+       (varint_len = hashtable_getvarint(bytes + pos, avail - pos, key_len)) == 0)
+        return 0;
+    pos += varint_len;
+    if(bytes[0] == HASHTABLE_WAL_INSERT) {
+        if((varint_len = hashtable_getvarint(bytes + pos, avail - pos, val)) == 0)
+            return 0;
+        pos += varint_len;
     }
+    if(avail - pos < (size_t) *key_len + 4)
+        return 0;
 
-    /* There is already at least one entry with the same hash value. Search
-       if the key is already present in the chaining list. */
-    int found = false;
-    while(true) {
-        if(strcmp(current_entry->key, key) == 0) {
-            found = true;
-            break;
+    const unsigned char* trailer = bytes + pos + *key_len;
+    unsigned int crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((unsigned int) trailer[3] << 24);
+    if(hashtable_crc32(0, bytes, pos + *key_len) != crc)
+        return 0;
+    *key = data + pos;
+    *length = (unsigned int)(pos + *key_len + 4);
+
+    return (hashtable_walop) bytes[0];
+}
+
+/* Search a key in the index. Return its slot, -1 if not present, and
+   store in 'free_slot' the first slot where it could be inserted. */
+static long hashtable_disk_find(hashtable_disk* disk, const char* key, unsigned int key_len, unsigned int hash, unsigned int* val, long* free_slot) {
+    unsigned int mask = disk->capacity - 1;
+
+    *free_slot = -1;
+    for(unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+        hashtable_disk_slot* slot = &disk->slots[i];
+
+        if(slot->offset == 0) {
+            if(*free_slot < 0)
+                *free_slot = i;
+            return -1;
         }
-        if(current_entry->next == NULL)
-            break;
-        
-        current_entry = current_entry->next;
+        if(slot->offset == 1) {
+            if(*free_slot < 0)
+                *free_slot = i;
+            continue;
+        }
+        if(slot->hash != hash || slot->length < key_len + 6)
+            continue;
+
+        const char* record = hashtable_disk_read(disk, slot->offset, slot->length);
+        const char* record_key;
+        unsigned int record_key_len, length;
+        if(record != NULL && hashtable_disk_decode(record, slot->length, &record_key, &record_key_len, val, &length) == HASHTABLE_WAL_INSERT &&
+           record_key_len == key_len && memcmp(record_key, key, key_len) == 0)
+            return i;
     }
-    
-    /* The key is already present, so update its value. */
-    if(found) {
-        current_entry->val = val;
+}
 
-        return current_entry;
+/* Double the index (or rebuild it, if most of its full slots are of
+   deleted keys), without reading the file. */
+static void hashtable_disk_grow(hashtable_disk* disk) {
+    unsigned int capacity = disk->used * 2 >= disk->capacity / 2 ? disk->capacity * 2 : disk->capacity;
+    hashtable_disk_slot* slots;
+
+    if((slots = (hashtable_disk_slot*)calloc(capacity, sizeof(hashtable_disk_slot))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'slots'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    for(unsigned int i = 0; i < disk->capacity; i++) {
+        if(disk->slots[i].offset > 1) {
+            unsigned int j = disk->slots[i].hash & (capacity - 1);
+            while(slots[j].offset != 0)
+                j = (j + 1) & (capacity - 1);
+            slots[j] = disk->slots[i];
+        }
     }
 
-    /* The key is not present, so insert it at the end of the chaining list. */
-    current_entry->next = hashtable_newentry(key, val);
-    (htable->collisions)++;
+    free(disk->slots);
+    disk->slots = slots;
+    disk->capacity = capacity;
+    disk->deleted = 0;
+}
+
+/* Write the buffered records at the end of the file. Return true on
+   success, false otherwise. */
+static bool hashtable_disk_flush(hashtable_disk* disk) {
+    for(size_t written = 0; written < disk->buffer_len; ) {
+        ssize_t result = pwrite(disk->fd, disk->buffer + written, disk->buffer_len - written, disk->size + written);
+        if(result < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        written += result;
+    }
+
+    /* The last block, if cached, misses the records just written. */
+    hashtable_disk_evict(disk, disk->size / HASHTABLE_DISK_BLOCK);
+    disk->size += disk->buffer_len;
+    disk->buffer_len = 0;
 
-    return current_entry->next;
+    return true;
 }
 
-/* Search an entry by 'key' and delete it if found, returning
-   its value. Return 0 if 'key' was not found. */
-unsigned int hashtable_delete(hashtable* htable, char* key) {
-    if(htable == NULL || key == NULL)
+/* Append a record to a table and return its offset, 0 on error. */
+static unsigned long hashtable_disk_append(hashtable_disk* disk, hashtable_walop op, const char* key, unsigned int key_len, unsigned int val, unsigned int* length) {
+    if(disk->buffer_len + key_len + HASHTABLE_WAL_OVERHEAD > HASHTABLE_DISK_BUFFER && !hashtable_disk_flush(disk))
         return 0;
 
-    unsigned int hash = hashtable_gethash(htable->size, key);
+    /* A key longer than the buffer is written on its own. */
+    if(key_len + HASHTABLE_WAL_OVERHEAD > HASHTABLE_DISK_BUFFER) {
+        char* record;
+        if((record = (char*)malloc(key_len + HASHTABLE_WAL_OVERHEAD)) == NULL) {
+            printf("[ERROR] There was an error while trying to call 'malloc' on 'record'. Closing...\n");
+            exit(EXIT_FAILURE);
+        }
+        *length = hashtable_wal_encode(record, op, key, key_len, val);
+        unsigned long offset = disk->size;
+        bool success = pwrite(disk->fd, record, *length, offset) == (ssize_t) *length;
+        free(record);
+        if(!success)
+            return 0;
+        hashtable_disk_evict(disk, disk->size / HASHTABLE_DISK_BLOCK);
+        disk->size += *length;
+        return offset;
+    }
+
+    unsigned long offset = disk->size + disk->buffer_len;
+    *length = hashtable_wal_encode(disk->buffer + disk->buffer_len, op, key, key_len, val);
+    disk->buffer_len += *length;
 
-    // printf("Delete: %s -> %u\n", key, hash);
+    return offset;
+}
 
-    hashtable_entry* current_entry = htable->table[hash];
+/* Apply to the index a record at 'offset' (used while loading). */
+static void hashtable_disk_index(hashtable_disk* disk, hashtable_walop op, const char* key, unsigned int key_len, unsigned long offset, unsigned int length) {
+    unsigned int hash = hashtable_fullhash(key, key_len), val;
+    long free_slot;
 
-    if(current_entry == NULL) {
-        return 0;
+    if(op == HASHTABLE_WAL_CLEAR) {
+        memset(disk->slots, 0, sizeof(hashtable_disk_slot) * disk->capacity);
+        disk->used = disk->deleted = 0;
+        disk->garbage = offset + length - strlen(HASHTABLE_DISK_MAGIC);
+        return;
     }
 
-    /* Search the entry in the chaining list */
-    hashtable_entry* previous_entry = current_entry;
-    while(current_entry != NULL && strcmp(current_entry->key, key) != 0) {
-        previous_entry = current_entry;
-        current_entry = current_entry->next;
+    long slot = hashtable_disk_find(disk, key, key_len, hash, &val, &free_slot);
+    if(op == HASHTABLE_WAL_INSERT) {
+        if(slot >= 0) {
+            disk->garbage += disk->slots[slot].length;
+            disk->slots[slot] = (hashtable_disk_slot){hash, length, offset};
+            return;
+        }
+        if(disk->slots[free_slot].offset == 1)
+            disk->deleted--;
+        disk->slots[free_slot] = (hashtable_disk_slot){hash, length, offset};
+        disk->used++;
+        if((disk->used + disk->deleted) * 4 > disk->capacity * 3)
+            hashtable_disk_grow(disk);
+    } else {
+        disk->garbage += length;
+        if(slot >= 0) {
+            disk->garbage += disk->slots[slot].length;
+            disk->slots[slot].offset = 1;
+            disk->used--;
+            disk->deleted++;
+        }
     }
-    
-    if(current_entry != NULL) {
-        int val = current_entry->val;
+}
 
-        /* Check if the entry is the head of the chaining list (htable->table[i]). */
-        if(previous_entry == current_entry) {
-            if(current_entry->next == NULL) {   /* Check if it is the only entry. */
-                htable->table[hash] = NULL;
-                (htable->different_entries)--;
-            }
-            else {
-                htable->table[hash] = current_entry->next;
-                (htable->collisions)--;
-            }
-        } else {
-            previous_entry->next = current_entry->next;
-            (htable->collisions)--;
+/* Open the disk-backed table 'path' (creating it if it does not exist)
+   with a block cache of 'cache_size' bytes, rebuilding its index from
+   the records of the file: a record cut by a crash, and what follows
+   it, is dropped. Return the table, NULL on error. */
+hashtable_disk* hashtable_disk_open(const char* path, size_t cache_size) {
+    size_t magic_len = strlen(HASHTABLE_DISK_MAGIC);
+    struct stat info;
+    int fd;
+
+    if(path == NULL || (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+        return NULL;
+    if(fstat(fd, &info) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char magic[16];
+    if(info.st_size == 0) {
+        if(pwrite(fd, HASHTABLE_DISK_MAGIC, magic_len, 0) != (ssize_t) magic_len) {
+            close(fd);
+            return NULL;
         }
+        info.st_size = magic_len;
+    } else if((size_t) info.st_size < magic_len || pread(fd, magic, magic_len, 0) != (ssize_t) magic_len ||
+              memcmp(magic, HASHTABLE_DISK_MAGIC, magic_len) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-        /* Releases the memory of both the string in the entry and the entry itself.*/
-        erease(current_entry->key, 65);
-        erease(current_entry, sizeof(hashtable_entry));
+    hashtable_disk* disk;
+    if((disk = (hashtable_disk*)calloc(1, sizeof(hashtable_disk))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'disk'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    disk->fd = fd;
+    if((disk->read_fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC)) < 0)
+        disk->read_fd = fd;
+    if((disk->path = strdup(path)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'strdup' on 'disk->path'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if((disk->buffer = (char*)malloc(HASHTABLE_DISK_BUFFER)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'disk->buffer'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
 
-        return val;
+    disk->capacity = 1024;
+    if((disk->slots = (hashtable_disk_slot*)calloc(disk->capacity, sizeof(hashtable_disk_slot))) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'calloc' on 'disk->slots'. Closing...\n");
+        exit(EXIT_FAILURE);
     }
 
-    return 0;
-}
+    disk->nframes = cache_size / HASHTABLE_DISK_BLOCK < 16 ? 16 : cache_size / HASHTABLE_DISK_BLOCK;
+    if(posix_memalign((void**)&disk->cache, HASHTABLE_DISK_BLOCK, (size_t) disk->nframes * HASHTABLE_DISK_BLOCK) != 0) {
+        printf("[ERROR] There was an error while trying to call 'posix_memalign' on 'disk->cache'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    if((disk->frames = (hashtable_disk_frame*)malloc(sizeof(hashtable_disk_frame) * disk->nframes)) == NULL ||
+       (disk->cache_buckets = (int*)malloc(sizeof(int) * disk->nframes)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'disk->frames'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+    hashtable_disk_resetcache(disk);
 
-/* Search an entry by 'key' and return the entry (key, val) if
-   found, NULL otherwise. */
-hashtable_entry* hashtable_get(hashtable* htable, char* key) {
-    if(htable == NULL || key == NULL)
+    /* Load the index, reading the file sequentially. The keys already
+       indexed are read (to compare them) through the cache, so the
+       size of the file grows with the records loaded. */
+    size_t file_size = info.st_size;
+    const unsigned char* data = NULL;
+    if(file_size > magic_len && (data = (const unsigned char*)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        hashtable_disk_close(disk);
         return NULL;
+    }
 
-    unsigned int hash = hashtable_gethash(htable->size, key);
+    size_t valid = magic_len;
+    disk->size = magic_len;
+    while(valid < file_size) {
+        const char* key;
+        unsigned int key_len, val, length;
+        hashtable_walop op = hashtable_disk_decode((const char*)(data + valid), file_size - valid, &key, &key_len, &val, &length);
 
-    hashtable_entry* current_entry = htable->table[hash];
+        if(op == 0)
+            break;
+        disk->size = valid + length;
+        hashtable_disk_index(disk, op, key, key_len, valid, length);
+        valid += length;
+    }
+    if(data != NULL)
+        munmap((void*) data, file_size);
 
-    while(true) {
-        /* The end of the chaining list has been reached and the
-           entry was not found. */
-        if(current_entry == NULL)
-            return NULL;
-        if(strcmp(current_entry->key, key) == 0) {
-            return current_entry;
+    if(valid < file_size && ftruncate(fd, valid) < 0) {
+        hashtable_disk_close(disk);
+        return NULL;
+    }
+    disk->size = valid;
+
+    return disk;
+}
+
+/* Write the records not yet written and close a disk-backed table. */
+void hashtable_disk_close(hashtable_disk* disk) {
+    if(disk == NULL)
+        return;
+
+    hashtable_disk_flush(disk);
+    if(disk->read_fd != disk->fd)
+        close(disk->read_fd);
+    close(disk->fd);
+    free(disk->path);
+    free(disk->buffer);
+    free(disk->record);
+    free(disk->slots);
+    free(disk->cache);
+    free(disk->frames);
+    free(disk->cache_buckets);
+    free(disk);
+}
+
+/* Insert (or update) a key in a disk-backed table. Return true on
+   success, false on a write error. */
+bool hashtable_disk_insert_len(hashtable_disk* disk, const char* key, unsigned int key_len, unsigned int val) {
+    unsigned int hash, length, old_val;
+    unsigned long offset;
+    long slot, free_slot;
+
+    if(disk == NULL || key == NULL)
+        return false;
+
+    hash = hashtable_fullhash(key, key_len);
+    slot = hashtable_disk_find(disk, key, key_len, hash, &old_val, &free_slot);
+    if(slot >= 0 && old_val == val)
+        return true;
+    if((offset = hashtable_disk_append(disk, HASHTABLE_WAL_INSERT, key, key_len, val, &length)) == 0)
+        return false;
+
+    if(slot >= 0) {
+        disk->garbage += disk->slots[slot].length;
+        disk->slots[slot].length = length;
+        disk->slots[slot].offset = offset;
+        return true;
+    }
+    if(disk->slots[free_slot].offset == 1)
+        disk->deleted--;
+    disk->slots[free_slot] = (hashtable_disk_slot){hash, length, offset};
+    disk->used++;
+    if((disk->used + disk->deleted) * 4 > disk->capacity * 3)
+        hashtable_disk_grow(disk);
+
+    return true;
+}
+
+/* Search a key in a disk-backed table and store its value in 'val'.
+   Return true if the key is present, false otherwise. */
+bool hashtable_disk_lookup_len(hashtable_disk* disk, const char* key, unsigned int key_len, unsigned int* val) {
+    unsigned int found;
+    long free_slot;
+
+    if(disk == NULL || key == NULL || hashtable_disk_find(disk, key, key_len, hashtable_fullhash(key, key_len), &found, &free_slot) < 0)
+        return false;
+    if(val != NULL)
+        *val = found;
+
+    return true;
+}
+
+/* Delete a key from a disk-backed table. Return true if the key was
+   present (and its deletion was logged), false otherwise. */
+bool hashtable_disk_delete_len(hashtable_disk* disk, const char* key, unsigned int key_len) {
+    unsigned int length, val;
+    long slot, free_slot;
+
+    if(disk == NULL || key == NULL)
+        return false;
+    if((slot = hashtable_disk_find(disk, key, key_len, hashtable_fullhash(key, key_len), &val, &free_slot)) < 0 ||
+       hashtable_disk_append(disk, HASHTABLE_WAL_DELETE, key, key_len, 0, &length) == 0)
+        return false;
+
+    disk->garbage += disk->slots[slot].length + length;
+    disk->slots[slot].offset = 1;
+    disk->used--;
+    disk->deleted++;
+
+    return true;
+}
+
+/* Return the number of keys of a disk-backed table. */
+unsigned long hashtable_disk_count(hashtable_disk* disk) {
+    return disk == NULL ? 0 : disk->used;
+}
+
+/* Write the records not yet written and make them durable. Return
+   true on success, false otherwise. */
+bool hashtable_disk_sync(hashtable_disk* disk) {
+    return disk != NULL && hashtable_disk_flush(disk) && fdatasync(disk->fd) == 0;
+}
+
+/* Rewrite a disk-backed table with only the records of its present
+   keys, to give back the space of the overwritten and deleted ones.
+   The new file replaces the old one atomically, so a crash leaves
+   either of them. Return true on success, false otherwise (the table
+   keeps the old file). */
+bool hashtable_disk_compact(hashtable_disk* disk) {
+    if(disk == NULL || !hashtable_disk_flush(disk))
+        return false;
+
+    size_t magic_len = strlen(HASHTABLE_DISK_MAGIC), path_len = strlen(disk->path);
+    char tmp_path[path_len + 5];
+    unsigned long* offsets;
+    int fd;
+
+    memcpy(tmp_path, disk->path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    if((fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return false;
+
+    /* The new offsets are kept apart until the rename succeeds. */
+    if((offsets = (unsigned long*)malloc(sizeof(unsigned long) * disk->capacity)) == NULL) {
+        printf("[ERROR] There was an error while trying to call 'malloc' on 'offsets'. Closing...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The records are copied in the order of the index, through the
+       write buffer (empty after the flush above). */
+    bool success = pwrite(fd, HASHTABLE_DISK_MAGIC, magic_len, 0) == (ssize_t) magic_len;
+    unsigned long size = magic_len;
+    for(unsigned int i = 0; success && i < disk->capacity; i++) {
+        hashtable_disk_slot* slot = &disk->slots[i];
+        const char* record;
+
+        if(slot->offset <= 1)
+            continue;
+        if((record = hashtable_disk_read(disk, slot->offset, slot->length)) == NULL) {
+            success = false;
+            break;
         }
-        current_entry = current_entry->next;
+        if(disk->buffer_len + slot->length > HASHTABLE_DISK_BUFFER || slot->length > HASHTABLE_DISK_BUFFER) {
+            success = pwrite(fd, disk->buffer, disk->buffer_len, size) == (ssize_t) disk->buffer_len;
+            size += disk->buffer_len;
+            disk->buffer_len = 0;
+            if(success && slot->length > HASHTABLE_DISK_BUFFER) {
+                success = pwrite(fd, record, slot->length, size) == (ssize_t) slot->length;
+                offsets[i] = size;
+                size += slot->length;
+                continue;
+            }
+        }
+        offsets[i] = size + disk->buffer_len;
+        memcpy(disk->buffer + disk->buffer_len, record, slot->length);
+        disk->buffer_len += slot->length;
+    }
+    if(success)
+        success = pwrite(fd, disk->buffer, disk->buffer_len, size) == (ssize_t) disk->buffer_len;
+    size += disk->buffer_len;
+    disk->buffer_len = 0;
+
+    int read_fd = -1;
+    if(success && (success = fdatasync(fd) == 0 && rename(tmp_path, disk->path) == 0)) {
+        if((read_fd = open(disk->path, O_RDONLY | O_DIRECT | O_CLOEXEC)) < 0)
+            read_fd = fd;
     }
+    if(!success) {
+        close(fd);
+        unlink(tmp_path);
+        free(offsets);
+        return false;
+    }
+
+    if(disk->read_fd != disk->fd)
+        close(disk->read_fd);
+    close(disk->fd);
+    disk->fd = fd;
+    disk->read_fd = read_fd;
+    disk->size = size;
+    disk->garbage = 0;
+    for(unsigned int i = 0; i < disk->capacity; i++) {
+        if(disk->slots[i].offset > 1)
+            disk->slots[i].offset = offsets[i];
+    }
+    free(offsets);
+    hashtable_disk_resetcache(disk);
+
+    return true;
 }
 
 /* Print an hash table with nice formatting of the individual entries. */
@@ -237,28 +6562,33 @@ void hashtable_prettyprint(hashtable* htable) {
         printf("This hash table does not exist.\n");
         return;
     }
+
+    /* A cooperative resize could have been left in progress: complete
+       it, so that all the entries are in the same bucket array. */
+    hashtable_completeresize(htable);
+    hashtable_buckets* buckets = htable->buckets;
     
     /* Calculate the number of digits of the size of the
        hashtable (es. (1...9)->1, (10...99)->2, (100...999)->3).
        It will be used to add padding to the print. */
     char size_str[11];
-    sprintf(size_str, "%u", htable->size);
+    sprintf(size_str, "%u", buckets->size);
     unsigned int padding_size = (unsigned int) strlen(size_str) + 1;
 
     hashtable_entry* current_entry = NULL;
     int dots = false;                       /* True if '[...]' has already been printed, false otherwise.  */
     int consecutive_null = 0;               /* Number of consecutive empty (NULL) hashtable entries. */
 
-    for(unsigned int i = 0; i < htable->size; i++) {       
-        if(htable->table[i] == NULL) {
+    for(unsigned int i = 0; i < buckets->size; i++) {       
+        if(buckets->table[i] == NULL) {
             consecutive_null++;
             
             /* If first or last entry is NULL, then print it. */
-            if(i == 0 || i == htable->size-1) {
+            if(i == 0 || i == buckets->size-1) {
                 printf("%*d --> NULL\n", padding_size, i);
             } else {
                 /* If this NULL entry is the first or the last (next one is not NULL), then print it. */
-                if(consecutive_null == 1 || htable->table[i+1] != NULL) {
+                if(consecutive_null == 1 || buckets->table[i+1] != NULL) {
                     printf("%*d --> NULL\n", padding_size, i);
                 } else {
                     /* If there is more than one NULL entry, print "truncation points" -> [...]. */
@@ -283,12 +6613,16 @@ void hashtable_prettyprint(hashtable* htable) {
             dots = false;
 
             /* Print first entry for a specific hash value. */
-            printf("%*d --> {(%s, %u)", padding_size, i, htable->table[i]->key, htable->table[i]->val);
+            printf("%*d --> {(", padding_size, i);
+            hashtable_printkey(buckets->table[i]);
+            printf(", %u)", buckets->table[i]->val);
 
             /* If there are, print all collisions for a specific hash value. */
-            current_entry = htable->table[i]->next;
+            current_entry = buckets->table[i]->next;
             while(current_entry != NULL) {
-                printf(", (%s, %u)", current_entry->key, current_entry->val);
+                printf(", (");
+                hashtable_printkey(current_entry);
+                printf(", %u)", current_entry->val);
                 
                 current_entry = current_entry->next;
             }
@@ -297,123 +6631,3 @@ void hashtable_prettyprint(hashtable* htable) {
     }
     printf("\n\n");
 }
-
-/* Test function: 
-    • add 12 unique string (10 characters) to an hash table;
-    • delete 4 strings;
-    • change value of 3 strings;
-    At each single step, it pretty prints the entire hash table. */
-void test_12_strings() {
-    hashtable* htable = hashtable_newhashtable(16);
-
-    printf("Empty hashtable\n");
-    hashtable_prettyprint(htable);
-
-    printf("\nInsert strings (8ct4xaucod, 7i2pefipwc, mmnoy7c6yq, ouam4phm2c, e2xztziqtj, wrrw5arl6d, 7lc5pgl8kd, 93i5i8sx17, 6kkd8e0zq1, yeqmy6bjmk, hn1gybiuy6, 5wr2vyui8t), with value '0', in the hash table:\n");
-    hashtable_insert(htable, "8ct4xaucod", 0); /* hash = 7 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "7i2pefipwc", 0); /* hash = 0 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "mmnoy7c6yq", 0); /* hash = 10 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "ouam4phm2c", 0); /* hash = 0 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "e2xztziqtj", 0); /* hash = 15 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "wrrw5arl6d", 0); /* hash = 0 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "7lc5pgl8kd", 0); /* hash = 5 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "93i5i8sx17", 0); /* hash = 14 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "6kkd8e0zq1", 0); /* hash = 9 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "yeqmy6bjmk", 0); /* hash = 15 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "hn1gybiuy6", 0); /* hash = 6 */
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "5wr2vyui8t", 0); /* hash = 9 */
-    hashtable_prettyprint(htable);
-
-    printf("\nDelete strings (7lc5pgl8kd, 6kkd8e0zq1, e2xztziqtj, yeqmy6bjmk) from the hash table:\n");
-    hashtable_delete(htable, "7lc5pgl8kd");
-    hashtable_prettyprint(htable);
-    hashtable_delete(htable, "6kkd8e0zq1");
-    hashtable_prettyprint(htable);
-    hashtable_delete(htable, "e2xztziqtj");
-    hashtable_prettyprint(htable);
-    hashtable_delete(htable, "yeqmy6bjmk");
-    hashtable_prettyprint(htable);
-
-    printf("\nChange value of strings (ouam4phm2c -> 37, 93i5i8sx17 -> 55, 5wr2vyui8t -> 79) in the hash table:\n");
-    hashtable_insert(htable, "ouam4phm2c", 37);
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "93i5i8sx17", 55);
-    hashtable_prettyprint(htable);
-    hashtable_insert(htable, "5wr2vyui8t", 79);
-    hashtable_prettyprint(htable);
-}
-
-/* Test function: reads from a file (rnd_str.txt) which contains 100.000
-   unique strings and adds them all into an hash table. */
-void test_100000_strings() {
-    hashtable* htable = hashtable_newhashtable(262144); /* 2^18 = 262144 */
-
-    FILE* file;
-    if((file = fopen("rnd_str.txt", "r")) == NULL) {
-        printf("[ERROR] There was an error while trying to call 'fopen' on 'rnd_str_2.txt'. Closing...\n");
-		exit(EXIT_FAILURE);
-    }
-    
-    /* Read line by line, up to 64 characters (+1 for string terminator '\0'), 
-       and add this string to the hash table. */
-    char line[65];
-    while (fgets(line, sizeof(line), file)) {
-        line[64] = '\0';
-
-        hashtable_insert(htable, line, 0);
-    }
-    fclose(file);
-
-    hashtable_prettyprint(htable);
-}
-
-int main() {
-    /* Print a simple choice menu */
-    printf("Welcome to the String Hash Table implementation in C!\n\n");
-    printf("There are two test functions available:\n");
-    printf("  1) Test with 12 different strings, each 10 characters long\n");
-    printf("  2) Test with 100.000 different strings, each 64 characters long, written in a file called \"rnd_str.txt\"\n");
-    printf("  3) Exit\n");
-    
-    /* Reads from input (stdin) a choice between 1 and 3 */
-    char tmp_buff[16];
-    int option, result;
-    do {
-        printf("Please, choose an option [1,2,3]: ");
-        if (fgets(tmp_buff, sizeof(tmp_buff), stdin) == NULL) {
-            option = -1;
-            break;
-        }
-        result = sscanf(tmp_buff, "%d", &option);
-    } while(result != 1 || option < 1 || option > 3);
-
-    switch (option) {
-        case 1:
-            test_12_strings();
-            break;
-        case 2:
-            test_100000_strings();
-            break;
-        case 3:
-            printf("\nGoodbye! :)\n");
-            break;
-        
-        default:
-            printf("[ERROR] There was an error while trying to read the value. Closing...\n");
-            exit(EXIT_FAILURE);
-            break;
-    }
-    
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
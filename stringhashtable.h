@@ -0,0 +1,799 @@
+#ifndef STRINGHASHTABLE_H
+#define STRINGHASHTABLE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+
+/* Size of a block of the key arena (HASHTABLE_KEY_ARENA mode). */
+#define HASHTABLE_ARENA_BLOCK_SIZE (1024*1024)
+
+/* Number of lock stripes of an hash table in a concurrent mode:
+   bucket 'i' is protected by stripe 'i % HASHTABLE_STRIPES'. */
+#define HASHTABLE_STRIPES 256
+
+/* Maximum number of threads that can use the concurrent hash
+   tables at the same time (see the epoch-based reclamation). */
+#define HASHTABLE_MAX_THREADS 512
+
+/* Maximum number of threads of the thread pool used by the bulk
+   operations (see hashtable_pool_run). */
+#define HASHTABLE_MAX_POOL_THREADS 64
+
+/* Number of buckets migrated at once by a thread that helps a
+   cooperative resize (see hashtable_transferchunk). */
+#define HASHTABLE_RESIZE_CHUNK 64
+
+/* Number of requests of a delegation ring (a power of two), and
+   maximum number of requests executed by a shard owner before
+   publishing their responses. */
+#define HASHTABLE_RING_SIZE 1024
+#define HASHTABLE_DELEGATION_BATCH 32
+
+/* Number of shards of the statistics counters of an hash table. */
+#define HASHTABLE_COUNTER_SHARDS 64
+
+/* Number of entries a thread adds, in the concurrent modes, between
+   two checks of the load of an hash table (see hashtable_checkgrowth). */
+#define HASHTABLE_GROWTH_CHECK 16
+
+/* Maximum number of NUMA nodes handled by the shard placement, and
+   the "preferred node" memory policy of the kernel (see
+   set_mempolicy(2)), used without depending on libnuma. */
+#define HASHTABLE_MAX_NODES 64
+#define HASHTABLE_MPOL_PREFERRED 1
+
+/* Size of the records buffered by a write-ahead log (without sync)
+   after which they are written anyway. */
+#define HASHTABLE_WAL_BUFFER (1024*1024)
+
+/* Maximum size of a log record besides its key (op, two varints, the
+   expiration time and the checksum). */
+#define HASHTABLE_WAL_OVERHEAD 23
+
+/* Size classes of the blocks released by a shared-memory table (a
+   class every 16 bytes): larger blocks are not recycled. The magic
+   number marks an initialized segment. */
+#define HASHTABLE_SHM_CLASSES 64
+#define HASHTABLE_SHM_MAGIC 0x53485431
+
+/* Size of the blocks read by a disk-backed table (and of its cache
+   frames), size of its buffer of records not yet written, and magic
+   string at the beginning of its file. */
+#define HASHTABLE_DISK_BLOCK 4096
+#define HASHTABLE_DISK_BUFFER (1024*1024)
+#define HASHTABLE_DISK_MAGIC "SHTDISK1"
+
+/* Maximum number of batches of requests served by a thread each time
+   it becomes the combiner (see hashtable_combine). */
+#define HASHTABLE_COMBINE_PASSES 4
+
+/* Number of pointers retired by a thread (a block of its limbo lists)
+   after which the epoch-based reclamation tries to advance the epoch
+   and release memory. */
+#define HASHTABLE_EBR_BATCH 64
+
+/* Levels of the timer wheel of the entries with a time to live, and
+   number of slots (2^HASHTABLE_WHEEL_BITS) of every level: the wheel
+   covers 2^32 milliseconds (about 49 days), farther timers are
+   parked in its last slot. */
+#define HASHTABLE_WHEEL_LEVELS 4
+#define HASHTABLE_WHEEL_BITS 8
+#define HASHTABLE_WHEEL_SLOTS (1 << HASHTABLE_WHEEL_BITS)
+
+/* Number of lists of the loads in progress of an hash table (see
+   hashtable_get_or_load_len). */
+#define HASHTABLE_FLIGHT_BUCKETS 64
+
+/* Number of expired keys collected from the timer wheel (whole
+   milliseconds at a time) before deleting them (see hashtable_expire). */
+#define HASHTABLE_EXPIRE_BATCH 256
+
+/* Number of times the expected number of attempts after which a
+   random sampling of an hash table gives up (see hashtable_random_entry). */
+#define HASHTABLE_SAMPLE_TRIES 64
+
+/* Maximum number of buckets, and of entries, visited by the CLOCK
+   hand to evict an entry from an hash table in cache mode (see
+   hashtable_setcapacity). */
+#define HASHTABLE_EVICT_BUCKETS 1024
+#define HASHTABLE_EVICT_ENTRIES 64
+
+/* Structure that holds information of an hash table entry. */
+typedef struct hashtable_entry_t {
+    char* key;                      /* Entry key (not necessarily NUL-terminated) */
+    unsigned int key_len;           /* Entry key length, in bytes */
+    unsigned int val;               /* Entry value */
+    bool referenced;                /* Read since the CLOCK hand last passed (see hashtable_setcapacity) */
+    unsigned int sample_index;      /* Position in the sampling index (see hashtable_setsampling) */
+    struct hashtable_timer_t* timer; /* Expiration of the entry (NULL: never, see hashtable_insert_ttl_len) */
+
+    struct hashtable_entry_t* next; /* Pointer to next entry */
+
+} hashtable_entry;
+
+/* Structure that holds the timer of an entry with a time to live. */
+typedef struct hashtable_timer_t {
+    struct hashtable_timer_t* next; /* Next timer of the same slot of the wheel */
+    struct hashtable_timer_t** pprev; /* Link that points to this timer (NULL: not in the wheel) */
+    hashtable_entry* entry;
+    unsigned long expires;          /* Expiration time, in milliseconds of CLOCK_MONOTONIC */
+} hashtable_timer;
+
+/* Structure that holds the hierarchical timer wheel of an hash table
+   (see hashtable_expire): the slots of level 'l' are 256^l
+   milliseconds long. */
+typedef struct hashtable_wheel_t {
+    pthread_mutex_t lock;           /* Protects the wheel in the concurrent modes */
+    unsigned long current;          /* Next millisecond to process */
+    unsigned long count;            /* Timers in the wheel */
+    hashtable_timer* slots[HASHTABLE_WHEEL_LEVELS][HASHTABLE_WHEEL_SLOTS];
+} hashtable_wheel;
+
+/* Structure that holds a load in progress of a missing key, shared by
+   all the callers of hashtable_get_or_load_len that miss it. */
+typedef struct hashtable_flight_t {
+    struct hashtable_flight_t* next; /* Next load of the same list */
+    char* key;
+    unsigned int key_len;
+    unsigned int hash;              /* Full hash of the key */
+    unsigned int waiters;           /* Callers waiting for the result */
+    bool done;                      /* Set when the result is ready */
+    bool found;                     /* Result: the key exists */
+    unsigned int val;               /* Result: its value */
+    pthread_cond_t cond;            /* Signaled when the result is ready */
+} hashtable_flight;
+
+/* Structure that holds the loads in progress of an hash table and its
+   negative cache (see hashtable_setnegativecache). */
+typedef struct hashtable_flights_t {
+    pthread_mutex_t lock;           /* Protects the lists and the results */
+    hashtable_flight* lists[HASHTABLE_FLIGHT_BUCKETS];
+    struct hashtable_t* negative;   /* Keys not found by the loader, with a time to live (NULL: disabled) */
+    unsigned int negative_ttl;      /* Time to live of the keys not found, in milliseconds */
+    unsigned long loads;            /* Calls to the loader */
+    unsigned long shared;           /* Callers served by the load of another one */
+} hashtable_flights;
+
+/* Structure that holds the sampling index of an hash table: a dense
+   array of all its entries, where a random one is picked in O(1). */
+typedef struct hashtable_sampler_t {
+    pthread_mutex_t lock;           /* Protects the index in the concurrent modes */
+    struct hashtable_entry_t** entries;
+    unsigned int count;             /* Entries in the index */
+    unsigned int size;              /* Capacity of 'entries' */
+} hashtable_sampler;
+
+/* Key ownership policies of an hash table. */
+typedef enum hashtable_keymode_t {
+    HASHTABLE_KEY_COPY,             /* Each entry owns a private copy of its key (default) */
+    HASHTABLE_KEY_BORROW,           /* Entries point to the caller's key, whose lifetime is managed by the caller */
+    HASHTABLE_KEY_ARENA             /* Keys are copied in a contiguous string arena owned by the table */
+} hashtable_keymode;
+
+/* Structure that holds a block of the key arena. Keys are appended
+   one after the other in 'data', and blocks are released all
+   together only when the hash table is released. */
+typedef struct hashtable_arena_block_t {
+    struct hashtable_arena_block_t* next; /* Pointer to the previous (full) block */
+    unsigned int size;              /* Capacity of 'data', in bytes */
+    unsigned int used;              /* Bytes of 'data' already in use */
+
+    char data[];                    /* Keys */
+} hashtable_arena_block;
+
+/* Synchronization modes of an hash table. */
+typedef enum hashtable_syncmode_t {
+    HASHTABLE_SYNC_NONE,            /* No synchronization, the caller serializes all the operations (default) */
+    HASHTABLE_SYNC_MUTEX,           /* Lock striping: one mutex per stripe of buckets */
+    HASHTABLE_SYNC_RWLOCK,          /* One pthread_rwlock per stripe: readers share it */
+    HASHTABLE_SYNC_SEQLOCK          /* One mutex and one sequence counter per stripe: readers never write */
+} hashtable_syncmode;
+
+/* Structure that holds a lock stripe. It is aligned to a cache line,
+   so that two stripes never share one. */
+typedef struct hashtable_stripe_t {
+    union {
+        pthread_mutex_t mutex;      /* HASHTABLE_SYNC_MUTEX and HASHTABLE_SYNC_SEQLOCK (writers only) */
+        pthread_rwlock_t rwlock;    /* HASHTABLE_SYNC_RWLOCK */
+    } lock;
+    unsigned int seq;               /* Sequence counter, odd while a writer is active (HASHTABLE_SYNC_SEQLOCK) */
+
+} __attribute__((aligned(64))) hashtable_stripe;
+
+/* Resize strategies of a concurrent hash table. */
+typedef enum hashtable_resizemode_t {
+    HASHTABLE_RESIZE_COOPERATIVE,   /* Every writer migrates a chunk of buckets while the resize is in progress (default) */
+    HASHTABLE_RESIZE_STOP           /* The thread that starts the resize migrates all the buckets, holding every stripe */
+} hashtable_resizemode;
+
+/* Structure that holds a bucket array of an hash table. An hash table
+   has more than one array only while it is being resized: 'next'
+   points to the new array, and every bucket of this one that has
+   already been migrated is marked with HASHTABLE_MOVED. */
+typedef struct hashtable_buckets_t {
+    unsigned int size;              /* Number of buckets */
+    struct hashtable_entry_t** table; /* Buckets array */
+    hashtable_stripe* stripes;      /* Lock stripes (NULL in HASHTABLE_SYNC_NONE mode) */
+
+    unsigned int max_chain;         /* Upper bound of the length of the chaining lists (see hashtable_random_entry) */
+    struct hashtable_version_t** versions; /* Saved versions of every bucket (NULL: none saved yet, see hashtable_snapshot) */
+
+    struct hashtable_buckets_t* next; /* Array that is replacing this one, NULL if not resizing */
+    unsigned int transfer_index;    /* First bucket not yet claimed by a migrating thread */
+    unsigned int transferred;       /* Number of buckets already migrated */
+} hashtable_buckets;
+
+/* Structure that holds the content of a bucket before the writes that
+   followed a snapshot: the snapshots taken up to 'generation' (and
+   after the older version of the bucket, if any) read it instead of
+   the bucket. */
+typedef struct hashtable_version_t {
+    struct hashtable_version_t* next; /* Older version of the same bucket */
+    struct hashtable_version_t* newer; /* Next version saved, of any bucket */
+    unsigned int bucket;
+    unsigned long generation;       /* Last snapshot that can read it */
+    struct hashtable_entry_t* entries; /* Copy of the chaining list */
+} hashtable_version;
+
+/* Structure that holds a read-only, point-in-time view of an hash
+   table (see hashtable_snapshot). */
+typedef struct hashtable_view_t {
+    struct hashtable_t* htable;
+    hashtable_buckets* buckets;     /* Bucket array, which is not resized until the view is released */
+    unsigned long generation;       /* Order of the snapshot */
+    unsigned long time;             /* Time of the snapshot, in milliseconds of CLOCK_MONOTONIC */
+    struct hashtable_view_t* next;  /* Next open view of the same table */
+} hashtable_view;
+
+/* Structure that holds the open views of an hash table and the
+   versions of its buckets saved for them. While a view is open (or a
+   checkpoint is being written) the bucket array is pinned and the
+   table does not grow: the growths needed in the meantime are counted
+   in 'deferred', and the release of the last pin starts one. */
+typedef struct hashtable_views_t {
+    pthread_mutex_t lock;           /* Protects the views and the list of the versions */
+    hashtable_view* open;
+    unsigned int pins;              /* Views open or being opened, and checkpoints: the bucket array cannot be resized */
+    unsigned long deferred;         /* Growths requested while pinned, not started yet */
+    unsigned int active;            /* Views open: the writers save the buckets before changing them */
+    unsigned long generation;       /* Generation of the last snapshot */
+    hashtable_version* oldest;      /* Versions alive, in the order they have been saved */
+    hashtable_version* newest;
+    unsigned long versions;         /* Number of versions alive */
+    unsigned long copies;           /* Entries copied into versions so far */
+} hashtable_views;
+
+/* Operations that can be requested to another thread, which will
+   execute them on behalf of the requesting one (see the flat
+   combining and the delegation). */
+typedef enum hashtable_op_t {
+    HASHTABLE_OP_GET,               /* Look up a key */
+    HASHTABLE_OP_INSERT,            /* Insert or update a key */
+    HASHTABLE_OP_DELETE,            /* Delete a key */
+    HASHTABLE_OP_INCREMENT          /* Add a value to a key (inserting it if not present) */
+} hashtable_op;
+
+/* Structure that holds a request of an operation, and its response.
+   It belongs to the requesting thread, and must stay valid until the
+   request is completed. */
+typedef struct hashtable_request_t {
+    hashtable_op op;                /* Requested operation */
+    const char* key;                /* Key (not necessarily NUL-terminated) */
+    unsigned int key_len;           /* Key length, in bytes */
+    unsigned int val;               /* Value to insert or add (HASHTABLE_OP_INSERT, HASHTABLE_OP_INCREMENT) */
+
+    unsigned int result;            /* Value found, inserted, deleted or obtained by the increment */
+    bool found;                     /* True if the key was found (HASHTABLE_OP_GET, HASHTABLE_OP_DELETE) */
+    struct hashtable_entry_t* entry; /* Entry inserted or updated (HASHTABLE_OP_INSERT, HASHTABLE_OP_INCREMENT) */
+    int done;                       /* Set to 1 by the executing thread when the response is ready */
+} hashtable_request;
+
+/* Structure that holds the slot where a thread publishes its pending
+   request to the combiner. */
+typedef struct hashtable_combiner_slot_t {
+    hashtable_request* request;     /* Pending request, NULL if none */
+} __attribute__((aligned(64))) hashtable_combiner_slot;
+
+/* Structure that holds the state of the flat combining of an hash
+   table (see hashtable_combine). */
+typedef struct hashtable_combiner_t {
+    int lock __attribute__((aligned(64))); /* 1 while a thread is combining */
+    unsigned int nslots;            /* Number of slots used so far */
+    hashtable_combiner_slot slots[HASHTABLE_MAX_THREADS]; /* Slots, indexed by EBR slot of the thread */
+} hashtable_combiner;
+
+/* Statistics and operation counters of an hash table. */
+typedef enum hashtable_counter_t {
+    HASHTABLE_COUNTER_DIFFERENT_ENTRIES, /* Number of non-empty buckets */
+    HASHTABLE_COUNTER_COLLISIONS,   /* Number of entries beyond the first one of their bucket */
+    HASHTABLE_COUNTER_LOOKUPS,      /* Searches of a key */
+    HASHTABLE_COUNTER_HITS,         /* Searches that found the key */
+    HASHTABLE_COUNTER_INSERTS,      /* New entries inserted */
+    HASHTABLE_COUNTER_UPDATES,      /* Values of existing entries updated (inserts and increments) */
+    HASHTABLE_COUNTER_DELETES,      /* Entries deleted */
+    HASHTABLE_COUNTER_RESIZES,      /* Resizes started */
+    HASHTABLE_COUNTER_EVICTIONS,    /* Entries evicted to respect the capacity (also counted as deleted, see hashtable_setcapacity) */
+    HASHTABLE_COUNTERS              /* Number of counters */
+} hashtable_counter;
+
+/* Structure that holds a shard of the counters of an hash table.
+   Every thread updates only the shard assigned to it, which fills a
+   cache line on its own, so the counters are never contended: the
+   shards are summed only when the counters are read, and a single
+   shard can hold a negative value. */
+typedef struct hashtable_counter_shard_t {
+    long value[HASHTABLE_COUNTERS];
+} __attribute__((aligned(64))) hashtable_counter_shard;
+
+/* Structure that holds the counters of an hash table, read through
+   hashtable_getstats. */
+typedef struct hashtable_stats_t {
+    unsigned int size;              /* Number of buckets */
+    unsigned long entries;          /* Number of entries */
+    unsigned long different_entries; /* Number of non-empty buckets */
+    unsigned long collisions;       /* Number of entries beyond the first one of their bucket */
+    unsigned long lookups;          /* Searches of a key */
+    unsigned long hits;             /* Searches that found the key */
+    unsigned long misses;           /* Searches that did not find the key */
+    unsigned long inserts;          /* New entries inserted */
+    unsigned long updates;          /* Values of existing entries updated */
+    unsigned long deletes;          /* Entries deleted */
+    unsigned long resizes;          /* Resizes started */
+    unsigned long evictions;        /* Entries evicted to respect the capacity */
+} hashtable_stats;
+
+/* Policies of durability of a write-ahead log. */
+typedef enum hashtable_walsync_t {
+    HASHTABLE_WAL_SYNC_ALWAYS,      /* Every write returns only when its record is on disk (group commit) */
+    HASHTABLE_WAL_SYNC_INTERVAL,    /* The records are written and synced every 'interval_ms' milliseconds */
+    HASHTABLE_WAL_SYNC_NEVER        /* The records are written, but synced only when the log is closed */
+} hashtable_walsync;
+
+/* Types of the records of a write-ahead log. */
+typedef enum hashtable_walop_t {
+    HASHTABLE_WAL_INSERT = 1,       /* Insert or update of a key */
+    HASHTABLE_WAL_DELETE = 2,       /* Delete of a key */
+    HASHTABLE_WAL_CLEAR = 3,        /* Delete of all the keys */
+    HASHTABLE_WAL_INSERT_TTL = 4    /* Insert or update of a key that expires (see hashtable_insert_ttl_len) */
+} hashtable_walop;
+
+/* Structure that holds an append-only write-ahead log.
+   The records are appended to 'buffer' (under 'lock') and written in
+   groups by a single thread at a time: while it writes and syncs, the
+   other writers keep appending to the (swapped) buffer, and the next
+   group is written by one of them as soon as it is done. */
+typedef struct hashtable_wal_t {
+    int fd;                         /* Log file, open in append mode */
+    char* path;                     /* Path of the log file */
+    hashtable_walsync policy;       /* Durability policy */
+    unsigned int interval_ms;       /* Sync interval (HASHTABLE_WAL_SYNC_INTERVAL) */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* Signaled when a group has been written */
+    pthread_cond_t flusher_cond;    /* Signaled to stop the flusher */
+    char* buffer;                   /* Records not yet written */
+    size_t buffer_len;
+    size_t buffer_size;
+    char* spare;                    /* Buffer being written by the flushing thread */
+    size_t spare_size;
+    unsigned long appended;         /* Number of records appended */
+    unsigned long synced;           /* Number of records written and synced */
+    unsigned long syncs;            /* Number of calls to fdatasync */
+    bool flushing;                  /* True while a thread is writing a group */
+    bool failed;                    /* True after a failed fdatasync: no later record is durable */
+    bool stop;                      /* True to terminate the flusher */
+    bool has_flusher;               /* True if the flusher thread is running */
+
+    pthread_t flusher;              /* Thread that syncs every 'interval_ms' (HASHTABLE_WAL_SYNC_INTERVAL) */
+} hashtable_wal;
+
+/* States of a snapshot written in background (see hashtable_bgsave). */
+typedef enum hashtable_bgsave_state_t {
+    HASHTABLE_BGSAVE_RUNNING,       /* The child process is writing it */
+    HASHTABLE_BGSAVE_DONE,          /* Written and renamed to its path */
+    HASHTABLE_BGSAVE_FAILED         /* Not written (the previous file, if any, is untouched) */
+} hashtable_bgsave_state;
+
+/* Structure that holds a snapshot written in background. It lives in
+   memory shared with the child process, which updates 'written'. */
+typedef struct hashtable_bgsave_job_t {
+    pid_t pid;                      /* Child process writing the snapshot */
+    hashtable_bgsave_state state;
+    unsigned long total;            /* Number of entries at the time of the snapshot */
+    unsigned long written;          /* Number of entries written so far */
+    unsigned long lsn;              /* Last write-ahead log record included (0 without a log) */
+} hashtable_bgsave_job;
+
+/* Structure that holds information of an hash table. */
+typedef struct hashtable_t {
+    hashtable_counter_shard* counters; /* Statistics counters, in HASHTABLE_COUNTER_SHARDS shards */
+
+    hashtable_keymode keymode;      /* Key ownership policy */
+    hashtable_arena_block* arena;   /* Current key arena block (HASHTABLE_KEY_ARENA only) */
+    pthread_mutex_t arena_lock;     /* Protects 'arena' in the concurrent modes */
+
+    hashtable_syncmode syncmode;    /* Synchronization mode */
+    hashtable_resizemode resizemode; /* Resize strategy */
+    unsigned int max_load;          /* Average entries per bucket that triggers a growth (0: never grow) */
+    unsigned int nthreads;          /* Threads used by the bulk operations (0: the default ones) */
+    hashtable_combiner* combiner;   /* Flat combining of the writes (NULL: disabled) */
+    hashtable_wal* wal;             /* Write-ahead log of the writes (NULL: disabled) */
+    unsigned long* digests;         /* Digest of every range of keys (NULL: disabled, see hashtable_setdigests) */
+    unsigned int digest_leaves;     /* Number of ranges, a power of 2 */
+    unsigned int max_entries;       /* Entries beyond which the inserts evict (0: unbounded, see hashtable_setcapacity) */
+    unsigned int clock_hand;        /* Next bucket visited by the eviction */
+    hashtable_wheel* wheel;         /* Timers of the entries with a time to live (NULL: none yet) */
+    hashtable_flights* flights;     /* Loads in progress (NULL: none yet, see hashtable_get_or_load_len) */
+    hashtable_sampler* sampler;     /* Sampling index (NULL: disabled, see hashtable_setsampling) */
+    hashtable_views views;          /* Open snapshots (see hashtable_snapshot) */
+
+    hashtable_buckets* buckets;     /* Current bucket array */
+} hashtable;
+
+/* Structure that holds a thread that writes checkpoints periodically
+   (see hashtable_checkpointer_start). */
+typedef struct hashtable_checkpointer_t {
+    hashtable* htable;
+    char* path;                     /* Path of the checkpoint */
+    unsigned int interval_ms;       /* Time between two checkpoints */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* Signaled to stop the thread */
+    bool stop;
+    unsigned long checkpoints;      /* Number of checkpoints written */
+    unsigned long failures;         /* Number of checkpoints failed */
+
+    pthread_t thread;
+} hashtable_checkpointer;
+
+/* Function executed by the pool on a range [begin, end). 'worker' is
+   the index of the thread (0 for the calling one). */
+typedef void (*hashtable_range_fn)(void* ctx, unsigned int begin, unsigned int end, unsigned int worker);
+
+/* Function called by hashtable_parallel_foreach on every entry.
+   'worker' is the index (from 0) of the calling thread, so that it
+   can be used to select a thread-local accumulator. */
+typedef void (*hashtable_foreach_fn)(hashtable_entry* entry, void* ctx, unsigned int worker);
+
+/* Function called by hashtable_parallel_reduce to add an entry to
+   the accumulator 'acc' of a thread. */
+typedef void (*hashtable_map_fn)(void* acc, hashtable_entry* entry, void* ctx);
+
+/* Function called by hashtable_parallel_reduce to merge the
+   accumulator 'other' into 'acc'. */
+typedef void (*hashtable_combine_fn)(void* acc, const void* other, void* ctx);
+
+/* Function called by hashtable_diff on every key whose value differs
+   between the two tables: 'val_a' or 'val_b' is NULL if the key is
+   missing from that table. */
+typedef void (*hashtable_diff_fn)(const char* key, unsigned int key_len, const unsigned int* val_a, const unsigned int* val_b, void* ctx);
+
+/* Function called by hashtable_get_or_load_len to load a missing key
+   (es. from a database): return true, storing its value in 'val', if
+   the key exists, false otherwise. */
+typedef bool (*hashtable_load_fn)(const char* key, unsigned int key_len, unsigned int* val, void* ctx);
+
+/* Structure that holds a cell of a request ring. */
+typedef struct hashtable_ring_cell_t {
+    unsigned long seq;              /* Position the cell is ready for (see hashtable_ring_push) */
+    hashtable_request* request;
+} hashtable_ring_cell;
+
+/* Structure that holds a bounded MPSC ring of requests (the bounded
+   queue by D. Vyukov, with a single consumer). Producers and consumer
+   work on different cache lines. */
+typedef struct hashtable_ring_t {
+    unsigned long tail __attribute__((aligned(64))); /* Next position to fill (producers) */
+    unsigned long head __attribute__((aligned(64))); /* Next position to consume (owner) */
+    hashtable_ring_cell cells[HASHTABLE_RING_SIZE] __attribute__((aligned(64)));
+} hashtable_ring;
+
+/* Structure that holds a shard and its owner. */
+typedef struct hashtable_shard_t {
+    hashtable_ring ring;            /* Requests sent to the owner */
+    hashtable* htable;              /* Private table of the shard */
+    unsigned int size;              /* Initial size of the table */
+    int cpu;                        /* CPU the owner is pinned to (-1: not pinned) */
+    int node;                       /* NUMA node of the memory of the shard (-1: first touch) */
+    bool stop;                      /* Set to true to terminate the owner */
+    bool ready;                     /* Set to true by the owner when the table is ready */
+
+    pthread_t owner;
+} __attribute__((aligned(64))) hashtable_shard;
+
+/* Structure that holds a sharded table with delegation. */
+typedef struct hashtable_delegation_t {
+    unsigned int nshards;           /* Number of shards */
+    hashtable_shard* shards;        /* Shards */
+} hashtable_delegation;
+
+/* Structure that holds a point of a consistent hashing ring. */
+typedef struct hashtable_hashring_point_t {
+    unsigned int hash;              /* Position on the ring */
+    unsigned int node;              /* Index of the node that owns it */
+} hashtable_hashring_point;
+
+/* Structure that holds a consistent hashing ring, which maps the keys
+   to a set of named nodes (es. the addresses of table processes):
+   every node owns 'vnodes' points of the ring, and a key belongs to
+   the node of the first point at or after its hash. */
+typedef struct hashtable_hashring_t {
+    unsigned int vnodes;            /* Points of every node */
+    char** nodes;                   /* Names of the nodes, NULL for a removed one */
+    unsigned int nodes_count;       /* Nodes added (including the removed ones) */
+    unsigned int nodes_size;        /* Allocated names */
+    hashtable_hashring_point* points; /* Points, sorted by position */
+    unsigned int points_count;
+} hashtable_hashring;
+
+/* Structure that holds an entry of a shared-memory table. The links
+   are offsets from the beginning of the segment, which can be mapped
+   at a different address in every process. */
+typedef struct hashtable_shm_entry_t {
+    unsigned long next;             /* Offset of the next entry of the chaining list (0: none) */
+    unsigned int key_len;           /* Key length, in bytes */
+    unsigned int val;
+    char key[];                     /* Key, followed by '\0' */
+} hashtable_shm_entry;
+
+/* Structure that holds a lock stripe of a shared-memory table. */
+typedef struct hashtable_shm_stripe_t {
+    pthread_mutex_t lock;           /* Process-shared (and robust) lock of the writers */
+    unsigned int seq;               /* Sequence counter of the lock-free readers (odd while writing) */
+} __attribute__((aligned(64))) hashtable_shm_stripe;
+
+/* Structure that holds the header of a shared-memory segment, followed
+   by the bucket array and by the heap of the entries. */
+typedef struct hashtable_shm_header_t {
+    unsigned int magic;             /* HASHTABLE_SHM_MAGIC once the segment is initialized */
+    unsigned int checksum;          /* CRC-32 of 'size', 'segment_size' and 'buckets' (persistent tables) */
+    unsigned int clean;             /* 1 if the file has been closed cleanly (persistent tables) */
+    unsigned int size;              /* Number of buckets */
+    unsigned long segment_size;     /* Size of the segment, in bytes */
+    unsigned long buckets;          /* Offset of the bucket array (offsets of the first entries) */
+    unsigned long heap;             /* Offset of the first never allocated byte */
+    unsigned long free_lists[HASHTABLE_SHM_CLASSES]; /* Released blocks, by size class */
+    unsigned long entries;          /* Number of entries */
+    pthread_mutex_t alloc_lock;     /* Protects 'heap' and 'free_lists' */
+    hashtable_shm_stripe stripes[HASHTABLE_STRIPES];
+} hashtable_shm_header;
+
+/* Policies that make the updates of a persistent table durable. */
+typedef enum hashtable_msync_t {
+    HASHTABLE_MSYNC_ALWAYS,         /* Every update is synced before returning, in order */
+    HASHTABLE_MSYNC_INTERVAL,       /* The whole file is synced by the first update after every interval */
+    HASHTABLE_MSYNC_NEVER           /* Synced only by hashtable_shm_sync and when the table is closed */
+} hashtable_msync;
+
+/* Structure that holds a shared-memory table attached by a process. */
+typedef struct hashtable_shm_t {
+    char* base;                     /* Address of the segment in this process */
+    hashtable_shm_header* header;   /* Same as 'base' */
+    unsigned long* buckets;         /* Bucket array */
+    size_t segment_size;            /* Size of the mapping */
+
+    int fd;                         /* File of a persistent table (-1 for a shared memory segment) */
+    hashtable_msync policy;         /* Durability policy (persistent tables) */
+    unsigned int interval_ms;       /* Sync interval (HASHTABLE_MSYNC_INTERVAL) */
+    unsigned long last_sync;        /* Time of the last sync, in milliseconds (HASHTABLE_MSYNC_INTERVAL) */
+} hashtable_shm;
+
+/* Structure that holds a slot of the index of a disk-backed table:
+   only the hash of the key and where its record is, so that the index
+   takes 16 bytes per slot whatever the length of the keys. */
+typedef struct hashtable_disk_slot_t {
+    unsigned int hash;              /* Full hash of the key */
+    unsigned int length;            /* Length of the record */
+    unsigned long offset;           /* Offset of the record in the file (0: empty slot, 1: deleted key) */
+} hashtable_disk_slot;
+
+/* Structure that holds a frame of the block cache of a disk-backed
+   table. */
+typedef struct hashtable_disk_frame_t {
+    unsigned long block;            /* Number of the block held (ULONG_MAX: none) */
+    unsigned int valid;             /* Bytes of the block read (less at the end of the file) */
+    int next;                       /* Next frame of the same cache bucket (-1: none) */
+    bool referenced;                /* Used since the CLOCK hand last passed */
+} hashtable_disk_frame;
+
+/* Structure that holds a disk-backed table (see hashtable_disk_open).
+   The caller serializes all the operations, as in
+   HASHTABLE_SYNC_NONE mode. */
+typedef struct hashtable_disk_t {
+    int fd;                         /* Log file */
+    int read_fd;                    /* Log file open with O_DIRECT (the same as 'fd' if not supported) */
+    char* path;
+    unsigned long size;             /* Bytes written to the file */
+    char* buffer;                   /* Records appended after 'size' and not yet written */
+    size_t buffer_len;
+    char* record;                   /* Buffer of the record being read */
+    unsigned int record_size;
+
+    hashtable_disk_slot* slots;     /* Index, with linear probing */
+    unsigned int capacity;          /* Number of slots, a power of 2 */
+    unsigned int used;              /* Slots of present keys */
+    unsigned int deleted;           /* Slots of deleted keys */
+
+    char* cache;                    /* Cached blocks, aligned for O_DIRECT */
+    hashtable_disk_frame* frames;
+    int* cache_buckets;             /* First frame of every bucket of the cache (-1: none) */
+    unsigned int nframes;
+    unsigned int hand;              /* CLOCK hand */
+
+    unsigned long garbage;          /* Bytes of the records of overwritten or deleted keys */
+    unsigned long hits;             /* Blocks found in the cache */
+    unsigned long misses;           /* Blocks read from the file */
+} hashtable_disk;
+
+/* Memory release and epoch-based reclamation. */
+void erease(void* pointer, unsigned int size);
+void hashtable_ebr_enter();
+void hashtable_ebr_exit();
+void hashtable_ebr_retire(void (*release)(void*, void*), void* owner, void* pointer);
+void hashtable_ebr_flush(void* owner);
+
+/* Thread pool. */
+void hashtable_pool_run(unsigned int nthreads, unsigned int begin, unsigned int end, unsigned int grain, hashtable_range_fn fn, void* ctx);
+void hashtable_setdefaultthreads(unsigned int nthreads);
+
+/* Hash functions. */
+unsigned int hashtable_gethash_len(unsigned int hashtable_size, const char* key, unsigned int key_len);
+unsigned int hashtable_gethash(unsigned int hashtable_size, char* key);
+unsigned int hashtable_fullhash(const char* key, unsigned int key_len);
+
+/* Creation and configuration of an hash table. */
+hashtable* hashtable_newhashtable_keymode(unsigned int size, hashtable_keymode keymode);
+hashtable* hashtable_newhashtable(unsigned int size);
+bool hashtable_resize(hashtable* htable, unsigned int new_size);
+bool hashtable_setgrowth(hashtable* htable, unsigned int max_load, hashtable_resizemode resizemode);
+bool hashtable_setsyncmode(hashtable* htable, hashtable_syncmode syncmode);
+bool hashtable_setcombining(hashtable* htable, bool enabled);
+bool hashtable_setthreads(hashtable* htable, unsigned int nthreads);
+bool hashtable_setcapacity(hashtable* htable, unsigned int max_entries);
+bool hashtable_setnegativecache(hashtable* htable, unsigned int ttl_ms);
+bool hashtable_setsampling(hashtable* htable, bool enabled);
+void hashtable_free(hashtable* htable);
+
+/* Entries. */
+hashtable_entry* hashtable_newentry_len(const char* key, unsigned int key_len, unsigned int val);
+hashtable_entry* hashtable_newentry(char* key, unsigned int val);
+char* hashtable_arena_storekey(hashtable* htable, const char* key, unsigned int key_len);
+hashtable_entry* hashtable_allocentry(hashtable* htable, const char* key, unsigned int key_len, unsigned int val);
+void hashtable_freeentry(hashtable* htable, hashtable_entry* entry);
+
+/* Operations on the keys. */
+hashtable_entry* hashtable_insert_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int val);
+hashtable_entry* hashtable_insert(hashtable* htable, char* key, unsigned int val);
+hashtable_entry* hashtable_insert_ttl_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int val, unsigned int ttl_ms);
+hashtable_entry* hashtable_insert_ttl(hashtable* htable, char* key, unsigned int val, unsigned int ttl_ms);
+unsigned long hashtable_expire(hashtable* htable);
+unsigned int hashtable_delete_len(hashtable* htable, const char* key, unsigned int key_len);
+unsigned int hashtable_delete(hashtable* htable, char* key);
+unsigned int hashtable_increment_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int delta);
+unsigned int hashtable_increment(hashtable* htable, char* key, unsigned int delta);
+hashtable_entry* hashtable_get_len(hashtable* htable, const char* key, unsigned int key_len);
+bool hashtable_lookup_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int* val);
+hashtable_entry* hashtable_get(hashtable* htable, char* key);
+bool hashtable_get_or_load_len(hashtable* htable, const char* key, unsigned int key_len, unsigned int* val, hashtable_load_fn loader, void* ctx);
+bool hashtable_get_or_load(hashtable* htable, char* key, unsigned int* val, hashtable_load_fn loader, void* ctx);
+hashtable_entry* hashtable_random_entry(hashtable* htable);
+unsigned int hashtable_sample(hashtable* htable, unsigned int k, hashtable_entry** out);
+
+/* Point-in-time views. */
+hashtable_view* hashtable_snapshot(hashtable* htable);
+bool hashtable_view_lookup_len(hashtable_view* view, const char* key, unsigned int key_len, unsigned int* val);
+void hashtable_view_foreach(hashtable_view* view, hashtable_foreach_fn fn, void* ctx);
+void hashtable_view_release(hashtable_view* view);
+
+/* Statistics and printing. */
+unsigned int hashtable_count(hashtable* htable);
+bool hashtable_getstats(hashtable* htable, hashtable_stats* stats);
+void hashtable_printstats(hashtable* htable);
+void hashtable_fprintkey(FILE* file, hashtable_entry* entry);
+void hashtable_printkey(hashtable_entry* entry);
+void hashtable_prettyprint(hashtable* htable);
+
+/* Bulk and parallel operations. */
+void hashtable_parallel_for(hashtable* htable, hashtable_range_fn fn, void* ctx);
+void hashtable_clear(hashtable* htable);
+void hashtable_build(hashtable* htable, const char** keys, const unsigned int* keys_len, const unsigned int* vals, unsigned int count);
+long hashtable_export(hashtable* htable, char* path);
+void hashtable_parallel_foreach(hashtable* htable, hashtable_foreach_fn fn, void* ctx, unsigned int nthreads);
+bool hashtable_parallel_reduce(hashtable* htable, hashtable_map_fn map, hashtable_combine_fn combine, void* init, size_t acc_size, void* ctx);
+
+/* NUMA placement and thread pinning. */
+int hashtable_numa_nodes();
+int hashtable_numa_cpu(int node, unsigned int index);
+bool hashtable_numa_bind(int node);
+bool hashtable_pincpu(int cpu);
+
+/* Delegation-based sharded execution. */
+hashtable_delegation* hashtable_delegation_new_placed(unsigned int nshards, unsigned int size, const int* nodes);
+hashtable_delegation* hashtable_delegation_new(unsigned int nshards, unsigned int size);
+void hashtable_delegation_free(hashtable_delegation* delegation);
+void hashtable_delegation_submit(hashtable_delegation* delegation, hashtable_request* request);
+void hashtable_delegation_wait(hashtable_request* request);
+void hashtable_delegation_execute(hashtable_delegation* delegation, hashtable_request* requests, unsigned int count);
+bool hashtable_delegation_lookup(hashtable_delegation* delegation, const char* key, unsigned int key_len, unsigned int* val);
+void hashtable_delegation_insert(hashtable_delegation* delegation, const char* key, unsigned int key_len, unsigned int val);
+unsigned int hashtable_delegation_delete(hashtable_delegation* delegation, const char* key, unsigned int key_len);
+
+/* Consistent hashing. */
+hashtable_hashring* hashtable_hashring_new(unsigned int vnodes);
+void hashtable_hashring_free(hashtable_hashring* ring);
+int hashtable_hashring_add(hashtable_hashring* ring, const char* name);
+bool hashtable_hashring_remove(hashtable_hashring* ring, const char* name);
+int hashtable_hashring_lookup(hashtable_hashring* ring, const char* key, unsigned int key_len);
+const char* hashtable_hashring_node(hashtable_hashring* ring, int node);
+
+/* Shared-memory tables. */
+hashtable_shm* hashtable_shm_create(const char* name, unsigned int size, size_t segment_size);
+hashtable_shm* hashtable_shm_attach(const char* name);
+void hashtable_shm_detach(hashtable_shm* shm);
+bool hashtable_shm_unlink(const char* name);
+bool hashtable_shm_insert_len(hashtable_shm* shm, const char* key, unsigned int key_len, unsigned int val);
+bool hashtable_shm_delete_len(hashtable_shm* shm, const char* key, unsigned int key_len, unsigned int* val);
+bool hashtable_shm_lookup_len(hashtable_shm* shm, const char* key, unsigned int key_len, unsigned int* val);
+unsigned long hashtable_shm_count(hashtable_shm* shm);
+hashtable_shm* hashtable_shm_open_file(const char* path, unsigned int size, size_t segment_size, hashtable_msync policy, unsigned int interval_ms);
+bool hashtable_shm_sync(hashtable_shm* shm);
+
+/* Disk-backed tables. */
+hashtable_disk* hashtable_disk_open(const char* path, size_t cache_size);
+void hashtable_disk_close(hashtable_disk* disk);
+bool hashtable_disk_insert_len(hashtable_disk* disk, const char* key, unsigned int key_len, unsigned int val);
+bool hashtable_disk_lookup_len(hashtable_disk* disk, const char* key, unsigned int key_len, unsigned int* val);
+bool hashtable_disk_delete_len(hashtable_disk* disk, const char* key, unsigned int key_len);
+unsigned long hashtable_disk_count(hashtable_disk* disk);
+bool hashtable_disk_sync(hashtable_disk* disk);
+bool hashtable_disk_compact(hashtable_disk* disk);
+
+/* Write-ahead log. */
+unsigned int hashtable_crc32(unsigned int crc, const void* data, size_t len);
+hashtable_wal* hashtable_wal_open(const char* path, hashtable_walsync policy, unsigned int interval_ms);
+bool hashtable_wal_sync(hashtable_wal* wal);
+bool hashtable_wal_close(hashtable_wal* wal);
+long hashtable_wal_replay(hashtable* htable, const char* path);
+unsigned int hashtable_wal_encode(char* out, hashtable_walop op, const char* key, unsigned int key_len, unsigned int val);
+unsigned int hashtable_wal_encode_entry(char* out, hashtable_entry* entry);
+long hashtable_wal_apply(hashtable* htable, const char* data, size_t len, size_t* consumed, bool* corrupted);
+bool hashtable_setwal(hashtable* htable, hashtable_wal* wal);
+
+/* Snapshots. */
+long hashtable_save(hashtable* htable, const char* path);
+hashtable_bgsave_job* hashtable_bgsave(hashtable* htable, const char* path);
+hashtable_bgsave_state hashtable_bgsave_poll(hashtable_bgsave_job* job, double* progress);
+hashtable_bgsave_state hashtable_bgsave_wait(hashtable_bgsave_job* job);
+
+/* Checkpoints. */
+bool hashtable_checkpoint(hashtable* htable, const char* path);
+hashtable_checkpointer* hashtable_checkpointer_start(hashtable* htable, const char* path, unsigned int interval_ms);
+void hashtable_checkpointer_stop(hashtable_checkpointer* checkpointer);
+long hashtable_recover(hashtable* htable, const char* checkpoint_path, const char* wal_path);
+
+/* Merkle digests. */
+bool hashtable_setdigests(hashtable* htable, unsigned int leaves);
+bool hashtable_digest_tree(hashtable* htable, unsigned long* tree);
+long hashtable_diff(hashtable* a, hashtable* b, hashtable_diff_fn fn, void* ctx);
+
+#endif